@@ -0,0 +1,224 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  BitPacking.cpp
+ *  @brief Implementation of the functions which pack 16 bit unsigned integers
+ * into a bit stream and back.
+ */
+
+#include "BitPacking.h"
+#include <ciso646>
+#include <cstring>
+
+#if defined(__x86_64__) and (defined(__GNUC__) or defined(__clang__))
+#define BIT_PACKING_AVX2
+#endif
+
+namespace KafkaInterface {
+
+namespace {
+/// @brief Number of values packed at once, taking exactly Bits bytes.
+const size_t groupValues = 8;
+
+/** @brief Packs 8 values into Bits bytes.
+ * The values are first combined into two 64 bit words, without branches and
+ * with shifts known at compile time, so that the compiler can vectorize the
+ * loop calling this function.
+ */
+template <int Bits>
+inline void PackGroup(const std::uint16_t *input, std::uint8_t *output) {
+  const std::uint64_t mask = (std::uint64_t(1) << Bits) - 1;
+  std::uint64_t low = 0;
+  std::uint64_t high = 0;
+  for (int i = 0; i < 4; i++) {
+    low |= (input[i] & mask) << (i * Bits);
+    high |= (input[i + 4] & mask) << (i * Bits);
+  }
+  // The 8 * Bits bits of the group, 4 * Bits is at most 60
+  const std::uint64_t words[2] = {low | high << (4 * Bits),
+                                  high >> (64 - 4 * Bits)};
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  std::memcpy(output, words, Bits);
+#else
+  for (int k = 0; k < Bits; k++) {
+    output[k] = static_cast<std::uint8_t>(words[k / 8] >> (8 * (k % 8)));
+  }
+#endif
+}
+
+/// @brief Unpacks 8 values from Bits bytes, see PackGroup().
+template <int Bits>
+inline void UnpackGroup(const std::uint8_t *input, std::uint16_t *output) {
+  const std::uint64_t mask = (std::uint64_t(1) << Bits) - 1;
+  std::uint64_t words[2] = {0, 0};
+  for (int k = 0; k < Bits; k++) {
+    words[k / 8] |= std::uint64_t(input[k]) << (8 * (k % 8));
+  }
+  const std::uint64_t low = words[0];
+  const std::uint64_t high =
+      words[0] >> (4 * Bits) | words[1] << (64 - 4 * Bits);
+  for (int i = 0; i < 4; i++) {
+    output[i] = static_cast<std::uint16_t>((low >> (i * Bits)) & mask);
+    output[i + 4] = static_cast<std::uint16_t>((high >> (i * Bits)) & mask);
+  }
+}
+
+template <int Bits>
+inline void PackFixed(const std::uint16_t *input, std::uint8_t *output,
+                      size_t elements) {
+  size_t groups = elements / groupValues;
+  for (size_t g = 0; g < groups; g++) {
+    PackGroup<Bits>(input + g * groupValues, output + g * Bits);
+  }
+  size_t rest = elements - groups * groupValues;
+  if (rest > 0) {
+    // The last group is padded with zeros
+    std::uint16_t lastValues[groupValues] = {};
+    std::uint8_t lastBytes[Bits];
+    std::memcpy(lastValues, input + groups * groupValues,
+                rest * sizeof(std::uint16_t));
+    PackGroup<Bits>(lastValues, lastBytes);
+    std::memcpy(output + groups * Bits, lastBytes, PackedSize(rest, Bits));
+  }
+}
+
+template <int Bits>
+inline void UnpackFixed(const std::uint8_t *input, std::uint16_t *output,
+                        size_t elements) {
+  size_t groups = elements / groupValues;
+  for (size_t g = 0; g < groups; g++) {
+    UnpackGroup<Bits>(input + g * Bits, output + g * groupValues);
+  }
+  size_t rest = elements - groups * groupValues;
+  if (rest > 0) {
+    std::uint8_t lastBytes[Bits] = {};
+    std::uint16_t lastValues[groupValues];
+    std::memcpy(lastBytes, input + groups * Bits, PackedSize(rest, Bits));
+    UnpackGroup<Bits>(lastBytes, lastValues);
+    std::memcpy(output + groups * groupValues, lastValues,
+                rest * sizeof(std::uint16_t));
+  }
+}
+
+/// @brief Bitwise or of all values, written so that it can be vectorized.
+inline std::uint16_t OrValues(const std::uint16_t *values, size_t elements) {
+  std::uint16_t result = 0;
+  for (size_t i = 0; i < elements; i++) {
+    result |= values[i];
+  }
+  return result;
+}
+
+#ifdef BIT_PACKING_AVX2
+/// @brief PackFixed() compiled for CPUs with AVX2.
+template <int Bits>
+__attribute__((target("avx2"))) void
+PackFixedAvx2(const std::uint16_t *input, std::uint8_t *output,
+              size_t elements) {
+  PackFixed<Bits>(input, output, elements);
+}
+
+/// @brief UnpackFixed() compiled for CPUs with AVX2.
+template <int Bits>
+__attribute__((target("avx2"))) void
+UnpackFixedAvx2(const std::uint8_t *input, std::uint16_t *output,
+                size_t elements) {
+  UnpackFixed<Bits>(input, output, elements);
+}
+
+/// @brief OrValues() compiled for CPUs with AVX2.
+__attribute__((target("avx2"))) std::uint16_t
+OrValuesAvx2(const std::uint16_t *values, size_t elements) {
+  return OrValues(values, elements);
+}
+
+bool HasAvx2() {
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+  return hasAvx2;
+}
+#endif
+
+template <int Bits>
+void PackDispatch(const std::uint16_t *input, std::uint8_t *output,
+                  size_t elements) {
+#ifdef BIT_PACKING_AVX2
+  if (HasAvx2()) {
+    PackFixedAvx2<Bits>(input, output, elements);
+    return;
+  }
+#endif
+  PackFixed<Bits>(input, output, elements);
+}
+
+template <int Bits>
+void UnpackDispatch(const std::uint8_t *input, std::uint16_t *output,
+                    size_t elements) {
+#ifdef BIT_PACKING_AVX2
+  if (HasAvx2()) {
+    UnpackFixedAvx2<Bits>(input, output, elements);
+    return;
+  }
+#endif
+  UnpackFixed<Bits>(input, output, elements);
+}
+
+using PackFunction = void (*)(const std::uint16_t *, std::uint8_t *, size_t);
+using UnpackFunction = void (*)(const std::uint8_t *, std::uint16_t *,
+                                size_t);
+
+/// @brief The pack functions, indexed by the number of bits minus one.
+const PackFunction packFunctions[maxPackedBits] = {
+    PackDispatch<1>,  PackDispatch<2>,  PackDispatch<3>,  PackDispatch<4>,
+    PackDispatch<5>,  PackDispatch<6>,  PackDispatch<7>,  PackDispatch<8>,
+    PackDispatch<9>,  PackDispatch<10>, PackDispatch<11>, PackDispatch<12>,
+    PackDispatch<13>, PackDispatch<14>, PackDispatch<15>};
+
+/// @brief The unpack functions, indexed by the number of bits minus one.
+const UnpackFunction unpackFunctions[maxPackedBits] = {
+    UnpackDispatch<1>,  UnpackDispatch<2>,  UnpackDispatch<3>,
+    UnpackDispatch<4>,  UnpackDispatch<5>,  UnpackDispatch<6>,
+    UnpackDispatch<7>,  UnpackDispatch<8>,  UnpackDispatch<9>,
+    UnpackDispatch<10>, UnpackDispatch<11>, UnpackDispatch<12>,
+    UnpackDispatch<13>, UnpackDispatch<14>, UnpackDispatch<15>};
+} // namespace
+
+int RequiredBits(const std::uint16_t *values, size_t elements) {
+  std::uint16_t allBits;
+#ifdef BIT_PACKING_AVX2
+  if (HasAvx2()) {
+    allBits = OrValuesAvx2(values, elements);
+  } else {
+    allBits = OrValues(values, elements);
+  }
+#else
+  allBits = OrValues(values, elements);
+#endif
+  int bits = 1;
+  while (bits < 16 and (allBits >> bits) != 0) {
+    bits++;
+  }
+  return bits;
+}
+
+size_t PackedSize(size_t elements, int bits) {
+  return (elements / groupValues) * bits +
+         ((elements % groupValues) * bits + 7) / 8;
+}
+
+bool PackBits(const std::uint16_t *input, std::uint8_t *output,
+              size_t elements, int bits) {
+  if (bits < 1 or bits > maxPackedBits) {
+    return false;
+  }
+  packFunctions[bits - 1](input, output, elements);
+  return true;
+}
+
+bool UnpackBits(const std::uint8_t *input, std::uint16_t *output,
+                size_t elements, int bits) {
+  if (bits < 1 or bits > maxPackedBits) {
+    return false;
+  }
+  unpackFunctions[bits - 1](input, output, elements);
+  return true;
+}
+} // namespace KafkaInterface
@@ -0,0 +1,58 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  BitPacking.h
+ *  @brief Header file of functions which pack 16 bit unsigned integers with
+ * fewer significant bits (e.g. 10 or 12 bit detector data) into a bit stream
+ * and back.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace KafkaInterface {
+
+/// @brief Largest number of bits per value supported by PackBits().
+const int maxPackedBits = 15;
+
+/** @brief Returns the number of bits required to store the largest of the
+ * given values.
+ * @param[in] values The values to check.
+ * @param[in] elements Number of values.
+ * @return A value in the range 1 to 16.
+ */
+int RequiredBits(const std::uint16_t *values, size_t elements);
+
+/** @brief Returns the size of packed data in bytes.
+ * @param[in] elements Number of values.
+ * @param[in] bits Number of bits per value.
+ */
+size_t PackedSize(size_t elements, int bits);
+
+/** @brief Packs the lowest bits of each value into a bit stream.
+ * Value i is stored at bit i * bits of the stream, least significant bit
+ * first, where bit 0 of the stream is the least significant bit of the first
+ * byte. Groups of 8 values (taking exactly bits bytes) are packed at once
+ * using code specialised for each number of bits, compiled for AVX2 as well
+ * and selected at run time.
+ * @param[in] input The values to pack. Bits above the lowest bits are
+ * ignored.
+ * @param[out] output The packed data, see PackedSize().
+ * @param[in] elements Number of values.
+ * @param[in] bits Number of bits per value, 1 to maxPackedBits.
+ * @return False if the number of bits is not supported, true otherwise.
+ */
+bool PackBits(const std::uint16_t *input, std::uint8_t *output,
+              size_t elements, int bits);
+
+/** @brief Unpacks data packed by PackBits().
+ * @param[in] input The packed data, see PackedSize().
+ * @param[out] output The unpacked values.
+ * @param[in] elements Number of values.
+ * @param[in] bits Number of bits per value, 1 to maxPackedBits.
+ * @return False if the number of bits is not supported, true otherwise.
+ */
+bool UnpackBits(const std::uint8_t *input, std::uint16_t *output,
+                size_t elements, int bits);
+} // namespace KafkaInterface
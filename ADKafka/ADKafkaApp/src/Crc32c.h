@@ -0,0 +1,29 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Crc32c.h
+ *  @brief Header file of the CRC32C (Castagnoli) checksum used to detect
+ * corrupted array data.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace KafkaInterface {
+
+/** @brief Computes the CRC32C (Castagnoli) checksum of a buffer.
+ * The SSE4.2 crc32 instruction is used if the CPU supports it (checked at run
+ * time), otherwise a table based implementation which processes 8 bytes at a
+ * time is used. Both give the same result.
+ * @param[in] data The data to compute the checksum of.
+ * @param[in] size Size of the data in bytes.
+ * @param[in] crc The checksum of the preceding data when computing the
+ * checksum of a buffer in several parts, 0 otherwise.
+ * @return The checksum of the data (and the preceding data).
+ */
+std::uint32_t Crc32c(const void *data, size_t size, std::uint32_t crc = 0);
+
+/// @brief Returns true if Crc32c() uses the SSE4.2 crc32 instruction.
+bool Crc32cIsHardwareAccelerated();
+} // namespace KafkaInterface
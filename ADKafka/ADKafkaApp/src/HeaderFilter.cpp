@@ -0,0 +1,134 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  HeaderFilter.cpp
+ *  @brief Implementation of a filter which matches Kafka message headers
+ * against a user supplied expression.
+ */
+
+#include "HeaderFilter.h"
+#include <ciso646>
+#include <cstdlib>
+
+namespace KafkaInterface {
+
+namespace {
+std::string Trim(std::string const &str) {
+  const char *whiteSpace = " \t\r\n";
+  auto first = str.find_first_not_of(whiteSpace);
+  if (std::string::npos == first) {
+    return "";
+  }
+  auto last = str.find_last_not_of(whiteSpace);
+  return str.substr(first, last - first + 1);
+}
+
+bool ToNumber(std::string const &str, double &number) {
+  if (str.empty()) {
+    return false;
+  }
+  char *endPtr{nullptr};
+  number = std::strtod(str.c_str(), &endPtr);
+  return '\0' == *endPtr;
+}
+
+} // namespace
+
+bool HeaderFilter::SetExpression(std::string const &expression) {
+  std::vector<Term> newTerms;
+  std::string::size_type start = 0;
+  while (start <= expression.size()) {
+    auto end = expression.find(',', start);
+    if (std::string::npos == end) {
+      end = expression.size();
+    }
+    auto termString = Trim(expression.substr(start, end - start));
+    if (not termString.empty()) {
+      Term newTerm;
+      if (not ParseTerm(termString, newTerm)) {
+        return false;
+      }
+      newTerms.push_back(newTerm);
+    }
+    start = end + 1;
+  }
+  HeaderFilter::expression = expression;
+  terms = newTerms;
+  return true;
+}
+
+std::string HeaderFilter::GetExpression() const { return expression; }
+
+bool HeaderFilter::IsEmpty() const { return terms.empty(); }
+
+bool HeaderFilter::Match(MessageHeaders const &headers) const {
+  for (auto const &term : terms) {
+    bool termIsTrue = false;
+    for (auto const &header : headers) {
+      if (header.first == term.key) {
+        termIsTrue = Compare(term, header.second);
+        break;
+      }
+    }
+    if (not termIsTrue) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool HeaderFilter::ParseTerm(std::string const &termString, Term &term) {
+  auto opStart = termString.find_first_of("=!<>");
+  if (std::string::npos == opStart) {
+    return false;
+  }
+  auto opEnd = opStart + 1;
+  if (opEnd < termString.size() and '=' == termString[opEnd]) {
+    ++opEnd;
+  }
+  auto opString = termString.substr(opStart, opEnd - opStart);
+  if ("==" == opString) {
+    term.op = Operator::EQUAL;
+  } else if ("!=" == opString) {
+    term.op = Operator::NOT_EQUAL;
+  } else if ("<" == opString) {
+    term.op = Operator::LESS;
+  } else if ("<=" == opString) {
+    term.op = Operator::LESS_EQUAL;
+  } else if (">" == opString) {
+    term.op = Operator::GREATER;
+  } else if (">=" == opString) {
+    term.op = Operator::GREATER_EQUAL;
+  } else {
+    return false;
+  }
+  term.key = Trim(termString.substr(0, opStart));
+  term.value = Trim(termString.substr(opEnd));
+  return not term.key.empty() and not term.value.empty();
+}
+
+bool HeaderFilter::Compare(Term const &term, std::string const &headerValue) {
+  int order;
+  double headerNumber, termNumber;
+  if (ToNumber(headerValue, headerNumber) and
+      ToNumber(term.value, termNumber)) {
+    order = (headerNumber > termNumber) - (headerNumber < termNumber);
+  } else {
+    order = headerValue.compare(term.value);
+  }
+  switch (term.op) {
+  case Operator::EQUAL:
+    return 0 == order;
+  case Operator::NOT_EQUAL:
+    return 0 != order;
+  case Operator::LESS:
+    return order < 0;
+  case Operator::LESS_EQUAL:
+    return order <= 0;
+  case Operator::GREATER:
+    return order > 0;
+  case Operator::GREATER_EQUAL:
+    return order >= 0;
+  }
+  return false;
+}
+} // namespace KafkaInterface
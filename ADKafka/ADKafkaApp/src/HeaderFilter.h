@@ -0,0 +1,83 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  HeaderFilter.h
+ *  @brief Header file of a simple filter which matches Kafka message headers
+ * against a user supplied expression.
+ */
+
+#pragma once
+
+#include "Transport.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace KafkaInterface {
+
+/** @brief Matches the headers of Kafka messages against a filter expression.
+ * The expression is a comma separated list of terms, all of which must be true
+ * for a set of headers to match. Each term has the form `key op value` where
+ * `op` is one of `==`, `!=`, `<`, `<=`, `>` and `>=`. If both the header value
+ * and the term value are numbers, they are compared as such. Otherwise they are
+ * compared as text strings. A term referring to a header which is missing is
+ * false. An empty expression matches all headers. Example:
+ * `dataType == uint16, uniqueId >= 1000`.
+ */
+class HeaderFilter {
+public:
+  HeaderFilter() = default;
+
+  /** @brief Parses and sets a new filter expression.
+   * @param[in] expression The new filter expression.
+   * @return True on success. False if the expression could not be parsed in
+   * which case the previous expression is kept.
+   */
+  bool SetExpression(std::string const &expression);
+
+  /// @brief Returns the current filter expression.
+  std::string GetExpression() const;
+
+  /// @brief Returns true if the filter has no terms, i.e. matches everything.
+  bool IsEmpty() const;
+
+  /** @brief Checks if a set of message headers matches the filter expression.
+   * @param[in] headers The headers of a Kafka message.
+   * @return True if all terms of the expression are true, false otherwise.
+   */
+  bool Match(MessageHeaders const &headers) const;
+
+protected:
+  /// @brief The comparison operators available in a filter term.
+  enum class Operator {
+    EQUAL,
+    NOT_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL,
+  };
+
+  /// @brief One (parsed) term of the filter expression.
+  struct Term {
+    std::string key;
+    Operator op;
+    std::string value;
+  };
+
+  /** @brief Parses a single term of a filter expression.
+   * @param[in] termString The text of the term.
+   * @param[out] term The parsed term.
+   * @return True on success, false otherwise.
+   */
+  static bool ParseTerm(std::string const &termString, Term &term);
+
+  /// @brief Evaluates a single term against a header value.
+  static bool Compare(Term const &term, std::string const &headerValue);
+
+  /// @brief The current filter expression in text form.
+  std::string expression;
+
+  /// @brief The parsed terms of the current filter expression.
+  std::vector<Term> terms;
+};
+} // namespace KafkaInterface
@@ -110,6 +110,13 @@ std::unique_ptr<KafkaMessage> KafkaConsumer::WaitForPkg(int timeout) {
       topicOffset = msg->offset();
       setParam(paramCallback, paramsList[PV::msg_offset],
                static_cast<int>(topicOffset));
+      if (not MessagePassesFilter(msg)) {
+        delete msg;
+        ++filteredMessages;
+        setParam(paramCallback, paramsList[PV::filtered_msgs],
+                 filteredMessages);
+        return nullptr;
+      }
       return std::unique_ptr<KafkaMessage>(new KafkaMessage(msg));
     } else {
       delete msg;
@@ -121,6 +128,36 @@ std::unique_ptr<KafkaMessage> KafkaConsumer::WaitForPkg(int timeout) {
   return nullptr;
 }
 
+bool KafkaConsumer::MessagePassesFilter(RdKafka::Message *msg) {
+  std::lock_guard<std::mutex> lock(filterMutex);
+  if (headerFilter.IsEmpty()) {
+    return true;
+  }
+  headerBuffer.clear();
+  RdKafka::Headers *headers = msg->headers();
+  if (nullptr != headers) {
+    for (auto const &header : headers->get_all()) {
+      if (nullptr != header.value()) {
+        headerBuffer.emplace_back(
+            header.key(),
+            std::string(reinterpret_cast<const char *>(header.value()),
+                        header.value_size()));
+      }
+    }
+  }
+  return headerFilter.Match(headerBuffer);
+}
+
+bool KafkaConsumer::SetHeaderFilter(std::string const &expression) {
+  std::lock_guard<std::mutex> lock(filterMutex);
+  return headerFilter.SetExpression(expression);
+}
+
+std::string KafkaConsumer::GetHeaderFilter() {
+  std::lock_guard<std::mutex> lock(filterMutex);
+  return headerFilter.GetExpression();
+}
+
 void KafkaConsumer::event_cb(RdKafka::Event &event) {
   /// @todo This member function really needs some expanded capability
   switch (event.type()) {
@@ -155,30 +192,33 @@ void KafkaConsumer::event_cb(RdKafka::Event &event) {
 
 void KafkaConsumer::ParseStatusString(std::string const &msg) {
   /// @todo We should probably extract some more stats from the JSON message
-  bool parseSuccess = reader.parse(msg, root);
-  if (not parseSuccess) {
+  KafkaStatistics stats;
+  if (not ExtractStatistics(msg.data(), msg.size(), stats)) {
     SetConStat(KafkaConsumer::ConStat::ERROR, "Status msg.: Unable to parse.");
     return;
   }
-  brokers = root["brokers"];
-  if (brokers.isNull() or brokers.empty()) {
+  if (0 == stats.brokers) {
     SetConStat(KafkaConsumer::ConStat::ERROR, "Status msg.: No brokers.");
+  } else if (stats.brokerUp) {
+    SetConStat(KafkaConsumer::ConStat::CONNECTED, "No errors.");
   } else {
-    KafkaConsumer::ConStat tempStat = KafkaConsumer::ConStat::DISCONNECTED;
-    std::string statString = "Brokers down. Attempting reconnection.";
-    if (std::any_of(brokers.begin(), brokers.end(),
-                    [](Json::Value const &CBrkr) {
-                      return "UP" == CBrkr["state"].asString();
-                    })) {
-      tempStat = KafkaConsumer::ConStat::CONNECTED;
-      statString = "No errors.";
-    }
-    SetConStat(tempStat, statString);
+    SetConStat(KafkaConsumer::ConStat::DISCONNECTED,
+               "Brokers down. Attempting reconnection.");
   }
+  if (statisticsCallback) {
+    statisticsCallback(stats);
+  }
+}
+
+void KafkaConsumer::SetStatisticsCallback(
+    std::function<void(KafkaStatistics const &)> callback) {
+  statisticsCallback = callback;
 }
 
 std::int64_t KafkaConsumer::GetCurrentOffset() { return topicOffset; }
 
+int KafkaConsumer::GetFilteredMessages() { return filteredMessages; }
+
 bool KafkaConsumer::UpdateTopic() {
   if (nullptr != consumer and not topicName.empty()) {
     consumer->unassign();
@@ -195,6 +235,10 @@ bool KafkaConsumer::UpdateTopic() {
   return true;
 }
 
+std::unique_ptr<TransportMessage> KafkaConsumer::ReceiveMessage(int timeout) {
+  return WaitForPkg(timeout);
+}
+
 void KafkaConsumer::StartConsumption() {
   if (consumptionHalted) {
     consumptionHalted = false;
@@ -285,6 +329,7 @@ void KafkaConsumer::RegisterParamCallbackClass(asynNDArrayDriver *ptr) {
   paramCallback = ptr;
   setParam(paramCallback, paramsList[PV::msg_offset],
            static_cast<int>(RdKafka::Topic::OFFSET_STORED));
+  setParam(paramCallback, paramsList[PV::filtered_msgs], filteredMessages);
 }
 
 bool KafkaConsumer::SetStatsTimeIntervalMS(int timeInterval) {
@@ -7,11 +7,15 @@
 
 #pragma once
 
+#include "HeaderFilter.h"
 #include "ParamUtility.h"
-#include "json.h"
+#include "StatsExtractor.h"
+#include "Transport.h"
 #include <asynNDArrayDriver.h>
+#include <functional>
 #include <librdkafka/rdkafkacpp.h>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -25,27 +29,27 @@ namespace KafkaInterface {
  * RdKafka::Message class
  * instance.
  */
-class KafkaMessage {
+class KafkaMessage : public TransportMessage {
 public:
   /** @brief Stores a pointer to a RdKafka:Message.
    * @param[in] msg The pointer to the RdKafka::Message which is to be stored.
    */
   explicit KafkaMessage(RdKafka::Message *msg);
   /// @brief De-allocates the stored RdKafka::Message.
-  ~KafkaMessage() = default;
+  ~KafkaMessage() override = default;
   /** @brief Returns the pointer to the data stored in the RdKafka::message.
    * @return The pointer returned by this member function is still owned by the
    * class and the data
    * it points to will become unavailable when the class instance is
    * de-allocated.
    */
-  void *GetDataPtr();
+  void *GetDataPtr() override;
 
   /** @brief The size of the data in number of bytes as pointed to by the
    * pointer returned by
    * KafkaMessage::GetDataPtr().
    */
-  size_t size();
+  size_t size() override;
 
 private:
   /// @brief The pointer to the actual RdKafka::Message.
@@ -70,7 +74,7 @@ private:
  * @todo Move the callback functionality to a separate class when it is
  * extended.
  */
-class KafkaConsumer : public RdKafka::EventCb {
+class KafkaConsumer : public RdKafka::EventCb, public TransportConsumer {
 public:
   /** @brief Sets up the class to consume messages from a Kafka broker.
    * @note After calling the constructor, the PV:s must be configured and
@@ -166,10 +170,32 @@ public:
    * correctly, returns nullptr. Returns a pointer to a
    * KafkaInterface::KafkaMessage on success.
    * Note that the caller is responsible for calling delete on the returned
-   * pointer.
+   * pointer. Messages with headers not matching the filter set by
+   * KafkaConsumer::SetHeaderFilter() are discarded without their payload being
+   * touched and nullptr is returned.
    */
   virtual std::unique_ptr<KafkaMessage> WaitForPkg(int timeout);
 
+  /// @brief Calls KafkaConsumer::WaitForPkg().
+  std::unique_ptr<TransportMessage> ReceiveMessage(int timeout) override;
+
+  /** @brief Set the expression used to filter messages on their headers.
+   * See KafkaInterface::HeaderFilter for the syntax of the expression. An empty
+   * expression disables the filtering of messages.
+   * @param[in] expression The new filter expression.
+   * @return True on success, false if the expression could not be parsed. In
+   * the latter case the previous expression is still used.
+   */
+  virtual bool SetHeaderFilter(std::string const &expression);
+
+  /// @brief Returns the message header filter expression currently in use.
+  virtual std::string GetHeaderFilter();
+
+  /** @brief Returns the number of messages discarded by the header filter.
+   * Must be called from the thread calling KafkaConsumer::WaitForPkg().
+   */
+  virtual int GetFilteredMessages();
+
   /** @brief Start the consumption of messages.
    * KafkaInterface::KafkaConsumer does not start consumption automatically.
    * This function must be
@@ -177,7 +203,7 @@ public:
    * KafkaConsumer::WaitForPkg() will
    * return nullptr. However, Kafka broker connection stats will be updated.
    */
-  virtual void StartConsumption();
+  void StartConsumption() override;
 
   /** @brief Stops the consumption of messages.
    * Stops the consumption of messages. If consumption is stopped,
@@ -185,7 +211,7 @@ public:
    * will return nullptr. However, Kafka broker connection stats will be
    * updated.
    */
-  virtual void StopConsumption();
+  void StopConsumption() override;
 
   /** @brief Returns the current message offset as stored by
    * KafkaInterface::KafkaConsumer.
@@ -257,6 +283,15 @@ public:
    */
   virtual int GetStatsTimeMS();
 
+  /** @brief Sets a function which is called with the statistics every time
+   * they are received from librdkafka, e.g. to export them as metrics.
+   * Called by the thread consuming the messages, without the port driver
+   * lock held. Must be set before messages are consumed.
+   * @param[in] callback The function, an empty function disables the calls.
+   */
+  void SetStatisticsCallback(
+      std::function<void(KafkaStatistics const &)> callback);
+
   /** @brief Returns the PV definitions used by the
    * KafkaInterface::KafkaConsumer.
    * KafkaInterface::KafkaConsumer can not initialize its own PV:s as the driver
@@ -357,6 +392,29 @@ protected:
    */
   virtual void ParseStatusString(std::string const &msg);
 
+  /// @brief See KafkaConsumer::SetStatisticsCallback().
+  std::function<void(KafkaStatistics const &)> statisticsCallback;
+
+  /** @brief Checks if the headers of a message matches the header filter.
+   * Only the headers of the message are examined.
+   * @param[in] msg The message to check.
+   * @return True if the message should be passed on, false otherwise.
+   */
+  virtual bool MessagePassesFilter(RdKafka::Message *msg);
+
+  /// @brief Filter used to discard messages based on their headers.
+  HeaderFilter headerFilter;
+
+  /// @brief Protects KafkaConsumer::headerFilter as it is set from a different
+  /// thread than the one consuming messages.
+  std::mutex filterMutex;
+
+  /// @brief Re-used storage for the headers of the message being filtered.
+  MessageHeaders headerBuffer;
+
+  /// @brief Number of messages discarded by the header filter.
+  int filteredMessages{0};
+
   int kafka_stats_interval{
       500}; /// @brief Saved Kafka connection stats interval in ms.
 
@@ -397,18 +455,13 @@ protected:
   /// @brief Pointer to Kafka consumer in librdkafka.
   RdKafka::KafkaConsumer *consumer{nullptr};
 
-  /// @brief The root and broker json objects extracted from a json string.
-  Json::Value root, brokers;
-
-  /// @brief Parses std:string objects into a Json::value.
-  Json::Reader reader;
-
   /// @brief Used to keep track of the PV:s made available by this driver.
   enum PV {
     max_msg_size,
     con_status,
     con_msg,
     msg_offset,
+    filtered_msgs,
     count,
   };
 
@@ -418,6 +471,7 @@ protected:
       PV_param("KAFKA_CONNECTION_STATUS", asynParamInt32),  // con_status
       PV_param("KAFKA_CONNECTION_MESSAGE", asynParamOctet), // con_msg
       PV_param("KAFKA_CURRENT_OFFSET", asynParamInt32),     // msg_offset
+      PV_param("KAFKA_FILTERED_MESSAGES", asynParamInt32),  // filtered_msgs
   };
 };
 } // namespace KafkaInterface
@@ -10,12 +10,14 @@
 #include <epicsTime.h>
 #include <iocsh.h>
 
+#include <algorithm>
 #include <asynDriver.h>
 #include <cassert>
 #include <ciso646>
 #include <epicsExport.h>
 #include "KafkaDriver.h"
 #include "NDArrayDeSerializer.h"
+#include "Probes.h"
 
 static const char *driverName = "KafkaDriver";
 
@@ -38,8 +40,26 @@ asynStatus KafkaDriver::writeOctet(asynUser *pasynUser, const char *value,
     consumer.SetBrokerAddr(std::string(value, nChars));
   } else if (function == *paramsList.at(PV::kafka_topic).index) {
     consumer.SetTopic(std::string(value, nChars));
+    if (TransportBackend::LOCAL == backend) {
+      UpdateTransport();
+    }
   } else if (function == *paramsList.at(PV::kafka_group).index) {
     consumer.SetGroupId(std::string(value, nChars));
+  } else if (function == *paramsList.at(PV::header_filter).index) {
+    if (not consumer.SetHeaderFilter(std::string(value, nChars))) {
+      // Invalid expression, restore the one still in use
+      setStringParam(addr, function, consumer.GetHeaderFilter().c_str());
+    }
+  } else if (function == *paramsList.at(PV::segment_path).index) {
+    segmentPath = std::string(value, nChars);
+    if (TransportBackend::SEGMENT_FILE == backend) {
+      UpdateTransport();
+    }
+  } else if (function == *paramsList.at(PV::recording_path).index) {
+    recordingPath = std::string(value, nChars);
+    if (TransportBackend::RECORDING == backend) {
+      UpdateTransport();
+    }
   } else if (function < MIN_PARAM_INDEX) {
     ADDriver::writeOctet(pasynUser, value, nChars, nActual);
   }
@@ -121,6 +141,33 @@ asynStatus KafkaDriver::writeInt32(asynUser *pasynUser, epicsInt32 value) {
     if (value > 0) {
       consumer.SetStatsTimeIntervalMS(value);
     }
+  } else if (function == *paramsList[verify_checksum].index) {
+    verifyChecksums = (0 != value);
+  } else if (function == *paramsList[widen_floats].index) {
+    widenFloats = (0 != value);
+  } else if (function == *paramsList[tile_threads].index) {
+    if (not tileAssembler.SetThreads(value)) {
+      value = tileAssembler.GetThreads();
+    }
+  } else if (function == *paramsList[backend_type].index) {
+    if (value >= 0 and value <= 3) {
+      backend = TransportBackend(value);
+      UpdateTransport();
+    } else {
+      value = static_cast<int>(backend);
+    }
+  } else if (function == *paramsList[replay_seek_frame].index) {
+    if (nullptr != recording and recording->SeekFrame(value)) {
+      // Do not count the arrays skipped over as lost
+      lastSequenceNumber = 0;
+      setParam(this, paramsList.at(PV::replay_position),
+               static_cast<int>(recording->GetPosition()));
+    }
+  } else if (function == *paramsList[replay_loop].index) {
+    replayLoop = (0 != value);
+    if (nullptr != recording) {
+      recording->SetLoop(replayLoop);
+    }
   }
   /* Set the parameter and readback in the parameter library.  This may be
    * overwritten when we
@@ -163,6 +210,40 @@ asynStatus KafkaDriver::writeInt32(asynUser *pasynUser, epicsInt32 value) {
   return status;
 }
 
+asynStatus KafkaDriver::writeFloat64(asynUser *pasynUser,
+                                     epicsFloat64 value) {
+  const int function{pasynUser->reason};
+  asynStatus status{asynSuccess};
+
+  /* Set the parameter in the parameter library. */
+  setDoubleParam(function, value);
+
+  if (function == *paramsList[replay_seek_time].index) {
+    if (nullptr != recording and recording->SeekTime(value)) {
+      lastSequenceNumber = 0;
+      setParam(this, paramsList.at(PV::replay_position),
+               static_cast<int>(recording->GetPosition()));
+    }
+  } else if (function < MIN_PARAM_INDEX) {
+    /* If this parameter belongs to a base class call its method */
+    status = ADDriver::writeFloat64(pasynUser, value);
+  }
+
+  /* Do callbacks so higher layers see any changes */
+  callParamCallbacks();
+
+  if (status != 0) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:writeFloat64 error, status=%d function=%d, value=%f\n",
+              driverName, status, function, value);
+  } else {
+    asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:writeFloat64: function=%d, value=%f\n", driverName,
+              function, value);
+  }
+  return status;
+}
+
 static void consumeTaskC(void *drvPvt) {
   auto *pPvt = reinterpret_cast<KafkaDriver *>(drvPvt);
 
@@ -179,6 +260,8 @@ KafkaDriver::KafkaDriver(const char *portName, int maxBuffers, size_t maxMemory,
                0,    /* No interfaces beyond those set in ADDriver.cpp */
                0, 1, /* ASYN_CANBLOCK=0, ASYN_MULTIDEVICE=0, autoConnect=1 */
                priority, stackSize),
+      stageTrace(portName, {"receive", "deserialize", "callbacks"}),
+      metricsSet(portName), metrics(metricsSet),
       consumer(brokerAddress, brokerTopic, asynPortDriver::portName) {
 
   const char *functionName = "KafkaDriver";
@@ -209,6 +292,9 @@ KafkaDriver::KafkaDriver(const char *portName, int maxBuffers, size_t maxMemory,
   // The following two calls must be made in this particular order
   InitPvParams(this, consumer.GetParams());
   consumer.RegisterParamCallbackClass(this);
+  consumer.SetStatisticsCallback(
+      [this](KafkaStatistics const &stats) { UpdateKafkaMetrics(stats); });
+  UpdateTransport();
 
   // Set start values in the PV database.
   status = setParam(this, paramsList.at(PV::kafka_addr), brokerAddress);
@@ -218,6 +304,33 @@ KafkaDriver::KafkaDriver(const char *portName, int maxBuffers, size_t maxMemory,
   status |=
       setParam(this, paramsList.at(PV::stats_time), consumer.GetStatsTimeMS());
   status |= setParam(this, paramsList.at(PV::set_offset), usedOffsetSetting);
+  status |= setParam(this, paramsList.at(PV::producer_dropped), 0);
+  status |= setParam(this, paramsList.at(PV::lost_arrays), 0);
+  status |= setParam(this, paramsList.at(PV::filtered_arrays), 0);
+  status |= setParam(this, paramsList.at(PV::skipped_arrays), 0);
+  status |= setParam(this, paramsList.at(PV::verify_checksum),
+                     verifyChecksums ? 1 : 0);
+  status |= setParam(this, paramsList.at(PV::checksum_failures), 0);
+  status |=
+      setParam(this, paramsList.at(PV::widen_floats), widenFloats ? 1 : 0);
+  status |= setParam(this, paramsList.at(PV::tile_threads),
+                     tileAssembler.GetThreads());
+  status |= setParam(this, paramsList.at(PV::incomplete_frames), 0);
+  status |= setParam(this, paramsList.at(PV::header_filter),
+                     consumer.GetHeaderFilter());
+  status |= setParam(this, paramsList.at(PV::backend_type),
+                     static_cast<int>(backend));
+  status |= setParam(this, paramsList.at(PV::segment_path), segmentPath);
+  status |= setParam(this, paramsList.at(PV::recording_path), recordingPath);
+  status |= setParam(this, paramsList.at(PV::replay_seek_frame), 0);
+  status |= setParam(this, paramsList.at(PV::replay_seek_time), 0.0);
+  status |= setParam(this, paramsList.at(PV::replay_loop), replayLoop ? 1 : 0);
+  status |= setParam(this, paramsList.at(PV::replay_position), 0);
+  status |= setParam(this, paramsList.at(PV::replay_records), 0);
+  status |= setParam(this, paramsList.at(PV::time_receive), 0.0);
+  status |= setParam(this, paramsList.at(PV::time_deserialize), 0.0);
+  status |= setParam(this, paramsList.at(PV::time_callbacks), 0.0);
+  status |= setParam(this, paramsList.at(PV::time_total), 0.0);
 
   // Array callbacks are required to send data to plugins
   setIntegerParam(NDArrayCallbacks, 1);
@@ -250,6 +363,8 @@ void KafkaDriver::consumeTask() {
   double acquirePeriod;
   const char *functionName = "consumeTask";
   double startWaitTimeout;
+  // The back-end used by the current acquisition
+  std::shared_ptr<TransportConsumer> activeTransport;
   keepThreadAlive = true;
   this->lock();
   /* Loop forever */
@@ -267,6 +382,14 @@ void KafkaDriver::consumeTask() {
       this->unlock();
       startWaitTimeout = consumer.GetStatsTimeMS() / 1000.0;
       consumer.StopConsumption();
+      if (nullptr != activeTransport) {
+        activeTransport->StopConsumption();
+        activeTransport.reset();
+      }
+      // Arrays left in a batch belong to the previous acquisition
+      currentMessage.reset();
+      keyframe.keyframeId = 0;
+      tileAssembler.Reset();
       // Loop waiting for start acquisition event
       do {
         status = epicsEventWaitWithTimeout(startEventId_, startWaitTimeout);
@@ -281,8 +404,9 @@ void KafkaDriver::consumeTask() {
           std::abort(); // This should never happen
         }
       } while (status == asynStatus::asynTimeout);
-      consumer.StartConsumption();
       this->lock();
+      activeTransport = transport;
+      activeTransport->StartConsumption();
       acquire = 1;
       setStringParam(ADStatusMessage, "Acquiring data");
       setIntegerParam(ADNumImagesCounter, 0);
@@ -313,13 +437,21 @@ void KafkaDriver::consumeTask() {
 
     /* Update the image */
     getDoubleParam(ADAcquirePeriod, &acquirePeriod);
+    StageTimes times;
     this->unlock();
     {
-      auto fbImg = consumer.WaitForPkg(static_cast<int>(acquirePeriod * 1000));
+      auto recvArr = GetNextArray(*activeTransport,
+                                  static_cast<int>(acquirePeriod * 1000));
       this->lock();
+      times.Mark(RECEIVE);
+
+      if (nullptr != recording) {
+        setParam(this, paramsList.at(PV::replay_position),
+                 static_cast<int>(recording->GetPosition()));
+      }
 
       // If we get no image, go to start of loop
-      if (nullptr == fbImg) {
+      if (nullptr == recvArr) {
         continue;
       }
 
@@ -330,10 +462,58 @@ void KafkaDriver::consumeTask() {
 
       /// @todo Make sure that there is actual a free NDArray to which the data
       /// can be copied.
-      DeSerializeData(this->pNDArrayPool,
-                      reinterpret_cast<unsigned char *>(fbImg->GetDataPtr()),
-                      pImage);
+      KAFKA_PROBE2(deserialize__start, recvArr->id(),
+                   nullptr == recvArr->pData() ? 0 : recvArr->pData()->size());
+      UpdateSequenceCounters(recvArr->sequenceNumber(),
+                             recvArr->droppedArrays(),
+                             consumer.GetFilteredMessages());
+      if (recvArr->tileCount() > 0) {
+        // The tiles are kept until all tiles of the array have been received
+        bool frameComplete =
+            tileAssembler.AddTile(recvArr, std::move(currentMessage));
+        setParam(this, paramsList.at(PV::incomplete_frames),
+                 static_cast<int>(tileAssembler.GetIncompleteFrames()));
+        if (not frameComplete) {
+          pImage = nullptr;
+          continue;
+        }
+        auto frameStatus = tileAssembler.AssembleFrame(
+            this->pNDArrayPool, pImage, widenFloats, verifyChecksums);
+        if (TileAssembler::FrameStatus::SKIPPED == frameStatus) {
+          ++skippedArrays;
+          metrics.skippedArrays.Add();
+          setParam(this, paramsList.at(PV::skipped_arrays),
+                   static_cast<int>(skippedArrays));
+          continue;
+        } else if (TileAssembler::FrameStatus::CHECKSUM_FAILED ==
+                   frameStatus) {
+          ++checksumFailures;
+          metrics.checksumFailures.Add();
+          setParam(this, paramsList.at(PV::checksum_failures),
+                   static_cast<int>(checksumFailures));
+          continue;
+        }
+      } else if (not DeSerializeData(this->pNDArrayPool, recvArr, pImage,
+                                     &keyframe, widenFloats)) {
+        // Delta encoded array received before its keyframe, or corrupt data
+        ++skippedArrays;
+        metrics.skippedArrays.Add();
+        setParam(this, paramsList.at(PV::skipped_arrays),
+                 static_cast<int>(skippedArrays));
+        continue;
+      } else if (verifyChecksums and not VerifyChecksum(recvArr, pImage)) {
+        // Corrupted data is not passed on to the plugins
+        ++checksumFailures;
+        metrics.checksumFailures.Add();
+        setParam(this, paramsList.at(PV::checksum_failures),
+                 static_cast<int>(checksumFailures));
+        pImage->release();
+        pImage = nullptr;
+        continue;
+      }
     }
+    times.Mark(DESERIALIZE);
+    KAFKA_PROBE2(deserialize__end, pImage->uniqueId, pImage->dataSize);
 
     /* Close the shutter */
     setShutter(ADShutterClosed);
@@ -353,6 +533,8 @@ void KafkaDriver::consumeTask() {
     getIntegerParam(ADNumImagesCounter, &numImagesCounter);
     numImagesCounter++;
     setIntegerParam(ADNumImagesCounter, numImagesCounter);
+    metrics.arrays.Add();
+    metrics.arrayBytes.Add(pImage->dataSize);
 
     // If callbacks are active, do them
     getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
@@ -365,9 +547,12 @@ void KafkaDriver::consumeTask() {
       asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
                 "%s:%s: calling imageData callback\n", driverName,
                 functionName);
+      KAFKA_PROBE2(callback__dispatch, pImage->uniqueId, pImage->dataSize);
       doCallbacksGenericPointer(pImage, NDArrayData, 0);
       this->lock();
     }
+    times.Mark(CALLBACKS);
+    RecordStageTimes(times, *pImage);
 
     /* See if acquisition is done */
     getIntegerParam(ADNumImages, &numImages);
@@ -380,7 +565,7 @@ void KafkaDriver::consumeTask() {
       callParamCallbacks();
 
       acquire = 0;
-      consumer.StopConsumption();
+      activeTransport->StopConsumption();
       setIntegerParam(ADAcquire, acquire);
       asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
                 "%s:%s: acquisition completed\n", driverName, functionName);
@@ -395,7 +580,7 @@ void KafkaDriver::consumeTask() {
       status = epicsEventTryWait(stopEventId_);
       if (status == epicsEventWaitOK) {
         acquire = 0;
-        consumer.StopConsumption();
+        activeTransport->StopConsumption();
         if (imageMode == ADImageContinuous) {
           setIntegerParam(ADStatus, ADStatusIdle);
         } else {
@@ -410,7 +595,193 @@ exitConsumeTaskLabel:
   epicsEventSignal(threadExitEventId_);
 }
 
+void KafkaDriver::UpdateSequenceCounters(std::uint64_t sequenceNumber,
+                                         std::uint64_t droppedArrays,
+                                         std::uint64_t filteredMessages) {
+  // Also updated for arrays without a sequence number so that only the
+  // messages filtered since the last array are taken into account
+  bool filtered = filteredMessages != lastFilteredMessages;
+  lastFilteredMessages = filteredMessages;
+  if (0 == sequenceNumber) {
+    return;
+  }
+  if (0 != lastSequenceNumber and sequenceNumber > lastSequenceNumber) {
+    std::uint64_t missingArrays = sequenceNumber - lastSequenceNumber - 1;
+    std::uint64_t producerDrops{0};
+    if (droppedArrays > lastDroppedArrays) {
+      producerDrops = droppedArrays - lastDroppedArrays;
+    }
+    if (missingArrays > producerDrops and filtered) {
+      // The number of arrays in a filtered message is not known, so the
+      // whole gap is attributed to the filter
+      filteredArrays += missingArrays - producerDrops;
+    } else if (missingArrays > producerDrops) {
+      lostArrays += missingArrays - producerDrops;
+      metrics.lostArrays.Add(missingArrays - producerDrops);
+    } else {
+      // Arrays dropped from the queue of the producer are only counted in
+      // the arrays serialized afterwards, i.e. after the gap they left
+      lostArrays -= std::min(lostArrays, producerDrops - missingArrays);
+    }
+  }
+  lastSequenceNumber = sequenceNumber;
+  lastDroppedArrays = droppedArrays;
+  setParam(this, paramsList.at(PV::producer_dropped),
+           static_cast<int>(droppedArrays));
+  setParam(this, paramsList.at(PV::lost_arrays), static_cast<int>(lostArrays));
+  setParam(this, paramsList.at(PV::filtered_arrays),
+           static_cast<int>(filteredArrays));
+}
+
+void KafkaDriver::UpdateTransport() {
+  const char *functionName = "UpdateTransport";
+  recording = nullptr;
+  if (TransportBackend::RECORDING == backend) {
+    recording = std::make_shared<RecordingConsumer>(recordingPath);
+    if (not recordingPath.empty() and not recording->IsOpen()) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n",
+                driverName, functionName, recording->GetError().c_str());
+    }
+    recording->SetLoop(replayLoop);
+    transport = recording;
+  } else if (TransportBackend::LOCAL == backend) {
+    transport = std::make_shared<KafkaInterface::LocalConsumer>(
+        consumer.GetTopic());
+  } else if (TransportBackend::SEGMENT_FILE == backend) {
+    transport = std::make_shared<KafkaInterface::SegmentConsumer>(segmentPath);
+  } else {
+    // The consumer is a member of the driver and must not be deleted
+    transport = std::shared_ptr<TransportConsumer>(std::shared_ptr<void>(),
+                                                   &consumer);
+  }
+  int records = nullptr == recording ? 0 : recording->GetRecords();
+  setParam(this, paramsList.at(PV::replay_records), records);
+  setParam(this, paramsList.at(PV::replay_position), 0);
+}
+
+const FB_Tables::NDArray *KafkaDriver::GetNextArray(TransportConsumer &source,
+                                                    int timeout) {
+  if (nullptr != currentMessage and
+      FB_Tables::NDArrayBatchBufferHasIdentifier(
+          currentMessage->GetDataPtr())) {
+    auto arrays =
+        FB_Tables::GetNDArrayBatch(currentMessage->GetDataPtr())->arrays();
+    if (nullptr != arrays and batchIndex < arrays->size()) {
+      return arrays->Get(batchIndex++);
+    }
+  }
+  currentMessage = source.ReceiveMessage(timeout);
+  if (nullptr == currentMessage) {
+    return nullptr;
+  }
+  metrics.messages.Add();
+  metrics.messageBytes.Add(currentMessage->size());
+  if (FB_Tables::NDArrayBatchBufferHasIdentifier(
+          currentMessage->GetDataPtr())) {
+    batchIndex = 0;
+    auto arrays =
+        FB_Tables::GetNDArrayBatch(currentMessage->GetDataPtr())->arrays();
+    if (nullptr == arrays or 0 == arrays->size()) {
+      return nullptr;
+    }
+    KAFKA_PROBE2(consume, arrays->Get(0)->id(), currentMessage->size());
+    return arrays->Get(batchIndex++);
+  }
+  auto recvArr = FB_Tables::GetNDArray(currentMessage->GetDataPtr());
+  KAFKA_PROBE2(consume, recvArr->id(), currentMessage->size());
+  return recvArr;
+}
+
+void KafkaDriver::RecordStageTimes(StageTimes const &times,
+                                   NDArray const &pArray) {
+  stageTrace.Record(times, pArray.uniqueId);
+  // The receive stage is left out as it includes waiting for the message
+  double processingTicks = times.ticks[DESERIALIZE] + times.ticks[CALLBACKS];
+  metrics.processingTime.Observe(processingTicks /
+                                 KafkaInterface::TicksPerSecond());
+  if (0 != pArray.epicsTS.secPastEpoch or 0 != pArray.epicsTS.nsec) {
+    // Only meaningful if the clocks of the producer and this host agree
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    metrics.latency.Observe(
+        std::max(0.0, epicsTimeDiffInSeconds(&now, &pArray.epicsTS)));
+  }
+  if (stageTrace.PublishDue()) {
+    setParam(this, paramsList.at(PV::time_receive),
+             stageTrace.GetAverageUs(RECEIVE));
+    setParam(this, paramsList.at(PV::time_deserialize),
+             stageTrace.GetAverageUs(DESERIALIZE));
+    setParam(this, paramsList.at(PV::time_callbacks),
+             stageTrace.GetAverageUs(CALLBACKS));
+    setParam(this, paramsList.at(PV::time_total),
+             stageTrace.GetAverageUs(STAGES));
+  }
+}
+
+KafkaDriver::Metrics::Metrics(MetricsSet &set)
+    : arrays(set.AddCounter("adkafka_driver_arrays_total",
+                            "Arrays passed on to the plugins.")),
+      arrayBytes(set.AddCounter("adkafka_driver_array_bytes_total",
+                                "Bytes of array data passed on to the "
+                                "plugins.")),
+      messages(set.AddCounter("adkafka_driver_messages_total",
+                              "Messages received from the back-end.")),
+      messageBytes(set.AddCounter("adkafka_driver_message_bytes_total",
+                                  "Bytes of the messages received from the "
+                                  "back-end.")),
+      lostArrays(set.AddCounter("adkafka_driver_lost_arrays_total",
+                                "Arrays missing from the sequence which were "
+                                "not dropped by the producer.")),
+      skippedArrays(set.AddCounter("adkafka_driver_skipped_arrays_total",
+                                   "Arrays which could not be decoded.")),
+      checksumFailures(set.AddCounter("adkafka_driver_checksum_failures_total",
+                                      "Arrays discarded as their checksum did "
+                                      "not match.")),
+      processingTime(set.AddHistogram(
+          "adkafka_driver_processing_seconds",
+          "Time spent deserializing an array and in its callbacks.",
+          KafkaInterface::ExponentialBuckets(1e-5, 2, 21))),
+      latency(set.AddHistogram(
+          "adkafka_driver_latency_seconds",
+          "Time from the EPICS timestamp of an array to the end of its "
+          "callbacks.",
+          KafkaInterface::ExponentialBuckets(1e-4, 2, 18))),
+      brokers(set.AddGauge("adkafka_driver_kafka_brokers",
+                           "Brokers known to the consumer.")),
+      brokerUp(set.AddGauge("adkafka_driver_kafka_broker_up",
+                            "1 if the consumer is connected to a broker.")),
+      rttAvg(set.AddGauge("adkafka_driver_kafka_rtt_avg_seconds",
+                          "Largest average broker round trip time.")),
+      rttP99(set.AddGauge("adkafka_driver_kafka_rtt_p99_seconds",
+                          "Largest 99th percentile broker round trip time.")) {}
+
+void KafkaDriver::UpdateKafkaMetrics(KafkaStatistics const &stats) {
+  metrics.brokers.Set(stats.brokers);
+  metrics.brokerUp.Set(stats.brokerUp ? 1 : 0);
+  metrics.rttAvg.Set(stats.rttAvg / 1e6);
+  metrics.rttP99.Set(stats.rttP99 / 1e6);
+}
+
+bool KafkaDriver::StartMetrics(int port) {
+  auto server = MetricsServer::Get(port);
+  if (nullptr == server) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:StartMetrics: Unable to serve metrics on port %d.\n",
+              driverName, port);
+    return false;
+  }
+  if (nullptr != metricsServer) {
+    metricsServer->Remove(&metricsSet);
+  }
+  metricsServer = server;
+  metricsServer->Add(&metricsSet);
+  return true;
+}
+
 KafkaDriver::~KafkaDriver() {
+  if (nullptr != metricsServer) {
+    metricsServer->Remove(&metricsSet);
+  }
   keepThreadAlive = false;
   epicsEventSignal(startEventId_);
   epicsEventWait(threadExitEventId_);
@@ -424,9 +795,12 @@ KafkaDriver::~KafkaDriver() {
 extern "C" int KafkaDriverConfigure(const char *portName, int maxBuffers,
                                     size_t maxMemory, int priority,
                                     int stackSize, const char *brokerAddrStr,
-                                    const char *topicName) {
-  new KafkaDriver(portName, maxBuffers, maxMemory, priority, stackSize,
-                  brokerAddrStr, topicName);
+                                    const char *topicName, int metricsPort) {
+  auto *pDriver = new KafkaDriver(portName, maxBuffers, maxMemory, priority,
+                                  stackSize, brokerAddrStr, topicName);
+  if (metricsPort > 0) {
+    pDriver->StartMetrics(metricsPort);
+  }
 
   return (asynSuccess);
 }
@@ -439,18 +813,39 @@ static const iocshArg initArg3 = {"priority", iocshArgInt};
 static const iocshArg initArg4 = {"stackSize", iocshArgInt};
 static const iocshArg initArg5 = {"broker address", iocshArgString};
 static const iocshArg initArg6 = {"broker topic", iocshArgString};
+static const iocshArg initArg7 = {"metrics port", iocshArgInt};
 static const iocshArg *const initArgs[] = {&initArg0, &initArg1, &initArg2,
                                            &initArg3, &initArg4, &initArg5,
-                                           &initArg6};
-static const iocshFuncDef initFuncDef = {"KafkaDriverConfigure", 7, initArgs};
+                                           &initArg6, &initArg7};
+static const iocshFuncDef initFuncDef = {"KafkaDriverConfigure", 8, initArgs};
 
 static void initCallFunc(const iocshArgBuf *args) {
   KafkaDriverConfigure(args[0].sval, args[1].ival, args[2].ival, args[3].ival,
-                       args[4].ival, args[5].sval, args[6].sval);
+                       args[4].ival, args[5].sval, args[6].sval, args[7].ival);
+}
+
+// Also registered by the Kafka plugin, for both kinds of ports
+static const iocshArg dumpArg0 = {"portName", iocshArgString};
+static const iocshArg dumpArg1 = {"records", iocshArgInt};
+static const iocshArg *const dumpArgs[] = {&dumpArg0, &dumpArg1};
+static const iocshFuncDef dumpFuncDef = {"StageTraceDump", 2, dumpArgs};
+
+static void dumpCallFunc(const iocshArgBuf *args) {
+  std::string portName = nullptr == args[0].sval ? "" : args[0].sval;
+  size_t records = args[1].ival > 0 ? args[1].ival : 20;
+  if (not StageTrace::Dump(stdout, portName, records)) {
+    printf("No stage times for port \"%s\", available ports:",
+           portName.c_str());
+    for (auto const &name : StageTrace::GetNames()) {
+      printf(" %s", name.c_str());
+    }
+    printf("\n");
+  }
 }
 
 extern "C" void KafkaDriverReg(void) {
   iocshRegister(&initFuncDef, initCallFunc);
+  iocshRegister(&dumpFuncDef, dumpCallFunc);
 }
 
 extern "C" {
@@ -9,14 +9,36 @@
 
 #include <ADDriver.h>
 #include <atomic>
+#include <cstdint>
 #include <epicsEvent.h>
 #include <map>
+#include <memory>
 #include <string>
 
 #include "KafkaConsumer.h"
+#include "LocalTransport.h"
+#include "MetricsServer.h"
+#include "NDArrayBatch_schema_generated.h"
+#include "NDArrayDeSerializer.h"
 #include "ParamUtility.h"
+#include "Recording.h"
+#include "SegmentTransport.h"
+#include "StageTrace.h"
+#include "TileAssembler.h"
 
 using KafkaInterface::KafkaConsumer;
+using KafkaInterface::KafkaStatistics;
+using KafkaInterface::MetricCounter;
+using KafkaInterface::MetricGauge;
+using KafkaInterface::MetricHistogram;
+using KafkaInterface::MetricsServer;
+using KafkaInterface::MetricsSet;
+using KafkaInterface::RecordingConsumer;
+using KafkaInterface::StageTimes;
+using KafkaInterface::StageTrace;
+using KafkaInterface::TileAssembler;
+using KafkaInterface::TransportBackend;
+using KafkaInterface::TransportConsumer;
 
 /** @brief An EPICS areaDetector driver which consumes Kafka messages containing
  * NDArray data.
@@ -126,6 +148,13 @@ public:
    */
   virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
 
+  /** @brief Used to set floating point parameters of the driver.
+   * @param[in] pasynUser pasynUser structure that encodes the reason and
+   * address.
+   * @param[in] value New floating point value to use.
+   */
+  virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+
   /** @brief The thread function which does the heavy lifting in this driver.
    * This function uses an endless loop to consume NDArray messages. Should be
    * protected/private
@@ -137,7 +166,157 @@ public:
    */
   virtual void consumeTask();
 
+  /** @brief Exports the metrics of the driver in the Prometheus text format
+   * on http://127.0.0.1:<port>/metrics. Several plugins and drivers can
+   * share a port, their metrics are told apart by the port label.
+   * @param[in] port The TCP port to listen on.
+   * @return True on success, false if the port can not be listened on.
+   */
+  bool StartMetrics(int port);
+
 protected:
+  /** @brief Keeps track of the producer sequence numbers and dropped arrays
+   * count sent with every NDArray.
+   * Arrays missing from the sequence which were not dropped by the producer
+   * are counted as lost in transport, unless messages were discarded by the
+   * header filter since the last received array, in which case they are
+   * counted as filtered. As the producer may only count arrays dropped from
+   * its queue after the gap they left has been received, arrays counted as
+   * dropped without a gap reduce the lost arrays count. If the
+   * sequence number decreases (e.g. because the producer was restarted or
+   * the offset was changed), the counting starts over from the new sequence
+   * number.
+   * @param[in] sequenceNumber The producer sequence number of the received
+   * array. Messages from producers that do not set it (i.e. it is 0) are
+   * ignored.
+   * @param[in] droppedArrays The number of arrays dropped by the producer
+   * before the received array was serialized.
+   * @param[in] filteredMessages The number of messages discarded by the
+   * header filter before the received array.
+   */
+  void UpdateSequenceCounters(std::uint64_t sequenceNumber,
+                              std::uint64_t droppedArrays,
+                              std::uint64_t filteredMessages);
+
+  /** @brief Returns the next NDArray flatbuffer table to process.
+   * If the last received message was a batch of arrays (see
+   * FB_Tables::NDArrayBatch), the next array in that batch is returned.
+   * Otherwise a new message is consumed.
+   * @param[in] source The back-end to receive new messages from.
+   * @param[in] timeout Time to wait for a new message in ms.
+   * @return The next array or nullptr if no message was received (or if a
+   * received batch was empty). Only valid until the next call.
+   */
+  const FB_Tables::NDArray *GetNextArray(TransportConsumer &source,
+                                         int timeout);
+
+  /** @brief Replaces KafkaDriver::transport with the selected back-end.
+   * Must be called with the driver lock held.
+   */
+  void UpdateTransport();
+
+  /// @brief The last received message, kept while its arrays are processed.
+  std::unique_ptr<KafkaInterface::TransportMessage> currentMessage;
+
+  /// @brief Index of the next array to process if currentMessage is a batch.
+  flatbuffers::uoffset_t batchIndex{0};
+
+  /// @brief The last keyframe, used to reconstruct delta encoded arrays.
+  KeyframeReference keyframe;
+
+  /// @brief Number of delta encoded arrays skipped as their keyframe was not
+  /// available.
+  std::uint64_t skippedArrays{0};
+
+  /// @brief If true, the checksums of the received arrays are verified.
+  bool verifyChecksums{false};
+
+  /// @brief Number of arrays discarded as their checksum did not match.
+  std::uint64_t checksumFailures{0};
+
+  /// @brief If true, float16 and bfloat16 arrays are converted to float32.
+  bool widenFloats{true};
+
+  /// @brief Assembles the arrays sent as tiles.
+  TileAssembler tileAssembler;
+
+  /// @brief Sequence number of the last received NDArray.
+  std::uint64_t lastSequenceNumber{0};
+
+  /// @brief Producer dropped arrays count of the last received NDArray.
+  std::uint64_t lastDroppedArrays{0};
+
+  /// @brief Number of arrays missing from the sequence not dropped by the
+  /// producer.
+  std::uint64_t lostArrays{0};
+
+  /// @brief Header filter discarded messages count at the last received
+  /// NDArray.
+  std::uint64_t lastFilteredMessages{0};
+
+  /// @brief Number of arrays missing from the sequence as their messages
+  /// were discarded by the header filter.
+  std::uint64_t filteredArrays{0};
+
+  /// @brief The timed stages of KafkaDriver::consumeTask().
+  enum Stage {
+    /// @brief Receiving the message, including waiting for it.
+    RECEIVE,
+    /// @brief Deserializing the array (or assembling its tiles).
+    DESERIALIZE,
+    /// @brief Parameter updates and the NDArray callbacks to the plugins.
+    CALLBACKS,
+    /// @brief The number of stages.
+    STAGES,
+  };
+
+  /** @brief Adds the stage times of an array to KafkaDriver::stageTrace and
+   * publishes the moving averages once a second. Must be called with the
+   * driver lock held.
+   * @param[in] times The stage times of the array.
+   * @param[in] pArray The array.
+   */
+  void RecordStageTimes(StageTimes const &times, NDArray const &pArray);
+
+  /// @brief Times the stages of the arrays received, dumped by StageTraceDump.
+  StageTrace stageTrace;
+
+  /// @brief The metrics exported by KafkaDriver::StartMetrics().
+  struct Metrics {
+    /// @brief Adds the metrics to a set.
+    explicit Metrics(MetricsSet &set);
+    MetricCounter &arrays;
+    MetricCounter &arrayBytes;
+    MetricCounter &messages;
+    MetricCounter &messageBytes;
+    MetricCounter &lostArrays;
+    MetricCounter &skippedArrays;
+    MetricCounter &checksumFailures;
+    MetricHistogram &processingTime;
+    MetricHistogram &latency;
+    MetricGauge &brokers;
+    MetricGauge &brokerUp;
+    MetricGauge &rttAvg;
+    MetricGauge &rttP99;
+  };
+
+  /** @brief Updates the metrics taken from the librdkafka statistics.
+   * Called by the consumer while it waits for messages.
+   * @param[in] stats The latest statistics.
+   */
+  void UpdateKafkaMetrics(KafkaStatistics const &stats);
+
+  /** @brief The set of metrics of the driver. Declared before the consumer,
+   * which updates some of the metrics.
+   */
+  MetricsSet metricsSet;
+
+  /// @brief The metrics of KafkaDriver::metricsSet.
+  Metrics metrics;
+
+  /// @brief The server exporting the metrics, nullptr if they are not.
+  std::shared_ptr<MetricsServer> metricsServer;
+
   /** @brief Used to keep track of the lowest PV index in order to know which
    * write events should
    * be passed to the parent class.
@@ -148,6 +327,31 @@ protected:
    */
   KafkaConsumer consumer;
 
+  /// @brief The back-end selected to receive the serialized arrays.
+  TransportBackend backend{TransportBackend::KAFKA};
+
+  /** @brief The back-end the arrays are received through. Points to
+   * KafkaDriver::consumer (without owning it) when the Kafka back-end is
+   * selected. Protected by the driver lock. The consumer thread uses the
+   * back-end it had when the acquisition was started, a new back-end is used
+   * from the next acquisition.
+   */
+  std::shared_ptr<TransportConsumer> transport;
+
+  /// @brief Path to the segment file used by the segment file back-end.
+  std::string segmentPath;
+
+  /// @brief Path of the recording replayed by the recording back-end.
+  std::string recordingPath;
+
+  /** @brief The recording being replayed, also KafkaDriver::transport. Used
+   * for seeking, nullptr unless the recording back-end is selected.
+   */
+  std::shared_ptr<RecordingConsumer> recording;
+
+  /// @brief If true, the replay of a recording starts over at its end.
+  bool replayLoop{false};
+
   /// @brief Used to pass a start acquisition event from writeInt32 to the
   /// processing thread.
   epicsEventId startEventId_;
@@ -167,6 +371,28 @@ protected:
     kafka_group,
     stats_time,
     set_offset,
+    producer_dropped,
+    lost_arrays,
+    filtered_arrays,
+    header_filter,
+    skipped_arrays,
+    verify_checksum,
+    checksum_failures,
+    widen_floats,
+    tile_threads,
+    incomplete_frames,
+    backend_type,
+    segment_path,
+    recording_path,
+    replay_seek_frame,
+    replay_seek_time,
+    replay_loop,
+    replay_position,
+    replay_records,
+    time_receive,
+    time_deserialize,
+    time_callbacks,
+    time_total,
     count,
   };
 
@@ -183,11 +409,33 @@ protected:
 
   /// @brief The list of PV:s created by the driver and their definition.
   std::vector<PV_param> paramsList = {
-      PV_param("KAFKA_BROKER_ADDRESS", asynParamOctet), // kafka_addr
-      PV_param("KAFKA_TOPIC", asynParamOctet),          // kafka_topic
-      PV_param("KAFKA_GROUP", asynParamOctet),          // kafka_group
-      PV_param("KAFKA_STATS_INT_MS", asynParamInt32),   // stats_time
-      PV_param("KAFKA_SET_OFFSET", asynParamInt32),     // set_offset
+      PV_param("KAFKA_BROKER_ADDRESS", asynParamOctet),     // kafka_addr
+      PV_param("KAFKA_TOPIC", asynParamOctet),              // kafka_topic
+      PV_param("KAFKA_GROUP", asynParamOctet),              // kafka_group
+      PV_param("KAFKA_STATS_INT_MS", asynParamInt32),       // stats_time
+      PV_param("KAFKA_SET_OFFSET", asynParamInt32),         // set_offset
+      PV_param("KAFKA_PRODUCER_DROPPED", asynParamInt32),   // producer_dropped
+      PV_param("KAFKA_LOST_ARRAYS", asynParamInt32),        // lost_arrays
+      PV_param("KAFKA_FILTERED_ARRAYS", asynParamInt32),    // filtered_arrays
+      PV_param("KAFKA_HEADER_FILTER", asynParamOctet),      // header_filter
+      PV_param("KAFKA_SKIPPED_ARRAYS", asynParamInt32),     // skipped_arrays
+      PV_param("KAFKA_VERIFY_CHECKSUM", asynParamInt32),    // verify_checksum
+      PV_param("KAFKA_CHECKSUM_FAILURES", asynParamInt32),  // checksum_failures
+      PV_param("KAFKA_WIDEN_FLOATS", asynParamInt32),       // widen_floats
+      PV_param("KAFKA_TILE_THREADS", asynParamInt32),       // tile_threads
+      PV_param("KAFKA_INCOMPLETE_FRAMES", asynParamInt32),  // incomplete_frames
+      PV_param("KAFKA_BACKEND", asynParamInt32),            // backend_type
+      PV_param("KAFKA_SEGMENT_PATH", asynParamOctet),       // segment_path
+      PV_param("KAFKA_RECORDING_PATH", asynParamOctet),     // recording_path
+      PV_param("KAFKA_REPLAY_SEEK_FRAME", asynParamInt32),  // replay_seek_frame
+      PV_param("KAFKA_REPLAY_SEEK_TIME", asynParamFloat64), // replay_seek_time
+      PV_param("KAFKA_REPLAY_LOOP", asynParamInt32),        // replay_loop
+      PV_param("KAFKA_REPLAY_POSITION", asynParamInt32),    // replay_position
+      PV_param("KAFKA_REPLAY_RECORDS", asynParamInt32),     // replay_records
+      PV_param("KAFKA_TIME_RECEIVE", asynParamFloat64),     // time_receive
+      PV_param("KAFKA_TIME_DESERIALIZE", asynParamFloat64), // time_deserialize
+      PV_param("KAFKA_TIME_CALLBACKS", asynParamFloat64),   // time_callbacks
+      PV_param("KAFKA_TIME_TOTAL", asynParamFloat64),       // time_total
   };
 
   /// @brief The consumeTask() function will keep running as long as this
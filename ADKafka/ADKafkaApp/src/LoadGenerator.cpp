@@ -0,0 +1,502 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  LoadGenerator.cpp
+ *  @brief Implementation of an areaDetector driver generating synthetic
+ * NDArrays for stress testing plugins.
+ */
+
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+#include <chrono>
+#include <ciso646>
+#include <cstdint>
+#include <epicsExport.h>
+#include <random>
+#include <string>
+#include "LoadGenerator.h"
+
+static const char *driverName = "LoadGenerator";
+
+namespace {
+/// @brief Largest value of the patterns, fits all data types.
+const std::uint32_t patternMax = 250;
+
+/// @brief Resolution of the sparsity.
+const std::uint32_t sparsitySteps = 10000;
+
+/** @brief Shortest time over which the achieved rate is measured (in s), a
+ * shorter one would give meaningless rates, e.g. for a single array.
+ */
+const double rateWindow = 1.0;
+
+template <typename T>
+void FillPatternT(T *data, size_t elements, LoadGenerator::Pattern pattern,
+                  double sparsity) {
+  // A fixed seed gives the same arrays every time
+  std::minstd_rand generator(1);
+  auto zeroLimit = static_cast<std::uint32_t>(sparsity * sparsitySteps);
+  for (size_t i = 0; i < elements; i++) {
+    std::uint32_t random = generator();
+    if (random % sparsitySteps < zeroLimit) {
+      data[i] = 0;
+    } else if (LoadGenerator::Pattern::NOISE == pattern) {
+      data[i] = static_cast<T>(1 + (random >> 16) % patternMax);
+    } else {
+      data[i] = static_cast<T>(1 + i % patternMax);
+    }
+  }
+}
+} // namespace
+
+void LoadGenerator::FillPattern(NDDataType_t dataType, void *data,
+                                size_t elements, Pattern pattern,
+                                double sparsity) {
+  switch (dataType) {
+  case NDInt8:
+    FillPatternT(reinterpret_cast<epicsInt8 *>(data), elements, pattern,
+                 sparsity);
+    break;
+  case NDUInt8:
+    FillPatternT(reinterpret_cast<epicsUInt8 *>(data), elements, pattern,
+                 sparsity);
+    break;
+  case NDInt16:
+    FillPatternT(reinterpret_cast<epicsInt16 *>(data), elements, pattern,
+                 sparsity);
+    break;
+  case NDUInt16:
+    FillPatternT(reinterpret_cast<epicsUInt16 *>(data), elements, pattern,
+                 sparsity);
+    break;
+  case NDInt32:
+    FillPatternT(reinterpret_cast<epicsInt32 *>(data), elements, pattern,
+                 sparsity);
+    break;
+  case NDUInt32:
+    FillPatternT(reinterpret_cast<epicsUInt32 *>(data), elements, pattern,
+                 sparsity);
+    break;
+  case NDFloat32:
+    FillPatternT(reinterpret_cast<epicsFloat32 *>(data), elements, pattern,
+                 sparsity);
+    break;
+  case NDFloat64:
+    FillPatternT(reinterpret_cast<epicsFloat64 *>(data), elements, pattern,
+                 sparsity);
+    break;
+  default:
+    break;
+  }
+}
+
+bool LoadGenerator::PrepareBuffers() {
+  ReleaseBuffers();
+  int sizeX, sizeY, dataType;
+  getIntegerParam(ADSizeX, &sizeX);
+  getIntegerParam(ADSizeY, &sizeY);
+  getIntegerParam(NDDataType, &dataType);
+  size_t dims[] = {static_cast<size_t>(sizeX), static_cast<size_t>(sizeY)};
+  NDArrayInfo_t arrayInfo;
+  for (int i = 0; i < bufferCount; i++) {
+    NDArray *pArray = pNDArrayPool->alloc(
+        2, dims, static_cast<NDDataType_t>(dataType), 0, nullptr);
+    if (nullptr == pArray) {
+      ReleaseBuffers();
+      return false;
+    }
+    buffers.push_back(pArray);
+    pArray->getInfo(&arrayInfo);
+    FillPattern(pArray->dataType, pArray->pData, arrayInfo.nElements, pattern,
+                sparsity);
+    pArray->pAttributeList->clear();
+    for (int j = 0; j < attributeCount; j++) {
+      std::string name = "LoadGenerator" + std::to_string(j);
+      epicsFloat64 value = j;
+      pArray->pAttributeList->add(name.c_str(), "Generated attribute",
+                                  NDAttrFloat64, &value);
+    }
+  }
+  setIntegerParam(NDArraySizeX, sizeX);
+  setIntegerParam(NDArraySizeY, sizeY);
+  setIntegerParam(NDArraySize, static_cast<int>(arrayInfo.totalBytes));
+  nextBuffer = 0;
+  buffersOutdated = false;
+  return true;
+}
+
+void LoadGenerator::ReleaseBuffers() {
+  // Buffers still used by plugins are returned to the pool by the plugins
+  for (auto pArray : buffers) {
+    pArray->release();
+  }
+  buffers.clear();
+}
+
+NDArray *LoadGenerator::GetFreeBuffer() {
+  for (size_t i = 0; i < buffers.size(); i++) {
+    size_t index = (nextBuffer + i) % buffers.size();
+    // Only the reference held by the driver is left
+    if (1 == buffers[index]->getReferenceCount()) {
+      nextBuffer = (index + 1) % buffers.size();
+      return buffers[index];
+    }
+  }
+  return nullptr;
+}
+
+asynStatus LoadGenerator::writeInt32(asynUser *pasynUser, epicsInt32 value) {
+  int function = pasynUser->reason;
+  int acquiring;
+  asynStatus status = asynSuccess;
+
+  getIntegerParam(ADAcquire, &acquiring);
+  int oldValue;
+  getIntegerParam(function, &oldValue);
+
+  /* Set the parameter and readback in the parameter library. */
+  setIntegerParam(function, value);
+
+  if (function == ADAcquire) {
+    if (value != 0 and acquiring == 0) {
+      setIntegerParam(ADStatus, ADStatusAcquire);
+      epicsEventSignal(startEventId_);
+    }
+    if (value == 0 and acquiring != 0) {
+      epicsEventSignal(stopEventId_);
+    }
+  } else if (function == ADSizeX or function == ADSizeY) {
+    int maxSize;
+    getIntegerParam(function == ADSizeX ? ADMaxSizeX : ADMaxSizeY, &maxSize);
+    if (value < 1 or value > maxSize) {
+      setIntegerParam(function, oldValue);
+    }
+    buffersOutdated = true;
+  } else if (function == NDDataType) {
+    if (value < NDInt8 or value > NDFloat64) {
+      setIntegerParam(function, oldValue);
+    }
+    buffersOutdated = true;
+  } else if (function == *paramsList[PV::attributes].index) {
+    if (value < 0) {
+      setIntegerParam(function, oldValue);
+    } else {
+      attributeCount = value;
+      buffersOutdated = true;
+    }
+  } else if (function == *paramsList[PV::data_pattern].index) {
+    if (static_cast<int>(Pattern::RAMP) != value and
+        static_cast<int>(Pattern::NOISE) != value) {
+      setIntegerParam(function, oldValue);
+    } else {
+      pattern = static_cast<Pattern>(value);
+      buffersOutdated = true;
+    }
+  } else if (function == *paramsList[PV::buffer_count].index) {
+    if (value < 1) {
+      setIntegerParam(function, oldValue);
+    } else {
+      bufferCount = value;
+      buffersOutdated = true;
+    }
+  } else if (function < MIN_PARAM_INDEX) {
+    /* If this parameter belongs to a base class call its method */
+    status = ADDriver::writeInt32(pasynUser, value);
+  }
+
+  /* Do callbacks so higher layers see any changes */
+  callParamCallbacks();
+
+  if (status != 0) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:writeInt32 error, status=%d function=%d, value=%d\n",
+              driverName, status, function, value);
+  } else {
+    asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:writeInt32: function=%d, value=%d\n", driverName, function,
+              value);
+  }
+  return status;
+}
+
+asynStatus LoadGenerator::writeFloat64(asynUser *pasynUser,
+                                       epicsFloat64 value) {
+  const int function{pasynUser->reason};
+  asynStatus status{asynSuccess};
+
+  /* Set the parameter in the parameter library. */
+  setDoubleParam(function, value);
+
+  if (function == *paramsList[PV::sparsity_fraction].index) {
+    if (value < 0.0 or value > 1.0) {
+      setDoubleParam(function, sparsity);
+    } else {
+      sparsity = value;
+      buffersOutdated = true;
+    }
+  } else if (function < MIN_PARAM_INDEX) {
+    /* If this parameter belongs to a base class call its method */
+    status = ADDriver::writeFloat64(pasynUser, value);
+  }
+
+  /* Do callbacks so higher layers see any changes */
+  callParamCallbacks();
+
+  if (status != 0) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:writeFloat64 error, status=%d function=%d, value=%f\n",
+              driverName, status, function, value);
+  } else {
+    asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:writeFloat64: function=%d, value=%f\n", driverName,
+              function, value);
+  }
+  return status;
+}
+
+static void generateTaskC(void *drvPvt) {
+  auto *pPvt = reinterpret_cast<LoadGenerator *>(drvPvt);
+
+  pPvt->generateTask();
+}
+
+LoadGenerator::LoadGenerator(const char *portName, int maxSizeX, int maxSizeY,
+                             int maxBuffers, size_t maxMemory, int priority,
+                             int stackSize)
+    // Invoke the base class constructor
+    : ADDriver(portName, 1, PV::count, maxBuffers, maxMemory, 0,
+               0,    /* No interfaces beyond those set in ADDriver.cpp */
+               0, 1, /* ASYN_CANBLOCK=0, ASYN_MULTIDEVICE=0, autoConnect=1 */
+               priority, stackSize) {
+  const char *functionName = "LoadGenerator";
+  int status{asynStatus::asynSuccess};
+  startEventId_ = epicsEventCreate(epicsEventEmpty);
+  stopEventId_ = epicsEventCreate(epicsEventEmpty);
+  threadExitEventId_ = epicsEventCreate(epicsEventEmpty);
+  if (startEventId_ == nullptr or stopEventId_ == nullptr or
+      threadExitEventId_ == nullptr) {
+    printf("%s:%s epicsEventCreate failure\n", driverName, functionName);
+    return;
+  }
+
+  MIN_PARAM_INDEX = InitPvParams(this, paramsList);
+
+  status |= setStringParam(ADManufacturer, "European Spallation Source");
+  status |= setStringParam(ADModel, "Load generator");
+  status |= setIntegerParam(ADMaxSizeX, maxSizeX);
+  status |= setIntegerParam(ADMaxSizeY, maxSizeY);
+  status |= setIntegerParam(ADSizeX, maxSizeX);
+  status |= setIntegerParam(ADSizeY, maxSizeY);
+  status |= setIntegerParam(NDDataType, NDUInt16);
+  status |= setIntegerParam(ADImageMode, ADImageContinuous);
+  status |= setIntegerParam(ADNumImages, 100);
+  status |= setDoubleParam(ADAcquirePeriod, 0.01);
+  status |= setParam(this, paramsList.at(PV::attributes), attributeCount);
+  status |= setParam(this, paramsList.at(PV::sparsity_fraction), sparsity);
+  status |= setParam(this, paramsList.at(PV::data_pattern),
+                     static_cast<int>(pattern));
+  status |= setParam(this, paramsList.at(PV::buffer_count), bufferCount);
+  status |= setParam(this, paramsList.at(PV::busy_skipped), 0);
+  status |= setParam(this, paramsList.at(PV::achieved_rate), 0.0);
+
+  // Array callbacks are required to send data to plugins
+  setIntegerParam(NDArrayCallbacks, 1);
+
+  if (status != 0) {
+    printf("%s: unable to set driver parameters\n", functionName);
+    return;
+  }
+
+  auto CreateThreadSuccess =
+      (epicsThreadCreate("LoadGeneratorTask", epicsThreadPriorityHigh,
+                         epicsThreadGetStackSize(epicsThreadStackMedium),
+                         reinterpret_cast<EPICSTHREADFUNC>(generateTaskC),
+                         this) != nullptr);
+  if (not CreateThreadSuccess) {
+    printf("%s:%s epicsThreadCreate failure for generator task\n",
+           driverName, functionName);
+    return;
+  }
+}
+
+LoadGenerator::~LoadGenerator() {
+  keepThreadAlive = false;
+  epicsEventSignal(startEventId_);
+  epicsEventSignal(stopEventId_);
+  epicsEventWait(threadExitEventId_);
+
+  this->lock();
+  ReleaseBuffers();
+  this->unlock();
+
+  epicsEventDestroy(startEventId_);
+  epicsEventDestroy(stopEventId_);
+  epicsEventDestroy(threadExitEventId_);
+}
+
+void LoadGenerator::generateTask() {
+  using Clock = std::chrono::steady_clock;
+  int acquire{0};
+  int imageMode, numImages, numImagesCounter;
+  int arrayCounter, arrayCallbacks;
+  double acquirePeriod;
+  const char *functionName = "generateTask";
+  // The arrays are sent at fixed times, not a fixed time after each other
+  Clock::time_point nextArrayTime;
+  // Start of the current rate measurement
+  Clock::time_point rateStart;
+  int rateArrays{0};
+  this->lock();
+  while (keepThreadAlive) {
+    if (acquire == 0) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                "%s:%s: waiting for acquire to start\n", driverName,
+                functionName);
+      this->unlock();
+      epicsEventWait(startEventId_);
+      this->lock();
+      if (not keepThreadAlive) {
+        break;
+      }
+      // A stop requested while idle does not apply to this acquisition
+      epicsEventTryWait(stopEventId_);
+      acquire = 1;
+      setStringParam(ADStatusMessage, "Generating arrays");
+      setIntegerParam(ADNumImagesCounter, 0);
+      setIntegerParam(ADStatus, ADStatusAcquire);
+      nextArrayTime = Clock::now();
+      rateStart = nextArrayTime;
+      rateArrays = 0;
+    }
+
+    if (buffersOutdated and not PrepareBuffers()) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: unable to allocate the arrays\n", driverName,
+                functionName);
+      acquire = 0;
+      setIntegerParam(ADAcquire, 0);
+      setIntegerParam(ADStatus, ADStatusError);
+      setStringParam(ADStatusMessage, "Unable to allocate the arrays");
+      callParamCallbacks();
+      continue;
+    }
+
+    NDArray *pImage = GetFreeBuffer();
+    if (nullptr == pImage) {
+      ++busySkipped;
+      setParam(this, paramsList.at(PV::busy_skipped),
+               static_cast<int>(busySkipped));
+    } else {
+      getIntegerParam(NDArrayCounter, &arrayCounter);
+      ++arrayCounter;
+      setIntegerParam(NDArrayCounter, arrayCounter);
+      getIntegerParam(ADNumImagesCounter, &numImagesCounter);
+      ++numImagesCounter;
+      setIntegerParam(ADNumImagesCounter, numImagesCounter);
+
+      pImage->uniqueId = arrayCounter;
+      epicsTimeGetCurrent(&pImage->epicsTS);
+      pImage->timeStamp =
+          pImage->epicsTS.secPastEpoch + pImage->epicsTS.nsec / 1.e9;
+
+      getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+      if (arrayCallbacks != 0) {
+        /* Must release the lock here, or we can get into a deadlock, because
+         * we can block on the plugin lock, and the plugin can be calling us */
+        this->unlock();
+        doCallbacksGenericPointer(pImage, NDArrayData, 0);
+        this->lock();
+      }
+      ++rateArrays;
+
+      getIntegerParam(ADImageMode, &imageMode);
+      getIntegerParam(ADNumImages, &numImages);
+      if (imageMode == ADImageSingle or
+          (imageMode == ADImageMultiple and numImagesCounter >= numImages)) {
+        acquire = 0;
+        setIntegerParam(ADAcquire, 0);
+        setIntegerParam(ADStatus, ADStatusIdle);
+        setStringParam(ADStatusMessage, "Waiting for acquisition");
+      }
+    }
+
+    auto now = Clock::now();
+    std::chrono::duration<double> rateTime = now - rateStart;
+    if (rateTime.count() >= rateWindow) {
+      setParam(this, paramsList.at(PV::achieved_rate),
+               rateArrays / rateTime.count());
+      rateStart = now;
+      rateArrays = 0;
+    }
+    callParamCallbacks();
+
+    if (acquire != 0) {
+      getDoubleParam(ADAcquirePeriod, &acquirePeriod);
+      nextArrayTime += std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(acquirePeriod));
+      // Do not try to catch up after falling behind by more than a period
+      if (nextArrayTime < now - std::chrono::duration_cast<Clock::duration>(
+                                    std::chrono::duration<double>(
+                                        acquirePeriod))) {
+        nextArrayTime = now;
+      }
+      std::chrono::duration<double> delay = nextArrayTime - now;
+      this->unlock();
+      auto stopStatus = delay.count() > 0.0
+                            ? epicsEventWaitWithTimeout(stopEventId_,
+                                                        delay.count())
+                            : epicsEventTryWait(stopEventId_);
+      this->lock();
+      if (stopStatus == epicsEventWaitOK) {
+        acquire = 0;
+        setIntegerParam(ADStatus, ADStatusIdle);
+        setStringParam(ADStatusMessage, "Waiting for acquisition");
+        callParamCallbacks();
+      }
+    }
+  }
+  this->unlock();
+  epicsEventSignal(threadExitEventId_);
+}
+
+// Configuration routine.  Called directly, or from the iocsh function
+extern "C" int LoadGeneratorConfigure(const char *portName, int maxSizeX,
+                                      int maxSizeY, int maxBuffers,
+                                      size_t maxMemory, int priority,
+                                      int stackSize) {
+  new LoadGenerator(portName, maxSizeX, maxSizeY, maxBuffers, maxMemory,
+                    priority, stackSize);
+
+  return (asynSuccess);
+}
+
+// EPICS iocsh shell commands
+static const iocshArg initArg0 = {"portName", iocshArgString};
+static const iocshArg initArg1 = {"maxSizeX", iocshArgInt};
+static const iocshArg initArg2 = {"maxSizeY", iocshArgInt};
+static const iocshArg initArg3 = {"maxBuffers", iocshArgInt};
+static const iocshArg initArg4 = {"maxMemory", iocshArgInt};
+static const iocshArg initArg5 = {"priority", iocshArgInt};
+static const iocshArg initArg6 = {"stackSize", iocshArgInt};
+static const iocshArg *const initArgs[] = {&initArg0, &initArg1, &initArg2,
+                                           &initArg3, &initArg4, &initArg5,
+                                           &initArg6};
+static const iocshFuncDef initFuncDef = {"LoadGeneratorConfigure", 7,
+                                         initArgs};
+
+static void initCallFunc(const iocshArgBuf *args) {
+  LoadGeneratorConfigure(args[0].sval, args[1].ival, args[2].ival,
+                         args[3].ival, args[4].ival, args[5].ival,
+                         args[6].ival);
+}
+
+extern "C" void LoadGeneratorReg(void) {
+  iocshRegister(&initFuncDef, initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(LoadGeneratorReg);
+}
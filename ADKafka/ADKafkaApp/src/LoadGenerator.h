@@ -0,0 +1,165 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  LoadGenerator.h
+ *  @brief Header file of an areaDetector driver generating synthetic NDArrays
+ * for stress testing plugins.
+ */
+
+#pragma once
+
+#include <ADDriver.h>
+#include <atomic>
+#include <cstdint>
+#include <epicsEvent.h>
+#include <vector>
+
+#include "ParamUtility.h"
+
+/** @brief An EPICS areaDetector driver which generates synthetic NDArrays at a
+ * configurable rate, e.g. for finding the highest rate a Kafka plugin can
+ * handle.
+ * The arrays are generated once, when the acquisition is started or their
+ * settings change, into a small set of buffers allocated from the NDArrayPool
+ * of the driver. The buffers are then passed to the plugins over and over,
+ * only updating their unique id and timestamps, so that generating an array
+ * takes almost no time. A buffer is only re-used once all plugins have
+ * released it. If all buffers are still in use, the array is skipped and
+ * counted (see LoadGenerator::PV::busy_skipped).
+ *
+ * The size and data type of the arrays, the acquisition period (i.e. the
+ * rate) and the image mode are set with the standard ADDriver parameters.
+ */
+class epicsShareClass LoadGenerator : public ADDriver {
+public:
+  /** @brief Creates the driver and starts the thread generating the arrays.
+   * @param[in] portName Name of the asyn port driver to be created.
+   * @param[in] maxSizeX Maximum width of the arrays.
+   * @param[in] maxSizeY Maximum height of the arrays.
+   * @param[in] maxBuffers The maximum number of NDArray buffers that the
+   * NDArrayPool of the driver will allocate, 0 for no limit.
+   * @param[in] maxMemory The maximum amount of memory (in bytes) that the
+   * NDArrayPool of the driver will allocate, 0 for no limit.
+   * @param[in] priority The thread priority for the asyn port driver thread.
+   * @param[in] stackSize The stack size for the asyn port driver thread.
+   */
+  LoadGenerator(const char *portName, int maxSizeX, int maxSizeY,
+                int maxBuffers, size_t maxMemory, int priority,
+                int stackSize);
+
+  /// @brief Stops the thread generating the arrays and releases the buffers.
+  ~LoadGenerator();
+
+  /** @brief Starts and stops the acquisition and applies new array settings.
+   * @param[in] pasynUser Specifies the parameter.
+   * @param[in] value The new value.
+   * @return asynSuccess on success, asynError otherwise.
+   */
+  virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+
+  /** @brief Applies a new sparsity.
+   * @param[in] pasynUser Specifies the parameter.
+   * @param[in] value The new value.
+   * @return asynSuccess on success, asynError otherwise.
+   */
+  virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+
+  /// @brief Generates the arrays while an acquisition is running.
+  virtual void generateTask();
+
+  /// @brief Values of the data pattern.
+  enum class Pattern {
+    RAMP = 0,
+    NOISE = 1,
+  };
+
+protected:
+  /** @brief Fills array data with a pattern.
+   * @param[in] dataType Data type of the elements.
+   * @param[out] data The elements to fill.
+   * @param[in] elements Number of elements.
+   * @param[in] pattern Pattern of the non-zero elements. A ramp of 1, 2, 3,
+   * etc. that restarts after 250 elements or (seeded, so always the same)
+   * pseudo-random values in the range 1 to 250.
+   * @param[in] sparsity The fraction of elements which are set to 0, from 0.0
+   * to 1.0. Spread pseudo-randomly over the array.
+   */
+  static void FillPattern(NDDataType_t dataType, void *data, size_t elements,
+                          Pattern pattern, double sparsity);
+
+  /** @brief Releases the buffers and allocates and fills new ones using the
+   * current settings. Must be called with the driver lock held.
+   * @return True on success, false if the buffers could not be allocated.
+   */
+  bool PrepareBuffers();
+
+  /// @brief Releases the buffers. Must be called with the driver lock held.
+  void ReleaseBuffers();
+
+  /** @brief Returns the next buffer which is not in use by any plugin, or
+   * nullptr if all buffers are in use. Must be called with the driver lock
+   * held.
+   */
+  NDArray *GetFreeBuffer();
+
+  /// @brief The buffers passed to the plugins, each holding one reference.
+  std::vector<NDArray *> buffers;
+
+  /// @brief Index of the buffer to try first for the next array.
+  size_t nextBuffer{0};
+
+  /// @brief Set when a setting changes, the buffers are then re-created.
+  bool buffersOutdated{true};
+
+  /// @brief Number of attributes added to every array.
+  int attributeCount{0};
+
+  /// @brief Fraction of elements set to 0.
+  double sparsity{0.0};
+
+  /// @brief Pattern of the non-zero elements.
+  Pattern pattern{Pattern::RAMP};
+
+  /// @brief Number of buffers that are passed to the plugins in turn.
+  int bufferCount{8};
+
+  /// @brief Number of arrays skipped as all buffers were in use.
+  std::uint64_t busySkipped{0};
+
+  /// @brief Used to pass a start acquisition event from writeInt32 to the
+  /// generating thread.
+  epicsEventId startEventId_;
+
+  /// @brief Used to pass a stop acquisition event from writeInt32 to the
+  /// generating thread.
+  epicsEventId stopEventId_;
+
+  /// @brief Signalled by the generating thread when it exits.
+  epicsEventId threadExitEventId_;
+
+  /// @brief Set to false to make the generating thread exit.
+  std::atomic_bool keepThreadAlive{true};
+
+  /// @brief Lowest index of the parameters of this class.
+  int MIN_PARAM_INDEX;
+
+  /// @brief Used to keep track of the PV:s made available by this driver.
+  enum PV {
+    attributes,
+    sparsity_fraction,
+    data_pattern,
+    buffer_count,
+    busy_skipped,
+    achieved_rate,
+    count,
+  };
+
+  /// @brief The list of PV:s created by the driver and their definition.
+  std::vector<PV_param> paramsList = {
+      PV_param("LOADGEN_ATTRIBUTES", asynParamInt32),      // attributes
+      PV_param("LOADGEN_SPARSITY", asynParamFloat64),      // sparsity_fraction
+      PV_param("LOADGEN_PATTERN", asynParamInt32),         // data_pattern
+      PV_param("LOADGEN_BUFFERS", asynParamInt32),         // buffer_count
+      PV_param("LOADGEN_BUSY_SKIPPED", asynParamInt32),    // busy_skipped
+      PV_param("LOADGEN_ACHIEVED_RATE", asynParamFloat64), // achieved_rate
+  };
+};
@@ -0,0 +1,166 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  LocalTransport.cpp
+ *  @brief Implementation of the back-end which passes messages from a plugin
+ * to a driver in the same IOC through a lock-free queue.
+ */
+
+#include "LocalTransport.h"
+#include "SharedRegistry.h"
+#include <chrono>
+#include <ciso646>
+#include <map>
+
+namespace KafkaInterface {
+
+namespace {
+/// @brief The channels of the IOC, shared by the plugins and the drivers.
+struct LocalChannels {
+  std::mutex mutex;
+  std::map<std::string, std::weak_ptr<LocalChannel>> channels;
+};
+} // namespace
+
+LocalMessage::LocalMessage(const unsigned char *buffer, size_t size,
+                           std::int64_t timestamp)
+    : data(buffer, buffer + size), timestamp(timestamp) {}
+
+void *LocalMessage::GetDataPtr() { return data.data(); }
+
+size_t LocalMessage::size() { return data.size(); }
+
+std::int64_t LocalMessage::GetTimestamp() const { return timestamp; }
+
+const size_t LocalChannel::defaultCapacity;
+
+LocalChannel::LocalChannel(size_t capacity) {
+  size_t cellCount = 2;
+  while (cellCount < capacity) {
+    cellCount *= 2;
+  }
+  cells.reset(new Cell[cellCount]);
+  mask = cellCount - 1;
+  for (size_t i = 0; i < cellCount; i++) {
+    cells[i].sequence.store(i, std::memory_order_relaxed);
+    cells[i].message = nullptr;
+  }
+}
+
+LocalChannel::~LocalChannel() {
+  for (size_t i = 0; i <= mask; i++) {
+    delete cells[i].message;
+  }
+}
+
+std::shared_ptr<LocalChannel> LocalChannel::Get(std::string const &name) {
+  auto &registry = SharedInstance<LocalChannels>("KafkaLocalChannels");
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto channel = registry.channels[name].lock();
+  if (nullptr == channel) {
+    channel = std::make_shared<LocalChannel>(defaultCapacity);
+    registry.channels[name] = channel;
+  }
+  return channel;
+}
+
+bool LocalChannel::Push(std::unique_ptr<LocalMessage> &message) {
+  size_t position = enqueuePosition.load(std::memory_order_relaxed);
+  Cell *cell;
+  while (true) {
+    cell = &cells[position & mask];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    auto difference =
+        static_cast<std::ptrdiff_t>(sequence) -
+        static_cast<std::ptrdiff_t>(position);
+    if (0 == difference) {
+      if (enqueuePosition.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (difference < 0) {
+      return false;
+    } else {
+      position = enqueuePosition.load(std::memory_order_relaxed);
+    }
+  }
+  cell->message = message.release();
+  cell->sequence.store(position + 1, std::memory_order_release);
+  // Either a waiting consumer sees the message or we see the consumer
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting.load() > 0) {
+    std::lock_guard<std::mutex> lock(waitMutex);
+    waitCondition.notify_all();
+  }
+  return true;
+}
+
+std::unique_ptr<LocalMessage> LocalChannel::TryPop() {
+  size_t position = dequeuePosition.load(std::memory_order_relaxed);
+  Cell *cell;
+  while (true) {
+    cell = &cells[position & mask];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    auto difference =
+        static_cast<std::ptrdiff_t>(sequence) -
+        static_cast<std::ptrdiff_t>(position + 1);
+    if (0 == difference) {
+      if (dequeuePosition.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (difference < 0) {
+      return nullptr;
+    } else {
+      position = dequeuePosition.load(std::memory_order_relaxed);
+    }
+  }
+  std::unique_ptr<LocalMessage> message(cell->message);
+  cell->message = nullptr;
+  cell->sequence.store(position + mask + 1, std::memory_order_release);
+  return message;
+}
+
+std::unique_ptr<LocalMessage> LocalChannel::Pop(int timeout) {
+  auto message = TryPop();
+  if (nullptr != message or timeout <= 0) {
+    return message;
+  }
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  std::unique_lock<std::mutex> lock(waitMutex);
+  ++waiting;
+  waitCondition.wait_until(lock, deadline, [this, &message]() {
+    message = TryPop();
+    return nullptr != message;
+  });
+  --waiting;
+  return message;
+}
+
+size_t LocalChannel::GetCapacity() const { return mask + 1; }
+
+LocalProducer::LocalProducer(std::string const &channelName)
+    : channel(LocalChannel::Get(channelName)) {}
+
+bool LocalProducer::SendMessage(const unsigned char *buffer, size_t size,
+                                std::int64_t timestamp, MessageHeaders const &,
+                                std::uint64_t) {
+  std::unique_ptr<LocalMessage> message(
+      new LocalMessage(buffer, size, timestamp));
+  return channel->Push(message);
+}
+
+LocalConsumer::LocalConsumer(std::string const &channelName)
+    : channel(LocalChannel::Get(channelName)) {}
+
+std::unique_ptr<TransportMessage> LocalConsumer::ReceiveMessage(int timeout) {
+  if (not consuming) {
+    return nullptr;
+  }
+  return channel->Pop(timeout);
+}
+
+void LocalConsumer::StartConsumption() { consuming = true; }
+
+void LocalConsumer::StopConsumption() { consuming = false; }
+} // namespace KafkaInterface
@@ -0,0 +1,107 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_NDARRAYBATCHSCHEMA_FB_TABLES_H_
+#define FLATBUFFERS_GENERATED_NDARRAYBATCHSCHEMA_FB_TABLES_H_
+
+#include "flatbuffers.h"
+
+#include "NDArray_schema_generated.h"
+
+namespace FB_Tables {
+
+struct NDArrayBatch;
+
+struct NDArrayBatch FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum FlatBuffersVTableOffset FLATBUFFERS_VTABLE_UNDERLYING_TYPE {
+    VT_ARRAYS = 4
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<NDArray>> *arrays() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<NDArray>> *>(VT_ARRAYS);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_ARRAYS) &&
+           verifier.VerifyVector(arrays()) &&
+           verifier.VerifyVectorOfTables(arrays()) &&
+           verifier.EndTable();
+  }
+};
+
+struct NDArrayBatchBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_arrays(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<NDArray>>> arrays) {
+    fbb_.AddOffset(NDArrayBatch::VT_ARRAYS, arrays);
+  }
+  explicit NDArrayBatchBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  NDArrayBatchBuilder &operator=(const NDArrayBatchBuilder &);
+  flatbuffers::Offset<NDArrayBatch> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<NDArrayBatch>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<NDArrayBatch> CreateNDArrayBatch(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<NDArray>>> arrays = 0) {
+  NDArrayBatchBuilder builder_(_fbb);
+  builder_.add_arrays(arrays);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<NDArrayBatch> CreateNDArrayBatchDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<NDArray>> *arrays = nullptr) {
+  auto arrays__ = arrays ? _fbb.CreateVector<flatbuffers::Offset<NDArray>>(*arrays) : 0;
+  return FB_Tables::CreateNDArrayBatch(
+      _fbb,
+      arrays__);
+}
+
+inline const FB_Tables::NDArrayBatch *GetNDArrayBatch(const void *buf) {
+  return flatbuffers::GetRoot<FB_Tables::NDArrayBatch>(buf);
+}
+
+inline const FB_Tables::NDArrayBatch *GetSizePrefixedNDArrayBatch(const void *buf) {
+  return flatbuffers::GetSizePrefixedRoot<FB_Tables::NDArrayBatch>(buf);
+}
+
+inline const char *NDArrayBatchIdentifier() {
+  return "NDAb";
+}
+
+inline bool NDArrayBatchBufferHasIdentifier(const void *buf) {
+  return flatbuffers::BufferHasIdentifier(
+      buf, NDArrayBatchIdentifier());
+}
+
+inline bool VerifyNDArrayBatchBuffer(
+    flatbuffers::Verifier &verifier) {
+  return verifier.VerifyBuffer<FB_Tables::NDArrayBatch>(NDArrayBatchIdentifier());
+}
+
+inline bool VerifySizePrefixedNDArrayBatchBuffer(
+    flatbuffers::Verifier &verifier) {
+  return verifier.VerifySizePrefixedBuffer<FB_Tables::NDArrayBatch>(NDArrayBatchIdentifier());
+}
+
+inline void FinishNDArrayBatchBuffer(
+    flatbuffers::FlatBufferBuilder &fbb,
+    flatbuffers::Offset<FB_Tables::NDArrayBatch> root) {
+  fbb.Finish(root, NDArrayBatchIdentifier());
+}
+
+inline void FinishSizePrefixedNDArrayBatchBuffer(
+    flatbuffers::FlatBufferBuilder &fbb,
+    flatbuffers::Offset<FB_Tables::NDArrayBatch> root) {
+  fbb.FinishSizePrefixed(root, NDArrayBatchIdentifier());
+}
+
+}  // namespace FB_Tables
+
+#endif  // FLATBUFFERS_GENERATED_NDARRAYBATCHSCHEMA_FB_TABLES_H_
@@ -6,6 +6,10 @@
  */
 
 #include "NDArrayDeSerializer.h"
+#include "BitPacking.h"
+#include "Crc32c.h"
+#include "FloatConversion.h"
+#include <algorithm>
 #include <cassert>
 #include <ciso646>
 #include <cstdlib>
@@ -29,6 +33,10 @@ NDDataType_t GetND_DType(FB_Tables::DType arrType) {
     return NDFloat32;
   case FB_Tables::DType::DType_float64:
     return NDFloat64;
+  case FB_Tables::DType::DType_float16:
+  case FB_Tables::DType::DType_bfloat16:
+    // The raw 16 bit values
+    return NDUInt16;
   default:
     assert(false);
   }
@@ -81,6 +89,10 @@ size_t GetTypeSize(FB_Tables::DType attrType) {
     return 8;
   case FB_Tables::DType::DType_c_string:
     return 1;
+  case FB_Tables::DType::DType_float16:
+    return 2;
+  case FB_Tables::DType::DType_bfloat16:
+    return 2;
   default:
     assert(false);
   }
@@ -89,18 +101,86 @@ size_t GetTypeSize(FB_Tables::DType attrType) {
 
 void DeSerializeData(NDArrayPool *pNDArrayPool, const unsigned char *bufferPtr,
                      NDArray *&pArray) {
-  auto recvArr = FB_Tables::GetNDArray(bufferPtr);
-  int id = recvArr->id();
-  double timeStamp = recvArr->timeStamp();
-  int EPICSsecPastEpoch = recvArr->epicsTS()->secPastEpoch();
-  int nsec = recvArr->epicsTS()->nsec();
-  std::vector<size_t> dims(recvArr->dims()->begin(), recvArr->dims()->end());
-  NDDataType_t dataType = GetND_DType(recvArr->dataType());
-  const void *pData = reinterpret_cast<const void *>(recvArr->pData()->Data());
-  int pData_size = recvArr->pData()->size();
+  DeSerializeData(pNDArrayPool, FB_Tables::GetNDArray(bufferPtr), pArray);
+}
 
-  pArray = pNDArrayPool->alloc(static_cast<int>(dims.size()), dims.data(),
-                               dataType, 0, nullptr);
+/** @brief Reverses the XOR delta and zero run-length encoding done by the
+ * serializer.
+ * @param[in] input The encoded data.
+ * @param[in] inputSize Size of the encoded data in bytes.
+ * @param[in] reference The keyframe data.
+ * @param[out] output The reconstructed data, same size as the keyframe.
+ * @param[in] size Size of the keyframe and output in bytes.
+ * @return True on success, false if the encoded data is corrupt.
+ */
+static bool DecodeXorDelta(const std::uint8_t *input, size_t inputSize,
+                           const std::uint8_t *reference, std::uint8_t *output,
+                           size_t size) {
+  auto ReadVarint = [&](size_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 and inputSize > 0; shift += 7) {
+      std::uint8_t byte = *input++;
+      --inputSize;
+      value |= static_cast<size_t>(byte & 0x7f) << shift;
+      if (0 == (byte & 0x80)) {
+        return true;
+      }
+    }
+    return false;
+  };
+  std::memcpy(output, reference, size);
+  size_t position = 0;
+  while (inputSize > 0) {
+    size_t zeroBytes, literalBytes;
+    if (not ReadVarint(zeroBytes) or not ReadVarint(literalBytes) or
+        zeroBytes > size - position or
+        literalBytes > size - position - zeroBytes or
+        literalBytes > inputSize) {
+      return false;
+    }
+    position += zeroBytes;
+    for (size_t i = 0; i < literalBytes; i++) {
+      output[position + i] ^= input[i];
+    }
+    position += literalBytes;
+    input += literalBytes;
+    inputSize -= literalBytes;
+  }
+  return position == size;
+}
+
+/// @brief Returns true for the reduced precision float32 transport types.
+static bool IsReducedFloat(FB_Tables::DType type) {
+  return FB_Tables::DType_float16 == type or FB_Tables::DType_bfloat16 == type;
+}
+
+/** @brief Converts float16 or bfloat16 data to float32.
+ * @param[in] type The data type of the input.
+ * @param[in] input The data to convert.
+ * @param[out] output The float32 data.
+ * @param[in] elements Number of elements to convert.
+ */
+static void WidenFloats(FB_Tables::DType type, const void *input,
+                        void *output, size_t elements) {
+  auto values = static_cast<float *>(output);
+  if (FB_Tables::DType_float16 == type) {
+    KafkaInterface::HalfToFloat(input, values, elements);
+  } else {
+    KafkaInterface::BFloat16ToFloat(input, values, elements);
+  }
+}
+
+NDArray *AllocateArray(NDArrayPool *pNDArrayPool,
+                       const FB_Tables::NDArray *recvArr,
+                       std::vector<size_t> &dims, bool widenFloats) {
+  bool widen = widenFloats and IsReducedFloat(recvArr->dataType());
+  NDDataType_t dataType =
+      widen ? NDFloat32 : GetND_DType(recvArr->dataType());
+  NDArray *pArray = pNDArrayPool->alloc(static_cast<int>(dims.size()),
+                                        dims.data(), dataType, 0, nullptr);
+  if (nullptr == pArray) {
+    return nullptr;
+  }
 
   NDAttributeList *attrPtr = pArray->pAttributeList;
   attrPtr->clear();
@@ -114,10 +194,147 @@ void DeSerializeData(NDArrayPool *pNDArrayPool, const unsigned char *bufferPtr,
                             cAttr->pData()->Data()))));
   }
 
-  std::memcpy(pArray->pData, pData, pData_size);
+  pArray->uniqueId = recvArr->id();
+  pArray->timeStamp = recvArr->timeStamp();
+  pArray->epicsTS.secPastEpoch = recvArr->epicsTS()->secPastEpoch();
+  pArray->epicsTS.nsec = recvArr->epicsTS()->nsec();
+  return pArray;
+}
+
+bool DeSerializeArrayData(const FB_Tables::NDArray *recvArr,
+                          void *destination, size_t elements,
+                          KeyframeReference *keyframe, bool widenFloats) {
+  if (FB_Tables::Encoding_delta == recvArr->encoding() and
+      (nullptr == keyframe or 0 == keyframe->keyframeId or
+       keyframe->keyframeId != recvArr->keyframeId())) {
+    return false;
+  }
+  bool widen = widenFloats and IsReducedFloat(recvArr->dataType());
+  const void *pData = reinterpret_cast<const void *>(recvArr->pData()->Data());
+  int pData_size = recvArr->pData()->size();
+
+  size_t elementSize = GetTypeSize(recvArr->dataType());
+  // Size of the dense data as sent
+  size_t dataBytes = elements * elementSize;
+  // Sparse and delta encoded reduced precision data is reconstructed here
+  // before being widened
+  std::vector<std::uint8_t> reducedData;
+  auto dst = static_cast<std::uint8_t *>(destination);
+  bool sparse = FB_Tables::Encoding_sparse == recvArr->encoding() and
+                nullptr != recvArr->sparseIndices();
+  if (widen and (sparse or FB_Tables::Encoding_delta == recvArr->encoding())) {
+    reducedData.resize(dataBytes);
+    dst = reducedData.data();
+  }
+
+  if (sparse) {
+    // Expand the (index, value) pairs, all other elements are 0
+    std::memset(dst, 0, dataBytes);
+    auto indices = recvArr->sparseIndices();
+    auto src = static_cast<const std::uint8_t *>(pData);
+    size_t values = pData_size / elementSize;
+    for (flatbuffers::uoffset_t i = 0; i < indices->size() and i < values;
+         i++) {
+      auto index = indices->Get(i);
+      if (index < elements) {
+        std::memcpy(dst + index * elementSize, src + i * elementSize,
+                    elementSize);
+      }
+    }
+  } else if (FB_Tables::Encoding_delta == recvArr->encoding()) {
+    if (keyframe->data.size() != dataBytes or
+        not DecodeXorDelta(static_cast<const std::uint8_t *>(pData),
+                           pData_size, keyframe->data.data(), dst,
+                           dataBytes)) {
+      return false;
+    }
+  } else if (FB_Tables::Encoding_packed == recvArr->encoding()) {
+    int bits = recvArr->packedBits();
+    if (FB_Tables::DType_uint16 != recvArr->dataType() or
+        static_cast<size_t>(pData_size) <
+            KafkaInterface::PackedSize(elements, bits) or
+        not KafkaInterface::UnpackBits(
+            static_cast<const std::uint8_t *>(pData),
+            static_cast<std::uint16_t *>(destination), elements, bits)) {
+      return false;
+    }
+  } else {
+    if (widen) {
+      WidenFloats(recvArr->dataType(), pData, destination,
+                  std::min(elements, pData_size / elementSize));
+    } else {
+      std::memcpy(destination, pData, std::min<size_t>(pData_size, dataBytes));
+    }
+    if (FB_Tables::Encoding_keyframe == recvArr->encoding() and
+        nullptr != keyframe) {
+      auto data = static_cast<const std::uint8_t *>(pData);
+      keyframe->data.assign(data, data + pData_size);
+      keyframe->keyframeId = recvArr->keyframeId();
+    }
+  }
+  if (not reducedData.empty()) {
+    WidenFloats(recvArr->dataType(), reducedData.data(), destination,
+                elements);
+  }
+  return true;
+}
+
+bool DeSerializeData(NDArrayPool *pNDArrayPool,
+                     const FB_Tables::NDArray *recvArr, NDArray *&pArray,
+                     KeyframeReference *keyframe, bool widenFloats) {
+  if (FB_Tables::Encoding_delta == recvArr->encoding() and
+      (nullptr == keyframe or 0 == keyframe->keyframeId or
+       keyframe->keyframeId != recvArr->keyframeId())) {
+    pArray = nullptr;
+    return false;
+  }
+  std::vector<size_t> dims(recvArr->dims()->begin(), recvArr->dims()->end());
+  pArray = AllocateArray(pNDArrayPool, recvArr, dims, widenFloats);
+  if (nullptr == pArray) {
+    return false;
+  }
+
+  NDArrayInfo_t arrInfo;
+  pArray->getInfo(&arrInfo);
+  if (not DeSerializeArrayData(recvArr, pArray->pData, arrInfo.nElements,
+                               keyframe, widenFloats)) {
+    pArray->release();
+    pArray = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool VerifyChecksum(const FB_Tables::NDArray *recvArr, const void *data,
+                    NDDataType_t dataType, size_t elements) {
+  if (FB_Tables::ChecksumType_crc32c != recvArr->checksumType()) {
+    return true;
+  }
+  auto type = recvArr->dataType();
+  if (not IsReducedFloat(type) or NDFloat32 != dataType) {
+    return recvArr->checksum() ==
+           KafkaInterface::Crc32c(data, elements * GetTypeSize(type));
+  }
+  // The checksum is of the data as sent, narrow the widened data again
+  const size_t chunkElements = 4096;
+  std::uint16_t narrowed[chunkElements];
+  auto values = static_cast<const float *>(data);
+  std::uint32_t crc = 0;
+  for (size_t start = 0; start < elements; start += chunkElements) {
+    size_t count = std::min(chunkElements, elements - start);
+    if (FB_Tables::DType_float16 == type) {
+      KafkaInterface::FloatToHalf(values + start, narrowed, count);
+    } else {
+      KafkaInterface::FloatToBFloat16(values + start, narrowed, count);
+    }
+    crc = KafkaInterface::Crc32c(narrowed, count * sizeof(narrowed[0]), crc);
+  }
+  return recvArr->checksum() == crc;
+}
 
-  pArray->uniqueId = id;
-  pArray->timeStamp = timeStamp;
-  pArray->epicsTS.secPastEpoch = EPICSsecPastEpoch;
-  pArray->epicsTS.nsec = nsec;
+bool VerifyChecksum(const FB_Tables::NDArray *recvArr, NDArray *pArray) {
+  NDArrayInfo_t arrInfo;
+  pArray->getInfo(&arrInfo);
+  return VerifyChecksum(recvArr, pArray->pData, pArray->dataType,
+                        arrInfo.nElements);
 }
@@ -6,10 +6,27 @@
 
 #pragma once
 
+#include "NDArrayBatch_schema_generated.h"
 #include "NDArray_schema_generated.h"
 #include <NDArray.h>
+#include <cstdint>
+#include <vector>
+
+/** @brief The last keyframe received, used to reconstruct delta encoded
+ * arrays (see FB_Tables::Encoding).
+ */
+struct KeyframeReference {
+  /// @brief Id of the keyframe, 0 if no keyframe has been received.
+  std::uint64_t keyframeId{0};
+
+  /// @brief The (dense) data of the keyframe.
+  std::vector<std::uint8_t> data;
+};
 
 /** @brief Deserializes NDArray data previously serialized by flatbuffers.
+ * Sparse encoded array data (see FB_Tables::Encoding) is expanded to the
+ * dense form, with all elements not sent set to 0. Bit packed data is
+ * unpacked to 16 bit integers.
  * The deserialization requires that a NDArrayPool provides a NDArray instance
  * to which the data can
  * be copied. The function currently does no checks to ensure that there is
@@ -31,3 +48,80 @@
  */
 void DeSerializeData(NDArrayPool *pNDArrayPool, const unsigned char *bufferPtr,
                      NDArray *&pArray);
+
+/** @brief Deserializes a single NDArray flatbuffer table, e.g. one of the
+ * arrays in a FB_Tables::NDArrayBatch.
+ * Keyframes are stored in the keyframe reference (if given) and used to
+ * reconstruct the delta encoded arrays that follow them.
+ * @param[in] pNDArrayPool The NDArrayPool used to allocate the NDArray.
+ * @param[in] recvArr The flatbuffer table to deserialize.
+ * @param[out] pArray The deserialized array. See the other overload of
+ * DeSerializeData() for ownership. Set to nullptr on failure.
+ * @param[in,out] keyframe The last keyframe received.
+ * @param[in] widenFloats If true, float16 and bfloat16 data (see
+ * NDArraySerializer::SetTransportType()) is converted to float32. Otherwise
+ * the raw 16 bit values are stored in an array of type NDUInt16.
+ * @return True on success, false if the array is delta encoded and the
+ * keyframe it refers to is not available (e.g. when starting to consume in
+ * the middle of a stream) or if the delta encoded or bit packed data is
+ * corrupt.
+ */
+bool DeSerializeData(NDArrayPool *pNDArrayPool,
+                     const FB_Tables::NDArray *recvArr, NDArray *&pArray,
+                     KeyframeReference *keyframe = nullptr,
+                     bool widenFloats = true);
+
+/** @brief Allocates an NDArray for the data of a flatbuffer table.
+ * The meta data (unique id and timestamps) and the attributes of the array
+ * are set from the table, the array data is not.
+ * @param[in] pNDArrayPool The NDArrayPool used to allocate the NDArray.
+ * @param[in] recvArr The flatbuffer table.
+ * @param[in] dims The dimensions of the array.
+ * @param[in] widenFloats See DeSerializeData().
+ * @return The allocated array, or nullptr if the allocation failed.
+ */
+NDArray *AllocateArray(NDArrayPool *pNDArrayPool,
+                       const FB_Tables::NDArray *recvArr,
+                       std::vector<size_t> &dims, bool widenFloats = true);
+
+/** @brief Decodes the array data of a flatbuffer table into a buffer.
+ * This is the part of DeSerializeData() which expands the sparse, delta or
+ * bit packed data, e.g. for writing a tile into its part of a larger array.
+ * @param[in] recvArr The flatbuffer table.
+ * @param[out] destination The decoded data, elements values of the data type
+ * of the table (float32 if widened).
+ * @param[in] elements Number of elements of the array, i.e. the product of
+ * its dimensions.
+ * @param[in,out] keyframe The last keyframe received.
+ * @param[in] widenFloats See DeSerializeData().
+ * @return True on success, false if the keyframe is not available or the
+ * data is corrupt.
+ */
+bool DeSerializeArrayData(const FB_Tables::NDArray *recvArr,
+                          void *destination, size_t elements,
+                          KeyframeReference *keyframe = nullptr,
+                          bool widenFloats = true);
+
+/** @brief Verifies the checksum of a deserialized array.
+ * The checksum (see FB_Tables::ChecksumType) is computed by the producer on
+ * the array data before any delta encoding and is thus compared with the
+ * reconstructed data. For sparse encoded arrays, it covers the thresholded
+ * data, i.e. the dense array with the elements not sent set to 0. For
+ * float16 and bfloat16 data widened to float32, the data is converted back
+ * before the comparison.
+ * @param[in] recvArr The flatbuffer table the array was deserialized from.
+ * @param[in] pArray The deserialized array.
+ * @return False if the checksum does not match the data, true otherwise
+ * (including if the producer did not add a checksum).
+ */
+bool VerifyChecksum(const FB_Tables::NDArray *recvArr, NDArray *pArray);
+
+/** @brief Verifies the checksum of data decoded by DeSerializeArrayData().
+ * @param[in] recvArr The flatbuffer table the data was decoded from.
+ * @param[in] data The decoded data.
+ * @param[in] dataType The data type of the decoded data.
+ * @param[in] elements Number of elements.
+ * @return False if the checksum does not match the data, true otherwise.
+ */
+bool VerifyChecksum(const FB_Tables::NDArray *recvArr, const void *data,
+                    NDDataType_t dataType, size_t elements);
@@ -10,6 +10,8 @@ namespace FB_Tables {
 
 struct epicsTimeStamp;
 
+struct DataStatistics;
+
 struct NDAttribute;
 
 struct NDArray;
@@ -24,11 +26,13 @@ enum DType {
   DType_float32 = 6,
   DType_float64 = 7,
   DType_c_string = 8,
+  DType_float16 = 9,
+  DType_bfloat16 = 10,
   DType_MIN = DType_int8,
-  DType_MAX = DType_c_string
+  DType_MAX = DType_bfloat16
 };
 
-inline const DType (&EnumValuesDType())[9] {
+inline const DType (&EnumValuesDType())[11] {
   static const DType values[] = {
     DType_int8,
     DType_uint8,
@@ -38,7 +42,9 @@ inline const DType (&EnumValuesDType())[9] {
     DType_uint32,
     DType_float32,
     DType_float64,
-    DType_c_string
+    DType_c_string,
+    DType_float16,
+    DType_bfloat16
   };
   return values;
 }
@@ -54,17 +60,88 @@ inline const char * const *EnumNamesDType() {
     "float32",
     "float64",
     "c_string",
+    "float16",
+    "bfloat16",
     nullptr
   };
   return names;
 }
 
 inline const char *EnumNameDType(DType e) {
-  if (e < DType_int8 || e > DType_c_string) return "";
+  if (e < DType_int8 || e > DType_bfloat16) return "";
   const size_t index = static_cast<int>(e);
   return EnumNamesDType()[index];
 }
 
+enum Encoding {
+  Encoding_dense = 0,
+  Encoding_sparse = 1,
+  Encoding_keyframe = 2,
+  Encoding_delta = 3,
+  Encoding_packed = 4,
+  Encoding_MIN = Encoding_dense,
+  Encoding_MAX = Encoding_packed
+};
+
+inline const Encoding (&EnumValuesEncoding())[5] {
+  static const Encoding values[] = {
+    Encoding_dense,
+    Encoding_sparse,
+    Encoding_keyframe,
+    Encoding_delta,
+    Encoding_packed
+  };
+  return values;
+}
+
+inline const char * const *EnumNamesEncoding() {
+  static const char * const names[] = {
+    "dense",
+    "sparse",
+    "keyframe",
+    "delta",
+    "packed",
+    nullptr
+  };
+  return names;
+}
+
+inline const char *EnumNameEncoding(Encoding e) {
+  if (e < Encoding_dense || e > Encoding_packed) return "";
+  const size_t index = static_cast<int>(e);
+  return EnumNamesEncoding()[index];
+}
+
+enum ChecksumType {
+  ChecksumType_none = 0,
+  ChecksumType_crc32c = 1,
+  ChecksumType_MIN = ChecksumType_none,
+  ChecksumType_MAX = ChecksumType_crc32c
+};
+
+inline const ChecksumType (&EnumValuesChecksumType())[2] {
+  static const ChecksumType values[] = {
+    ChecksumType_none,
+    ChecksumType_crc32c
+  };
+  return values;
+}
+
+inline const char * const *EnumNamesChecksumType() {
+  static const char * const names[] = {
+    "none",
+    "crc32c",
+    nullptr
+  };
+  return names;
+}
+
+inline const char *EnumNameChecksumType(ChecksumType e) {
+  if (e < ChecksumType_none || e > ChecksumType_crc32c) return "";
+  const size_t index = static_cast<int>(e);
+  return EnumNamesChecksumType()[index];
+}
+
 FLATBUFFERS_MANUALLY_ALIGNED_STRUCT(4) epicsTimeStamp FLATBUFFERS_FINAL_CLASS {
  private:
   int32_t secPastEpoch_;
@@ -87,6 +164,38 @@ FLATBUFFERS_MANUALLY_ALIGNED_STRUCT(4) epicsTimeStamp FLATBUFFERS_FINAL_CLASS {
 };
 FLATBUFFERS_STRUCT_END(epicsTimeStamp, 8);
 
+FLATBUFFERS_MANUALLY_ALIGNED_STRUCT(8) DataStatistics FLATBUFFERS_FINAL_CLASS {
+ private:
+  double min_;
+  double max_;
+  double sum_;
+  uint64_t aboveThreshold_;
+
+ public:
+  DataStatistics() {
+    memset(static_cast<void *>(this), 0, sizeof(DataStatistics));
+  }
+  DataStatistics(double _min, double _max, double _sum, uint64_t _aboveThreshold)
+      : min_(flatbuffers::EndianScalar(_min)),
+        max_(flatbuffers::EndianScalar(_max)),
+        sum_(flatbuffers::EndianScalar(_sum)),
+        aboveThreshold_(flatbuffers::EndianScalar(_aboveThreshold)) {
+  }
+  double min() const {
+    return flatbuffers::EndianScalar(min_);
+  }
+  double max() const {
+    return flatbuffers::EndianScalar(max_);
+  }
+  double sum() const {
+    return flatbuffers::EndianScalar(sum_);
+  }
+  uint64_t aboveThreshold() const {
+    return flatbuffers::EndianScalar(aboveThreshold_);
+  }
+};
+FLATBUFFERS_STRUCT_END(DataStatistics, 32);
+
 struct NDAttribute FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum FlatBuffersVTableOffset FLATBUFFERS_VTABLE_UNDERLYING_TYPE {
     VT_PNAME = 4,
@@ -199,7 +308,20 @@ struct NDArray FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
     VT_DIMS = 10,
     VT_DATATYPE = 12,
     VT_PDATA = 14,
-    VT_PATTRIBUTELIST = 16
+    VT_PATTRIBUTELIST = 16,
+    VT_SEQUENCENUMBER = 18,
+    VT_DROPPEDARRAYS = 20,
+    VT_ENCODING = 22,
+    VT_SPARSEINDICES = 24,
+    VT_KEYFRAMEID = 26,
+    VT_STATISTICS = 28,
+    VT_CHECKSUMTYPE = 30,
+    VT_CHECKSUM = 32,
+    VT_PACKEDBITS = 34,
+    VT_TILEINDEX = 36,
+    VT_TILECOUNT = 38,
+    VT_TILEOFFSET = 40,
+    VT_FRAMEDIMS = 42
   };
   int32_t id() const {
     return GetField<int32_t>(VT_ID, 0);
@@ -222,6 +344,45 @@ struct NDArray FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const flatbuffers::Vector<flatbuffers::Offset<NDAttribute>> *pAttributeList() const {
     return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<NDAttribute>> *>(VT_PATTRIBUTELIST);
   }
+  uint64_t sequenceNumber() const {
+    return GetField<uint64_t>(VT_SEQUENCENUMBER, 0);
+  }
+  uint64_t droppedArrays() const {
+    return GetField<uint64_t>(VT_DROPPEDARRAYS, 0);
+  }
+  Encoding encoding() const {
+    return static_cast<Encoding>(GetField<int8_t>(VT_ENCODING, 0));
+  }
+  const flatbuffers::Vector<uint32_t> *sparseIndices() const {
+    return GetPointer<const flatbuffers::Vector<uint32_t> *>(VT_SPARSEINDICES);
+  }
+  uint64_t keyframeId() const {
+    return GetField<uint64_t>(VT_KEYFRAMEID, 0);
+  }
+  const DataStatistics *statistics() const {
+    return GetStruct<const DataStatistics *>(VT_STATISTICS);
+  }
+  ChecksumType checksumType() const {
+    return static_cast<ChecksumType>(GetField<int8_t>(VT_CHECKSUMTYPE, 0));
+  }
+  uint32_t checksum() const {
+    return GetField<uint32_t>(VT_CHECKSUM, 0);
+  }
+  uint8_t packedBits() const {
+    return GetField<uint8_t>(VT_PACKEDBITS, 0);
+  }
+  uint32_t tileIndex() const {
+    return GetField<uint32_t>(VT_TILEINDEX, 0);
+  }
+  uint32_t tileCount() const {
+    return GetField<uint32_t>(VT_TILECOUNT, 0);
+  }
+  uint64_t tileOffset() const {
+    return GetField<uint64_t>(VT_TILEOFFSET, 0);
+  }
+  const flatbuffers::Vector<uint64_t> *frameDims() const {
+    return GetPointer<const flatbuffers::Vector<uint64_t> *>(VT_FRAMEDIMS);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<int32_t>(verifier, VT_ID) &&
@@ -235,6 +396,21 @@ struct NDArray FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            VerifyOffset(verifier, VT_PATTRIBUTELIST) &&
            verifier.VerifyVector(pAttributeList()) &&
            verifier.VerifyVectorOfTables(pAttributeList()) &&
+           VerifyField<uint64_t>(verifier, VT_SEQUENCENUMBER) &&
+           VerifyField<uint64_t>(verifier, VT_DROPPEDARRAYS) &&
+           VerifyField<int8_t>(verifier, VT_ENCODING) &&
+           VerifyOffset(verifier, VT_SPARSEINDICES) &&
+           verifier.VerifyVector(sparseIndices()) &&
+           VerifyField<uint64_t>(verifier, VT_KEYFRAMEID) &&
+           VerifyField<DataStatistics>(verifier, VT_STATISTICS) &&
+           VerifyField<int8_t>(verifier, VT_CHECKSUMTYPE) &&
+           VerifyField<uint32_t>(verifier, VT_CHECKSUM) &&
+           VerifyField<uint8_t>(verifier, VT_PACKEDBITS) &&
+           VerifyField<uint32_t>(verifier, VT_TILEINDEX) &&
+           VerifyField<uint32_t>(verifier, VT_TILECOUNT) &&
+           VerifyField<uint64_t>(verifier, VT_TILEOFFSET) &&
+           VerifyOffset(verifier, VT_FRAMEDIMS) &&
+           verifier.VerifyVector(frameDims()) &&
            verifier.EndTable();
   }
 };
@@ -263,6 +439,45 @@ struct NDArrayBuilder {
   void add_pAttributeList(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<NDAttribute>>> pAttributeList) {
     fbb_.AddOffset(NDArray::VT_PATTRIBUTELIST, pAttributeList);
   }
+  void add_sequenceNumber(uint64_t sequenceNumber) {
+    fbb_.AddElement<uint64_t>(NDArray::VT_SEQUENCENUMBER, sequenceNumber, 0);
+  }
+  void add_droppedArrays(uint64_t droppedArrays) {
+    fbb_.AddElement<uint64_t>(NDArray::VT_DROPPEDARRAYS, droppedArrays, 0);
+  }
+  void add_encoding(Encoding encoding) {
+    fbb_.AddElement<int8_t>(NDArray::VT_ENCODING, static_cast<int8_t>(encoding), 0);
+  }
+  void add_sparseIndices(flatbuffers::Offset<flatbuffers::Vector<uint32_t>> sparseIndices) {
+    fbb_.AddOffset(NDArray::VT_SPARSEINDICES, sparseIndices);
+  }
+  void add_keyframeId(uint64_t keyframeId) {
+    fbb_.AddElement<uint64_t>(NDArray::VT_KEYFRAMEID, keyframeId, 0);
+  }
+  void add_statistics(const DataStatistics *statistics) {
+    fbb_.AddStruct(NDArray::VT_STATISTICS, statistics);
+  }
+  void add_checksumType(ChecksumType checksumType) {
+    fbb_.AddElement<int8_t>(NDArray::VT_CHECKSUMTYPE, static_cast<int8_t>(checksumType), 0);
+  }
+  void add_checksum(uint32_t checksum) {
+    fbb_.AddElement<uint32_t>(NDArray::VT_CHECKSUM, checksum, 0);
+  }
+  void add_packedBits(uint8_t packedBits) {
+    fbb_.AddElement<uint8_t>(NDArray::VT_PACKEDBITS, packedBits, 0);
+  }
+  void add_tileIndex(uint32_t tileIndex) {
+    fbb_.AddElement<uint32_t>(NDArray::VT_TILEINDEX, tileIndex, 0);
+  }
+  void add_tileCount(uint32_t tileCount) {
+    fbb_.AddElement<uint32_t>(NDArray::VT_TILECOUNT, tileCount, 0);
+  }
+  void add_tileOffset(uint64_t tileOffset) {
+    fbb_.AddElement<uint64_t>(NDArray::VT_TILEOFFSET, tileOffset, 0);
+  }
+  void add_frameDims(flatbuffers::Offset<flatbuffers::Vector<uint64_t>> frameDims) {
+    fbb_.AddOffset(NDArray::VT_FRAMEDIMS, frameDims);
+  }
   explicit NDArrayBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -283,15 +498,41 @@ inline flatbuffers::Offset<NDArray> CreateNDArray(
     flatbuffers::Offset<flatbuffers::Vector<uint64_t>> dims = 0,
     DType dataType = DType_int8,
     flatbuffers::Offset<flatbuffers::Vector<uint8_t>> pData = 0,
-    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<NDAttribute>>> pAttributeList = 0) {
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<NDAttribute>>> pAttributeList = 0,
+    uint64_t sequenceNumber = 0,
+    uint64_t droppedArrays = 0,
+    Encoding encoding = Encoding_dense,
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t>> sparseIndices = 0,
+    uint64_t keyframeId = 0,
+    const DataStatistics *statistics = 0,
+    ChecksumType checksumType = ChecksumType_none,
+    uint32_t checksum = 0,
+    uint8_t packedBits = 0,
+    uint32_t tileIndex = 0,
+    uint32_t tileCount = 0,
+    uint64_t tileOffset = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint64_t>> frameDims = 0) {
   NDArrayBuilder builder_(_fbb);
+  builder_.add_tileOffset(tileOffset);
+  builder_.add_keyframeId(keyframeId);
+  builder_.add_droppedArrays(droppedArrays);
+  builder_.add_sequenceNumber(sequenceNumber);
   builder_.add_timeStamp(timeStamp);
+  builder_.add_frameDims(frameDims);
+  builder_.add_tileCount(tileCount);
+  builder_.add_tileIndex(tileIndex);
+  builder_.add_checksum(checksum);
+  builder_.add_statistics(statistics);
+  builder_.add_sparseIndices(sparseIndices);
   builder_.add_pAttributeList(pAttributeList);
   builder_.add_pData(pData);
   builder_.add_dims(dims);
   builder_.add_epicsTS(epicsTS);
   builder_.add_id(id);
+  builder_.add_checksumType(checksumType);
+  builder_.add_encoding(encoding);
   builder_.add_dataType(dataType);
+  builder_.add_packedBits(packedBits);
   return builder_.Finish();
 }
 
@@ -303,10 +544,25 @@ inline flatbuffers::Offset<NDArray> CreateNDArrayDirect(
     const std::vector<uint64_t> *dims = nullptr,
     DType dataType = DType_int8,
     const std::vector<uint8_t> *pData = nullptr,
-    const std::vector<flatbuffers::Offset<NDAttribute>> *pAttributeList = nullptr) {
+    const std::vector<flatbuffers::Offset<NDAttribute>> *pAttributeList = nullptr,
+    uint64_t sequenceNumber = 0,
+    uint64_t droppedArrays = 0,
+    Encoding encoding = Encoding_dense,
+    const std::vector<uint32_t> *sparseIndices = nullptr,
+    uint64_t keyframeId = 0,
+    const DataStatistics *statistics = 0,
+    ChecksumType checksumType = ChecksumType_none,
+    uint32_t checksum = 0,
+    uint8_t packedBits = 0,
+    uint32_t tileIndex = 0,
+    uint32_t tileCount = 0,
+    uint64_t tileOffset = 0,
+    const std::vector<uint64_t> *frameDims = nullptr) {
   auto dims__ = dims ? _fbb.CreateVector<uint64_t>(*dims) : 0;
   auto pData__ = pData ? _fbb.CreateVector<uint8_t>(*pData) : 0;
   auto pAttributeList__ = pAttributeList ? _fbb.CreateVector<flatbuffers::Offset<NDAttribute>>(*pAttributeList) : 0;
+  auto sparseIndices__ = sparseIndices ? _fbb.CreateVector<uint32_t>(*sparseIndices) : 0;
+  auto frameDims__ = frameDims ? _fbb.CreateVector<uint64_t>(*frameDims) : 0;
   return FB_Tables::CreateNDArray(
       _fbb,
       id,
@@ -315,7 +571,20 @@ inline flatbuffers::Offset<NDArray> CreateNDArrayDirect(
       dims__,
       dataType,
       pData__,
-      pAttributeList__);
+      pAttributeList__,
+      sequenceNumber,
+      droppedArrays,
+      encoding,
+      sparseIndices__,
+      keyframeId,
+      statistics,
+      checksumType,
+      checksum,
+      packedBits,
+      tileIndex,
+      tileCount,
+      tileOffset,
+      frameDims__);
 }
 
 inline const FB_Tables::NDArray *GetNDArray(const void *buf) {
@@ -0,0 +1,50 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Probes.h
+ *  @brief Statically defined tracepoints (USDT probes) of the plugin and
+ * driver hot paths.
+ *
+ * The probes belong to the provider "adkafka" and can be attached to with
+ * e.g. perf, bpftrace or SystemTap. A probe which is not attached to is a
+ * single nop instruction. The probes are compiled in on Linux when
+ * <sys/sdt.h> (package systemtap-sdt-dev or systemtap-sdt-devel) is
+ * available, unless KAFKA_DISABLE_USDT is defined. Otherwise the macros
+ * expand to nothing.
+ *
+ * The probes and their arguments are:
+ * - serialize__start(uniqueId, array bytes)
+ * - serialize__end(uniqueId, message bytes), message bytes is 0 for arrays
+ *   sent as tiles or added to a batch
+ * - produce__enqueue(uniqueId, message bytes, success), fired for every tile
+ *   and for every batch (with the uniqueId of its first array)
+ * - delivery__report(message bytes, error code, partition, offset)
+ * - consume(uniqueId, message bytes), fired once for a batch (with the
+ *   uniqueId of its first array)
+ * - deserialize__start(uniqueId, array data bytes in the message)
+ * - deserialize__end(uniqueId, array bytes)
+ * - callback__dispatch(uniqueId, array bytes)
+ */
+
+#pragma once
+
+#include <ciso646>
+
+#if not defined(KAFKA_DISABLE_USDT) and defined(__linux__) and                \
+    defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define KAFKA_USDT
+#include <sys/sdt.h>
+#endif
+#endif
+
+#ifdef KAFKA_USDT
+#define KAFKA_PROBE2(name, arg1, arg2) DTRACE_PROBE2(adkafka, name, arg1, arg2)
+#define KAFKA_PROBE3(name, arg1, arg2, arg3)                                   \
+  DTRACE_PROBE3(adkafka, name, arg1, arg2, arg3)
+#define KAFKA_PROBE4(name, arg1, arg2, arg3, arg4)                             \
+  DTRACE_PROBE4(adkafka, name, arg1, arg2, arg3, arg4)
+#else
+#define KAFKA_PROBE2(name, arg1, arg2)
+#define KAFKA_PROBE3(name, arg1, arg2, arg3)
+#define KAFKA_PROBE4(name, arg1, arg2, arg3, arg4)
+#endif
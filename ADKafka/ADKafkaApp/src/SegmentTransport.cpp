@@ -0,0 +1,372 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  SegmentTransport.cpp
+ *  @brief Implementation of the back-end which passes messages through a
+ * memory mapped segment file.
+ */
+
+#include "SegmentTransport.h"
+#include <algorithm>
+#include <ciso646>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace KafkaInterface {
+
+namespace {
+const char segmentMagic[8] = {'A', 'D', 'K', 'S', 'E', 'G', 'M', 'T'};
+const std::uint64_t segmentVersion = 1;
+
+/// @brief How often an idle consumer checks if the file has been replaced.
+const std::chrono::seconds replacedCheckInterval(1);
+
+#ifndef _WIN32
+/** @brief Allocates the disk blocks of a file, so that a full disk is
+ * reported here rather than by a SIGBUS when writing to a mapping of it.
+ */
+bool AllocateFile(int fd, std::uint64_t size) {
+#ifdef __APPLE__
+  fstore_t store{F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(size), 0};
+  return -1 != fcntl(fd, F_PREALLOCATE, &store);
+#else
+  return 0 == posix_fallocate(fd, 0, static_cast<off_t>(size));
+#endif
+}
+#endif
+
+/// @brief A message copied out of the ring.
+class SegmentMessage : public TransportMessage {
+public:
+  SegmentMessage(const unsigned char *buffer, size_t size)
+      : data(buffer, buffer + size) {}
+
+  void *GetDataPtr() override { return data.data(); }
+
+  size_t size() override { return data.size(); }
+
+private:
+  std::vector<unsigned char> data;
+};
+} // namespace
+
+SegmentFile::~SegmentFile() { Close(); }
+
+std::uint64_t SegmentFile::RecordSize(std::uint64_t payloadSize) {
+  std::uint64_t size = sizeof(RecordHeader) + payloadSize;
+  // Keep the record headers 8 byte aligned
+  return (size + 7) & ~std::uint64_t(7);
+}
+
+SegmentFile::FileHeader *SegmentFile::Header() const {
+  return reinterpret_cast<FileHeader *>(mappedFile);
+}
+
+unsigned char *SegmentFile::Ring() const { return mappedFile + dataStart; }
+
+bool SegmentFile::IsOpen() const { return nullptr != mappedFile; }
+
+std::string SegmentFile::GetError() const { return errorString; }
+
+#ifdef _WIN32
+bool SegmentFile::Create(std::string const &, std::uint64_t) {
+  errorString = "Segment files not supported on this platform.";
+  return false;
+}
+
+bool SegmentFile::Open(std::string const &) {
+  errorString = "Segment files not supported on this platform.";
+  return false;
+}
+
+bool SegmentFile::Map(int, std::uint64_t, bool) { return false; }
+
+bool SegmentFile::IsReplaced(std::string const &) const { return false; }
+
+void SegmentFile::Close() {}
+#else
+bool SegmentFile::Map(int fd, std::uint64_t sizeBytes, bool writable) {
+  int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  void *mapping = mmap(nullptr, sizeBytes, protection, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == mapping) {
+    close(fd);
+    errorString = "Unable to memory map segment file.";
+    return false;
+  }
+  fileDescriptor = fd;
+  mappedFile = reinterpret_cast<unsigned char *>(mapping);
+  fileSize = sizeBytes;
+  return true;
+}
+
+bool SegmentFile::Create(std::string const &path, std::uint64_t sizeBytes) {
+  Close();
+  // Make room for the header and at least two records of 1 kB
+  std::uint64_t capacity = (sizeBytes - dataStart) & ~std::uint64_t(7);
+  if (sizeBytes < dataStart or capacity < 2 * RecordSize(1024)) {
+    errorString = "Segment file size too small.";
+    return false;
+  }
+  sizeBytes = dataStart + capacity;
+
+  // Re-use an existing segment of the same size
+  int fd = open(path.c_str(), O_RDWR);
+  if (-1 != fd) {
+    FileHeader oldHeader;
+    struct stat fileStat;
+    if (0 == fstat(fd, &fileStat) and
+        sizeBytes == static_cast<std::uint64_t>(fileStat.st_size) and
+        sizeof(oldHeader) == pread(fd, &oldHeader, sizeof(oldHeader), 0) and
+        0 == std::memcmp(oldHeader.magic, segmentMagic,
+                         sizeof(segmentMagic)) and
+        segmentVersion == oldHeader.version and
+        capacity == oldHeader.capacity) {
+      if (not AllocateFile(fd, sizeBytes)) {
+        close(fd);
+        errorString = "Unable to allocate segment file space.";
+        return false;
+      }
+      if (not Map(fd, sizeBytes, true)) {
+        return false;
+      }
+      // A record being written when the previous producer stopped is lost
+      Header()->reserved = Header()->written.load();
+      return true;
+    }
+    close(fd);
+  }
+
+  // Consumers keep reading the replaced file until they notice the new one
+  std::string tempPath = path + ".tmp";
+  fd = open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (-1 == fd) {
+    errorString = "Unable to create segment file.";
+    return false;
+  }
+  if (-1 == ftruncate(fd, sizeBytes)) {
+    close(fd);
+    unlink(tempPath.c_str());
+    errorString = "Unable to set segment file size.";
+    return false;
+  }
+  if (not AllocateFile(fd, sizeBytes)) {
+    close(fd);
+    unlink(tempPath.c_str());
+    errorString = "Unable to allocate segment file space.";
+    return false;
+  }
+  if (not Map(fd, sizeBytes, true)) {
+    unlink(tempPath.c_str());
+    return false;
+  }
+  FileHeader *header = Header();
+  header->version = segmentVersion;
+  header->capacity = capacity;
+  header->reserved = 0;
+  header->written = 0;
+  // The magic is written last so that consumers never see a partial header
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(header->magic, segmentMagic, sizeof(segmentMagic));
+  if (-1 == rename(tempPath.c_str(), path.c_str())) {
+    Close();
+    unlink(tempPath.c_str());
+    errorString = "Unable to replace segment file.";
+    return false;
+  }
+  return true;
+}
+
+bool SegmentFile::Open(std::string const &path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (-1 == fd) {
+    errorString = "Unable to open segment file.";
+    return false;
+  }
+  struct stat fileStat;
+  FileHeader header;
+  if (0 != fstat(fd, &fileStat) or
+      static_cast<std::uint64_t>(fileStat.st_size) < dataStart or
+      sizeof(header) != pread(fd, &header, sizeof(header), 0) or
+      0 != std::memcmp(header.magic, segmentMagic, sizeof(segmentMagic)) or
+      segmentVersion != header.version or
+      dataStart + header.capacity !=
+          static_cast<std::uint64_t>(fileStat.st_size)) {
+    close(fd);
+    errorString = "Not a segment file.";
+    return false;
+  }
+  return Map(fd, fileStat.st_size, false);
+}
+
+bool SegmentFile::IsReplaced(std::string const &path) const {
+  struct stat pathStat, fileStat;
+  if (0 != stat(path.c_str(), &pathStat) or
+      0 != fstat(fileDescriptor, &fileStat)) {
+    return false;
+  }
+  return pathStat.st_ino != fileStat.st_ino or
+         pathStat.st_dev != fileStat.st_dev;
+}
+
+void SegmentFile::Close() {
+  if (nullptr != mappedFile) {
+    munmap(mappedFile, fileSize);
+    mappedFile = nullptr;
+    fileSize = 0;
+  }
+  if (-1 != fileDescriptor) {
+    close(fileDescriptor);
+    fileDescriptor = -1;
+  }
+}
+#endif
+
+bool SegmentProducer::Open(std::string const &path, std::uint64_t sizeBytes) {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  if (path.empty()) {
+    file.Close();
+    return false;
+  }
+  return file.Create(path, sizeBytes);
+}
+
+bool SegmentProducer::SendMessage(const unsigned char *buffer, size_t size,
+                                  std::int64_t timestamp,
+                                  MessageHeaders const &, std::uint64_t) {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  if (not file.IsOpen()) {
+    return false;
+  }
+  auto header = file.Header();
+  std::uint64_t capacity = header->capacity;
+  std::uint64_t recordSize = SegmentFile::RecordSize(size);
+  if (recordSize > capacity / 2) {
+    return false;
+  }
+  std::uint64_t position = header->written.load(std::memory_order_relaxed);
+  std::uint64_t offset = position % capacity;
+  std::uint64_t remaining = capacity - offset;
+  std::uint64_t skipped = recordSize > remaining ? remaining : 0;
+  header->reserved.store(position + skipped + recordSize,
+                         std::memory_order_relaxed);
+  // Consumers check the reserved position after reading a record
+  std::atomic_thread_fence(std::memory_order_release);
+  unsigned char *ring = file.Ring();
+  if (skipped > 0) {
+    if (remaining >= sizeof(SegmentFile::RecordHeader)) {
+      SegmentFile::RecordHeader skip{position, SegmentFile::padding, 0};
+      std::memcpy(ring + offset, &skip, sizeof(skip));
+    }
+    position += skipped;
+    offset = 0;
+  }
+  SegmentFile::RecordHeader record{position, size, timestamp};
+  std::memcpy(ring + offset, &record, sizeof(record));
+  std::memcpy(ring + offset + sizeof(record), buffer, size);
+  header->written.store(position + recordSize, std::memory_order_release);
+  return true;
+}
+
+SegmentConsumer::SegmentConsumer(std::string const &path) : path(path) {}
+
+bool SegmentConsumer::OpenFile() {
+  if (not file.Open(path)) {
+    return false;
+  }
+  readPosition = file.Header()->written.load(std::memory_order_acquire);
+  replacedCheck = std::chrono::steady_clock::now();
+  return true;
+}
+
+std::unique_ptr<TransportMessage> SegmentConsumer::ReceiveMessage(int timeout) {
+  if (not consuming) {
+    return nullptr;
+  }
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(std::max(timeout, 0));
+  while (true) {
+    if (file.IsOpen() or OpenFile()) {
+      auto message = ReadMessage();
+      if (nullptr != message) {
+        return message;
+      }
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (file.IsOpen() and now - replacedCheck >= replacedCheckInterval) {
+      replacedCheck = now;
+      if (file.IsReplaced(path)) {
+        file.Close();
+        continue;
+      }
+    }
+    if (now >= deadline) {
+      return nullptr;
+    }
+    // The producer may be in another process, so there is nothing to wait on
+    std::this_thread::sleep_for(std::min(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::milliseconds(1)),
+        deadline - now));
+  }
+}
+
+std::unique_ptr<TransportMessage> SegmentConsumer::ReadMessage() {
+  auto header = file.Header();
+  std::uint64_t capacity = header->capacity;
+  const unsigned char *ring = file.Ring();
+  while (true) {
+    std::uint64_t written = header->written.load(std::memory_order_acquire);
+    if (written == readPosition) {
+      return nullptr;
+    }
+    if (written < readPosition or written - readPosition > capacity) {
+      // Restarted producer or overwritten records, skip to the newest
+      readPosition = written;
+      return nullptr;
+    }
+    std::uint64_t offset = readPosition % capacity;
+    std::uint64_t remaining = capacity - offset;
+    if (remaining < sizeof(SegmentFile::RecordHeader)) {
+      readPosition += remaining;
+      continue;
+    }
+    SegmentFile::RecordHeader record;
+    std::memcpy(&record, ring + offset, sizeof(record));
+    if (record.position != readPosition) {
+      readPosition = written;
+      return nullptr;
+    }
+    if (SegmentFile::padding == record.payloadSize) {
+      readPosition += remaining;
+      continue;
+    }
+    if (SegmentFile::RecordSize(record.payloadSize) > remaining) {
+      readPosition = written;
+      return nullptr;
+    }
+    std::unique_ptr<TransportMessage> message(new SegmentMessage(
+        ring + offset + sizeof(record), record.payloadSize));
+    // Discard the copy if the producer has started to overwrite the record
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->reserved.load(std::memory_order_relaxed) >
+        readPosition + capacity) {
+      readPosition = header->written.load(std::memory_order_acquire);
+      return nullptr;
+    }
+    readPosition += SegmentFile::RecordSize(record.payloadSize);
+    return message;
+  }
+}
+
+void SegmentConsumer::StartConsumption() { consuming = true; }
+
+void SegmentConsumer::StopConsumption() { consuming = false; }
+} // namespace KafkaInterface
@@ -0,0 +1,188 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  SegmentTransport.h
+ *  @brief Header file of the back-end which passes messages through a memory
+ * mapped segment file, e.g. between IOCs on the same host.
+ */
+
+#pragma once
+
+#include "Transport.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+namespace KafkaInterface {
+
+/** @brief A ring of messages in a memory mapped file (a segment), written by
+ * one SegmentProducer and read by any number of SegmentConsumer:s which may
+ * be in other processes.
+ * The producer never waits for the consumers. A consumer which falls more
+ * than the size of the ring behind skips to the newest message, the driver
+ * counts the arrays lost this way from their sequence numbers. Records never
+ * wrap around the end of the ring, the space left at the end is skipped.
+ * @note This class is not thread safe.
+ */
+class SegmentFile {
+public:
+  SegmentFile() = default;
+
+  /// @brief Unmaps and closes the file.
+  ~SegmentFile();
+
+  SegmentFile(SegmentFile const &) = delete;
+  SegmentFile &operator=(SegmentFile const &) = delete;
+
+  /** @brief Opens a segment file for writing, creating it if needed.
+   * An existing segment of the same size is re-used so that its consumers
+   * keep their positions. Otherwise a new file replaces it, the consumers
+   * detect this and re-open the file.
+   * @param[in] path Path to the segment file.
+   * @param[in] sizeBytes Size of the file.
+   * @return True on success, false otherwise. See SegmentFile::GetError().
+   */
+  bool Create(std::string const &path, std::uint64_t sizeBytes);
+
+  /** @brief Opens an existing segment file for reading.
+   * @param[in] path Path to the segment file.
+   * @return True on success, false otherwise. See SegmentFile::GetError().
+   */
+  bool Open(std::string const &path);
+
+  /// @brief Unmaps and closes the file.
+  void Close();
+
+  /// @brief Returns true if a file is open.
+  bool IsOpen() const;
+
+  /** @brief Returns true if the file at the path given to
+   * SegmentFile::Open() has been replaced by another file.
+   */
+  bool IsReplaced(std::string const &path) const;
+
+  /// @brief Describes the last error encountered.
+  std::string GetError() const;
+
+  /// @brief Stored at the start of the file.
+  struct FileHeader {
+    char magic[8];
+    std::uint64_t version;
+
+    /// @brief Size of the ring in bytes.
+    std::uint64_t capacity;
+
+    /// @brief Set by the producer before it writes up to this position.
+    std::atomic<std::uint64_t> reserved;
+
+    /// @brief Set by the producer once it has written up to this position.
+    std::atomic<std::uint64_t> written;
+  };
+
+  /** @brief Stored in front of every message. The positions count all bytes
+   * written to the ring.
+   */
+  struct RecordHeader {
+    /// @brief Position of the record, used to detect overwritten records.
+    std::uint64_t position;
+
+    /// @brief Size of the payload, SegmentFile::padding at the end of the
+    /// ring.
+    std::uint64_t payloadSize;
+
+    std::int64_t timestamp;
+  };
+
+  /// @brief Marks the space skipped at the end of the ring.
+  static const std::uint64_t padding{~std::uint64_t(0)};
+
+  /// @brief Size of a record including padding for alignment.
+  static std::uint64_t RecordSize(std::uint64_t payloadSize);
+
+  /// @brief Returns the header at the start of the mapped file.
+  FileHeader *Header() const;
+
+  /// @brief Returns the ring, following the header.
+  unsigned char *Ring() const;
+
+private:
+  /// @brief Maps an open file, closing the file descriptor on failure.
+  bool Map(int fd, std::uint64_t sizeBytes, bool writable);
+
+  /// @brief Offset of the ring in the file.
+  static const std::uint64_t dataStart{64};
+
+  /// @brief File descriptor of the segment file, -1 if not open.
+  int fileDescriptor{-1};
+
+  /// @brief Start of the memory mapped file.
+  unsigned char *mappedFile{nullptr};
+
+  /// @brief Size of the memory mapped file in bytes.
+  std::uint64_t fileSize{0};
+
+  /// @brief Description of the last error.
+  std::string errorString;
+};
+
+/// @brief Writes messages to a segment file.
+class SegmentProducer : public TransportProducer {
+public:
+  /** @brief Opens (or creates) the segment file, see SegmentFile::Create().
+   * @return True on success, false otherwise. Messages are dropped while no
+   * file is open.
+   */
+  bool Open(std::string const &path, std::uint64_t sizeBytes);
+
+  /** @brief Writes a copy of the message to the segment file.
+   * Messages larger than half of the ring are dropped and the headers are
+   * not written.
+   */
+  bool SendMessage(const unsigned char *buffer, size_t size,
+                   std::int64_t timestamp, MessageHeaders const &headers,
+                   std::uint64_t arrays = 1) override;
+
+private:
+  SegmentFile file;
+
+  /// @brief The plugin may send from several threads.
+  std::mutex writeMutex;
+};
+
+/// @brief Reads messages from a segment file.
+class SegmentConsumer : public TransportConsumer {
+public:
+  /** @brief The file is opened once it exists, starting with the next
+   * message written to it.
+   * @param[in] path Path to the segment file.
+   */
+  explicit SegmentConsumer(std::string const &path);
+
+  std::unique_ptr<TransportMessage> ReceiveMessage(int timeout) override;
+
+  /** @brief Starts the consumption of messages. Messages written while the
+   * consumption was stopped are read unless they have been overwritten.
+   */
+  void StartConsumption() override;
+
+  void StopConsumption() override;
+
+private:
+  /// @brief Reads the message at the read position, if it is complete.
+  std::unique_ptr<TransportMessage> ReadMessage();
+
+  /// @brief (Re-)opens the file, returns false if it can not be opened.
+  bool OpenFile();
+
+  std::string path;
+  SegmentFile file;
+
+  /// @brief Position of the next record to read.
+  std::uint64_t readPosition{0};
+
+  /// @brief When the file was last checked for having been replaced.
+  std::chrono::steady_clock::time_point replacedCheck;
+
+  std::atomic_bool consuming{false};
+};
+} // namespace KafkaInterface
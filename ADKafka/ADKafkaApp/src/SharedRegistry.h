@@ -0,0 +1,41 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  SharedRegistry.h
+ *  @brief Header file of a helper which shares objects between the plugin and
+ * the driver libraries of an IOC.
+ */
+
+#pragma once
+
+#include <registryFunction.h>
+
+namespace KafkaInterface {
+
+/// @brief Returns the instance of T belonging to the calling library.
+template <typename T> T *LibraryInstance() {
+  static T instance;
+  return &instance;
+}
+
+/** @brief Returns an object shared by all the libraries of the IOC.
+ * The plugin and the driver libraries both contain this code and thus their
+ * own instance of T. The first library calling this function registers a
+ * function returning its instance in the EPICS function registry, which is
+ * part of EPICS base and exists once per process. All libraries use that
+ * instance from then on, without relying on the dynamic linker resolving
+ * their symbols to the same definition. T must thus be the same in all
+ * libraries, i.e. they must be built from the same sources.
+ * @param[in] name Name of the registry entry, unique for each T.
+ * @return The shared instance of T.
+ */
+template <typename T> T &SharedInstance(const char *name) {
+  REGISTRYFUNCTION function = registryFunctionFind(name);
+  if (nullptr == function) {
+    // Fails if another library or thread was first, which is fine
+    registryFunctionAdd(
+        name, reinterpret_cast<REGISTRYFUNCTION>(&LibraryInstance<T>));
+    function = registryFunctionFind(name);
+  }
+  return *reinterpret_cast<T *(*)()>(function)();
+}
+} // namespace KafkaInterface
@@ -0,0 +1,210 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  StageTrace.cpp
+ *  @brief Implementation of the low overhead timing of the stages of
+ * processing an array.
+ */
+
+#include "StageTrace.h"
+#include "SharedRegistry.h"
+#include <algorithm>
+#include <ciso646>
+#include <mutex>
+#include <thread>
+
+namespace KafkaInterface {
+
+namespace {
+/// @brief Weight of a new value in the moving averages.
+const double averageWeight = 1.0 / 64;
+
+double CalibrateTicks() {
+  using Clock = std::chrono::steady_clock;
+  auto startTime = Clock::now();
+  std::uint64_t startTicks = ReadTicks();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  auto endTime = Clock::now();
+  std::uint64_t endTicks = ReadTicks();
+  std::chrono::duration<double> elapsed = endTime - startTime;
+  return (endTicks - startTicks) / elapsed.count();
+}
+} // namespace
+
+double TicksPerSecond() {
+  static const double ticksPerSecond = CalibrateTicks();
+  return ticksPerSecond;
+}
+
+/// @brief The traces of the IOC, shared by the plugins and the drivers.
+struct StageTrace::Registry {
+  std::mutex mutex;
+  std::vector<StageTrace *> traces;
+};
+
+StageTrace::Registry &StageTrace::GetRegistry() {
+  return SharedInstance<Registry>("KafkaStageTraces");
+}
+
+StageTrace::StageTrace(std::string const &name,
+                       std::vector<std::string> const &stageNames,
+                       size_t capacity)
+    : name(name),
+      stages(stageNames.begin(),
+             stageNames.begin() + std::min(stageNames.size(), maxTraceStages)),
+      ticksPerSecond(TicksPerSecond()) {
+  size_t size = 1;
+  while (size < capacity) {
+    size *= 2;
+  }
+  ring.reset(new Entry[size]);
+  mask = size - 1;
+  for (size_t i = 0; i < size; i++) {
+    for (auto &stageTicks : ring[i].ticks) {
+      stageTicks.store(0, std::memory_order_relaxed);
+    }
+  }
+  for (auto &average : averages) {
+    average.store(0.0, std::memory_order_relaxed);
+  }
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.traces.push_back(this);
+}
+
+StageTrace::~StageTrace() {
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto &traces = registry.traces;
+  traces.erase(std::remove(traces.begin(), traces.end(), this), traces.end());
+}
+
+void StageTrace::Record(StageTimes const &times, std::int64_t frameId) {
+  std::uint64_t total = ReadTicks() - times.start;
+  std::uint64_t index = head.load(std::memory_order_relaxed);
+  Entry &entry = ring[index & mask];
+  entry.frameId.store(frameId, std::memory_order_relaxed);
+  entry.start.store(times.start, std::memory_order_relaxed);
+  entry.total.store(total, std::memory_order_relaxed);
+  for (size_t i = 0; i < stages.size(); i++) {
+    entry.ticks[i].store(times.ticks[i], std::memory_order_relaxed);
+    double average = averages[i].load(std::memory_order_relaxed);
+    averages[i].store(average + (times.ticks[i] - average) * averageWeight,
+                      std::memory_order_relaxed);
+  }
+  auto &totalAverage = averages[stages.size()];
+  double average = totalAverage.load(std::memory_order_relaxed);
+  totalAverage.store(average + (total - average) * averageWeight,
+                     std::memory_order_relaxed);
+  head.store(index + 1, std::memory_order_release);
+}
+
+double StageTrace::GetAverageUs(size_t stage) const {
+  if (stage > stages.size()) {
+    return 0.0;
+  }
+  return ToMicroseconds(averages[stage].load(std::memory_order_relaxed));
+}
+
+size_t StageTrace::GetStages() const { return stages.size(); }
+
+std::uint64_t StageTrace::GetRecorded() const {
+  return head.load(std::memory_order_acquire);
+}
+
+bool StageTrace::PublishDue() {
+  std::uint64_t now = ReadTicks();
+  if (now < nextPublish) {
+    return false;
+  }
+  nextPublish = now + static_cast<std::uint64_t>(ticksPerSecond);
+  return true;
+}
+
+double StageTrace::ToMicroseconds(double ticks) const {
+  return ticks * 1e6 / ticksPerSecond;
+}
+
+void StageTrace::Dump(std::FILE *file, size_t records) const {
+  std::uint64_t end = head.load(std::memory_order_acquire);
+  // The oldest entry is the next one to be overwritten
+  std::uint64_t first = end - std::min<std::uint64_t>({end, records, mask});
+  struct Copy {
+    std::int64_t frameId;
+    std::uint64_t start;
+    std::uint64_t total;
+    std::uint64_t ticks[maxTraceStages];
+  };
+  std::vector<Copy> copies;
+  copies.reserve(end - first);
+  for (std::uint64_t i = first; i < end; i++) {
+    Entry const &entry = ring[i & mask];
+    Copy copy;
+    copy.frameId = entry.frameId.load(std::memory_order_relaxed);
+    copy.start = entry.start.load(std::memory_order_relaxed);
+    copy.total = entry.total.load(std::memory_order_relaxed);
+    for (size_t j = 0; j < stages.size(); j++) {
+      copy.ticks[j] = entry.ticks[j].load(std::memory_order_relaxed);
+    }
+    copies.push_back(copy);
+  }
+  // Leave out the entries that may have been overwritten while copying
+  std::atomic_thread_fence(std::memory_order_acquire);
+  std::uint64_t newEnd = head.load(std::memory_order_relaxed);
+  size_t skip = 0;
+  if (newEnd - first > mask) {
+    skip = std::min<std::uint64_t>(copies.size(), newEnd - first - mask);
+  }
+
+  std::fprintf(file, "Stage times of \"%s\" in us, %llu arrays recorded\n",
+               name.c_str(), static_cast<unsigned long long>(newEnd));
+  std::fprintf(file, "%12s %12s", "frame id", "start");
+  for (auto const &stage : stages) {
+    std::fprintf(file, " %12s", stage.c_str());
+  }
+  std::fprintf(file, " %12s\n", "total");
+  std::fprintf(file, "%12s %12s", "average", "");
+  for (size_t j = 0; j <= stages.size(); j++) {
+    std::fprintf(file, " %12.1f", GetAverageUs(j));
+  }
+  std::fprintf(file, "\n");
+  if (skip >= copies.size()) {
+    return;
+  }
+  // The start of an array is relative to the start of the first array
+  std::uint64_t firstStart = copies[skip].start;
+  for (size_t i = skip; i < copies.size(); i++) {
+    auto const &copy = copies[i];
+    std::fprintf(file, "%12lld %12.1f", static_cast<long long>(copy.frameId),
+                 ToMicroseconds(static_cast<double>(copy.start - firstStart)));
+    for (size_t j = 0; j < stages.size(); j++) {
+      std::fprintf(file, " %12.1f",
+                   ToMicroseconds(static_cast<double>(copy.ticks[j])));
+    }
+    std::fprintf(file, " %12.1f\n",
+                 ToMicroseconds(static_cast<double>(copy.total)));
+  }
+}
+
+bool StageTrace::Dump(std::FILE *file, std::string const &name,
+                      size_t records) {
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (auto trace : registry.traces) {
+    if (trace->name == name) {
+      trace->Dump(file, records);
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<std::string> StageTrace::GetNames() {
+  auto &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::vector<std::string> names;
+  for (auto trace : registry.traces) {
+    names.push_back(trace->name);
+  }
+  return names;
+}
+} // namespace KafkaInterface
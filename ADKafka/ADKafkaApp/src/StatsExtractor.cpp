@@ -0,0 +1,382 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  StatsExtractor.cpp
+ *  @brief Implementation of the function which extracts the values published
+ * as PV:s from the JSON statistics of librdkafka.
+ */
+
+#include "StatsExtractor.h"
+#include <algorithm>
+#include <ciso646>
+#include <cstdlib>
+#include <cstring>
+
+namespace KafkaInterface {
+
+namespace {
+/// @brief Deepest nesting of objects and arrays accepted.
+const int MaxDepth = 32;
+
+/// @brief Number of levels of keys kept, deeper keys are never looked at.
+const int PathDepth = 4;
+
+/// @brief Longest number which is converted, longer numbers are read as 0.
+const size_t MaxNumberLength = 32;
+
+/** @brief A string of the document, without the quotes. Escape sequences are
+ * not decoded, none of the keys looked for contain any.
+ */
+struct Token {
+  const char *begin{nullptr};
+  size_t size{0};
+
+  /// @brief Returns true if the string equals the given name.
+  bool Is(const char *name) const {
+    return size == std::strlen(name) and 0 == std::memcmp(begin, name, size);
+  }
+};
+
+/// @brief Values of a broker, used once the whole broker has been scanned.
+struct BrokerValues {
+  bool internal{false};
+  bool up{false};
+  std::int64_t outbufCount{0};
+  double rttAvg{0.0};
+  double rttP99{0.0};
+  double intLatencyAvg{0.0};
+  double throttleAvg{0.0};
+};
+
+/// @brief Values of a topic, used once the whole topic has been scanned.
+struct TopicValues {
+  double batchSizeAvg{0.0};
+  double batchSizeCount{0.0};
+  double batchCountAvg{0.0};
+};
+
+/** @brief Recursive descent scanner of a JSON document which only stores the
+ * values which are in KafkaStatistics. Keeps the keys leading to the current
+ * value as pointers into the document.
+ */
+class Scanner {
+public:
+  Scanner(const char *json, size_t size, KafkaStatistics &stats)
+      : pos(json), end(json + size), stats(stats) {}
+
+  /// @brief Scans the whole document, returns false if it is invalid.
+  bool Scan() {
+    if (not Value(0)) {
+      return false;
+    }
+    SkipWhitespace();
+    if (pos != end) {
+      return false;
+    }
+    if (batches > 0.0) {
+      stats.batchSizeAvg = batchSizeSum / batches;
+      stats.batchCountAvg = batchCountSum / batches;
+    }
+    return true;
+  }
+
+private:
+  /** @brief Scans a value.
+   * @param[in] depth Number of objects and arrays containing the value.
+   */
+  bool Value(int depth) {
+    SkipWhitespace();
+    if (pos == end) {
+      return false;
+    }
+    switch (*pos) {
+    case '{':
+      return Object(depth);
+    case '[':
+      return Array(depth);
+    case '"': {
+      Token value;
+      if (not String(value)) {
+        return false;
+      }
+      StoreString(depth, value);
+      return true;
+    }
+    case 't':
+      return Literal("true");
+    case 'f':
+      return Literal("false");
+    case 'n':
+      return Literal("null");
+    default:
+      return Number(depth);
+    }
+  }
+
+  bool Object(int depth) {
+    if (depth >= MaxDepth) {
+      return false;
+    }
+    ++pos;
+    bool isBroker = IsBroker(depth);
+    bool isTopic = IsTopic(depth);
+    if (isBroker) {
+      broker = BrokerValues();
+    } else if (isTopic) {
+      topic = TopicValues();
+    }
+    SkipWhitespace();
+    if (pos != end and '}' == *pos) {
+      ++pos;
+    } else {
+      while (true) {
+        SkipWhitespace();
+        Token key;
+        if (not String(key)) {
+          return false;
+        }
+        if (depth < PathDepth) {
+          path[depth] = key;
+        }
+        SkipWhitespace();
+        if (pos == end or ':' != *pos) {
+          return false;
+        }
+        ++pos;
+        if (not Value(depth + 1)) {
+          return false;
+        }
+        SkipWhitespace();
+        if (pos == end) {
+          return false;
+        }
+        if ('}' == *pos++) {
+          break;
+        }
+        if (',' != pos[-1]) {
+          return false;
+        }
+      }
+    }
+    if (isBroker) {
+      StoreBroker();
+    } else if (isTopic) {
+      StoreTopic();
+    }
+    return true;
+  }
+
+  bool Array(int depth) {
+    if (depth >= MaxDepth) {
+      return false;
+    }
+    ++pos;
+    if (depth < PathDepth) {
+      path[depth] = Token();
+    }
+    SkipWhitespace();
+    if (pos != end and ']' == *pos) {
+      ++pos;
+      return true;
+    }
+    while (true) {
+      if (not Value(depth + 1)) {
+        return false;
+      }
+      SkipWhitespace();
+      if (pos == end) {
+        return false;
+      }
+      if (']' == *pos++) {
+        return true;
+      }
+      if (',' != pos[-1]) {
+        return false;
+      }
+    }
+  }
+
+  bool String(Token &string) {
+    if (pos == end or '"' != *pos) {
+      return false;
+    }
+    string.begin = ++pos;
+    while (pos != end and '"' != *pos) {
+      if ('\\' == *pos and ++pos == end) {
+        return false;
+      }
+      ++pos;
+    }
+    if (pos == end) {
+      return false;
+    }
+    string.size = static_cast<size_t>(pos - string.begin);
+    ++pos;
+    return true;
+  }
+
+  bool Number(int depth) {
+    const char *begin = pos;
+    bool integer = true;
+    if (pos != end and '-' == *pos) {
+      ++pos;
+    }
+    if (not SkipDigits()) {
+      return false;
+    }
+    if (pos != end and '.' == *pos) {
+      ++pos;
+      integer = false;
+      if (not SkipDigits()) {
+        return false;
+      }
+    }
+    if (pos != end and ('e' == *pos or 'E' == *pos)) {
+      ++pos;
+      integer = false;
+      if (pos != end and ('+' == *pos or '-' == *pos)) {
+        ++pos;
+      }
+      if (not SkipDigits()) {
+        return false;
+      }
+    }
+    size_t length = static_cast<size_t>(pos - begin);
+    if (length >= MaxNumberLength) {
+      return true;
+    }
+    // The conversion functions require a null terminated string
+    char buffer[MaxNumberLength];
+    std::memcpy(buffer, begin, length);
+    buffer[length] = '\0';
+    double real = std::strtod(buffer, nullptr);
+    std::int64_t whole = integer ? std::strtoll(buffer, nullptr, 10)
+                                 : static_cast<std::int64_t>(real);
+    StoreNumber(depth, real, whole);
+    return true;
+  }
+
+  bool Literal(const char *word) {
+    size_t length = std::strlen(word);
+    if (static_cast<size_t>(end - pos) < length or
+        0 != std::memcmp(pos, word, length)) {
+      return false;
+    }
+    pos += length;
+    return true;
+  }
+
+  bool SkipDigits() {
+    const char *begin = pos;
+    while (pos != end and *pos >= '0' and *pos <= '9') {
+      ++pos;
+    }
+    return pos != begin;
+  }
+
+  void SkipWhitespace() {
+    while (pos != end and
+           (' ' == *pos or '\n' == *pos or '\r' == *pos or '\t' == *pos)) {
+      ++pos;
+    }
+  }
+
+  /// @brief Returns true if an object at the given depth is a broker.
+  bool IsBroker(int depth) const {
+    return 2 == depth and path[0].Is("brokers");
+  }
+
+  /// @brief Returns true if an object at the given depth is a topic.
+  bool IsTopic(int depth) const { return 2 == depth and path[0].Is("topics"); }
+
+  void StoreString(int depth, Token const &value) {
+    if (3 == depth and path[0].Is("brokers")) {
+      if (path[2].Is("state")) {
+        broker.up = value.Is("UP");
+      } else if (path[2].Is("source")) {
+        broker.internal = value.Is("internal");
+      }
+    }
+  }
+
+  void StoreNumber(int depth, double real, std::int64_t whole) {
+    if (1 == depth) {
+      if (path[0].Is("ts")) {
+        stats.timestamp = whole;
+      } else if (path[0].Is("msg_cnt")) {
+        stats.messagesInQueue = whole;
+      } else if (path[0].Is("txmsgs")) {
+        stats.txMessages = whole;
+      } else if (path[0].Is("txmsg_bytes")) {
+        stats.txBytes = whole;
+      } else if (path[0].Is("msg_size")) {
+        stats.queuedBytes = whole;
+      }
+    } else if (3 == depth and path[0].Is("brokers")) {
+      if (path[2].Is("outbuf_cnt")) {
+        broker.outbufCount = whole;
+      }
+    } else if (4 == depth and path[0].Is("brokers")) {
+      if (path[2].Is("rtt")) {
+        if (path[3].Is("avg")) {
+          broker.rttAvg = real;
+        } else if (path[3].Is("p99")) {
+          broker.rttP99 = real;
+        }
+      } else if (path[2].Is("int_latency") and path[3].Is("avg")) {
+        broker.intLatencyAvg = real;
+      } else if (path[2].Is("throttle") and path[3].Is("avg")) {
+        broker.throttleAvg = real;
+      }
+    } else if (4 == depth and path[0].Is("topics")) {
+      if (path[2].Is("batchsize")) {
+        if (path[3].Is("avg")) {
+          topic.batchSizeAvg = real;
+        } else if (path[3].Is("cnt")) {
+          topic.batchSizeCount = real;
+        }
+      } else if (path[2].Is("batchcnt") and path[3].Is("avg")) {
+        topic.batchCountAvg = real;
+      }
+    }
+  }
+
+  void StoreBroker() {
+    ++stats.brokers;
+    stats.brokerUp = stats.brokerUp or broker.up;
+    if (broker.internal) {
+      return;
+    }
+    stats.outbufCount += broker.outbufCount;
+    stats.rttAvg = std::max(stats.rttAvg, broker.rttAvg);
+    stats.rttP99 = std::max(stats.rttP99, broker.rttP99);
+    stats.intLatencyAvg = std::max(stats.intLatencyAvg, broker.intLatencyAvg);
+    stats.throttleAvg = std::max(stats.throttleAvg, broker.throttleAvg);
+  }
+
+  void StoreTopic() {
+    batchSizeSum += topic.batchSizeAvg * topic.batchSizeCount;
+    batchCountSum += topic.batchCountAvg * topic.batchSizeCount;
+    batches += topic.batchSizeCount;
+  }
+
+  const char *pos;
+  const char *end;
+  KafkaStatistics &stats;
+
+  /// @brief Keys of the objects containing the current value, an empty key
+  /// for array elements.
+  Token path[PathDepth];
+
+  BrokerValues broker;
+  TopicValues topic;
+  double batchSizeSum{0.0};
+  double batchCountSum{0.0};
+  double batches{0.0};
+};
+} // namespace
+
+bool ExtractStatistics(const char *json, size_t size, KafkaStatistics &stats) {
+  Scanner scanner(json, size, stats);
+  return scanner.Scan();
+}
+} // namespace KafkaInterface
@@ -0,0 +1,187 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  TileAssembler.cpp
+ *  @brief Implementation of the class which assembles arrays sent as tiles
+ * into one NDArray.
+ */
+
+#include "TileAssembler.h"
+#include <algorithm>
+#include <ciso646>
+#include <iterator>
+#include <utility>
+
+namespace KafkaInterface {
+
+namespace {
+/** @brief Checks that a tile fits into the frame described by the first
+ * tile.
+ * @param[in] tile The tile to check.
+ * @param[in] first The first tile of the frame.
+ * @param[in] frameDims The dimensions of the frame.
+ * @return True if the tile has the data type of the first tile and its
+ * dimensions fit into the frame at its offset.
+ */
+bool TileFits(const FB_Tables::NDArray *tile, const FB_Tables::NDArray *first,
+              std::vector<size_t> const &frameDims) {
+  auto dims = tile->dims();
+  if (nullptr == dims or dims->size() != frameDims.size() or
+      tile->dataType() != first->dataType()) {
+    return false;
+  }
+  size_t last = frameDims.size() - 1;
+  for (size_t i = 0; i < last; i++) {
+    if (dims->Get(i) != frameDims[i]) {
+      return false;
+    }
+  }
+  return tile->tileOffset() <= frameDims[last] and
+         dims->Get(last) <= frameDims[last] - tile->tileOffset();
+}
+} // namespace
+
+const int TileAssembler::maxThreads;
+const size_t TileAssembler::maxPendingFrames;
+
+bool TileAssembler::AddTile(const FB_Tables::NDArray *tile,
+                            std::shared_ptr<void> owner) {
+  auto count = tile->tileCount();
+  auto index = tile->tileIndex();
+  if (0 == count or index >= count or nullptr == tile->frameDims() or
+      0 == tile->frameDims()->size()) {
+    return false;
+  }
+  auto frame = std::find_if(pendingFrames.begin(), pendingFrames.end(),
+                            [tile](Frame const &pending) {
+                              return pending.uniqueId == tile->id() and
+                                     pending.sequenceNumber ==
+                                         tile->sequenceNumber();
+                            });
+  if (pendingFrames.end() == frame) {
+    if (pendingFrames.size() >= maxPendingFrames) {
+      pendingFrames.pop_front();
+      ++incompleteFrames;
+    }
+    pendingFrames.emplace_back();
+    frame = std::prev(pendingFrames.end());
+    frame->uniqueId = tile->id();
+    frame->sequenceNumber = tile->sequenceNumber();
+    frame->tiles.assign(count, nullptr);
+    frame->owners.resize(count);
+  }
+  if (frame->tiles.size() != count or nullptr != frame->tiles[index]) {
+    return false;
+  }
+  frame->tiles[index] = tile;
+  frame->owners[index] = std::move(owner);
+  if (++frame->receivedTiles < count) {
+    return false;
+  }
+  completeFrame = std::move(*frame);
+  pendingFrames.erase(frame);
+  return true;
+}
+
+TileAssembler::FrameStatus
+TileAssembler::AssembleFrame(NDArrayPool *pNDArrayPool, NDArray *&pArray,
+                             bool widenFloats, bool verifyChecksums) {
+  pArray = nullptr;
+  // The tiles are released when returning
+  Frame frame = std::move(completeFrame);
+  completeFrame = Frame();
+  auto const &tiles = frame.tiles;
+  if (tiles.empty()) {
+    return FrameStatus::SKIPPED;
+  }
+  auto first = tiles.front();
+  std::vector<size_t> dims(first->frameDims()->begin(),
+                           first->frameDims()->end());
+  size_t last = dims.size() - 1;
+  // The offsets and rows of the tiles, which must cover every row of the
+  // frame exactly once
+  std::vector<std::pair<size_t, size_t>> tileRows;
+  tileRows.reserve(tiles.size());
+  for (auto tile : tiles) {
+    if (not TileFits(tile, first, dims)) {
+      return FrameStatus::SKIPPED;
+    }
+    tileRows.emplace_back(tile->tileOffset(), tile->dims()->Get(last));
+  }
+  std::sort(tileRows.begin(), tileRows.end());
+  size_t nextRow = 0;
+  for (auto const &rows : tileRows) {
+    if (rows.first != nextRow) {
+      return FrameStatus::SKIPPED;
+    }
+    nextRow += rows.second;
+  }
+  if (nextRow != dims[last]) {
+    return FrameStatus::SKIPPED;
+  }
+  pArray = AllocateArray(pNDArrayPool, first, dims, widenFloats);
+  if (nullptr == pArray) {
+    return FrameStatus::SKIPPED;
+  }
+  NDArrayInfo_t arrInfo;
+  pArray->getInfo(&arrInfo);
+  size_t rowElements = 0 == dims[last] ? 0 : arrInfo.nElements / dims[last];
+  keyframes.resize(tiles.size());
+
+  std::vector<FrameStatus> results(tiles.size(), FrameStatus::OK);
+  size_t usedThreads = std::min(static_cast<size_t>(threads), tiles.size());
+  // Tile i is decoded by thread i % usedThreads
+  auto decodeTiles = [&](size_t firstTile) {
+    for (size_t i = firstTile; i < tiles.size(); i += usedThreads) {
+      size_t elements = rowElements * tiles[i]->dims()->Get(last);
+      void *destination = static_cast<std::uint8_t *>(pArray->pData) +
+                          tiles[i]->tileOffset() * rowElements *
+                              arrInfo.bytesPerElement;
+      if (not DeSerializeArrayData(tiles[i], destination, elements,
+                                   &keyframes[i], widenFloats)) {
+        results[i] = FrameStatus::SKIPPED;
+      } else if (verifyChecksums and
+                 not VerifyChecksum(tiles[i], destination, pArray->dataType,
+                                    elements)) {
+        results[i] = FrameStatus::CHECKSUM_FAILED;
+      }
+    }
+  };
+  workers.Run(usedThreads, decodeTiles);
+
+  FrameStatus status = FrameStatus::OK;
+  for (auto result : results) {
+    if (FrameStatus::SKIPPED == result) {
+      status = result;
+      break;
+    } else if (FrameStatus::CHECKSUM_FAILED == result) {
+      status = result;
+    }
+  }
+  if (FrameStatus::OK != status) {
+    pArray->release();
+    pArray = nullptr;
+  }
+  return status;
+}
+
+bool TileAssembler::SetThreads(int threads) {
+  if (threads < 1 or threads > maxThreads) {
+    return false;
+  }
+  this->threads = threads;
+  workers.Shrink(threads - 1);
+  return true;
+}
+
+int TileAssembler::GetThreads() const { return threads; }
+
+std::uint64_t TileAssembler::GetIncompleteFrames() const {
+  return incompleteFrames;
+}
+
+void TileAssembler::Reset() {
+  pendingFrames.clear();
+  completeFrame = Frame();
+  keyframes.clear();
+}
+} // namespace KafkaInterface
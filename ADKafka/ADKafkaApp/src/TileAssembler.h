@@ -0,0 +1,122 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  TileAssembler.h
+ *  @brief Header file of the class which assembles arrays sent as tiles into
+ * one NDArray.
+ */
+
+#pragma once
+
+#include "NDArrayDeSerializer.h"
+#include "NDArray_schema_generated.h"
+#include "WorkerPool.h"
+#include <NDArray.h>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace KafkaInterface {
+
+/** @brief Collects the tiles of arrays split by the producer (see
+ * NDArraySerializer::SerializeTiles()) and assembles them into NDArrays.
+ * The tiles of a frame are kept until all of them have been received, after
+ * which they are decoded in parallel directly into their part of the
+ * assembled array. A few frames can be collected at the same time, as the
+ * tiles of consecutive frames may arrive out of order if they are sent to
+ * several partitions. Frames which are still incomplete when too many newer
+ * frames are being collected are discarded.
+ */
+class TileAssembler {
+public:
+  /// @brief The result of assembling a frame.
+  enum class FrameStatus {
+    OK,
+    SKIPPED,
+    CHECKSUM_FAILED,
+  };
+
+  TileAssembler() = default;
+
+  /** @brief Adds a received tile.
+   * @param[in] tile The tile, i.e. an NDArray flatbuffer table with a tile
+   * count larger than 0.
+   * @param[in] owner The object holding the buffer of the tile, e.g. the
+   * Kafka message. It is kept until the frame has been assembled.
+   * @return True if all tiles of the frame have been received, in which case
+   * TileAssembler::AssembleFrame() should be called. False otherwise,
+   * including if the tile is invalid or a duplicate.
+   */
+  bool AddTile(const FB_Tables::NDArray *tile, std::shared_ptr<void> owner);
+
+  /** @brief Assembles the frame completed by the last call to
+   * TileAssembler::AddTile(). The tiles are released afterwards.
+   * @param[in] pNDArrayPool The NDArrayPool used to allocate the NDArray.
+   * @param[out] pArray The assembled array, nullptr on failure. The caller
+   * must call NDArray::release() when the array is no longer needed.
+   * @param[in] widenFloats See DeSerializeData().
+   * @param[in] verifyChecksums If true, the checksum of each tile is
+   * verified.
+   * @return FrameStatus::SKIPPED if a tile could not be decoded (e.g. a delta
+   * encoded tile received before its keyframe) or if the tiles do not fit
+   * together, i.e. their rows overlap or leave a gap,
+   * FrameStatus::CHECKSUM_FAILED if the checksum of a tile did not match its
+   * data and FrameStatus::OK otherwise.
+   */
+  FrameStatus AssembleFrame(NDArrayPool *pNDArrayPool, NDArray *&pArray,
+                            bool widenFloats, bool verifyChecksums);
+
+  /** @brief Sets the number of threads used to decode the tiles of a frame.
+   * The threads are kept between frames, the ones no longer needed are
+   * stopped.
+   * @param[in] threads The number of threads, 1 to maxThreads.
+   * @return True on success, false otherwise.
+   */
+  bool SetThreads(int threads);
+
+  /// @brief Returns the number of threads used to decode tiles.
+  int GetThreads() const;
+
+  /// @brief Largest number of threads accepted by SetThreads().
+  static const int maxThreads = 64;
+
+  /// @brief Number of frames discarded as not all of their tiles arrived.
+  std::uint64_t GetIncompleteFrames() const;
+
+  /** @brief Discards all tiles and keyframes, e.g. when restarting
+   * consumption.
+   */
+  void Reset();
+
+private:
+  /// @brief The tiles of one frame.
+  struct Frame {
+    int uniqueId{0};
+    std::uint64_t sequenceNumber{0};
+    std::vector<const FB_Tables::NDArray *> tiles;
+    std::vector<std::shared_ptr<void>> owners;
+    size_t receivedTiles{0};
+  };
+
+  /// @brief Number of frames collected at the same time.
+  static const size_t maxPendingFrames = 4;
+
+  /// @brief The frames being collected, oldest first.
+  std::deque<Frame> pendingFrames;
+
+  /// @brief The last completed frame.
+  Frame completeFrame;
+
+  /// @brief The last keyframe of each tile index.
+  std::vector<KeyframeReference> keyframes;
+
+  /// @brief See TileAssembler::SetThreads().
+  int threads{4};
+
+  /// @brief Decode the tiles together with the thread assembling the frame.
+  WorkerPool workers;
+
+  /// @brief See TileAssembler::GetIncompleteFrames().
+  std::uint64_t incompleteFrames{0};
+};
+} // namespace KafkaInterface
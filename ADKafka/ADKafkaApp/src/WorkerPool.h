@@ -0,0 +1,88 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  WorkerPool.h
+ *  @brief Header file of the threads which process the tiles of an array in
+ * parallel.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace KafkaInterface {
+
+/** @brief Worker threads kept alive between frames, so that processing the
+ * tiles of a frame in parallel does not create and join a thread per tile.
+ * The threads are started by the first call to WorkerPool::Run() which needs
+ * them and are stopped by WorkerPool::Shrink() or when the pool is destroyed.
+ * The member functions must not be called at the same time from several
+ * threads, which the port driver lock of the owner takes care of.
+ */
+class WorkerPool {
+public:
+  WorkerPool() = default;
+
+  /// @brief Stops the worker threads.
+  ~WorkerPool();
+
+  WorkerPool(WorkerPool const &) = delete;
+  WorkerPool &operator=(WorkerPool const &) = delete;
+
+  /** @brief Calls a function once for each of tasks indexes in parallel and
+   * returns when all calls have returned. Index 0 is run by the calling
+   * thread and the others by the worker threads, of which tasks - 1 are
+   * started if there are not enough of them yet.
+   * @param[in] tasks The number of calls.
+   * @param[in] task The function, called with the index of the call.
+   */
+  void Run(size_t tasks, std::function<void(size_t)> const &task);
+
+  /** @brief Stops the worker threads above a number, e.g. when fewer threads
+   * are to be used.
+   * @param[in] workers The number of worker threads to keep.
+   */
+  void Shrink(size_t workers);
+
+  /// @brief Returns the number of worker threads started.
+  size_t GetWorkers() const;
+
+private:
+  /** @brief Runs the calls given to the worker by WorkerPool::Run() until it
+   * is stopped.
+   * @param[in] index The index of the worker, it runs the call index + 1.
+   * @param[in] seenRun The value of WorkerPool::runCount when the worker
+   * was started.
+   */
+  void ThreadFunction(size_t index, std::uint64_t seenRun);
+
+  /// @brief Protects the members below.
+  mutable std::mutex mutex;
+
+  /// @brief Wakes up the workers when there is work or they must stop.
+  std::condition_variable startCondition;
+
+  /// @brief Wakes up WorkerPool::Run() when the workers are done.
+  std::condition_variable doneCondition;
+
+  std::vector<std::thread> workers;
+
+  /// @brief Incremented by every call to WorkerPool::Run().
+  std::uint64_t runCount{0};
+
+  /// @brief The function and number of calls of the current run.
+  std::function<void(size_t)> const *currentTask{nullptr};
+  size_t currentTasks{0};
+
+  /// @brief Number of workers still running a call of the current run.
+  size_t busyWorkers{0};
+
+  /// @brief Workers with an index from this one on stop.
+  size_t workerLimit{SIZE_MAX};
+};
+} // namespace KafkaInterface
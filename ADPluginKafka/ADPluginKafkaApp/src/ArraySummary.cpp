@@ -0,0 +1,226 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ArraySummary.cpp
+ *  @brief Implementation of the function which copies array data while
+ * computing statistics and a checksum of it.
+ */
+
+#include "ArraySummary.h"
+#include "Crc32c.h"
+#include <algorithm>
+#include <ciso646>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#if defined(__x86_64__) and (defined(__GNUC__) or defined(__clang__))
+#define SUMMARY_AVX2
+#endif
+
+namespace KafkaInterface {
+
+namespace {
+/// @brief Size of the blocks processed at once, small enough to fit in the L1
+/// cache of most CPUs together with a copy of it.
+const size_t summaryBlockBytes = 8192;
+
+/** @brief Type used to sum the elements of one block.
+ * Integers are summed as integers just wide enough not to overflow for the
+ * number of elements in a block. Unlike doubles, this lets the compiler
+ * vectorize the loop.
+ */
+template <typename T>
+using BlockSum = typename std::conditional<
+    std::is_floating_point<T>::value, double,
+    typename std::conditional<
+        sizeof(T) <= 2,
+        typename std::conditional<std::is_signed<T>::value, std::int32_t,
+                                  std::uint32_t>::type,
+        typename std::conditional<std::is_signed<T>::value, std::int64_t,
+                                  std::uint64_t>::type>::type>::type;
+
+/** @brief Converts the threshold to the data type of the elements.
+ * Comparing elements with a limit of the same type is much faster than
+ * converting every element to a double.
+ * @param[in] threshold Elements larger than this are counted.
+ * @param[out] limit Elements larger than this are counted.
+ * @return False if all elements are larger than the threshold, i.e. if no
+ * limit of the type can be used.
+ */
+template <typename T> bool ThresholdToLimit(double threshold, T &limit) {
+  if (std::is_floating_point<T>::value) {
+    limit = static_cast<T>(threshold);
+    // Rounding must not change which elements are counted
+    if (static_cast<double>(limit) > threshold) {
+      limit = std::nextafter(limit, std::numeric_limits<T>::lowest());
+    }
+    return true;
+  }
+  // For integers, value > threshold is the same as value > floor(threshold)
+  double floorThreshold = std::floor(threshold);
+  if (floorThreshold < static_cast<double>(std::numeric_limits<T>::lowest())) {
+    return false;
+  }
+  if (floorThreshold >= static_cast<double>(std::numeric_limits<T>::max())) {
+    limit = std::numeric_limits<T>::max();
+  } else {
+    limit = static_cast<T>(floorThreshold);
+  }
+  return true;
+}
+
+/** @brief Updates the statistics with one block of elements.
+ * Written without branches so that the compiler can vectorize it.
+ */
+template <typename T>
+inline void SummarizeBlock(const T *values, size_t elements, T limit,
+                           T &minValue, T &maxValue, double &sum,
+                           std::uint64_t &aboveLimit) {
+  T blockMin = minValue;
+  T blockMax = maxValue;
+  BlockSum<T> blockSum = 0;
+  // A block has less than 2^32 elements
+  std::uint32_t blockAbove = 0;
+  for (size_t i = 0; i < elements; i++) {
+    T value = values[i];
+    // NaN compares false and is thus ignored by min and max
+    blockMin = value < blockMin ? value : blockMin;
+    blockMax = value > blockMax ? value : blockMax;
+    blockSum += value;
+    blockAbove += value > limit;
+  }
+  minValue = blockMin;
+  maxValue = blockMax;
+  sum += static_cast<double>(blockSum);
+  aboveLimit += blockAbove;
+}
+
+#ifdef SUMMARY_AVX2
+/** @brief SummarizeBlock() compiled for CPUs with AVX2, which among other
+ * things adds min/max instructions for all integer types.
+ */
+template <typename T>
+__attribute__((target("avx2"))) void
+SummarizeBlockAvx2(const T *values, size_t elements, T limit, T &minValue,
+                   T &maxValue, double &sum, std::uint64_t &aboveLimit) {
+  SummarizeBlock(values, elements, limit, minValue, maxValue, sum,
+                 aboveLimit);
+}
+
+bool HasAvx2() {
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+  return hasAvx2;
+}
+#endif
+
+template <typename T>
+void CopyAndSummarize(const void *source, void *destination, size_t elements,
+                      double threshold, bool statistics, bool checksum,
+                      ArraySummary &summary) {
+  auto sourceBytes = static_cast<const std::uint8_t *>(source);
+  auto destinationBytes = static_cast<std::uint8_t *>(destination);
+  const size_t blockElements = summaryBlockBytes / sizeof(T);
+  T minValue = std::numeric_limits<T>::max();
+  T maxValue = std::numeric_limits<T>::lowest();
+  double sum = 0.0;
+  std::uint64_t aboveThreshold = 0;
+  std::uint32_t crc = 0;
+  T limit{};
+  bool countAll = not ThresholdToLimit(threshold, limit);
+#ifdef SUMMARY_AVX2
+  const bool useAvx2 = HasAvx2();
+#endif
+  // Used if the data is not aligned for the data type
+  T alignedValues[summaryBlockBytes / sizeof(T)];
+  for (size_t start = 0; start < elements; start += blockElements) {
+    size_t count = std::min(blockElements, elements - start);
+    size_t bytes = count * sizeof(T);
+    const std::uint8_t *block = sourceBytes + start * sizeof(T);
+    if (nullptr != destinationBytes) {
+      std::memcpy(destinationBytes + start * sizeof(T), block, bytes);
+    }
+    if (statistics) {
+      auto values = reinterpret_cast<const T *>(block);
+      if (0 != reinterpret_cast<std::uintptr_t>(block) % alignof(T)) {
+        std::memcpy(alignedValues, block, bytes);
+        values = alignedValues;
+      }
+#ifdef SUMMARY_AVX2
+      if (useAvx2) {
+        SummarizeBlockAvx2(values, count, limit, minValue, maxValue, sum,
+                           aboveThreshold);
+      } else {
+        SummarizeBlock(values, count, limit, minValue, maxValue, sum,
+                       aboveThreshold);
+      }
+#else
+      SummarizeBlock(values, count, limit, minValue, maxValue, sum,
+                     aboveThreshold);
+#endif
+    }
+    if (checksum) {
+      crc = Crc32c(block, bytes, crc);
+    }
+  }
+  summary = ArraySummary();
+  if (statistics) {
+    if (minValue <= maxValue) {
+      summary.min = static_cast<double>(minValue);
+      summary.max = static_cast<double>(maxValue);
+    } else if (elements > 0) {
+      // All elements are NaN
+      summary.min = std::numeric_limits<double>::quiet_NaN();
+      summary.max = std::numeric_limits<double>::quiet_NaN();
+    }
+    summary.sum = sum;
+    summary.aboveThreshold = countAll ? elements : aboveThreshold;
+  }
+  if (checksum) {
+    summary.crc32c = crc;
+  }
+}
+} // namespace
+
+bool CopyAndSummarize(NDDataType_t dataType, const void *source,
+                      void *destination, size_t elements, double threshold,
+                      bool statistics, bool checksum, ArraySummary &summary) {
+  switch (dataType) {
+  case NDInt8:
+    CopyAndSummarize<epicsInt8>(source, destination, elements, threshold,
+                                statistics, checksum, summary);
+    return true;
+  case NDUInt8:
+    CopyAndSummarize<epicsUInt8>(source, destination, elements, threshold,
+                                 statistics, checksum, summary);
+    return true;
+  case NDInt16:
+    CopyAndSummarize<epicsInt16>(source, destination, elements, threshold,
+                                 statistics, checksum, summary);
+    return true;
+  case NDUInt16:
+    CopyAndSummarize<epicsUInt16>(source, destination, elements, threshold,
+                                  statistics, checksum, summary);
+    return true;
+  case NDInt32:
+    CopyAndSummarize<epicsInt32>(source, destination, elements, threshold,
+                                 statistics, checksum, summary);
+    return true;
+  case NDUInt32:
+    CopyAndSummarize<epicsUInt32>(source, destination, elements, threshold,
+                                  statistics, checksum, summary);
+    return true;
+  case NDFloat32:
+    CopyAndSummarize<epicsFloat32>(source, destination, elements, threshold,
+                                   statistics, checksum, summary);
+    return true;
+  case NDFloat64:
+    CopyAndSummarize<epicsFloat64>(source, destination, elements, threshold,
+                                   statistics, checksum, summary);
+    return true;
+  default:
+    summary = ArraySummary();
+    return false;
+  }
+}
+} // namespace KafkaInterface
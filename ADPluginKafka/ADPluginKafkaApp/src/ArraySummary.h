@@ -0,0 +1,55 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ArraySummary.h
+ *  @brief Header file of a function which copies array data while computing
+ * statistics and a checksum of it.
+ */
+
+#pragma once
+
+#include <NDArray.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace KafkaInterface {
+
+/// @brief Statistics and checksum of the data of an array.
+struct ArraySummary {
+  /// @brief Smallest element, NaN elements are ignored.
+  double min{0.0};
+
+  /// @brief Largest element, NaN elements are ignored.
+  double max{0.0};
+
+  /// @brief Sum of all elements.
+  double sum{0.0};
+
+  /// @brief Number of elements larger than the threshold.
+  std::uint64_t aboveThreshold{0};
+
+  /// @brief CRC32C of the data, see KafkaInterface::Crc32c().
+  std::uint32_t crc32c{0};
+};
+
+/** @brief Copies array data and computes statistics and/or a checksum of it
+ * in the same pass.
+ * The data is processed in blocks small enough to stay in the L1 cache. Each
+ * block is copied and then read again (from the cache) to compute the
+ * statistics and the checksum, instead of reading the whole array from memory
+ * once per operation.
+ * @param[in] dataType The data type of the elements.
+ * @param[in] source The array data.
+ * @param[out] destination Where to copy the data to, nullptr to only compute
+ * the statistics and/or the checksum. Must not overlap the source.
+ * @param[in] elements Number of elements in the array.
+ * @param[in] threshold Elements larger than this are counted.
+ * @param[in] statistics If true, the statistics are computed.
+ * @param[in] checksum If true, the checksum is computed.
+ * @param[out] summary The computed values, the others are set to 0.
+ * @return False if the data type is not supported, in which case nothing is
+ * copied or computed.
+ */
+bool CopyAndSummarize(NDDataType_t dataType, const void *source,
+                      void *destination, size_t elements, double threshold,
+                      bool statistics, bool checksum, ArraySummary &summary);
+} // namespace KafkaInterface
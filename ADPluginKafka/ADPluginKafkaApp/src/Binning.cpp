@@ -0,0 +1,166 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Binning.cpp
+ *  @brief Implementation of the function which reduces the resolution of
+ * array data.
+ */
+
+#include "Binning.h"
+#include <algorithm>
+#include <ciso646>
+#include <vector>
+
+#if defined(__x86_64__) and (defined(__GNUC__) or defined(__clang__))
+#define BINNING_AVX2
+#endif
+
+namespace KafkaInterface {
+
+namespace {
+/** @brief Sums rows of elements into a row of floats.
+ * Written without branches so that the compiler can vectorize it.
+ * @param[in] source The first row.
+ * @param[in] rowElements Number of elements between two rows.
+ * @param[in] rows Number of rows to sum.
+ * @param[out] sums The sum of each column.
+ * @param[in] columns Number of columns to sum.
+ */
+template <typename T>
+inline void SumRows(const T *source, size_t rowElements, size_t rows,
+                    float *sums, size_t columns) {
+  for (size_t x = 0; x < columns; x++) {
+    sums[x] = static_cast<float>(source[x]);
+  }
+  for (size_t y = 1; y < rows; y++) {
+    const T *row = source + y * rowElements;
+    for (size_t x = 0; x < columns; x++) {
+      sums[x] += static_cast<float>(row[x]);
+    }
+  }
+}
+
+#ifdef BINNING_AVX2
+/// @brief SumRows() compiled for CPUs with AVX2.
+template <typename T>
+__attribute__((target("avx2"))) void
+SumRowsAvx2(const T *source, size_t rowElements, size_t rows, float *sums,
+            size_t columns) {
+  SumRows(source, rowElements, rows, sums, columns);
+}
+
+bool HasAvx2() {
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+  return hasAvx2;
+}
+#endif
+
+template <typename T>
+void BinData(const T *source, void *destination, size_t width, size_t height,
+             size_t planes, size_t factor, BinningMode mode, size_t colors) {
+  const size_t xFactor = BinningFactor(width, factor);
+  const size_t yFactor = BinningFactor(height, factor);
+  const size_t binnedWidth = 0 == xFactor ? 0 : width / xFactor;
+  const size_t binnedHeight = 0 == yFactor ? 0 : height / yFactor;
+  // The colours of a pixel are next to each other in a row
+  const size_t rowElements = width * colors;
+  if (BinningMode::DECIMATE == mode) {
+    auto output = static_cast<T *>(destination);
+    for (size_t p = 0; p < planes; p++) {
+      for (size_t y = 0; y < binnedHeight; y++) {
+        const T *row = source + (p * height + y * yFactor) * rowElements;
+        for (size_t x = 0; x < binnedWidth; x++) {
+          for (size_t c = 0; c < colors; c++) {
+            *output++ = row[x * xFactor * colors + c];
+          }
+        }
+      }
+    }
+    return;
+  }
+  const float scale =
+      BinningMode::MEAN == mode ? 1.0f / (xFactor * yFactor) : 1.0f;
+  const size_t columns = binnedWidth * xFactor * colors;
+  std::vector<float> sums(columns);
+#ifdef BINNING_AVX2
+  const bool useAvx2 = HasAvx2();
+#endif
+  auto output = static_cast<float *>(destination);
+  for (size_t p = 0; p < planes; p++) {
+    for (size_t y = 0; y < binnedHeight; y++) {
+      const T *row = source + (p * height + y * yFactor) * rowElements;
+#ifdef BINNING_AVX2
+      if (useAvx2) {
+        SumRowsAvx2(row, rowElements, yFactor, sums.data(), columns);
+      } else {
+        SumRows(row, rowElements, yFactor, sums.data(), columns);
+      }
+#else
+      SumRows(row, rowElements, yFactor, sums.data(), columns);
+#endif
+      for (size_t x = 0; x < binnedWidth; x++) {
+        const float *block = sums.data() + x * xFactor * colors;
+        for (size_t c = 0; c < colors; c++) {
+          float sum = 0.0f;
+          for (size_t k = 0; k < xFactor; k++) {
+            sum += block[k * colors + c];
+          }
+          *output++ = sum * scale;
+        }
+      }
+    }
+  }
+}
+} // namespace
+
+size_t BinningFactor(size_t size, size_t factor) {
+  return std::min(size, factor);
+}
+
+NDDataType_t BinnedDataType(NDDataType_t dataType, BinningMode mode) {
+  return BinningMode::DECIMATE == mode ? dataType : NDFloat32;
+}
+
+bool BinData(NDDataType_t dataType, const void *source, void *destination,
+             size_t width, size_t height, size_t planes, size_t factor,
+             BinningMode mode, size_t colors) {
+  if (0 == factor or 0 == colors) {
+    return false;
+  }
+  switch (dataType) {
+  case NDInt8:
+    BinData(static_cast<const epicsInt8 *>(source), destination, width,
+            height, planes, factor, mode, colors);
+    return true;
+  case NDUInt8:
+    BinData(static_cast<const epicsUInt8 *>(source), destination, width,
+            height, planes, factor, mode, colors);
+    return true;
+  case NDInt16:
+    BinData(static_cast<const epicsInt16 *>(source), destination, width,
+            height, planes, factor, mode, colors);
+    return true;
+  case NDUInt16:
+    BinData(static_cast<const epicsUInt16 *>(source), destination, width,
+            height, planes, factor, mode, colors);
+    return true;
+  case NDInt32:
+    BinData(static_cast<const epicsInt32 *>(source), destination, width,
+            height, planes, factor, mode, colors);
+    return true;
+  case NDUInt32:
+    BinData(static_cast<const epicsUInt32 *>(source), destination, width,
+            height, planes, factor, mode, colors);
+    return true;
+  case NDFloat32:
+    BinData(static_cast<const epicsFloat32 *>(source), destination, width,
+            height, planes, factor, mode, colors);
+    return true;
+  case NDFloat64:
+    BinData(static_cast<const epicsFloat64 *>(source), destination, width,
+            height, planes, factor, mode, colors);
+    return true;
+  default:
+    return false;
+  }
+}
+} // namespace KafkaInterface
@@ -0,0 +1,67 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Binning.h
+ *  @brief Header file of a function which reduces the resolution of array
+ * data, e.g. for preview images.
+ */
+
+#pragma once
+
+#include <NDArray.h>
+#include <cstddef>
+
+namespace KafkaInterface {
+
+/// @brief How the elements of a block are combined by BinData().
+enum class BinningMode {
+  MEAN = 0,
+  SUM = 1,
+  DECIMATE = 2,
+};
+
+/** @brief Returns the binning factor actually used for a dimension, i.e. the
+ * factor limited to the size of the dimension.
+ * @param[in] size The size of the dimension.
+ * @param[in] factor The requested binning factor, at least 1.
+ */
+size_t BinningFactor(size_t size, size_t factor);
+
+/** @brief Returns the data type of data binned by BinData().
+ * @param[in] dataType The data type of the input data.
+ * @param[in] mode The binning mode.
+ * @return NDFloat32 for BinningMode::MEAN and BinningMode::SUM, the input
+ * data type for BinningMode::DECIMATE.
+ */
+NDDataType_t BinnedDataType(NDDataType_t dataType, BinningMode mode);
+
+/** @brief Bins the first two dimensions of array data, not counting the
+ * colour dimension of pixel interleaved data.
+ * Blocks of BinningFactor(width, factor) times BinningFactor(height, factor)
+ * elements are combined into one element. Elements which do not fill a
+ * whole block at the end of a row or column are ignored. All further
+ * dimensions, e.g. the frames of a stack, are binned separately. For
+ * BinningMode::MEAN and BinningMode::SUM, each block of rows is first summed
+ * into a row of floats, a loop which is compiled for AVX2 as well and
+ * selected at run time, and then the columns of that row are combined.
+ * BinningMode::DECIMATE keeps the first element of each block. The colours
+ * of pixel interleaved data (e.g. RGB1 arrays of dimensions [3, X, Y]) are
+ * binned separately.
+ * @param[in] dataType The data type of the input data.
+ * @param[in] source The input data.
+ * @param[out] destination The binned data, of the type returned by
+ * BinnedDataType().
+ * @param[in] width Size of the first dimension, in pixels.
+ * @param[in] height Size of the second dimension, 1 for one dimensional
+ * data.
+ * @param[in] planes Product of the sizes of all further dimensions.
+ * @param[in] factor The binning factor, at least 1.
+ * @param[in] mode How the elements of a block are combined.
+ * @param[in] colors Number of elements of each pixel, e.g. 3 for RGB1
+ * arrays of which the first dimension is the colour.
+ * @return False if the data type is not supported or the factor or the
+ * number of colours is 0.
+ */
+bool BinData(NDDataType_t dataType, const void *source, void *destination,
+             size_t width, size_t height, size_t planes, size_t factor,
+             BinningMode mode, size_t colors = 1);
+} // namespace KafkaInterface
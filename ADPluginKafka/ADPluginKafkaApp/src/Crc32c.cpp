@@ -0,0 +1,180 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Crc32c.cpp
+ *  @brief Implementation of the CRC32C (Castagnoli) checksum.
+ */
+
+#include "Crc32c.h"
+#include <ciso646>
+#include <cstring>
+
+#if defined(__x86_64__) and (defined(__GNUC__) or defined(__clang__))
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+namespace KafkaInterface {
+
+namespace {
+/// @brief The CRC32C polynomial in reversed bit order.
+const std::uint32_t crc32cPolynomial = 0x82F63B78;
+
+/// @brief Lookup tables used to process 8 bytes at a time ("slicing-by-8").
+struct Crc32cTables {
+  Crc32cTables() {
+    for (std::uint32_t i = 0; i < 256; i++) {
+      std::uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (crc32cPolynomial & (0 - (crc & 1)));
+      }
+      table[0][i] = crc;
+    }
+    for (std::uint32_t i = 0; i < 256; i++) {
+      for (int slice = 1; slice < 8; slice++) {
+        std::uint32_t previous = table[slice - 1][i];
+        table[slice][i] = (previous >> 8) ^ table[0][previous & 0xFF];
+      }
+    }
+  }
+  std::uint32_t table[8][256];
+};
+
+std::uint32_t Crc32cSoftware(std::uint32_t crc, const std::uint8_t *data,
+                             size_t size) {
+  static const Crc32cTables tables;
+  auto const &t = tables.table;
+  while (size > 0 and (reinterpret_cast<std::uintptr_t>(data) & 7) != 0) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+    size--;
+  }
+  while (size >= 8) {
+    // The table is built for little endian byte order
+    std::uint32_t low = crc ^ (std::uint32_t(data[0]) |
+                               std::uint32_t(data[1]) << 8 |
+                               std::uint32_t(data[2]) << 16 |
+                               std::uint32_t(data[3]) << 24);
+    crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^
+          t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^ t[3][data[4]] ^
+          t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    data += 8;
+    size -= 8;
+  }
+  while (size > 0) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+    size--;
+  }
+  return crc;
+}
+
+#ifdef CRC32C_SSE42
+/** @brief Bytes per stream when computing the checksum of three streams in
+ * parallel. The crc32 instruction has a latency of three cycles but can
+ * start a new computation every cycle.
+ */
+const size_t streamBytes = 256;
+
+/// @brief Multiplies two polynomials modulo the CRC32C polynomial.
+std::uint32_t MultiplyModP(std::uint32_t a, std::uint32_t b) {
+  std::uint32_t product = 0;
+  for (std::uint32_t mask = std::uint32_t(1) << 31; mask != 0; mask >>= 1) {
+    if (a & mask) {
+      product ^= b;
+    }
+    b = (b & 1) ? (b >> 1) ^ crc32cPolynomial : b >> 1;
+  }
+  return product;
+}
+
+/** @brief Lookup tables which shift a checksum past a fixed number of zero
+ * bytes, used to combine the checksums of consecutive streams.
+ */
+struct Crc32cShiftTable {
+  explicit Crc32cShiftTable(size_t bytes) {
+    // x^(8 * bytes) modulo the polynomial, x^0 being the highest bit
+    std::uint32_t xPower = std::uint32_t(1) << 31;
+    std::uint32_t xSquare = std::uint32_t(1) << 23; // x^8
+    for (size_t n = bytes; n != 0; n >>= 1) {
+      if (n & 1) {
+        xPower = MultiplyModP(xSquare, xPower);
+      }
+      xSquare = MultiplyModP(xSquare, xSquare);
+    }
+    for (std::uint32_t i = 0; i < 256; i++) {
+      for (int byte = 0; byte < 4; byte++) {
+        table[byte][i] = MultiplyModP(xPower, i << (8 * byte));
+      }
+    }
+  }
+  std::uint32_t Shift(std::uint32_t crc) const {
+    return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^
+           table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+  }
+  std::uint32_t table[4][256];
+};
+
+__attribute__((target("sse4.2"))) std::uint32_t
+Crc32cHardware(std::uint32_t crc, const std::uint8_t *data, size_t size) {
+  static const Crc32cShiftTable shiftOne(streamBytes);
+  static const Crc32cShiftTable shiftTwo(2 * streamBytes);
+  while (size > 0 and (reinterpret_cast<std::uintptr_t>(data) & 7) != 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+    size--;
+  }
+  std::uint64_t word;
+  while (size >= 3 * streamBytes) {
+    std::uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+    for (size_t i = 0; i < streamBytes; i += sizeof(word)) {
+      std::memcpy(&word, data + i, sizeof(word));
+      crc0 = _mm_crc32_u64(crc0, word);
+      std::memcpy(&word, data + streamBytes + i, sizeof(word));
+      crc1 = _mm_crc32_u64(crc1, word);
+      std::memcpy(&word, data + 2 * streamBytes + i, sizeof(word));
+      crc2 = _mm_crc32_u64(crc2, word);
+    }
+    crc = shiftTwo.Shift(static_cast<std::uint32_t>(crc0)) ^
+          shiftOne.Shift(static_cast<std::uint32_t>(crc1)) ^
+          static_cast<std::uint32_t>(crc2);
+    data += 3 * streamBytes;
+    size -= 3 * streamBytes;
+  }
+  std::uint64_t crc64 = crc;
+  while (size >= 8) {
+    std::memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    data += 8;
+    size -= 8;
+  }
+  crc = static_cast<std::uint32_t>(crc64);
+  while (size > 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+    size--;
+  }
+  return crc;
+}
+
+bool HasSse42() {
+  static const bool hasSse42 = __builtin_cpu_supports("sse4.2");
+  return hasSse42;
+}
+#endif
+} // namespace
+
+std::uint32_t Crc32c(const void *data, size_t size, std::uint32_t crc) {
+  auto bytes = static_cast<const std::uint8_t *>(data);
+  crc = ~crc;
+#ifdef CRC32C_SSE42
+  if (HasSse42()) {
+    return ~Crc32cHardware(crc, bytes, size);
+  }
+#endif
+  return ~Crc32cSoftware(crc, bytes, size);
+}
+
+bool Crc32cIsHardwareAccelerated() {
+#ifdef CRC32C_SSE42
+  return HasSse42();
+#else
+  return false;
+#endif
+}
+} // namespace KafkaInterface
@@ -0,0 +1,195 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  FloatConversion.cpp
+ *  @brief Implementation of the conversions between single precision floats
+ * and the float16 and bfloat16 formats.
+ */
+
+#include "FloatConversion.h"
+#include <ciso646>
+#include <cstring>
+
+#if defined(__x86_64__) and (defined(__GNUC__) or defined(__clang__))
+#define FLOAT_CONVERSION_X86
+#include <immintrin.h>
+#endif
+
+namespace KafkaInterface {
+
+namespace {
+inline std::uint32_t FloatBits(float value) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+inline float BitsFloat(std::uint32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/** @brief Converts one float to float16 bits.
+ * Based on the well known "float_to_half_fast3_rtne" algorithm by F. Giesen.
+ * NaN payloads are kept (truncated) and made quiet, as done by F16C.
+ */
+inline std::uint16_t FloatToHalfBits(float value) {
+  std::uint32_t bits = FloatBits(value);
+  std::uint32_t sign = bits & 0x80000000u;
+  bits ^= sign;
+  std::uint32_t result;
+  if (bits >= 0x47800000u) {
+    // Infinity, NaN or too large (>= 65536)
+    result = 0x7C00u;
+    if (bits > 0x7F800000u) {
+      result |= 0x200u | ((bits >> 13) & 0x3FFu);
+    }
+  } else if (bits < 0x38800000u) {
+    // Subnormal float16 or 0, let the FPU do the rounding
+    const std::uint32_t magic = ((127 - 15) + (23 - 10) + 1) << 23;
+    result = FloatBits(BitsFloat(bits) + BitsFloat(magic)) - magic;
+  } else {
+    std::uint32_t mantissaOdd = (bits >> 13) & 1;
+    bits += ((15u - 127u) << 23) + 0xFFFu + mantissaOdd;
+    result = bits >> 13;
+  }
+  return static_cast<std::uint16_t>(result | (sign >> 16));
+}
+
+/** @brief Converts float16 bits to a float, by F. Giesen ("fast5").
+ * Signaling NaN is made quiet, as done by F16C.
+ */
+inline float HalfBitsToFloat(std::uint16_t half) {
+  const float magic = BitsFloat((254u - 15u) << 23);
+  const float wasInfNan = BitsFloat((127u + 16u) << 23);
+  float value = BitsFloat((half & 0x7FFFu) << 13) * magic;
+  std::uint32_t bits = FloatBits(value);
+  if (value >= wasInfNan) {
+    bits |= 255u << 23;
+    if (bits != 0x7F800000u) {
+      bits |= 0x400000u;
+    }
+  }
+  return BitsFloat(bits | (std::uint32_t(half & 0x8000u) << 16));
+}
+
+/// @brief Converts one float to bfloat16 bits, NaN is kept as a quiet NaN.
+inline std::uint16_t FloatToBFloat16Bits(float value) {
+  std::uint32_t bits = FloatBits(value);
+  std::uint32_t rounded = (bits + 0x7FFFu + ((bits >> 16) & 1)) >> 16;
+  std::uint32_t quietNan = (bits >> 16) | 0x40u;
+  return static_cast<std::uint16_t>(
+      (bits & 0x7FFFFFFFu) > 0x7F800000u ? quietNan : rounded);
+}
+
+inline void FloatToHalfGeneric(const float *input, std::uint8_t *output,
+                               size_t elements) {
+  for (size_t i = 0; i < elements; i++) {
+    std::uint16_t half = FloatToHalfBits(input[i]);
+    std::memcpy(output + 2 * i, &half, sizeof(half));
+  }
+}
+
+inline void HalfToFloatGeneric(const std::uint8_t *input, float *output,
+                               size_t elements) {
+  for (size_t i = 0; i < elements; i++) {
+    std::uint16_t half;
+    std::memcpy(&half, input + 2 * i, sizeof(half));
+    output[i] = HalfBitsToFloat(half);
+  }
+}
+
+/// @brief Written without branches so that the compiler can vectorize it.
+inline void FloatToBFloat16Generic(const float *input, std::uint8_t *output,
+                                   size_t elements) {
+  for (size_t i = 0; i < elements; i++) {
+    std::uint16_t value = FloatToBFloat16Bits(input[i]);
+    std::memcpy(output + 2 * i, &value, sizeof(value));
+  }
+}
+
+#ifdef FLOAT_CONVERSION_X86
+__attribute__((target("avx,f16c"))) void
+FloatToHalfF16c(const float *input, std::uint8_t *output, size_t elements) {
+  size_t i = 0;
+  for (; i + 8 <= elements; i += 8) {
+    __m256 values = _mm256_loadu_ps(input + i);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output + 2 * i),
+                     _mm256_cvtps_ph(values, _MM_FROUND_TO_NEAREST_INT));
+  }
+  FloatToHalfGeneric(input + i, output + 2 * i, elements - i);
+}
+
+__attribute__((target("avx,f16c"))) void
+HalfToFloatF16c(const std::uint8_t *input, float *output, size_t elements) {
+  size_t i = 0;
+  for (; i + 8 <= elements; i += 8) {
+    __m128i values =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + 2 * i));
+    _mm256_storeu_ps(output + i, _mm256_cvtph_ps(values));
+  }
+  HalfToFloatGeneric(input + 2 * i, output + i, elements - i);
+}
+
+/// @brief FloatToBFloat16Generic() compiled for CPUs with AVX2.
+__attribute__((target("avx2"))) void
+FloatToBFloat16Avx2(const float *input, std::uint8_t *output,
+                    size_t elements) {
+  FloatToBFloat16Generic(input, output, elements);
+}
+
+bool HasF16c() {
+  static const bool hasF16c =
+      __builtin_cpu_supports("avx") and __builtin_cpu_supports("f16c");
+  return hasF16c;
+}
+
+bool HasAvx2() {
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+  return hasAvx2;
+}
+#endif
+} // namespace
+
+void FloatToHalf(const float *input, void *output, size_t elements) {
+  auto outputBytes = static_cast<std::uint8_t *>(output);
+#ifdef FLOAT_CONVERSION_X86
+  if (HasF16c()) {
+    FloatToHalfF16c(input, outputBytes, elements);
+    return;
+  }
+#endif
+  FloatToHalfGeneric(input, outputBytes, elements);
+}
+
+void HalfToFloat(const void *input, float *output, size_t elements) {
+  auto inputBytes = static_cast<const std::uint8_t *>(input);
+#ifdef FLOAT_CONVERSION_X86
+  if (HasF16c()) {
+    HalfToFloatF16c(inputBytes, output, elements);
+    return;
+  }
+#endif
+  HalfToFloatGeneric(inputBytes, output, elements);
+}
+
+void FloatToBFloat16(const float *input, void *output, size_t elements) {
+  auto outputBytes = static_cast<std::uint8_t *>(output);
+#ifdef FLOAT_CONVERSION_X86
+  if (HasAvx2()) {
+    FloatToBFloat16Avx2(input, outputBytes, elements);
+    return;
+  }
+#endif
+  FloatToBFloat16Generic(input, outputBytes, elements);
+}
+
+void BFloat16ToFloat(const void *input, float *output, size_t elements) {
+  auto inputBytes = static_cast<const std::uint8_t *>(input);
+  for (size_t i = 0; i < elements; i++) {
+    std::uint16_t value;
+    std::memcpy(&value, inputBytes + 2 * i, sizeof(value));
+    output[i] = BitsFloat(std::uint32_t(value) << 16);
+  }
+}
+} // namespace KafkaInterface
@@ -0,0 +1,55 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  FloatConversion.h
+ *  @brief Header file of functions which convert between single precision
+ * floating point numbers and the 16 bit float16 and bfloat16 formats.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace KafkaInterface {
+
+/** @brief Converts single precision floats to IEEE 754 half precision
+ * (float16), rounding to nearest even.
+ * Values too large for float16 (larger than 65504) become infinity and
+ * values smaller than about 6e-8 become 0. The F16C instructions are used if
+ * the CPU supports them (checked at run time).
+ * @param[in] input The values to convert.
+ * @param[out] output The converted values, 2 bytes each in native byte order.
+ * Does not need to be aligned.
+ * @param[in] elements Number of values to convert.
+ */
+void FloatToHalf(const float *input, void *output, size_t elements);
+
+/** @brief Converts IEEE 754 half precision floats (float16) to single
+ * precision. The conversion is exact.
+ * @param[in] input The values to convert, 2 bytes each in native byte order.
+ * Does not need to be aligned.
+ * @param[out] output The converted values.
+ * @param[in] elements Number of values to convert.
+ */
+void HalfToFloat(const void *input, float *output, size_t elements);
+
+/** @brief Converts single precision floats to bfloat16, rounding to nearest
+ * even.
+ * bfloat16 is the upper 16 bits of a single precision float, i.e. it has the
+ * same range but only 8 bits of precision.
+ * @param[in] input The values to convert.
+ * @param[out] output The converted values, 2 bytes each in native byte order.
+ * Does not need to be aligned.
+ * @param[in] elements Number of values to convert.
+ */
+void FloatToBFloat16(const float *input, void *output, size_t elements);
+
+/** @brief Converts bfloat16 values to single precision floats. The conversion
+ * is exact.
+ * @param[in] input The values to convert, 2 bytes each in native byte order.
+ * Does not need to be aligned.
+ * @param[out] output The converted values.
+ * @param[in] elements Number of values to convert.
+ */
+void BFloat16ToFloat(const void *input, float *output, size_t elements);
+} // namespace KafkaInterface
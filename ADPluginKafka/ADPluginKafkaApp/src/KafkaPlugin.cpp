@@ -15,6 +15,7 @@
 #include <epicsExport.h>
 
 #include "KafkaPlugin.h"
+#include "Probes.h"
 
 static const char *driverName = "KafkaPlugin";
 
@@ -24,27 +25,502 @@ void KafkaPlugin::processCallbacks(NDArray *pArray) {
   // and by the thread in non-blocking mode.
   /// @todo Check the order of these calls and if all of them are needed.
   NDArrayInfo_t arrayInfo;
+  StageTimes times;
 
   NDPluginDriver::beginProcessCallbacks(pArray);
 
   pArray->getInfo(&arrayInfo);
+  metrics.arrays.Add();
+  metrics.arrayBytes.Add(arrayInfo.totalBytes);
 
   unsigned char *bufferPtr;
   size_t bufferSize;
 
-  serializer.SerializeData(*pArray, bufferPtr, bufferSize);
+  std::int64_t timestamp = GetKafkaTimestamp(*pArray);
+  if (not previewTopic.empty()) {
+    QueuePreview(*pArray, timestamp);
+  }
+  setParam(this, paramsList.at(PV::preview_sent), int(previewsSent));
+  setParam(this, paramsList.at(PV::recorded_msgs),
+           static_cast<int>(recorder.GetRecords()));
+  // Skipped arrays are not part of the stream, so they do not use up a
+  // sequence number and are not counted as dropped
+  if (not rateLimiter.Allow(arrayInfo.totalBytes)) {
+    setParam(this, paramsList.at(PV::skipped_arrays),
+             static_cast<int>(rateLimiter.GetSkippedArrays()));
+    metrics.skippedArrays.Add();
+    callParamCallbacks();
+    return;
+  }
+  times.Mark(PREPARE);
+  KAFKA_PROBE2(serialize__start, pArray->uniqueId, arrayInfo.totalBytes);
+  ++sequenceNumber;
+  size_t tiles =
+      serializer.SerializeTiles(*pArray, sequenceNumber, droppedArrays);
+  times.Mark(SERIALIZE);
+  if (tiles > 0) {
+    KAFKA_PROBE2(serialize__end, pArray->uniqueId, 0);
+    // Arrays already in the batch are sent first to keep the order
+    SendBatch(false);
+    SendTiles(*pArray, tiles, timestamp);
+    times.Mark(SEND);
+    RecordStageTimes(times, *pArray);
+    callParamCallbacks();
+    return;
+  }
+  if (batchMaxArrays > 1) {
+    AddToBatch(*pArray, timestamp);
+    times.Mark(SERIALIZE);
+    KAFKA_PROBE2(serialize__end, pArray->uniqueId, 0);
+    RecordStageTimes(times, *pArray);
+    callParamCallbacks();
+    return;
+  }
+  serializer.SerializeData(*pArray, bufferPtr, bufferSize, sequenceNumber,
+                           droppedArrays);
+  if (sendHeaders) {
+    serializer.SerializeHeaders(*pArray, headerAttributes, headers);
+  } else {
+    headers.clear();
+  }
+  times.Mark(SERIALIZE);
+  KAFKA_PROBE2(serialize__end, pArray->uniqueId, bufferSize);
+  auto sendTransport = transport;
   this->unlock();
-  bool addToQueueSuccess = producer.SendKafkaPacket(bufferPtr, bufferSize);
+  bool addToQueueSuccess =
+      sendTransport->SendMessage(bufferPtr, bufferSize, timestamp, headers);
+  KAFKA_PROBE3(produce__enqueue, pArray->uniqueId, bufferSize,
+               addToQueueSuccess);
+  if (addToQueueSuccess) {
+    metrics.messages.Add();
+    metrics.messageBytes.Add(bufferSize);
+    RecordMessage(bufferPtr, bufferSize, timestamp, pArray->uniqueId);
+  }
+  times.Mark(SEND);
   this->lock();
+  times.Mark(RELOCK);
   if (not addToQueueSuccess) {
-    int droppedArrays;
-    getIntegerParam(NDPluginDriverDroppedArrays, &droppedArrays);
-    droppedArrays++;
-    setIntegerParam(NDPluginDriverDroppedArrays, droppedArrays);
+    AddDroppedArrays(1);
+    // The consumers can not decode deltas against a keyframe they never got
+    serializer.RequestKeyframe();
   }
+  AddEvictedArrays();
+  RecordStageTimes(times, *pArray);
   callParamCallbacks();
 }
 
+void KafkaPlugin::RecordStageTimes(StageTimes const &times,
+                                   NDArray const &pArray) {
+  stageTrace.Record(times, pArray.uniqueId);
+  metrics.processingTime.Observe((ReadTicks() - times.start) /
+                                 TicksPerSecond());
+  if (stageTrace.PublishDue()) {
+    setParam(this, paramsList.at(PV::time_prepare),
+             stageTrace.GetAverageUs(PREPARE));
+    setParam(this, paramsList.at(PV::time_serialize),
+             stageTrace.GetAverageUs(SERIALIZE));
+    setParam(this, paramsList.at(PV::time_send),
+             stageTrace.GetAverageUs(SEND));
+    setParam(this, paramsList.at(PV::time_relock),
+             stageTrace.GetAverageUs(RELOCK));
+    setParam(this, paramsList.at(PV::time_total),
+             stageTrace.GetAverageUs(STAGES));
+  }
+}
+
+void KafkaPlugin::AddDroppedArrays(std::uint64_t arrays) {
+  droppedArrays += arrays;
+  metrics.droppedArrays.Add(arrays);
+  int droppedArraysPV;
+  getIntegerParam(NDPluginDriverDroppedArrays, &droppedArraysPV);
+  droppedArraysPV += static_cast<int>(arrays);
+  setIntegerParam(NDPluginDriverDroppedArrays, droppedArraysPV);
+}
+
+void KafkaPlugin::AddEvictedArrays() {
+  std::uint64_t evictedArrays = producer.TakeEvictedArrays();
+  if (evictedArrays > 0) {
+    AddDroppedArrays(evictedArrays);
+    serializer.RequestKeyframe();
+  }
+}
+
+KafkaPlugin::Metrics::Metrics(MetricsSet &set)
+    : arrays(set.AddCounter("adkafka_plugin_arrays_total",
+                            "Arrays received by the plugin.")),
+      arrayBytes(set.AddCounter("adkafka_plugin_array_bytes_total",
+                                "Bytes of array data received by the plugin.")),
+      messages(set.AddCounter("adkafka_plugin_messages_total",
+                              "Messages handed to the back-end.")),
+      messageBytes(set.AddCounter("adkafka_plugin_message_bytes_total",
+                                  "Bytes of the messages handed to the "
+                                  "back-end.")),
+      droppedArrays(set.AddCounter("adkafka_plugin_dropped_arrays_total",
+                                   "Arrays the back-end could not take.")),
+      skippedArrays(set.AddCounter("adkafka_plugin_skipped_arrays_total",
+                                   "Arrays skipped by the rate limiter.")),
+      processingTime(set.AddHistogram(
+          "adkafka_plugin_processing_seconds",
+          "Time from receiving an array to handing it to the back-end.",
+          ExponentialBuckets(1e-5, 2, 21))),
+      brokers(set.AddGauge("adkafka_plugin_kafka_brokers",
+                           "Brokers known to the producer.")),
+      brokerUp(set.AddGauge("adkafka_plugin_kafka_broker_up",
+                            "1 if the producer is connected to a broker.")),
+      queueMessages(set.AddGauge("adkafka_plugin_kafka_queue_messages",
+                                 "Messages in the producer queue.")),
+      queueBytes(set.AddGauge("adkafka_plugin_kafka_queue_bytes",
+                              "Bytes of the messages in the producer queue.")),
+      outbufRequests(set.AddGauge("adkafka_plugin_kafka_outbuf_requests",
+                                  "Requests waiting to be sent to the "
+                                  "brokers.")),
+      txMessages(set.AddGauge("adkafka_plugin_kafka_tx_messages",
+                              "Messages transmitted to the brokers since the "
+                              "producer was created.")),
+      txBytes(set.AddGauge("adkafka_plugin_kafka_tx_bytes",
+                           "Bytes transmitted to the brokers since the "
+                           "producer was created.")),
+      rttAvg(set.AddGauge("adkafka_plugin_kafka_rtt_avg_seconds",
+                          "Largest average broker round trip time.")),
+      rttP99(set.AddGauge("adkafka_plugin_kafka_rtt_p99_seconds",
+                          "Largest 99th percentile broker round trip time.")),
+      queueLatency(set.AddGauge("adkafka_plugin_kafka_queue_latency_seconds",
+                                "Largest average time messages spend in the "
+                                "producer queue.")),
+      throttleTime(set.AddGauge("adkafka_plugin_kafka_throttle_seconds",
+                                "Largest average broker throttling time.")) {}
+
+void KafkaPlugin::UpdateKafkaMetrics(KafkaStatistics const &stats) {
+  metrics.brokers.Set(stats.brokers);
+  metrics.brokerUp.Set(stats.brokerUp ? 1 : 0);
+  metrics.queueMessages.Set(static_cast<double>(stats.messagesInQueue));
+  metrics.queueBytes.Set(static_cast<double>(stats.queuedBytes));
+  metrics.outbufRequests.Set(static_cast<double>(stats.outbufCount));
+  metrics.txMessages.Set(static_cast<double>(stats.txMessages));
+  metrics.txBytes.Set(static_cast<double>(stats.txBytes));
+  metrics.rttAvg.Set(stats.rttAvg / 1e6);
+  metrics.rttP99.Set(stats.rttP99 / 1e6);
+  metrics.queueLatency.Set(stats.intLatencyAvg / 1e6);
+  metrics.throttleTime.Set(stats.throttleAvg / 1e3);
+}
+
+bool KafkaPlugin::StartMetrics(int port) {
+  const char *functionName = "StartMetrics";
+  auto server = MetricsServer::Get(port);
+  if (nullptr == server) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: Unable to serve metrics on port %d.\n", driverName,
+              functionName, port);
+    return false;
+  }
+  if (nullptr != metricsServer) {
+    metricsServer->Remove(&metricsSet);
+  }
+  metricsServer = server;
+  metricsServer->Add(&metricsSet);
+  return true;
+}
+
+void KafkaPlugin::UpdateTransport() {
+  const char *functionName = "UpdateTransport";
+  if (TransportBackend::LOCAL == backend) {
+    transport = std::make_shared<LocalProducer>(producer.GetTopic());
+  } else if (TransportBackend::SEGMENT_FILE == backend) {
+    auto segmentProducer = std::make_shared<SegmentProducer>();
+    auto sizeBytes = static_cast<std::uint64_t>(segmentSizeMB) * 1000000;
+    if (not segmentPath.empty() and
+        not segmentProducer->Open(segmentPath, sizeBytes)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: Unable to open segment file \"%s\".\n", driverName,
+                functionName, segmentPath.c_str());
+    }
+    transport = segmentProducer;
+  } else {
+    // The producer is a member of the plugin and must not be deleted
+    transport = std::shared_ptr<TransportProducer>(std::shared_ptr<void>(),
+                                                   &producer);
+  }
+  // The consumers of the new back-end have not seen the last keyframe
+  serializer.RequestKeyframe();
+}
+
+void KafkaPlugin::AddToBatch(NDArray &pArray, std::int64_t timestamp) {
+  if (0 == serializer.GetBatchArrays()) {
+    batchStart = std::chrono::steady_clock::now();
+    batchTimestamp = timestamp;
+    batchFrameId = pArray.uniqueId;
+    if (sendHeaders) {
+      serializer.SerializeHeaders(pArray, headerAttributes, batchHeaders);
+    } else {
+      batchHeaders.clear();
+    }
+    SetBatchDeadline(batchStart + std::chrono::milliseconds(batchMaxTimeMS));
+  }
+  serializer.AddToBatch(pArray, sequenceNumber, droppedArrays);
+  if (serializer.GetBatchArrays() >= static_cast<size_t>(batchMaxArrays) or
+      serializer.GetBatchBytes() >= static_cast<size_t>(batchMaxBytes)) {
+    SendBatch(false);
+  }
+}
+
+void KafkaPlugin::SendBatch(bool copyBuffer) {
+  std::uint64_t arrays = serializer.GetBatchArrays();
+  if (0 == arrays) {
+    return;
+  }
+  std::unique_lock<std::mutex> sendLock(batchSendMutex);
+  unsigned char *bufferPtr;
+  size_t bufferSize;
+  serializer.FinishBatch(bufferPtr, bufferSize);
+  SetBatchDeadline(std::chrono::steady_clock::time_point::max());
+  if (copyBuffer) {
+    batchBuffer.assign(bufferPtr, bufferPtr + bufferSize);
+    bufferPtr = batchBuffer.data();
+  }
+  std::int64_t timestamp = batchTimestamp;
+  std::int64_t frameId = batchFrameId;
+  // A new batch may be started while the port is unlocked
+  MessageHeaders messageHeaders;
+  messageHeaders.swap(batchHeaders);
+  auto sendTransport = transport;
+  this->unlock();
+  bool addToQueueSuccess = sendTransport->SendMessage(
+      bufferPtr, bufferSize, timestamp, messageHeaders, arrays);
+  KAFKA_PROBE3(produce__enqueue, frameId, bufferSize, addToQueueSuccess);
+  if (addToQueueSuccess) {
+    metrics.messages.Add();
+    metrics.messageBytes.Add(bufferSize);
+    RecordMessage(bufferPtr, bufferSize, timestamp, frameId);
+  }
+  sendLock.unlock();
+  this->lock();
+  if (not addToQueueSuccess) {
+    AddDroppedArrays(arrays);
+    serializer.RequestKeyframe();
+  }
+  AddEvictedArrays();
+}
+
+void KafkaPlugin::SendTiles(NDArray &pArray, size_t tiles,
+                            std::int64_t timestamp) {
+  if (sendHeaders) {
+    serializer.SerializeHeaders(pArray, headerAttributes, headers);
+    headers.emplace_back("tileCount", std::to_string(tiles));
+    headers.emplace_back("tileIndex", "");
+  } else {
+    headers.clear();
+  }
+  for (size_t i = 0; i < tiles; i++) {
+    unsigned char *bufferPtr;
+    size_t bufferSize;
+    serializer.GetTile(i, bufferPtr, bufferSize);
+    if (sendHeaders) {
+      headers.back().second = std::to_string(i);
+    }
+    auto sendTransport = transport;
+    this->unlock();
+    // The array is counted as dropped if its first tile is dropped later,
+    // the driver counts the arrays missing other tiles as incomplete
+    bool addToQueueSuccess = sendTransport->SendMessage(
+        bufferPtr, bufferSize, timestamp, headers, 0 == i ? 1 : 0);
+    KAFKA_PROBE3(produce__enqueue, pArray.uniqueId, bufferSize,
+                 addToQueueSuccess);
+    if (addToQueueSuccess) {
+      metrics.messages.Add();
+      metrics.messageBytes.Add(bufferSize);
+      RecordMessage(bufferPtr, bufferSize, timestamp, pArray.uniqueId);
+    }
+    this->lock();
+    AddEvictedArrays();
+    if (not addToQueueSuccess) {
+      // The consumers can not assemble the array without all of its tiles
+      AddDroppedArrays(1);
+      serializer.RequestKeyframe();
+      return;
+    }
+  }
+}
+
+void KafkaPlugin::RecordMessage(const unsigned char *buffer, size_t size,
+                                std::int64_t timestamp, std::int64_t frameId) {
+  const char *functionName = "RecordMessage";
+  if (recorder.IsOpen() and
+      not recorder.Append(buffer, size, timestamp, frameId)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName,
+              functionName, recorder.GetError().c_str());
+  }
+}
+
+void KafkaPlugin::QueuePreview(NDArray &pArray, std::int64_t timestamp) {
+  auto now = std::chrono::steady_clock::now();
+  if (now - previewStart < std::chrono::duration<double>(1.0 / previewRate)) {
+    return;
+  }
+  // The preview thread only holds the mutex briefly, but the main path must
+  // not wait for it even then
+  std::unique_lock<std::mutex> previewLock(previewMutex, std::try_to_lock);
+  if (not previewLock.owns_lock() or nullptr != previewArray) {
+    return;
+  }
+  pArray.reserve();
+  previewArray = &pArray;
+  previewTimestamp = timestamp;
+  previewArrayFactor = previewFactor;
+  previewArrayMode = previewMode;
+  previewStart = now;
+  previewCondition.notify_one();
+}
+
+void KafkaPlugin::PreviewThreadFunction() {
+  std::unique_lock<std::mutex> previewLock(previewMutex);
+  while (true) {
+    previewCondition.wait(previewLock, [this]() {
+      return nullptr != previewArray or not runPreviewThread;
+    });
+    if (not runPreviewThread) {
+      return;
+    }
+    // The array is kept in previewArray until it has been sent so that no
+    // new array is handed over in the meantime
+    NDArray *pArray = previewArray;
+    std::int64_t timestamp = previewTimestamp;
+    size_t factor = static_cast<size_t>(previewArrayFactor);
+    BinningMode mode = previewArrayMode;
+    KafkaProducer *sendProducer = previewProducer.get();
+    previewLock.unlock();
+
+    NDArray *binned = BinPreview(*pArray, factor, mode);
+    pArray->release();
+    if (nullptr != binned) {
+      unsigned char *bufferPtr;
+      size_t bufferSize;
+      previewSerializer.SerializeData(*binned, bufferPtr, bufferSize,
+                                      ++previewSequence, 0);
+      binned->release();
+      if (sendProducer->SendKafkaPacket(bufferPtr, bufferSize, timestamp)) {
+        ++previewsSent;
+      }
+    }
+
+    previewLock.lock();
+    previewArray = nullptr;
+  }
+}
+
+NDArray *KafkaPlugin::BinPreview(NDArray &pArray, size_t factor,
+                                 BinningMode mode) {
+  if (pArray.ndims < 1) {
+    return nullptr;
+  }
+  int colorMode = NDColorModeMono;
+  NDAttribute *colorAttr = pArray.pAttributeList->find("ColorMode");
+  if (nullptr != colorAttr) {
+    colorAttr->getValue(NDAttrInt32, &colorMode);
+  } else if (3 == pArray.ndims and 3 == pArray.dims[0].size) {
+    colorMode = NDColorModeRGB1;
+  }
+  // Binning the rows of RGB2 arrays would mix their colours
+  if (NDColorModeRGB2 == colorMode and 3 == pArray.ndims) {
+    return nullptr;
+  }
+  // The colour dimension of RGB1 arrays is not binned
+  bool rgb1 = NDColorModeRGB1 == colorMode and 3 == pArray.ndims and
+              3 == pArray.dims[0].size;
+  int first = rgb1 ? 1 : 0;
+  size_t colors = rgb1 ? 3 : 1;
+  size_t dims[ND_ARRAY_MAX_DIMS];
+  size_t planes = 1;
+  for (int i = 0; i < pArray.ndims; i++) {
+    dims[i] = pArray.dims[i].size;
+    if (i >= first + 2) {
+      planes *= dims[i];
+    }
+  }
+  size_t width = dims[first];
+  size_t height = pArray.ndims > first + 1 ? dims[first + 1] : 1;
+  if (0 == width or 0 == height or 0 == planes) {
+    return nullptr;
+  }
+  dims[first] = width / BinningFactor(width, factor);
+  if (pArray.ndims > first + 1) {
+    dims[first + 1] = height / BinningFactor(height, factor);
+  }
+  NDArray *binned =
+      this->pNDArrayPool->alloc(pArray.ndims, dims,
+                                BinnedDataType(pArray.dataType, mode), 0,
+                                nullptr);
+  if (nullptr == binned) {
+    return nullptr;
+  }
+  if (not BinData(pArray.dataType, pArray.pData, binned->pData, width,
+                  height, planes, factor, mode, colors)) {
+    binned->release();
+    return nullptr;
+  }
+  binned->uniqueId = pArray.uniqueId;
+  binned->timeStamp = pArray.timeStamp;
+  binned->epicsTS = pArray.epicsTS;
+  pArray.pAttributeList->copy(binned->pAttributeList);
+  return binned;
+}
+
+void KafkaPlugin::SetBatchDeadline(
+    std::chrono::steady_clock::time_point deadline) {
+  {
+    std::lock_guard<std::mutex> timerLock(batchTimerMutex);
+    batchDeadline = deadline;
+  }
+  batchCondition.notify_one();
+}
+
+void KafkaPlugin::BatchThreadFunction() {
+  auto const noDeadline = std::chrono::steady_clock::time_point::max();
+  std::unique_lock<std::mutex> timerLock(batchTimerMutex);
+  while (runBatchThread) {
+    if (noDeadline == batchDeadline) {
+      batchCondition.wait(timerLock);
+      continue;
+    }
+    if (std::chrono::steady_clock::now() < batchDeadline) {
+      batchCondition.wait_until(timerLock, batchDeadline);
+      continue;
+    }
+    batchDeadline = noDeadline;
+    timerLock.unlock();
+    this->lock();
+    if (serializer.GetBatchArrays() > 0) {
+      auto deadline = batchStart + std::chrono::milliseconds(batchMaxTimeMS);
+      if (std::chrono::steady_clock::now() >= deadline) {
+        SendBatch(true);
+        callParamCallbacks();
+      } else {
+        SetBatchDeadline(deadline);
+      }
+    }
+    this->unlock();
+    timerLock.lock();
+  }
+}
+
+std::int64_t KafkaPlugin::GetKafkaTimestamp(NDArray &pArray) {
+  if (TimestampSource::EPICS_TS == timestampSource) {
+    if (0 == pArray.epicsTS.secPastEpoch and 0 == pArray.epicsTS.nsec) {
+      return 0;
+    }
+    return (static_cast<std::int64_t>(pArray.epicsTS.secPastEpoch) +
+            POSIX_TIME_AT_EPICS_EPOCH) *
+               1000 +
+           pArray.epicsTS.nsec / 1000000;
+  } else if (TimestampSource::TIME_STAMP == timestampSource) {
+    if (pArray.timeStamp <= 0.0) {
+      return 0;
+    }
+    return static_cast<std::int64_t>(
+        (pArray.timeStamp + POSIX_TIME_AT_EPICS_EPOCH) * 1000.0);
+  }
+  return 0;
+}
+
 asynStatus KafkaPlugin::writeOctet(asynUser *pasynUser, const char *value,
                                    size_t nChars, size_t *nActual) {
   int addr = 0;
@@ -64,9 +540,63 @@ asynStatus KafkaPlugin::writeOctet(asynUser *pasynUser, const char *value,
   if (function == *paramsList.at(PV::kafka_addr).index) {
     tempStr = std::string(value, nChars);
     producer.SetBrokerAddr(tempStr);
+    if (nullptr != previewProducer) {
+      previewProducer->SetBrokerAddr(tempStr);
+    }
   } else if (function == *paramsList.at(PV::kafka_topic).index) {
     tempStr = std::string(value, nChars);
     producer.SetTopic(tempStr);
+    if (TransportBackend::LOCAL == backend) {
+      UpdateTransport();
+    }
+  } else if (function == *paramsList.at(PV::header_attrs).index) {
+    tempStr = std::string(value, nChars);
+    headerAttributes.clear();
+    std::string::size_type start = 0;
+    while (start <= tempStr.size()) {
+      auto end = tempStr.find(',', start);
+      if (std::string::npos == end) {
+        end = tempStr.size();
+      }
+      auto name = tempStr.substr(start, end - start);
+      name.erase(0, name.find_first_not_of(' '));
+      name.erase(name.find_last_not_of(' ') + 1);
+      if (not name.empty()) {
+        headerAttributes.push_back(name);
+      }
+      start = end + 1;
+    }
+  } else if (function == *paramsList.at(PV::preview_topic).index) {
+    previewTopic = std::string(value, nChars);
+    if (not previewTopic.empty()) {
+      std::lock_guard<std::mutex> previewLock(previewMutex);
+      if (nullptr == previewProducer) {
+        previewProducer.reset(
+            new KafkaProducer(producer.GetBrokerAddr(), previewTopic));
+        previewProducer->StartThread();
+      } else {
+        previewProducer->SetTopic(previewTopic);
+      }
+    }
+  } else if (function == *paramsList.at(PV::spool_path).index) {
+    spoolPath = std::string(value, nChars);
+    producer.SetSpoolFile(spoolPath,
+                          static_cast<std::uint64_t>(spoolSizeMB) * 1000000);
+  } else if (function == *paramsList.at(PV::segment_path).index) {
+    segmentPath = std::string(value, nChars);
+    if (TransportBackend::SEGMENT_FILE == backend) {
+      UpdateTransport();
+    }
+  } else if (function == *paramsList.at(PV::record_path).index) {
+    recordPath = std::string(value, nChars);
+    auto segmentBytes = static_cast<std::uint64_t>(recordSegmentMB) * 1000000;
+    if (recordPath.empty()) {
+      recorder.Close();
+    } else if (not recorder.Open(recordPath, segmentBytes)) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR, "%s:%s: %s\n", driverName,
+                functionName, recorder.GetError().c_str());
+    }
+    setParam(this, paramsList.at(PV::recorded_msgs), 0);
   } else if (function < MIN_PARAM_INDEX) {
     NDPluginDriver::writeOctet(pasynUser, value, nChars, nActual);
   }
@@ -100,6 +630,133 @@ asynStatus KafkaPlugin::writeInt32(asynUser *pasynUser, epicsInt32 value) {
     producer.SetStatsTimeMS(value);
   } else if (function == *paramsList[queue_size].index) {
     producer.SetMessageQueueLength(value);
+  } else if (function == *paramsList[timestamp_source].index) {
+    if (value >= 0 and value <= 2) {
+      timestampSource = TimestampSource(value);
+    } else {
+      setIntegerParam(function, static_cast<int>(timestampSource));
+    }
+  } else if (function == *paramsList[send_headers].index) {
+    sendHeaders = (0 != value);
+  } else if (function == *paramsList[spool_size].index) {
+    if (value > 0) {
+      spoolSizeMB = value;
+      if (not spoolPath.empty()) {
+        producer.SetSpoolFile(
+            spoolPath, static_cast<std::uint64_t>(spoolSizeMB) * 1000000);
+      }
+    } else {
+      setIntegerParam(function, spoolSizeMB);
+    }
+  } else if (function == *paramsList[spool_rate].index) {
+    producer.SetSpoolReplayRate(value);
+    setIntegerParam(function, producer.GetSpoolReplayRate());
+  } else if (function == *paramsList[queue_policy].index) {
+    if (value >= 0 and value <= 2) {
+      producer.SetQueueFullPolicy(
+          KafkaInterface::KafkaProducer::QueueFullPolicy(value));
+    } else {
+      setIntegerParam(function,
+                      static_cast<int>(producer.GetQueueFullPolicy()));
+    }
+  } else if (function == *paramsList[block_timeout].index) {
+    if (not producer.SetBlockTimeoutMS(value)) {
+      setIntegerParam(function, producer.GetBlockTimeoutMS());
+    }
+  } else if (function == *paramsList[batch_arrays].index) {
+    if (value > 0) {
+      batchMaxArrays = value;
+    } else {
+      setIntegerParam(function, batchMaxArrays);
+    }
+  } else if (function == *paramsList[batch_bytes].index) {
+    if (value > 0) {
+      batchMaxBytes = value;
+    } else {
+      setIntegerParam(function, batchMaxBytes);
+    }
+  } else if (function == *paramsList[batch_time].index) {
+    if (value > 0) {
+      batchMaxTimeMS = value;
+      if (serializer.GetBatchArrays() > 0) {
+        SetBatchDeadline(batchStart +
+                         std::chrono::milliseconds(batchMaxTimeMS));
+      }
+    } else {
+      setIntegerParam(function, batchMaxTimeMS);
+    }
+  } else if (function == *paramsList[encoding].index) {
+    if (value >= 0 and value <= 3) {
+      serializer.SetEncoding(NDArraySerializer::Encoding(value));
+    } else {
+      setIntegerParam(function, static_cast<int>(serializer.GetEncoding()));
+    }
+  } else if (function == *paramsList[packed_bits].index) {
+    if (not serializer.SetPackedBits(value)) {
+      setIntegerParam(function, serializer.GetPackedBits());
+    }
+  } else if (function == *paramsList[keyframe_interval].index) {
+    if (not serializer.SetKeyframeInterval(value)) {
+      setIntegerParam(function, serializer.GetKeyframeInterval());
+    }
+  } else if (function == *paramsList[statistics].index) {
+    serializer.SetStatistics(0 != value);
+  } else if (function == *paramsList[checksum].index) {
+    serializer.SetChecksum(0 != value);
+  } else if (function == *paramsList[tile_size].index) {
+    if (not serializer.SetTileSize(value)) {
+      setIntegerParam(function, serializer.GetTileSize());
+    }
+  } else if (function == *paramsList[tile_threads].index) {
+    if (not serializer.SetTileThreads(value)) {
+      setIntegerParam(function, serializer.GetTileThreads());
+    }
+  } else if (function == *paramsList[preview_binning].index) {
+    if (value > 0) {
+      previewFactor = value;
+    } else {
+      setIntegerParam(function, previewFactor);
+    }
+  } else if (function == *paramsList[preview_mode].index) {
+    if (value >= 0 and value <= 2) {
+      previewMode = BinningMode(value);
+    } else {
+      setIntegerParam(function, static_cast<int>(previewMode));
+    }
+  } else if (function == *paramsList[decimation].index) {
+    if (not rateLimiter.SetDecimation(value)) {
+      setIntegerParam(function, rateLimiter.GetDecimation());
+    }
+  } else if (function == *paramsList[backend_type].index) {
+    if (value >= 0 and value <= 2) {
+      backend = TransportBackend(value);
+      UpdateTransport();
+    } else {
+      setIntegerParam(function, static_cast<int>(backend));
+    }
+  } else if (function == *paramsList[segment_size].index) {
+    if (value > 0) {
+      segmentSizeMB = value;
+      if (TransportBackend::SEGMENT_FILE == backend) {
+        UpdateTransport();
+      }
+    } else {
+      setIntegerParam(function, segmentSizeMB);
+    }
+  } else if (function == *paramsList[record_segment].index) {
+    // Used from the next recording on
+    if (value > 0) {
+      recordSegmentMB = value;
+    } else {
+      setIntegerParam(function, recordSegmentMB);
+    }
+  } else if (function == *paramsList[transport_type].index) {
+    if (value >= 0 and value <= 2) {
+      serializer.SetTransportType(NDArraySerializer::TransportType(value));
+    } else {
+      setIntegerParam(function,
+                      static_cast<int>(serializer.GetTransportType()));
+    }
   } else {
     /* If this parameter belongs to a base class call its method */
     if (function < MIN_PARAM_INDEX) {
@@ -121,6 +778,58 @@ asynStatus KafkaPlugin::writeInt32(asynUser *pasynUser, epicsInt32 value) {
   return status;
 }
 
+asynStatus KafkaPlugin::writeFloat64(asynUser *pasynUser,
+                                     epicsFloat64 value) {
+  const int function{pasynUser->reason};
+  asynStatus status{asynSuccess};
+  static const char *functionName = "writeFloat64";
+
+  /* Set the parameter in the parameter library. */
+  setDoubleParam(function, value);
+
+  if (function == *paramsList[sparse_threshold].index) {
+    if (not serializer.SetSparseThreshold(value)) {
+      setDoubleParam(function, serializer.GetSparseThreshold());
+    }
+  } else if (function == *paramsList[stats_threshold].index) {
+    if (not serializer.SetStatisticsThreshold(value)) {
+      setDoubleParam(function, serializer.GetStatisticsThreshold());
+    }
+  } else if (function == *paramsList[max_array_rate].index) {
+    if (not rateLimiter.SetMaxArrayRate(value)) {
+      setDoubleParam(function, rateLimiter.GetMaxArrayRate());
+    }
+  } else if (function == *paramsList[max_data_rate].index) {
+    if (not rateLimiter.SetMaxDataRate(value * 1000000)) {
+      setDoubleParam(function, rateLimiter.GetMaxDataRate() / 1000000);
+    }
+  } else if (function == *paramsList[preview_rate].index) {
+    if (value > 0.0) {
+      previewRate = value;
+    } else {
+      setDoubleParam(function, previewRate);
+    }
+  } else {
+    /* If this parameter belongs to a base class call its method */
+    if (function < MIN_PARAM_INDEX) {
+      NDPluginDriver::writeFloat64(pasynUser, value);
+    }
+  }
+
+  /* Do callbacks so higher layers see any changes */
+  status = callParamCallbacks();
+
+  if (status != 0) {
+    epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "%s:%s: status=%d, function=%d, value=%f", driverName,
+                  functionName, status, function, value);
+  } else {
+    asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, "%s:%s: function=%d, value=%f\n",
+              driverName, functionName, function, value);
+  }
+  return status;
+}
+
 KafkaPlugin::KafkaPlugin(const char *portName, int queueSize,
                          int blockingCallbacks, const char *NDArrayPort,
                          int NDArrayAddr, size_t maxMemory, int priority,
@@ -130,14 +839,20 @@ KafkaPlugin::KafkaPlugin(const char *portName, int queueSize,
     : NDPluginDriver(portName, queueSize, blockingCallbacks, NDArrayPort,
                      NDArrayAddr, 1, 2, maxMemory, intMask, intMask, 0, 1,
                      priority, stackSize, 1),
+      stageTrace(portName, {"prepare", "serialize", "send", "relock"}),
+      metricsSet(portName), metrics(metricsSet),
       producer(brokerAddress, brokerTopic) {
 
   MIN_PARAM_INDEX = InitPvParams(this, paramsList);
 
+  producer.SetStatisticsCallback(
+      [this](KafkaStatistics const &stats) { UpdateKafkaMetrics(stats); });
+
   // The following three calls must be made in this particular order
   InitPvParams(this, producer.GetParams());
   producer.RegisterParamCallbackClass(this);
   producer.StartThread();
+  UpdateTransport();
 
   setStringParam(NDPluginDriverPluginType, "KafkaPlugin");
   setParam(this, paramsList.at(PV::kafka_addr), brokerAddress);
@@ -145,6 +860,60 @@ KafkaPlugin::KafkaPlugin(const char *portName, int queueSize,
   setParam(this, paramsList.at(PV::stats_time), producer.GetStatsTimeMS());
   setParam(this, paramsList.at(PV::queue_size),
            producer.GetMessageQueueLength());
+  setParam(this, paramsList.at(PV::timestamp_source),
+           static_cast<int>(timestampSource));
+  setParam(this, paramsList.at(PV::send_headers), sendHeaders ? 1 : 0);
+  setParam(this, paramsList.at(PV::header_attrs), std::string());
+  setParam(this, paramsList.at(PV::spool_path), spoolPath);
+  setParam(this, paramsList.at(PV::spool_size), spoolSizeMB);
+  setParam(this, paramsList.at(PV::spool_rate),
+           producer.GetSpoolReplayRate());
+  setParam(this, paramsList.at(PV::queue_policy),
+           static_cast<int>(producer.GetQueueFullPolicy()));
+  setParam(this, paramsList.at(PV::block_timeout),
+           producer.GetBlockTimeoutMS());
+  setParam(this, paramsList.at(PV::batch_arrays), batchMaxArrays);
+  setParam(this, paramsList.at(PV::batch_bytes), batchMaxBytes);
+  setParam(this, paramsList.at(PV::batch_time), batchMaxTimeMS);
+  setParam(this, paramsList.at(PV::encoding),
+           static_cast<int>(serializer.GetEncoding()));
+  setParam(this, paramsList.at(PV::sparse_threshold),
+           serializer.GetSparseThreshold());
+  setParam(this, paramsList.at(PV::keyframe_interval),
+           serializer.GetKeyframeInterval());
+  setParam(this, paramsList.at(PV::statistics),
+           serializer.GetStatistics() ? 1 : 0);
+  setParam(this, paramsList.at(PV::stats_threshold),
+           serializer.GetStatisticsThreshold());
+  setParam(this, paramsList.at(PV::checksum), serializer.GetChecksum() ? 1 : 0);
+  setParam(this, paramsList.at(PV::transport_type),
+           static_cast<int>(serializer.GetTransportType()));
+  setParam(this, paramsList.at(PV::packed_bits), serializer.GetPackedBits());
+  setParam(this, paramsList.at(PV::tile_size), serializer.GetTileSize());
+  setParam(this, paramsList.at(PV::tile_threads), serializer.GetTileThreads());
+  setParam(this, paramsList.at(PV::preview_topic), previewTopic);
+  setParam(this, paramsList.at(PV::preview_binning), previewFactor);
+  setParam(this, paramsList.at(PV::preview_mode),
+           static_cast<int>(previewMode));
+  setParam(this, paramsList.at(PV::preview_rate), previewRate);
+  setParam(this, paramsList.at(PV::preview_sent), int(previewsSent));
+  setParam(this, paramsList.at(PV::max_array_rate),
+           rateLimiter.GetMaxArrayRate());
+  setParam(this, paramsList.at(PV::max_data_rate),
+           rateLimiter.GetMaxDataRate() / 1000000);
+  setParam(this, paramsList.at(PV::decimation), rateLimiter.GetDecimation());
+  setParam(this, paramsList.at(PV::skipped_arrays), 0);
+  setParam(this, paramsList.at(PV::backend_type), static_cast<int>(backend));
+  setParam(this, paramsList.at(PV::segment_path), segmentPath);
+  setParam(this, paramsList.at(PV::segment_size), segmentSizeMB);
+  setParam(this, paramsList.at(PV::record_path), recordPath);
+  setParam(this, paramsList.at(PV::record_segment), recordSegmentMB);
+  setParam(this, paramsList.at(PV::recorded_msgs), 0);
+  setParam(this, paramsList.at(PV::time_prepare), 0.0);
+  setParam(this, paramsList.at(PV::time_serialize), 0.0);
+  setParam(this, paramsList.at(PV::time_send), 0.0);
+  setParam(this, paramsList.at(PV::time_relock), 0.0);
+  setParam(this, paramsList.at(PV::time_total), 0.0);
 
   // Disable ArrayCallbacks.
   // This plugin currently does not do array callbacks, so make the setting
@@ -153,6 +922,36 @@ KafkaPlugin::KafkaPlugin(const char *portName, int queueSize,
 
   /* Try to connect to the NDArray port */
   connectToArrayPort();
+
+  runBatchThread = true;
+  batchThread = std::thread(&KafkaPlugin::BatchThreadFunction, this);
+  runPreviewThread = true;
+  previewThread = std::thread(&KafkaPlugin::PreviewThreadFunction, this);
+}
+
+KafkaPlugin::~KafkaPlugin() {
+  if (nullptr != metricsServer) {
+    metricsServer->Remove(&metricsSet);
+  }
+  if (batchThread.joinable()) {
+    {
+      std::lock_guard<std::mutex> timerLock(batchTimerMutex);
+      runBatchThread = false;
+    }
+    batchCondition.notify_one();
+    batchThread.join();
+  }
+  if (previewThread.joinable()) {
+    {
+      std::lock_guard<std::mutex> previewLock(previewMutex);
+      runPreviewThread = false;
+    }
+    previewCondition.notify_one();
+    previewThread.join();
+    if (nullptr != previewArray) {
+      previewArray->release();
+    }
+  }
 }
 
 // Configuration routine.  Called directly, or from the iocsh function
@@ -160,10 +959,13 @@ extern "C" int KafkaPluginConfigure(const char *portName, int queueSize,
                                     int blockingCallbacks,
                                     const char *NDArrayPort, int NDArrayAddr,
                                     size_t maxMemory, const char *brokerAddress,
-                                    const char *topic) {
+                                    const char *topic, int metricsPort) {
   auto *pPlugin =
       new KafkaPlugin(portName, queueSize, blockingCallbacks, NDArrayPort,
                       NDArrayAddr, maxMemory, 0, 0, brokerAddress, topic);
+  if (metricsPort > 0) {
+    pPlugin->StartMetrics(metricsPort);
+  }
 
   return pPlugin->start();
 }
@@ -179,20 +981,41 @@ static const iocshArg initArg5 = {"maxMemory", iocshArgInt};
 // static const iocshArg initArg7 = {"stack size", iocshArgInt};
 static const iocshArg initArg8 = {"broker address", iocshArgString};
 static const iocshArg initArg9 = {"topic", iocshArgString};
+static const iocshArg initArg10 = {"metrics port", iocshArgInt};
 // static const iocshArg *const initArgs[] = {&initArg0, &initArg1, &initArg2,
 // &initArg3,
 //    &initArg4, &initArg5, &initArg6, &initArg7, &initArg8, &initArg9};
-static const iocshArg *const initArgs[] = {&initArg0, &initArg1, &initArg2,
-                                           &initArg3, &initArg4, &initArg5,
-                                           &initArg8, &initArg9};
-static const iocshFuncDef initFuncDef = {"KafkaPluginConfigure", 8, initArgs};
+static const iocshArg *const initArgs[] = {
+    &initArg0, &initArg1, &initArg2, &initArg3, &initArg4,
+    &initArg5, &initArg8, &initArg9, &initArg10};
+static const iocshFuncDef initFuncDef = {"KafkaPluginConfigure", 9, initArgs};
 static void initCallFunc(const iocshArgBuf *args) {
   KafkaPluginConfigure(args[0].sval, args[1].ival, args[2].ival, args[3].sval,
-                       args[4].ival, args[5].ival, args[6].sval, args[7].sval);
+                       args[4].ival, args[5].ival, args[6].sval, args[7].sval,
+                       args[8].ival);
+}
+
+// Also registered by the Kafka driver, for both kinds of ports
+static const iocshArg dumpArg0 = {"portName", iocshArgString};
+static const iocshArg dumpArg1 = {"records", iocshArgInt};
+static const iocshArg *const dumpArgs[] = {&dumpArg0, &dumpArg1};
+static const iocshFuncDef dumpFuncDef = {"StageTraceDump", 2, dumpArgs};
+static void dumpCallFunc(const iocshArgBuf *args) {
+  std::string portName = nullptr == args[0].sval ? "" : args[0].sval;
+  size_t records = args[1].ival > 0 ? args[1].ival : 20;
+  if (not StageTrace::Dump(stdout, portName, records)) {
+    printf("No stage times for port \"%s\", available ports:",
+           portName.c_str());
+    for (auto const &name : StageTrace::GetNames()) {
+      printf(" %s", name.c_str());
+    }
+    printf("\n");
+  }
 }
 
 extern "C" void KafkaPluginReg(void) {
   iocshRegister(&initFuncDef, initCallFunc);
+  iocshRegister(&dumpFuncDef, dumpCallFunc);
 }
 
 extern "C" {
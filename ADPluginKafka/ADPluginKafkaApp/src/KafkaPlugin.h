@@ -10,11 +10,26 @@
 #include <epicsTypes.h>
 #include <string>
 
+#include "Binning.h"
 #include "KafkaProducer.h"
+#include "LocalTransport.h"
+#include "MetricsServer.h"
 #include "NDArraySerializer.h"
 #include "ParamUtility.h"
+#include "RateLimiter.h"
+#include "Recording.h"
+#include "SegmentTransport.h"
+#include "StageTrace.h"
 #include <NDPluginDriver.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 using namespace KafkaInterface;
 /** @brief areaDetector plugin that produces Kafka messages and sends them to a
@@ -68,8 +83,8 @@ public:
               int priority, int stackSize, const char *brokerAddress,
               const char *brokerTopic);
 
-  /// @brief Destructor, currently empty.
-  ~KafkaPlugin() = default;
+  /// @brief Stops the batch flushing and preview threads.
+  ~KafkaPlugin();
 
   /** @brief Called when new data from the areaDetector is available.
    * Based on a implementation in one of the standard plugins. Calls
@@ -104,7 +119,297 @@ public:
    */
   asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
 
+  /** @brief Used to set floating point paramters of the plugin.
+   * @param[in] pasynUser pasynUser structure that encodes the reason and
+   * address.
+   * @param[in] value The new value of the paramter.
+   * @return asynStatus value corresponding to the success of setting a new
+   * value.
+   */
+  asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+
+  /** @brief Exports the metrics of the plugin in the Prometheus text format
+   * on http://127.0.0.1:<port>/metrics. Several plugins and drivers can
+   * share a port, their metrics are told apart by the port label.
+   * @param[in] port The TCP port to listen on.
+   * @return True on success, false if the port can not be listened on.
+   */
+  bool StartMetrics(int port);
+
 protected:
+  /// @brief The possible sources of the Kafka message timestamp.
+  enum class TimestampSource {
+    EPICS_TS = 0,
+    TIME_STAMP = 1,
+    PRODUCER = 2,
+  };
+
+  /** @brief Returns the Kafka message timestamp to use for an NDArray.
+   * Converts the time of the NDArray, as selected by
+   * KafkaPlugin::timestampSource, to milliseconds since the Unix epoch.
+   * @param[in] pArray The NDArray which is to be sent.
+   * @return Timestamp in milliseconds since the Unix epoch or 0 if librdkafka
+   * should set the timestamp. 0 is also returned if the selected NDArray time
+   * has not been set.
+   */
+  std::int64_t GetKafkaTimestamp(NDArray &pArray);
+
+  /// @brief The currently used source of Kafka message timestamps.
+  TimestampSource timestampSource{TimestampSource::EPICS_TS};
+
+  /** @brief Adds an array to the current batch and sends the batch if it has
+   * reached its maximum number of arrays or bytes.
+   * Must be called with the plugin lock held.
+   * @param[in] pArray The array to add.
+   * @param[in] timestamp The Kafka timestamp of the array.
+   */
+  void AddToBatch(NDArray &pArray, std::int64_t timestamp);
+
+  /** @brief Serializes and sends the current batch of arrays.
+   * Must be called with the plugin lock held. The lock is released while the
+   * batch is handed to the producer.
+   * @param[in] copyBuffer If true, the serialized batch is copied before the
+   * lock is released. Required when called from another thread than
+   * KafkaPlugin::processCallbacks() as the serializer buffer is re-used by
+   * the next call to NDArraySerializer::AddToBatch().
+   */
+  void SendBatch(bool copyBuffer);
+
+  /** @brief Sends the tiles serialized by NDArraySerializer::SerializeTiles().
+   * Must be called with the plugin lock held. The lock is released while
+   * each tile is handed to the producer. If a tile can not be sent, the
+   * remaining tiles are not sent either and the array is counted as dropped.
+   * @param[in] pArray The array the tiles were serialized from.
+   * @param[in] tiles The number of tiles.
+   * @param[in] timestamp The Kafka timestamp of the array.
+   */
+  void SendTiles(NDArray &pArray, size_t tiles, std::int64_t timestamp);
+
+  /** @brief Sets when the batch thread must check the age of the current
+   * batch and wakes it up.
+   * @param[in] deadline The time, time_point::max() if no batch is open.
+   */
+  void SetBatchDeadline(std::chrono::steady_clock::time_point deadline);
+
+  /** @brief Sends the current batch of arrays once it is older than
+   * KafkaPlugin::batchMaxTimeMS. Sleeps until KafkaPlugin::batchDeadline, or
+   * as long as no batch is open. Runs in KafkaPlugin::batchThread.
+   */
+  void BatchThreadFunction();
+
+  /** @brief Hands an array to the preview thread if a preview is due.
+   * Must be called with the plugin lock held. Never waits for the preview
+   * thread: if it is still busy with the previous preview, no preview is
+   * made of this array.
+   * @param[in] pArray The array to make a preview of.
+   * @param[in] timestamp The Kafka timestamp of the array.
+   */
+  void QueuePreview(NDArray &pArray, std::int64_t timestamp);
+
+  /** @brief Appends a message sent to the recording, if one is open. Prints
+   * the error if that fails, which closes the recording.
+   */
+  void RecordMessage(const unsigned char *buffer, size_t size,
+                     std::int64_t timestamp, std::int64_t frameId);
+
+  /** @brief Bins, serializes and sends the arrays handed over by
+   * KafkaPlugin::QueuePreview(). Runs in KafkaPlugin::previewThread.
+   */
+  void PreviewThreadFunction();
+
+  /** @brief Bins an array for the preview stream.
+   * @param[in] pArray The array to bin.
+   * @param[in] factor The binning factor.
+   * @param[in] mode The binning mode.
+   * @return The binned array or nullptr if it could not be allocated or if
+   * it is an RGB2 array. The caller must call NDArray::release().
+   */
+  NDArray *BinPreview(NDArray &pArray, size_t factor, BinningMode mode);
+
+  /** @brief Counts arrays which have been dropped by the producer.
+   * Must be called with the plugin lock held.
+   * @param[in] arrays Number of dropped arrays.
+   */
+  void AddDroppedArrays(std::uint64_t arrays);
+
+  /** @brief Counts the arrays which the producer accepted but dropped
+   * afterwards (see KafkaProducer::TakeEvictedArrays()) and sends the next
+   * array as a keyframe if there are any. Must be called with the plugin
+   * lock held.
+   */
+  void AddEvictedArrays();
+
+  /// @brief The timed stages of KafkaPlugin::processCallbacks().
+  enum Stage {
+    /// @brief Rate limiting, previews and parameter updates.
+    PREPARE,
+    /// @brief Serializing the array, or adding it to a batch.
+    SERIALIZE,
+    /// @brief Handing the message to the back-end.
+    SEND,
+    /// @brief Waiting for the plugin lock after sending.
+    RELOCK,
+    /// @brief The number of stages.
+    STAGES,
+  };
+
+  /** @brief Adds the stage times of an array to KafkaPlugin::stageTrace and
+   * publishes the moving averages once a second. Must be called with the
+   * plugin lock held.
+   * @param[in] times The stage times of the array.
+   * @param[in] pArray The array.
+   */
+  void RecordStageTimes(StageTimes const &times, NDArray const &pArray);
+
+  /// @brief Times the stages of the arrays sent, dumped by StageTraceDump.
+  StageTrace stageTrace;
+
+  /// @brief The metrics exported by KafkaPlugin::StartMetrics().
+  struct Metrics {
+    /// @brief Adds the metrics to a set.
+    explicit Metrics(MetricsSet &set);
+    MetricCounter &arrays;
+    MetricCounter &arrayBytes;
+    MetricCounter &messages;
+    MetricCounter &messageBytes;
+    MetricCounter &droppedArrays;
+    MetricCounter &skippedArrays;
+    MetricHistogram &processingTime;
+    MetricGauge &brokers;
+    MetricGauge &brokerUp;
+    MetricGauge &queueMessages;
+    MetricGauge &queueBytes;
+    MetricGauge &outbufRequests;
+    MetricGauge &txMessages;
+    MetricGauge &txBytes;
+    MetricGauge &rttAvg;
+    MetricGauge &rttP99;
+    MetricGauge &queueLatency;
+    MetricGauge &throttleTime;
+  };
+
+  /** @brief Updates the metrics taken from the librdkafka statistics.
+   * Called by the status thread of the producer.
+   * @param[in] stats The latest statistics.
+   */
+  void UpdateKafkaMetrics(KafkaStatistics const &stats);
+
+  /** @brief The set of metrics of the plugin. Declared before the producer,
+   * as its status thread updates some of the metrics.
+   */
+  MetricsSet metricsSet;
+
+  /// @brief The metrics of KafkaPlugin::metricsSet.
+  Metrics metrics;
+
+  /// @brief The server exporting the metrics, nullptr if they are not.
+  std::shared_ptr<MetricsServer> metricsServer;
+
+  /** @brief Replaces KafkaPlugin::transport with the selected back-end.
+   * Must be called with the plugin lock held. Messages being sent through
+   * the previous back-end are not affected.
+   */
+  void UpdateTransport();
+
+  /// @brief Maximum number of arrays in a batch, 1 disables batching.
+  int batchMaxArrays{1};
+
+  /// @brief Send the batch once its array data reaches this number of bytes.
+  int batchMaxBytes{1000000};
+
+  /// @brief Send the batch once its first array is this old (in ms).
+  int batchMaxTimeMS{100};
+
+  /// @brief When the first array was added to the current batch.
+  std::chrono::steady_clock::time_point batchStart;
+
+  /// @brief Kafka timestamp of the first array in the current batch.
+  std::int64_t batchTimestamp{0};
+
+  /// @brief NDArray::uniqueId of the first array in the current batch.
+  std::int64_t batchFrameId{0};
+
+  /// @brief Used to copy batches sent by the batch thread.
+  std::vector<unsigned char> batchBuffer;
+
+  /// @brief Keeps batches in order while the plugin lock is released.
+  std::mutex batchSendMutex;
+
+  /// @brief Thread sending batches which have reached their maximum age.
+  std::thread batchThread;
+
+  /** @brief When the batch thread must check the age of the current batch,
+   * time_point::max() if no batch is open. Protected by
+   * KafkaPlugin::batchTimerMutex.
+   */
+  std::chrono::steady_clock::time_point batchDeadline{
+      std::chrono::steady_clock::time_point::max()};
+
+  /// @brief Protects KafkaPlugin::batchDeadline.
+  std::mutex batchTimerMutex;
+
+  /// @brief Wakes up the batch thread.
+  std::condition_variable batchCondition;
+
+  /// @brief Used to shut down the batch thread.
+  std::atomic_bool runBatchThread{false};
+
+  /// @brief The preview topic, empty if no preview stream is sent.
+  std::string previewTopic;
+
+  /// @brief The preview binning factor.
+  int previewFactor{4};
+
+  /// @brief How the elements are combined when binning previews.
+  BinningMode previewMode{BinningMode::MEAN};
+
+  /// @brief Maximum number of previews sent per second.
+  double previewRate{1.0};
+
+  /// @brief When the last array was handed to the preview thread.
+  std::chrono::steady_clock::time_point previewStart;
+
+  /** @brief Producer of the preview stream, created when a preview topic is
+   * first set. Uses the broker of the full resolution stream and drops
+   * previews if its queue is full.
+   */
+  std::unique_ptr<KafkaProducer> previewProducer;
+
+  /// @brief Serializes the binned preview arrays.
+  NDArraySerializer previewSerializer;
+
+  /// @brief Sequence number of the last preview.
+  std::uint64_t previewSequence{0};
+
+  /** @brief The array being binned by the preview thread, nullptr if it is
+   * idle. Protected by KafkaPlugin::previewMutex.
+   */
+  NDArray *previewArray{nullptr};
+
+  /// @brief The Kafka timestamp of KafkaPlugin::previewArray.
+  std::int64_t previewTimestamp{0};
+
+  /// @brief The binning factor to use for KafkaPlugin::previewArray.
+  int previewArrayFactor{1};
+
+  /// @brief The binning mode to use for KafkaPlugin::previewArray.
+  BinningMode previewArrayMode{BinningMode::MEAN};
+
+  /// @brief Protects the hand over of arrays to the preview thread.
+  std::mutex previewMutex;
+
+  /// @brief Wakes up the preview thread.
+  std::condition_variable previewCondition;
+
+  /// @brief Thread binning and sending previews.
+  std::thread previewThread;
+
+  /// @brief Used to shut down the preview thread.
+  bool runPreviewThread{false};
+
+  /// @brief Number of previews handed to the preview producer.
+  std::atomic_int previewsSent{0};
+
   /** @brief Interrupt mask passed to NDPluginDriver.
    * @todo What does the interrupt mask actually do?
    */
@@ -121,23 +426,167 @@ protected:
   /// the broker.
   KafkaProducer producer;
 
+  /// @brief The back-end selected to carry the serialized arrays.
+  TransportBackend backend{TransportBackend::KAFKA};
+
+  /** @brief The back-end the serialized arrays are sent through. Points to
+   * KafkaPlugin::producer (without owning it) when the Kafka back-end is
+   * selected. Protected by the plugin lock, a copy is made before the lock is
+   * released to send a message so that the back-end can be replaced in the
+   * meantime.
+   */
+  std::shared_ptr<TransportProducer> transport;
+
+  /// @brief Path to the segment file used by the segment file back-end.
+  std::string segmentPath;
+
+  /// @brief Size of the segment file in MB.
+  int segmentSizeMB{64};
+
+  /// @brief Records the messages sent, whatever the back-end.
+  RecordingWriter recorder;
+
+  /// @brief Path of the recording, empty if nothing is recorded.
+  std::string recordPath;
+
+  /// @brief Size of the recording segment files in MB.
+  int recordSegmentMB{256};
+
   /// @brief The class instance used to serialize NDArray data.
   NDArraySerializer serializer;
 
+  /** @brief Decides which arrays are sent, checked before an array is
+   * serialized. Arrays it skips are counted separately from the arrays
+   * dropped by the producer.
+   */
+  RateLimiter rateLimiter;
+
+  /** @brief Sequence number of the last array handed to the producer.
+   * Incremented for every array, also the ones that are dropped, so that a
+   * consumer can detect gaps in the stream.
+   */
+  std::uint64_t sequenceNumber{0};
+
+  /** @brief Number of arrays dropped by the producer since the plugin was
+   * created. Unlike NDPluginDriverDroppedArrays this counter can not be reset
+   * and is sent with every message.
+   */
+  std::uint64_t droppedArrays{0};
+
+  /// @brief If true, some NDArray meta data is also sent as message headers.
+  bool sendHeaders{false};
+
+  /// @brief Names of the NDArray attributes to send as message headers.
+  std::vector<std::string> headerAttributes;
+
+  /// @brief Re-used storage for the message headers of the current array.
+  KafkaInterface::MessageHeaders headers;
+
+  /// @brief The message headers of the first array of the current batch.
+  KafkaInterface::MessageHeaders batchHeaders;
+
+  /// @brief Path to the spool file, empty if spooling is disabled.
+  std::string spoolPath;
+
+  /// @brief Maximum size of the spool file in MB.
+  int spoolSizeMB{1024};
+
   /// @brief Used to keep track of the PV:s made available by this driver.
   enum PV {
     kafka_addr,
     kafka_topic,
     stats_time,
     queue_size,
+    timestamp_source,
+    send_headers,
+    header_attrs,
+    spool_path,
+    spool_size,
+    spool_rate,
+    queue_policy,
+    block_timeout,
+    batch_arrays,
+    batch_bytes,
+    batch_time,
+    encoding,
+    sparse_threshold,
+    keyframe_interval,
+    statistics,
+    stats_threshold,
+    checksum,
+    transport_type,
+    packed_bits,
+    tile_size,
+    tile_threads,
+    preview_topic,
+    preview_binning,
+    preview_mode,
+    preview_rate,
+    preview_sent,
+    max_array_rate,
+    max_data_rate,
+    decimation,
+    skipped_arrays,
+    backend_type,
+    segment_path,
+    segment_size,
+    record_path,
+    record_segment,
+    recorded_msgs,
+    time_prepare,
+    time_serialize,
+    time_send,
+    time_relock,
+    time_total,
     count,
   };
 
   /// @brief The list of PV:s created by the driver and their definition.
   std::vector<PV_param> paramsList = {
-      PV_param("KAFKA_BROKER_ADDRESS", asynParamOctet), // kafka_addr
-      PV_param("KAFKA_TOPIC", asynParamOctet),          // kafka_topic
-      PV_param("KAFKA_STATS_INT_MS", asynParamInt32),   // stats_time
-      PV_param("KAFKA_QUEUE_SIZE", asynParamInt32),     // queue_size
+      PV_param("KAFKA_BROKER_ADDRESS", asynParamOctet),     // kafka_addr
+      PV_param("KAFKA_TOPIC", asynParamOctet),              // kafka_topic
+      PV_param("KAFKA_STATS_INT_MS", asynParamInt32),       // stats_time
+      PV_param("KAFKA_QUEUE_SIZE", asynParamInt32),         // queue_size
+      PV_param("KAFKA_TIMESTAMP_SOURCE", asynParamInt32),   // timestamp_source
+      PV_param("KAFKA_SEND_HEADERS", asynParamInt32),       // send_headers
+      PV_param("KAFKA_HEADER_ATTRIBUTES", asynParamOctet),  // header_attrs
+      PV_param("KAFKA_SPOOL_PATH", asynParamOctet),         // spool_path
+      PV_param("KAFKA_SPOOL_SIZE", asynParamInt32),         // spool_size
+      PV_param("KAFKA_SPOOL_RATE", asynParamInt32),         // spool_rate
+      PV_param("KAFKA_QUEUE_FULL_POLICY", asynParamInt32),  // queue_policy
+      PV_param("KAFKA_BLOCK_TIMEOUT_MS", asynParamInt32),   // block_timeout
+      PV_param("KAFKA_BATCH_ARRAYS", asynParamInt32),       // batch_arrays
+      PV_param("KAFKA_BATCH_BYTES", asynParamInt32),        // batch_bytes
+      PV_param("KAFKA_BATCH_TIME_MS", asynParamInt32),      // batch_time
+      PV_param("KAFKA_ENCODING", asynParamInt32),           // encoding
+      PV_param("KAFKA_SPARSE_THRESHOLD", asynParamFloat64), // sparse_threshold
+      PV_param("KAFKA_KEYFRAME_INTERVAL", asynParamInt32),  // keyframe_interval
+      PV_param("KAFKA_STATISTICS", asynParamInt32),         // statistics
+      PV_param("KAFKA_STATS_THRESHOLD", asynParamFloat64),  // stats_threshold
+      PV_param("KAFKA_CHECKSUM", asynParamInt32),           // checksum
+      PV_param("KAFKA_TRANSPORT_TYPE", asynParamInt32),     // transport_type
+      PV_param("KAFKA_PACKED_BITS", asynParamInt32),        // packed_bits
+      PV_param("KAFKA_TILE_SIZE", asynParamInt32),          // tile_size
+      PV_param("KAFKA_TILE_THREADS", asynParamInt32),       // tile_threads
+      PV_param("KAFKA_PREVIEW_TOPIC", asynParamOctet),      // preview_topic
+      PV_param("KAFKA_PREVIEW_BINNING", asynParamInt32),    // preview_binning
+      PV_param("KAFKA_PREVIEW_MODE", asynParamInt32),       // preview_mode
+      PV_param("KAFKA_PREVIEW_RATE", asynParamFloat64),     // preview_rate
+      PV_param("KAFKA_PREVIEW_SENT", asynParamInt32),       // preview_sent
+      PV_param("KAFKA_MAX_ARRAY_RATE", asynParamFloat64),   // max_array_rate
+      PV_param("KAFKA_MAX_DATA_RATE", asynParamFloat64),    // max_data_rate
+      PV_param("KAFKA_DECIMATION", asynParamInt32),         // decimation
+      PV_param("KAFKA_SKIPPED_ARRAYS", asynParamInt32),     // skipped_arrays
+      PV_param("KAFKA_BACKEND", asynParamInt32),            // backend_type
+      PV_param("KAFKA_SEGMENT_PATH", asynParamOctet),       // segment_path
+      PV_param("KAFKA_SEGMENT_SIZE", asynParamInt32),       // segment_size
+      PV_param("KAFKA_RECORD_PATH", asynParamOctet),        // record_path
+      PV_param("KAFKA_RECORD_SEGMENT", asynParamInt32),     // record_segment
+      PV_param("KAFKA_RECORDED_MESSAGES", asynParamInt32),  // recorded_msgs
+      PV_param("KAFKA_TIME_PREPARE", asynParamFloat64),     // time_prepare
+      PV_param("KAFKA_TIME_SERIALIZE", asynParamFloat64),   // time_serialize
+      PV_param("KAFKA_TIME_SEND", asynParamFloat64),        // time_send
+      PV_param("KAFKA_TIME_RELOCK", asynParamFloat64),      // time_relock
+      PV_param("KAFKA_TIME_TOTAL", asynParamFloat64),       // time_total
   };
 };
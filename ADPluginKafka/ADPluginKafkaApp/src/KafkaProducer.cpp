@@ -5,6 +5,7 @@
  */
 
 #include "KafkaProducer.h"
+#include "Probes.h"
 #include <cassert>
 #include <chrono>
 #include <ciso646>
@@ -13,6 +14,11 @@
 
 namespace KafkaInterface {
 
+/** @brief How often a blocked KafkaProducer::SendKafkaPacket() serves the
+ * delivery reports itself (in ms), in case no other thread does.
+ */
+static const int blockPollIntervalMS = 10;
+
 int KafkaProducer::GetNumberOfPVs() { return PV::count; }
 
 KafkaProducer::KafkaProducer(std::string const &broker, std::string topic,
@@ -68,8 +74,18 @@ void KafkaProducer::ThreadFunction() {
       std::lock_guard<std::mutex> lock(brokerMutex);
       if (producer != nullptr and topic != nullptr) {
         producer->poll(0);
+        SendPendingMessages();
+        ReplaySpool();
       }
     }
+    {
+      std::lock_guard<std::mutex> lock(statsMutex);
+      parsedStats.swap(pendingStats);
+    }
+    if (not parsedStats.empty()) {
+      ParseStatusString(parsedStats);
+      parsedStats.clear();
+    }
   }
 }
 
@@ -142,7 +158,10 @@ bool KafkaProducer::SetMessageQueueLength(int queue) {
 int KafkaProducer::GetMessageQueueLength() { return msgQueueSize; }
 
 bool KafkaProducer::SendKafkaPacket(const unsigned char *buffer,
-                                    size_t buffer_size) {
+                                    size_t buffer_size,
+                                    std::int64_t timestamp,
+                                    MessageHeaders const &headers,
+                                    std::uint64_t arrays) {
   if (errorState or 0 == buffer_size) {
     return false;
   }
@@ -153,13 +172,25 @@ bool KafkaProducer::SendKafkaPacket(const unsigned char *buffer,
       return false;
     }
   }
-  std::lock_guard<std::mutex> lock(brokerMutex);
+  std::unique_lock<std::mutex> lock(brokerMutex);
+  // Once the brokers are up again, the spooled messages are sent by
+  // ReplaySpool() alongside the new messages
+  if (spool.IsOpen() and brokersDown and
+      SpoolPacket(buffer, buffer_size, timestamp, headers)) {
+    return true;
+  }
   if (nullptr == producer or nullptr == topic) {
     return false;
   }
-  RdKafka::ErrorCode resp = producer->produce(
-      topic, -1, RdKafka::Producer::RK_MSG_COPY /* Copy payload */,
-      const_cast<unsigned char *>(buffer), buffer_size, nullptr, nullptr);
+  // Messages waiting for room in the queue go first, to keep the order
+  RdKafka::ErrorCode resp{RdKafka::ERR__QUEUE_FULL};
+  if (SendPendingMessages()) {
+    resp = Produce(buffer, buffer_size, timestamp, headers);
+  }
+  if (RdKafka::ERR__QUEUE_FULL == resp) {
+    resp = HandleQueueFull(lock, buffer, buffer_size, timestamp, headers,
+                           arrays);
+  }
 
   if (RdKafka::ERR_NO_ERROR != resp) {
     SetConStat(KafkaProducer::ConStat::ERROR,
@@ -169,11 +200,213 @@ bool KafkaProducer::SendKafkaPacket(const unsigned char *buffer,
   return true;
 }
 
+bool KafkaProducer::SendMessage(const unsigned char *buffer, size_t size,
+                                std::int64_t timestamp,
+                                MessageHeaders const &headers,
+                                std::uint64_t arrays) {
+  return SendKafkaPacket(buffer, size, timestamp, headers, arrays);
+}
+
+std::uint64_t KafkaProducer::TakeEvictedArrays() {
+  return evictedArrays.exchange(0);
+}
+
+RdKafka::ErrorCode KafkaProducer::Produce(const unsigned char *buffer,
+                                          size_t buffer_size,
+                                          std::int64_t timestamp,
+                                          MessageHeaders const &headers) {
+  RdKafka::Headers *kafkaHeaders{nullptr};
+  if (not headers.empty()) {
+    kafkaHeaders = RdKafka::Headers::create();
+    for (auto const &header : headers) {
+      kafkaHeaders->add(header.first, header.second);
+    }
+  }
+  RdKafka::ErrorCode resp = producer->produce(
+      topicName, RdKafka::Topic::PARTITION_UA,
+      RdKafka::Producer::RK_MSG_COPY /* Copy payload */,
+      const_cast<unsigned char *>(buffer), buffer_size, nullptr, 0, timestamp,
+      kafkaHeaders, nullptr);
+
+  if (RdKafka::ERR_NO_ERROR != resp) {
+    // The headers are only owned by librdkafka if the call was successful
+    delete kafkaHeaders;
+  }
+  return resp;
+}
+
+RdKafka::ErrorCode KafkaProducer::HandleQueueFull(
+    std::unique_lock<std::mutex> &lock, const unsigned char *buffer,
+    size_t buffer_size, std::int64_t timestamp, MessageHeaders const &headers,
+    std::uint64_t arrays) {
+  RdKafka::ErrorCode resp{RdKafka::ERR__QUEUE_FULL};
+  if (QueueFullPolicy::DROP_OLDEST == queueFullPolicy) {
+    while (not pendingMessages.empty() and
+           (pendingMessages.size() >= static_cast<size_t>(msgQueueSize) or
+            pendingBytes + buffer_size > maxMessageBufferSizeKb * 1024)) {
+      pendingBytes -= pendingMessages.front().data.size();
+      evictedArrays += pendingMessages.front().arrays;
+      pendingMessages.pop_front();
+      ++undeliveredMessages;
+    }
+    setParam(paramCallback, paramsList.at(PV::undelivered),
+             int(undeliveredMessages));
+    pendingMessages.push_back(
+        {std::vector<unsigned char>(buffer, buffer + buffer_size), timestamp,
+         headers, arrays});
+    pendingBytes += buffer_size;
+    resp = RdKafka::ERR_NO_ERROR;
+  } else if (QueueFullPolicy::BLOCK == queueFullPolicy) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(blockTimeout);
+    while (RdKafka::ERR__QUEUE_FULL == resp) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        break;
+      }
+      // The mutex is released while waiting, so that the status thread and
+      // the setters are not held up. The status thread serves the delivery
+      // reports every KafkaProducer::sleepTime ms, dr_cb() then wakes us up.
+      deliveryCondition.wait_for(
+          lock, std::min<std::chrono::steady_clock::duration>(
+                    deadline - now,
+                    std::chrono::milliseconds(blockPollIntervalMS)));
+      // The producer may have been re-created in the meantime
+      if (nullptr == producer or nullptr == topic) {
+        break;
+      }
+      producer->poll(0);
+      if (SendPendingMessages()) {
+        resp = Produce(buffer, buffer_size, timestamp, headers);
+      }
+    }
+  }
+  return resp;
+}
+
+bool KafkaProducer::SendPendingMessages() {
+  if (nullptr == producer or nullptr == topic) {
+    return pendingMessages.empty();
+  }
+  while (not pendingMessages.empty()) {
+    auto const &message = pendingMessages.front();
+    if (RdKafka::ERR_NO_ERROR != Produce(message.data.data(),
+                                         message.data.size(),
+                                         message.timestamp, message.headers)) {
+      return false;
+    }
+    pendingBytes -= message.data.size();
+    pendingMessages.pop_front();
+  }
+  return true;
+}
+
+void KafkaProducer::dr_cb(RdKafka::Message &message) {
+  KAFKA_PROBE4(delivery__report, message.len(),
+               static_cast<int>(message.err()), message.partition(),
+               message.offset());
+  if (RdKafka::ERR_NO_ERROR != message.err()) {
+    ++undeliveredMessages;
+    setParam(paramCallback, paramsList.at(PV::undelivered),
+             int(undeliveredMessages));
+  }
+  deliveryCondition.notify_all();
+}
+
+void KafkaProducer::SetQueueFullPolicy(QueueFullPolicy policy) {
+  queueFullPolicy = policy;
+}
+
+KafkaProducer::QueueFullPolicy KafkaProducer::GetQueueFullPolicy() {
+  return queueFullPolicy;
+}
+
+bool KafkaProducer::SetBlockTimeoutMS(int timeout) {
+  if (timeout <= 0) {
+    return false;
+  }
+  blockTimeout = timeout;
+  return true;
+}
+
+int KafkaProducer::GetBlockTimeoutMS() { return blockTimeout; }
+
+bool KafkaProducer::SpoolPacket(const unsigned char *buffer,
+                                size_t buffer_size, std::int64_t timestamp,
+                                MessageHeaders const &headers) {
+  bool spooled = spool.Append(buffer, buffer_size, timestamp, headers);
+  UpdateSpoolPVs();
+  return spooled;
+}
+
+void KafkaProducer::ReplaySpool() {
+  if (spool.Empty()) {
+    return;
+  }
+  if (brokersDown) {
+    spoolReplayCredit = 0;
+    return;
+  }
+  if (spoolReplayRate > 0) {
+    // Never allow more than one second worth of messages in a burst
+    spoolReplayCredit =
+        std::min(spoolReplayCredit + spoolReplayRate * sleepTime / 1000.0,
+                 static_cast<double>(spoolReplayRate));
+  } else {
+    spoolReplayCredit = static_cast<double>(spool.GetMessages());
+  }
+  const unsigned char *buffer;
+  size_t bufferSize;
+  std::int64_t timestamp;
+  while (spoolReplayCredit >= 1.0 and
+         spool.Front(buffer, bufferSize, timestamp, spoolHeaders)) {
+    if (RdKafka::ERR_NO_ERROR !=
+        Produce(buffer, bufferSize, timestamp, spoolHeaders)) {
+      // Most likely a full queue, try again later
+      break;
+    }
+    spool.PopFront();
+    ++spoolReplayed;
+    spoolReplayCredit -= 1.0;
+  }
+  UpdateSpoolPVs();
+}
+
+void KafkaProducer::UpdateSpoolPVs() {
+  setParam(paramCallback, paramsList.at(PV::spool_fill),
+           spool.GetFillLevel());
+  setParam(paramCallback, paramsList.at(PV::spool_msgs),
+           static_cast<int>(spool.GetMessages()));
+  setParam(paramCallback, paramsList.at(PV::spool_replayed), spoolReplayed);
+}
+
+bool KafkaProducer::SetSpoolFile(std::string const &path,
+                                 std::uint64_t sizeBytes) {
+  std::lock_guard<std::mutex> lock(brokerMutex);
+  bool success = true;
+  if (path.empty()) {
+    spool.Close();
+  } else if (not spool.Open(path, sizeBytes)) {
+    SetConStat(KafkaProducer::ConStat::ERROR, spool.GetError());
+    success = false;
+  }
+  UpdateSpoolPVs();
+  return success;
+}
+
+void KafkaProducer::SetSpoolReplayRate(int messagesPerSecond) {
+  std::lock_guard<std::mutex> lock(brokerMutex);
+  spoolReplayRate = std::max(0, messagesPerSecond);
+}
+
+int KafkaProducer::GetSpoolReplayRate() { return spoolReplayRate; }
+
 void KafkaProducer::event_cb(RdKafka::Event &event) {
   /// @todo This member function really needs some expanded capability
   switch (event.type()) {
   case RdKafka::Event::EVENT_ERROR:
     if (event.err() == RdKafka::ERR__ALL_BROKERS_DOWN) {
+      brokersDown = true;
       SetConStat(KafkaProducer::ConStat::DISCONNECTED,
                  "Brokers down. Attempting to reconnect.");
     } else {
@@ -187,9 +420,11 @@ void KafkaProducer::event_cb(RdKafka::Event &event) {
   case RdKafka::Event::EVENT_THROTTLE:
     /// @todo Add message/log or something
     break;
-  case RdKafka::Event::EVENT_STATS:
-    ParseStatusString(event.str());
+  case RdKafka::Event::EVENT_STATS: {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    pendingStats = event.str();
     break;
+  }
   default:
     if ((event.type() == RdKafka::Event::EVENT_LOG) and
         (event.severity() == RdKafka::Event::EVENT_SEVERITY_ERROR)) {
@@ -204,35 +439,64 @@ void KafkaProducer::event_cb(RdKafka::Event &event) {
 void KafkaProducer::SetConStat(KafkaProducer::ConStat stat,
                                std::string const &msg) {
   // Should we add some storage functionality here?
+  connectionStatus = stat;
   setParam(paramCallback, paramsList.at(PV::con_status), int(stat));
   setParam(paramCallback, paramsList.at(PV::con_msg), msg);
 }
 
 void KafkaProducer::ParseStatusString(std::string const &msg) {
-  /// @todo We should probably extract some more stats from the JSON message
-  bool parseSuccess = reader.parse(msg, root);
-  if (not parseSuccess) {
+  Statistics stats;
+  if (not ExtractStatistics(msg.data(), msg.size(), stats)) {
     SetConStat(KafkaProducer::ConStat::ERROR, "Status msg.: Unable to parse.");
     return;
   }
-  brokers = root["brokers"]; // Contains broker information, including
-                             // connection state
-  if (brokers.isNull() or brokers.empty()) {
+  brokersDown = not stats.brokerUp;
+  if (0 == stats.brokers) {
     SetConStat(KafkaProducer::ConStat::ERROR, "Status msg.: No brokers.");
+  } else if (stats.brokerUp) {
+    SetConStat(KafkaProducer::ConStat::CONNECTED, "No errors.");
   } else {
-    KafkaProducer::ConStat tempStat = KafkaProducer::ConStat::DISCONNECTED;
-    std::string statString = "Brokers down. Attempting reconnection.";
-    if (std::any_of(brokers.begin(), brokers.end(),
-                    [](Json::Value const &CBrkr) {
-                      return "UP" == CBrkr["state"].asString();
-                    })) {
-      tempStat = KafkaProducer::ConStat::CONNECTED;
-      statString = "No errors.";
-    }
-    SetConStat(tempStat, statString);
+    SetConStat(KafkaProducer::ConStat::DISCONNECTED,
+               "Brokers down. Attempting reconnection.");
   }
-  int unsentMessages = root["msg_cnt"].asInt();
-  setParam(paramCallback, paramsList.at(PV::msgs_in_queue), unsentMessages);
+  setParam(paramCallback, paramsList.at(PV::msgs_in_queue),
+           static_cast<int>(stats.messagesInQueue));
+  UpdateStatistics(stats);
+}
+
+void KafkaProducer::UpdateStatistics(Statistics const &stats) {
+  double elapsed = (stats.timestamp - lastStats.timestamp) / 1e6;
+  // The counters restart when the producer is re-created
+  if (0 != lastStats.timestamp and elapsed > 0.0 and
+      stats.txMessages >= lastStats.txMessages and
+      stats.txBytes >= lastStats.txBytes) {
+    setParam(paramCallback, paramsList.at(PV::tx_msg_rate),
+             (stats.txMessages - lastStats.txMessages) / elapsed);
+    setParam(paramCallback, paramsList.at(PV::tx_data_rate),
+             (stats.txBytes - lastStats.txBytes) / elapsed / 1e6);
+  }
+  lastStats = stats;
+  setParam(paramCallback, paramsList.at(PV::queued_bytes),
+           static_cast<int>(stats.queuedBytes));
+  setParam(paramCallback, paramsList.at(PV::outbuf_count),
+           static_cast<int>(stats.outbufCount));
+  setParam(paramCallback, paramsList.at(PV::rtt_avg), stats.rttAvg / 1000);
+  setParam(paramCallback, paramsList.at(PV::rtt_p99), stats.rttP99 / 1000);
+  setParam(paramCallback, paramsList.at(PV::int_latency),
+           stats.intLatencyAvg / 1000);
+  setParam(paramCallback, paramsList.at(PV::throttle_time),
+           stats.throttleAvg);
+  setParam(paramCallback, paramsList.at(PV::batch_size), stats.batchSizeAvg);
+  setParam(paramCallback, paramsList.at(PV::batch_count),
+           stats.batchCountAvg);
+  if (statisticsCallback) {
+    statisticsCallback(stats);
+  }
+}
+
+void KafkaProducer::SetStatisticsCallback(
+    std::function<void(KafkaStatistics const &)> callback) {
+  statisticsCallback = callback;
 }
 
 void KafkaProducer::AttemptFlushAtReconnect(bool flush, int timeout_ms) {
@@ -256,13 +520,23 @@ void KafkaProducer::InitRdKafka() {
   }
 
   RdKafka::Conf::ConfResult configResult;
-  configResult = conf->set("event_cb", this, errstr);
+  configResult =
+      conf->set("event_cb", static_cast<RdKafka::EventCb *>(this), errstr);
   if (RdKafka::Conf::CONF_OK != configResult) {
     errorState = true;
     SetConStat(KafkaProducer::ConStat::ERROR, "Can not set event callback.");
     return;
   }
 
+  configResult = conf->set(
+      "dr_cb", static_cast<RdKafka::DeliveryReportCb *>(this), errstr);
+  if (RdKafka::Conf::CONF_OK != configResult) {
+    errorState = true;
+    SetConStat(KafkaProducer::ConStat::ERROR,
+               "Can not set delivery report callback.");
+    return;
+  }
+
   configResult = conf->set("statistics.interval.ms",
                            std::to_string(kafka_stats_interval), errstr);
   if (RdKafka::Conf::CONF_OK != configResult) {
@@ -379,6 +653,8 @@ bool KafkaProducer::MakeConnection() {
   if (nullptr == producer and nullptr == topic) {
     if (not brokerAddr.empty()) {
       producer = RdKafka::Producer::create(conf.get(), errstr);
+      // Nothing is known about the brokers of the new producer yet
+      brokersDown = false;
       if (nullptr == producer) {
         SetConStat(KafkaProducer::ConStat::ERROR, "Unable to create producer.");
         return false;
@@ -455,5 +731,8 @@ void KafkaProducer::RegisterParamCallbackClass(asynNDArrayDriver *ptr) {
   paramCallback = ptr;
 
   setParam(paramCallback, paramsList[PV::max_msg_size], int(maxMessageSize));
+  setParam(paramCallback, paramsList[PV::undelivered],
+           int(undeliveredMessages));
+  UpdateSpoolPVs();
 }
 } // namespace KafkaInterface
@@ -7,12 +7,19 @@
 #pragma once
 
 #include "ParamUtility.h"
-#include "json.h"
+#include "SpoolFile.h"
+#include "StatsExtractor.h"
+#include "Transport.h"
 #include <asynNDArrayDriver.h>
 #include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <librdkafka/rdkafkacpp.h>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -39,8 +46,17 @@ namespace KafkaInterface {
  * @todo This class copies the data that is to be sent, make it so that it does
  * not have to.
  */
-class KafkaProducer : public RdKafka::EventCb {
+class KafkaProducer : public RdKafka::EventCb,
+                      public RdKafka::DeliveryReportCb,
+                      public TransportProducer {
 public:
+  /// @brief What to do with a message when the producer queue is full.
+  enum class QueueFullPolicy {
+    DROP_NEWEST = 0,
+    DROP_OLDEST = 1,
+    BLOCK = 2,
+  };
+
   /** @brief Sets up the producer to send messages to a Kafka broker.
    * @note The steps for setting up this class as described in the class
    * description MUST be
@@ -219,10 +235,108 @@ public:
    */
   virtual bool StartThread();
 
+  /** @brief Sets a function which is called with the statistics every time
+   * they are received from librdkafka, e.g. to export them as metrics.
+   * Called by the status thread, without the port driver lock held. Must be
+   * set before KafkaProducer::StartThread() is called.
+   * @param[in] callback The function, an empty function disables the calls.
+   */
+  void SetStatisticsCallback(
+      std::function<void(KafkaStatistics const &)> callback);
+
   /** @brief Sends the binary data stored in the buffer to the Kafka broker.
-   * \todo Complete documentation.
+   * The data is copied by librdkafka and the buffer can thus be re-used as
+   * soon as this member function returns.
+   * @param[in] buffer Pointer to the data to send.
+   * @param[in] buffer_size Size of the data in bytes.
+   * @param[in] timestamp Kafka message timestamp in milliseconds since the
+   * Unix epoch. If set to 0, librdkafka will use the time at which the
+   * message was added to the queue.
+   * @param[in] headers Headers to add to the Kafka message. If empty, the
+   * message is sent without headers.
+   * @param[in] arrays The number of arrays in the message, counted by
+   * KafkaProducer::TakeEvictedArrays() if the message is dropped with
+   * QueueFullPolicy::DROP_OLDEST after it has been accepted.
+   * @return True if the message was added to the producer queue, false
+   * otherwise.
+   */
+  virtual bool SendKafkaPacket(const unsigned char *buffer, size_t buffer_size,
+                               std::int64_t timestamp = 0,
+                               MessageHeaders const &headers = {},
+                               std::uint64_t arrays = 1);
+
+  /// @brief Calls KafkaProducer::SendKafkaPacket().
+  bool SendMessage(const unsigned char *buffer, size_t size,
+                   std::int64_t timestamp, MessageHeaders const &headers,
+                   std::uint64_t arrays = 1) override;
+
+  /** @brief Returns the number of arrays in the messages dropped with
+   * QueueFullPolicy::DROP_OLDEST since the last call, and resets it. These
+   * messages were accepted by KafkaProducer::SendKafkaPacket(), so the
+   * caller has to count them as dropped itself.
+   */
+  std::uint64_t TakeEvictedArrays();
+
+  /** @brief Sets the file used to spool messages while the brokers can not be
+   * reached.
+   * While librdkafka reports all brokers as down, messages are appended to
+   * the spool file instead of being queued by librdkafka. Once a broker is
+   * reported as up, the spooled messages are sent in order at the rate set by
+   * KafkaProducer::SetSpoolReplayRate(), alongside the new messages which are
+   * sent at once. Thus, the spooled messages arrive after newer messages and
+   * consumers must not rely on the order of the messages (the timestamps are
+   * kept). Messages left in the spool file from a previous run are also sent.
+   * If the spool file is full, the messages are queued by librdkafka.
+   * @param[in] path Path to the spool file. An empty string disables spooling.
+   * @param[in] sizeBytes Maximum size of the spool file in bytes.
+   * @return True on success, false otherwise.
+   */
+  virtual bool SetSpoolFile(std::string const &path, std::uint64_t sizeBytes);
+
+  /** @brief Sets the rate at which spooled messages are sent once the
+   * connection to the brokers is up again.
+   * @param[in] messagesPerSecond Number of messages per second. A value of 0
+   * (the default) sends messages as fast as there is room for them in the
+   * librdkafka queue.
+   */
+  virtual void SetSpoolReplayRate(int messagesPerSecond);
+
+  /// @brief Returns the spooled messages replay rate in messages per second.
+  virtual int GetSpoolReplayRate();
+
+  /** @brief Sets what KafkaProducer::SendKafkaPacket() should do when the
+   * producer queue is full.
+   * * QueueFullPolicy::DROP_NEWEST: The new message is dropped (default).
+   * * QueueFullPolicy::DROP_OLDEST: The new message is kept in a queue of
+   * the producer in front of the librdkafka queue, which holds at most as
+   * many messages and bytes as the librdkafka queue, so that the memory used
+   * can double. When that queue is full too, its oldest message is dropped,
+   * counted as undelivered and reported by
+   * KafkaProducer::TakeEvictedArrays(). librdkafka does not
+   * provide a way to remove individual messages from its own queue, so the
+   * messages already handed to librdkafka are never dropped.
+   * * QueueFullPolicy::BLOCK: Wait for messages to be delivered for at most
+   * the time set by KafkaProducer::SetBlockTimeoutMS() before dropping the
+   * new message.
+   *
+   * If a spool file is used, messages are spooled instead while the brokers
+   * can not be reached, see KafkaProducer::SetSpoolFile().
+   * @param[in] policy The new policy.
    */
-  virtual bool SendKafkaPacket(const unsigned char *buffer, size_t buffer_size);
+  virtual void SetQueueFullPolicy(QueueFullPolicy policy);
+
+  /// @brief Returns the current queue full policy.
+  virtual QueueFullPolicy GetQueueFullPolicy();
+
+  /** @brief Sets the maximum time to wait for room in the producer queue
+   * when using QueueFullPolicy::BLOCK.
+   * @param[in] timeout The timeout in milliseconds, must be > 0.
+   * @return True on success, false otherwise.
+   */
+  virtual bool SetBlockTimeoutMS(int timeout);
+
+  /// @brief Returns the queue full block timeout in milliseconds.
+  virtual int GetBlockTimeoutMS();
 
   static int GetNumberOfPVs();
 
@@ -261,6 +375,75 @@ protected:
    */
   virtual void event_cb(RdKafka::Event &event);
 
+  /** @brief Callback member function called by librdkafka for every message
+   * that has been delivered or has failed to be delivered.
+   * Registering this callback makes KafkaProducer::SendKafkaPacket() able to
+   * wait for delivery progress when blocking on a full queue. Messages that
+   * could not be delivered are counted.
+   * @param[in] message The delivered (or failed) message.
+   */
+  virtual void dr_cb(RdKafka::Message &message);
+
+  /** @brief Applies the queue full policy to a message which did not fit in
+   * the producer queue.
+   * Must be called with KafkaProducer::brokerMutex locked. When blocking, the
+   * mutex is released while waiting for room in the queue.
+   * @param[in] lock The lock of KafkaProducer::brokerMutex.
+   * @return The error code of the last attempt to send the message, or
+   * RdKafka::ERR_NO_ERROR if the message was added to
+   * KafkaProducer::pendingMessages.
+   */
+  RdKafka::ErrorCode HandleQueueFull(std::unique_lock<std::mutex> &lock,
+                                     const unsigned char *buffer,
+                                     size_t buffer_size,
+                                     std::int64_t timestamp,
+                                     MessageHeaders const &headers,
+                                     std::uint64_t arrays);
+
+  /// @brief A message waiting for room in the producer queue.
+  struct PendingMessage {
+    std::vector<unsigned char> data;
+    std::int64_t timestamp;
+    MessageHeaders headers;
+    std::uint64_t arrays;
+  };
+
+  /** @brief Messages accepted with QueueFullPolicy::DROP_OLDEST while the
+   * producer queue was full, oldest first. Holds at most
+   * KafkaProducer::msgQueueSize messages and
+   * KafkaProducer::maxMessageBufferSizeKb kilobytes, unless a single message
+   * is larger. Protected by KafkaProducer::brokerMutex.
+   */
+  std::deque<PendingMessage> pendingMessages;
+
+  /// @brief The size of the payloads in KafkaProducer::pendingMessages.
+  size_t pendingBytes{0};
+
+  /// @brief See KafkaProducer::TakeEvictedArrays().
+  std::atomic<std::uint64_t> evictedArrays{0};
+
+  /** @brief Hands the pending messages to librdkafka for as long as there is
+   * room in the producer queue. Called by KafkaProducer::SendKafkaPacket()
+   * and periodically by KafkaProducer::ThreadFunction(), with
+   * KafkaProducer::brokerMutex locked.
+   * @return True if there are no pending messages left.
+   */
+  bool SendPendingMessages();
+
+  /** @brief Signalled by KafkaProducer::dr_cb() when a message has left the
+   * producer queue, wakes up KafkaProducer::HandleQueueFull() when blocking.
+   */
+  std::condition_variable deliveryCondition;
+
+  /// @brief What to do when the producer queue is full.
+  std::atomic<QueueFullPolicy> queueFullPolicy{QueueFullPolicy::DROP_NEWEST};
+
+  /// @brief Maximum time to wait for room in the queue in milliseconds.
+  std::atomic_int blockTimeout{1000};
+
+  /// @brief Number of messages that were queued but never delivered.
+  std::atomic_int undeliveredMessages{0};
+
   /** @brief Thread member function. Should only be called by
    * KafkaProducer::StartThread().
    */
@@ -274,6 +457,55 @@ protected:
     ERROR = 3,
   };
 
+  /// @brief The latest connection status as set by KafkaProducer::SetConStat().
+  std::atomic<ConStat> connectionStatus{ConStat::DISCONNECTED};
+
+  /** @brief True if librdkafka reported all brokers as down, either by an
+   * ERR__ALL_BROKERS_DOWN event or by the statistics, and no broker has been
+   * reported as up since. Messages are only spooled while this is true, not
+   * before the first statistics are received nor after other errors.
+   */
+  std::atomic_bool brokersDown{false};
+
+  /** @brief Hands a message over to librdkafka.
+   * Must be called with KafkaProducer::brokerMutex locked.
+   * @return The error code returned by librdkafka.
+   */
+  RdKafka::ErrorCode Produce(const unsigned char *buffer, size_t buffer_size,
+                             std::int64_t timestamp,
+                             MessageHeaders const &headers);
+
+  /** @brief Appends a message to the spool file and updates the spool PV:s.
+   * @return True if the message was spooled, false if the spool is full.
+   */
+  bool SpoolPacket(const unsigned char *buffer, size_t buffer_size,
+                   std::int64_t timestamp, MessageHeaders const &headers);
+
+  /** @brief Sends spooled messages at the configured rate unless the brokers
+   * are down. Called periodically by KafkaProducer::ThreadFunction() with
+   * KafkaProducer::brokerMutex locked.
+   */
+  void ReplaySpool();
+
+  /// @brief Updates the spool fill level and replay progress PV:s.
+  void UpdateSpoolPVs();
+
+  /// @brief Stores messages while the brokers can not be reached.
+  SpoolFile spool;
+
+  /// @brief Maximum number of spooled messages sent per second, 0 for no
+  /// limit.
+  int spoolReplayRate{0};
+
+  /// @brief Number of spooled messages that may currently be sent.
+  double spoolReplayCredit{0};
+
+  /// @brief Total number of spooled messages that have been sent.
+  int spoolReplayed{0};
+
+  /// @brief Re-used storage for the headers of spooled messages.
+  MessageHeaders spoolHeaders;
+
   /** @brief Sets the correct status PV:s.
    * Will call KafkaPlugin::DestroyKafkaConnection() if the status id is equal
    * to
@@ -288,15 +520,45 @@ protected:
   virtual void SetConStat(ConStat stat, std::string const &msg);
 
   /** @brief Parses JSON status string from Kafka system and updates PV:s.
-   * Uses jsoncpp to parse the status string and extracts current connection
-   * status of available
-   * brokers as well as the number of messages not yet transmitted to the Kafka
-   * broker. This
-   * information is then used to update the relevant PV:s.
+   * Uses ExtractStatistics() to scan the status string, without building a
+   * JSON tree, for the current connection status of available brokers as well
+   * as the number of messages not yet transmitted to the Kafka broker. This
+   * information is then used to update the relevant PV:s. The throughput,
+   * latency and batching statistics are extracted as well, see
+   * KafkaStatistics.
    * @param[in] msg JSON status message obtained from the Kafka producer system.
    */
   virtual void ParseStatusString(std::string const &msg);
 
+  /// @brief Values extracted from the librdkafka statistics.
+  using Statistics = KafkaStatistics;
+
+  /** @brief Updates the statistics PV:s, including the transmit rates
+   * computed from the previous statistics.
+   * @param[in] stats The latest statistics.
+   */
+  void UpdateStatistics(Statistics const &stats);
+
+  /// @brief The previous statistics, used to compute the transmit rates.
+  Statistics lastStats;
+
+  /// @brief See KafkaProducer::SetStatisticsCallback().
+  std::function<void(KafkaStatistics const &)> statisticsCallback;
+
+  /** @brief The latest statistics JSON string received by
+   * KafkaProducer::event_cb(). Parsed by the status thread so that the
+   * parsing never delays the produce path, which may also serve events while
+   * waiting for room in the queue. Only the latest string is kept.
+   * Protected by KafkaProducer::statsMutex.
+   */
+  std::string pendingStats;
+
+  /// @brief The statistics JSON string being parsed by the status thread.
+  std::string parsedStats;
+
+  /// @brief Protects KafkaProducer::pendingStats.
+  std::mutex statsMutex;
+
   int kafka_stats_interval{
       500}; /// @brief Saved Kafka connection stats interval in ms.
 
@@ -346,10 +608,6 @@ protected:
   std::string brokerAddr; /// @brief Stores the current broker address used by
                           /// the consumer.
 
-  /// @brief The root and broker json objects extracted from a json string.
-  Json::Value root, brokers;
-  Json::Reader reader; /// @brief Parses std:string objects into a Json::value.
-
   /// @brief C++11 thread which periodically polls for connection stats.
   std::thread statusThread;
 
@@ -369,6 +627,20 @@ protected:
     msgs_in_queue,
     max_msg_size,
     msg_buffer_size,
+    spool_fill,
+    spool_msgs,
+    spool_replayed,
+    undelivered,
+    tx_msg_rate,
+    tx_data_rate,
+    queued_bytes,
+    outbuf_count,
+    rtt_avg,
+    rtt_p99,
+    int_latency,
+    throttle_time,
+    batch_size,
+    batch_count,
     count,
   };
 
@@ -379,6 +651,20 @@ protected:
       PV_param("KAFKA_UNSENT_PACKETS", asynParamInt32),     // msgs_in_queue
       PV_param("KAFKA_MAX_MSG_SIZE", asynParamInt32),       // max_msg_size
       PV_param("KAFKA_MSG_BUFFER_SIZE", asynParamInt32),    // msg_buffer_size
+      PV_param("KAFKA_SPOOL_FILL", asynParamInt32),         // spool_fill
+      PV_param("KAFKA_SPOOL_MESSAGES", asynParamInt32),     // spool_msgs
+      PV_param("KAFKA_SPOOL_REPLAYED", asynParamInt32),     // spool_replayed
+      PV_param("KAFKA_UNDELIVERED", asynParamInt32),        // undelivered
+      PV_param("KAFKA_TX_MSG_RATE", asynParamFloat64),      // tx_msg_rate
+      PV_param("KAFKA_TX_DATA_RATE", asynParamFloat64),     // tx_data_rate
+      PV_param("KAFKA_QUEUED_BYTES", asynParamInt32),       // queued_bytes
+      PV_param("KAFKA_OUTBUF_COUNT", asynParamInt32),       // outbuf_count
+      PV_param("KAFKA_RTT_AVG_MS", asynParamFloat64),       // rtt_avg
+      PV_param("KAFKA_RTT_P99_MS", asynParamFloat64),       // rtt_p99
+      PV_param("KAFKA_INT_LATENCY_MS", asynParamFloat64),   // int_latency
+      PV_param("KAFKA_THROTTLE_MS", asynParamFloat64),      // throttle_time
+      PV_param("KAFKA_BATCH_SIZE_AVG", asynParamFloat64),   // batch_size
+      PV_param("KAFKA_BATCH_COUNT_AVG", asynParamFloat64),  // batch_count
   };
 };
 } // namespace KafkaInterface
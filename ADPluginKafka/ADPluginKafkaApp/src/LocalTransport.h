@@ -0,0 +1,149 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  LocalTransport.h
+ *  @brief Header file of the back-end which passes messages from a plugin to
+ * a driver in the same IOC through a lock-free queue.
+ */
+
+#pragma once
+
+#include "Transport.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace KafkaInterface {
+
+/// @brief A message passed through a LocalChannel.
+class LocalMessage : public TransportMessage {
+public:
+  LocalMessage(const unsigned char *buffer, size_t size,
+               std::int64_t timestamp);
+
+  void *GetDataPtr() override;
+
+  size_t size() override;
+
+  /// @brief The timestamp given to LocalProducer::SendMessage().
+  std::int64_t GetTimestamp() const;
+
+private:
+  std::vector<unsigned char> data;
+  std::int64_t timestamp;
+};
+
+/** @brief A bounded multi producer, multi consumer queue of messages.
+ * Adding and removing messages is lock-free (the queue of D. Vyukov). Only a
+ * consumer waiting for an empty queue takes a mutex, and a producer only
+ * takes it to wake up such a consumer.
+ */
+class LocalChannel {
+public:
+  /** @brief Creates an empty queue.
+   * @param[in] capacity Maximum number of messages, rounded up to a power of
+   * two.
+   */
+  explicit LocalChannel(size_t capacity);
+
+  /// @brief Frees the messages still in the queue.
+  ~LocalChannel();
+
+  LocalChannel(LocalChannel const &) = delete;
+  LocalChannel &operator=(LocalChannel const &) = delete;
+
+  /** @brief Returns the channel with the given name, created with
+   * LocalChannel::defaultCapacity if it does not exist.
+   * The channels are shared by all plugins and drivers in the process and
+   * exist for as long as one of them is using it.
+   */
+  static std::shared_ptr<LocalChannel> Get(std::string const &name);
+
+  /** @brief Adds a message to the end of the queue.
+   * @param[in] message The message, only taken if there is room for it.
+   * @return False if the queue is full, true otherwise.
+   */
+  bool Push(std::unique_ptr<LocalMessage> &message);
+
+  /** @brief Removes the first message from the queue.
+   * @param[in] timeout Maximum time to wait for a message in milliseconds.
+   * @return The message or nullptr if the queue stayed empty.
+   */
+  std::unique_ptr<LocalMessage> Pop(int timeout);
+
+  /// @brief Maximum number of messages in the queue.
+  size_t GetCapacity() const;
+
+  /// @brief Capacity of the channels returned by LocalChannel::Get().
+  static const size_t defaultCapacity{64};
+
+private:
+  /// @brief Removes the first message from the queue without waiting.
+  std::unique_ptr<LocalMessage> TryPop();
+
+  /// @brief A slot of the queue, its sequence tells whose turn it is.
+  struct Cell {
+    std::atomic<size_t> sequence;
+    LocalMessage *message;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+
+  /// @brief Number of cells minus one.
+  size_t mask;
+
+  /// @brief Position of the next message added by a producer.
+  std::atomic<size_t> enqueuePosition{0};
+
+  /// @brief Keeps the positions, updated by different threads, on separate
+  /// cache lines.
+  char padding[64];
+
+  /// @brief Position of the next message removed by a consumer.
+  std::atomic<size_t> dequeuePosition{0};
+
+  /// @brief Number of consumers waiting for a message.
+  std::atomic_int waiting{0};
+  std::mutex waitMutex;
+  std::condition_variable waitCondition;
+};
+
+/// @brief Sends messages to a LocalChannel.
+class LocalProducer : public TransportProducer {
+public:
+  /// @param[in] channelName Name of the channel, see LocalChannel::Get().
+  explicit LocalProducer(std::string const &channelName);
+
+  /** @brief Adds a copy of the message to the channel.
+   * Messages are dropped if the channel is full and the headers are not
+   * sent.
+   */
+  bool SendMessage(const unsigned char *buffer, size_t size,
+                   std::int64_t timestamp, MessageHeaders const &headers,
+                   std::uint64_t arrays = 1) override;
+
+private:
+  std::shared_ptr<LocalChannel> channel;
+};
+
+/// @brief Receives messages from a LocalChannel.
+class LocalConsumer : public TransportConsumer {
+public:
+  /// @param[in] channelName Name of the channel, see LocalChannel::Get().
+  explicit LocalConsumer(std::string const &channelName);
+
+  std::unique_ptr<TransportMessage> ReceiveMessage(int timeout) override;
+
+  /** @brief Starts the consumption of messages. Messages sent while the
+   * consumption was stopped are kept by the channel until it is full.
+   */
+  void StartConsumption() override;
+
+  void StopConsumption() override;
+
+private:
+  std::shared_ptr<LocalChannel> channel;
+  std::atomic_bool consuming{false};
+};
+} // namespace KafkaInterface
@@ -0,0 +1,356 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  MetricsServer.cpp
+ *  @brief Implementation of the metrics of the plugin and the driver and of
+ * the HTTP server exporting them.
+ */
+
+#include "MetricsServer.h"
+#include "SharedRegistry.h"
+#include <algorithm>
+#include <ciso646>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace KafkaInterface {
+
+namespace {
+/// @brief How often the server thread checks if it should stop (in ms).
+const int stopCheckIntervalMS = 200;
+
+/// @brief Maximum size of a request, the rest is ignored.
+const size_t maxRequestSize = 4096;
+
+#ifdef MSG_NOSIGNAL
+/// @brief A scraper closing the connection early must not raise SIGPIPE.
+const int sendFlags = MSG_NOSIGNAL;
+#else
+const int sendFlags = 0;
+#endif
+
+/// @brief Formats a sample value as Prometheus expects it.
+std::string FormatValue(double value) {
+  if (std::isnan(value)) {
+    return "NaN";
+  } else if (std::isinf(value)) {
+    return value > 0 ? "+Inf" : "-Inf";
+  }
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+  return buffer;
+}
+
+/// @brief Escapes a label value or a help text.
+std::string Escape(std::string const &text, bool quotes) {
+  std::string escaped;
+  for (auto character : text) {
+    if ('\\' == character) {
+      escaped += "\\\\";
+    } else if ('\n' == character) {
+      escaped += "\\n";
+    } else if (quotes and '"' == character) {
+      escaped += "\\\"";
+    } else {
+      escaped += character;
+    }
+  }
+  return escaped;
+}
+} // namespace
+
+MetricHistogram::MetricHistogram(std::vector<double> const &bounds)
+    : bounds(bounds),
+      buckets(new std::atomic<std::uint64_t>[bounds.size() + 1]) {
+  for (size_t i = 0; i <= bounds.size(); i++) {
+    buckets[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void MetricHistogram::Observe(double value) {
+  size_t bucket =
+      std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+  buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  double oldSum = sum.load(std::memory_order_relaxed);
+  while (not sum.compare_exchange_weak(oldSum, oldSum + value,
+                                       std::memory_order_relaxed)) {
+  }
+  count.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::uint64_t MetricHistogram::GetBucket(size_t bucket) const {
+  if (bucket > bounds.size()) {
+    return 0;
+  }
+  return buckets[bucket].load(std::memory_order_relaxed);
+}
+
+std::uint64_t MetricHistogram::GetCount() const {
+  return count.load(std::memory_order_relaxed);
+}
+
+double MetricHistogram::GetSum() const {
+  return sum.load(std::memory_order_relaxed);
+}
+
+std::vector<double> ExponentialBuckets(double start, double factor,
+                                       size_t count) {
+  std::vector<double> bounds;
+  double bound = start;
+  for (size_t i = 0; i < count; i++) {
+    bounds.push_back(bound);
+    bound *= factor;
+  }
+  return bounds;
+}
+
+MetricsSet::MetricsSet(std::string const &portName)
+    : portLabel("port=\"" + Escape(portName, true) + "\"") {}
+
+MetricCounter &MetricsSet::AddCounter(std::string const &name,
+                                      std::string const &help) {
+  counters.emplace_back();
+  metrics.push_back({name, help, &counters.back(), nullptr, nullptr});
+  return counters.back();
+}
+
+MetricGauge &MetricsSet::AddGauge(std::string const &name,
+                                  std::string const &help) {
+  gauges.emplace_back();
+  metrics.push_back({name, help, nullptr, &gauges.back(), nullptr});
+  return gauges.back();
+}
+
+MetricHistogram &MetricsSet::AddHistogram(std::string const &name,
+                                          std::string const &help,
+                                          std::vector<double> const &bounds) {
+  histograms.emplace_back(bounds);
+  metrics.push_back({name, help, nullptr, nullptr, &histograms.back()});
+  return histograms.back();
+}
+
+void MetricsSet::RenderSamples(Metric const &metric, std::string &text) const {
+  if (nullptr != metric.counter) {
+    text += metric.name + "{" + portLabel + "} " +
+            std::to_string(metric.counter->Get()) + "\n";
+  } else if (nullptr != metric.gauge) {
+    text += metric.name + "{" + portLabel + "} " +
+            FormatValue(metric.gauge->Get()) + "\n";
+  } else {
+    auto const &histogram = *metric.histogram;
+    auto const &bounds = histogram.GetBounds();
+    // The count is read first, so that it is never larger than the +Inf
+    // bucket, as the buckets are updated before the count
+    std::uint64_t count = histogram.GetCount();
+    std::uint64_t cumulative = 0;
+    for (size_t i = 0; i <= bounds.size(); i++) {
+      cumulative += histogram.GetBucket(i);
+      std::string bound =
+          i < bounds.size() ? FormatValue(bounds[i]) : std::string("+Inf");
+      text += metric.name + "_bucket{" + portLabel + ",le=\"" + bound +
+              "\"} " + std::to_string(cumulative) + "\n";
+    }
+    text += metric.name + "_sum{" + portLabel + "} " +
+            FormatValue(histogram.GetSum()) + "\n";
+    text += metric.name + "_count{" + portLabel + "} " +
+            std::to_string(count) + "\n";
+  }
+}
+
+std::string MetricsSet::Render(std::vector<MetricsSet const *> const &sets) {
+  // The names in the order they were first added
+  std::vector<Metric const *> names;
+  for (auto set : sets) {
+    for (auto const &metric : set->metrics) {
+      if (names.end() == std::find_if(names.begin(), names.end(),
+                                      [&metric](Metric const *other) {
+                                        return other->name == metric.name;
+                                      })) {
+        names.push_back(&metric);
+      }
+    }
+  }
+  std::string text;
+  for (auto name : names) {
+    const char *type = "histogram";
+    if (nullptr != name->counter) {
+      type = "counter";
+    } else if (nullptr != name->gauge) {
+      type = "gauge";
+    }
+    text += "# HELP " + name->name + " " + Escape(name->help, false) + "\n";
+    text += "# TYPE " + name->name + " " + type + "\n";
+    for (auto set : sets) {
+      for (auto const &metric : set->metrics) {
+        if (metric.name == name->name) {
+          set->RenderSamples(metric, text);
+        }
+      }
+    }
+  }
+  return text;
+}
+
+/// @brief The servers of the IOC, shared by the plugins and the drivers.
+struct MetricsServer::Registry {
+  std::mutex mutex;
+  std::map<int, std::weak_ptr<MetricsServer>> servers;
+};
+
+std::shared_ptr<MetricsServer> MetricsServer::Get(int port) {
+  auto &registry = SharedInstance<Registry>("KafkaMetricsServers");
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto &servers = registry.servers;
+  if (0 != port) {
+    auto server = servers[port].lock();
+    if (nullptr != server) {
+      return server;
+    }
+  }
+  std::shared_ptr<MetricsServer> server(new MetricsServer());
+  if (not server->Listen(port)) {
+    return nullptr;
+  }
+  if (0 != port) {
+    servers[port] = server;
+  }
+  server->runThread = true;
+  server->serverThread =
+      std::thread(&MetricsServer::ThreadFunction, server.get());
+  return server;
+}
+
+MetricsServer::~MetricsServer() {
+  if (serverThread.joinable()) {
+    runThread = false;
+    serverThread.join();
+  }
+#ifndef _WIN32
+  if (-1 != listenSocket) {
+    close(listenSocket);
+  }
+#endif
+}
+
+void MetricsServer::Add(MetricsSet const *set) {
+  std::lock_guard<std::mutex> lock(setsMutex);
+  if (sets.end() == std::find(sets.begin(), sets.end(), set)) {
+    sets.push_back(set);
+  }
+}
+
+void MetricsServer::Remove(MetricsSet const *set) {
+  std::lock_guard<std::mutex> lock(setsMutex);
+  sets.erase(std::remove(sets.begin(), sets.end(), set), sets.end());
+}
+
+std::string MetricsServer::Render() const {
+  std::lock_guard<std::mutex> lock(setsMutex);
+  return MetricsSet::Render(sets);
+}
+
+#ifdef _WIN32
+bool MetricsServer::Listen(int) { return false; }
+
+void MetricsServer::ThreadFunction() {}
+
+void MetricsServer::Serve(int) {}
+#else
+bool MetricsServer::Listen(int tcpPort) {
+  if (tcpPort < 0 or tcpPort > 65535) {
+    return false;
+  }
+  listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+  if (-1 == listenSocket) {
+    return false;
+  }
+  int reuse = 1;
+  setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(static_cast<std::uint16_t>(tcpPort));
+  socklen_t addressSize = sizeof(address);
+  if (0 != bind(listenSocket, reinterpret_cast<sockaddr *>(&address),
+                addressSize) or
+      0 != listen(listenSocket, 8) or
+      0 != getsockname(listenSocket, reinterpret_cast<sockaddr *>(&address),
+                       &addressSize)) {
+    close(listenSocket);
+    listenSocket = -1;
+    return false;
+  }
+  port = ntohs(address.sin_port);
+  return true;
+}
+
+void MetricsServer::ThreadFunction() {
+  while (runThread) {
+    pollfd listenPoll{listenSocket, POLLIN, 0};
+    if (poll(&listenPoll, 1, stopCheckIntervalMS) <= 0) {
+      continue;
+    }
+    int connection = accept(listenSocket, nullptr, nullptr);
+    if (-1 == connection) {
+      continue;
+    }
+    Serve(connection);
+    close(connection);
+  }
+}
+
+void MetricsServer::Serve(int connection) {
+  // A scraper which stops sending must not block the server for long
+  timeval timeout{1, 0};
+  setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos and
+         request.find("\n\n") == std::string::npos and
+         request.size() < maxRequestSize) {
+    ssize_t received = recv(connection, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+      break;
+    }
+    request.append(buffer, received);
+  }
+  std::string status = "200 OK";
+  std::string body;
+  bool head = 0 == request.compare(0, 5, "HEAD ");
+  if (0 != request.compare(0, 4, "GET ") and not head) {
+    status = "405 Method Not Allowed";
+  } else {
+    body = Render();
+  }
+  std::string response = "HTTP/1.0 " + status +
+                         "\r\nContent-Type: text/plain; version=0.0.4; "
+                         "charset=utf-8\r\nContent-Length: " +
+                         std::to_string(body.size()) +
+                         "\r\nConnection: close\r\n\r\n";
+  if (not head) {
+    response += body;
+  }
+  size_t sent = 0;
+  while (sent < response.size()) {
+    ssize_t result = send(connection, response.data() + sent,
+                          response.size() - sent, sendFlags);
+    if (result <= 0) {
+      break;
+    }
+    sent += result;
+  }
+}
+#endif
+} // namespace KafkaInterface
@@ -0,0 +1,224 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  MetricsServer.h
+ *  @brief Header file of the metrics of the plugin and the driver and of the
+ * HTTP server exporting them in the Prometheus text format.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace KafkaInterface {
+
+/// @brief A value which only increases, e.g. the number of arrays sent.
+class MetricCounter {
+public:
+  /// @brief Increases the value, safe to call from any thread.
+  void Add(std::uint64_t amount = 1) {
+    value.fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  /// @brief Returns the current value.
+  std::uint64_t Get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<std::uint64_t> value{0};
+};
+
+/// @brief A value which can go up and down, e.g. the length of a queue.
+class MetricGauge {
+public:
+  /// @brief Sets the value, safe to call from any thread.
+  void Set(double newValue) {
+    value.store(newValue, std::memory_order_relaxed);
+  }
+
+  /// @brief Returns the current value.
+  double Get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<double> value{0.0};
+};
+
+/** @brief Counts observed values, e.g. processing times, in buckets with
+ * fixed upper bounds. The values can be observed by several threads at the
+ * same time. A scrape during an observation may see the count of the bucket
+ * updated but not yet the sum, which Prometheus tolerates.
+ */
+class MetricHistogram {
+public:
+  /** @brief Creates a histogram.
+   * @param[in] bounds The upper bounds of the buckets in increasing order.
+   * A bucket for larger values is always added.
+   */
+  explicit MetricHistogram(std::vector<double> const &bounds);
+
+  /// @brief Adds a value to the bucket it belongs to and to the sum.
+  void Observe(double value);
+
+  /// @brief Returns the upper bounds of the buckets, without the last one.
+  std::vector<double> const &GetBounds() const { return bounds; }
+
+  /** @brief Returns the number of values in a bucket (not including the
+   * smaller buckets). The bucket of the values larger than all bounds has
+   * index GetBounds().size().
+   */
+  std::uint64_t GetBucket(size_t bucket) const;
+
+  /// @brief Returns the number of values observed.
+  std::uint64_t GetCount() const;
+
+  /// @brief Returns the sum of the values observed.
+  double GetSum() const;
+
+private:
+  std::vector<double> bounds;
+  std::unique_ptr<std::atomic<std::uint64_t>[]> buckets;
+  std::atomic<std::uint64_t> count{0};
+  std::atomic<double> sum{0.0};
+};
+
+/** @brief Returns count bucket bounds, the first one being start and each
+ * following one factor times the previous one.
+ */
+std::vector<double> ExponentialBuckets(double start, double factor,
+                                       size_t count);
+
+/** @brief The metrics of one plugin or driver.
+ * All metrics of a set get the label port="<port name>", so that several
+ * ports can be served by the same MetricsServer. The metrics are added when
+ * the set is created, before it is added to a server, and live as long as
+ * the set. Updating them never takes a lock.
+ */
+class MetricsSet {
+public:
+  /// @param[in] portName The value of the port label of the metrics.
+  explicit MetricsSet(std::string const &portName);
+
+  MetricsSet(MetricsSet const &) = delete;
+  MetricsSet &operator=(MetricsSet const &) = delete;
+
+  /** @brief Adds a counter.
+   * @param[in] name Name of the metric, should end with "_total".
+   * @param[in] help Description of the metric.
+   * @return The counter, valid as long as the set.
+   */
+  MetricCounter &AddCounter(std::string const &name, std::string const &help);
+
+  /** @brief Adds a gauge.
+   * @param[in] name Name of the metric.
+   * @param[in] help Description of the metric.
+   * @return The gauge, valid as long as the set.
+   */
+  MetricGauge &AddGauge(std::string const &name, std::string const &help);
+
+  /** @brief Adds a histogram.
+   * @param[in] name Name of the metric, without the "_bucket", "_sum" and
+   * "_count" suffixes.
+   * @param[in] help Description of the metric.
+   * @param[in] bounds The upper bounds of the buckets, see MetricHistogram.
+   * @return The histogram, valid as long as the set.
+   */
+  MetricHistogram &AddHistogram(std::string const &name,
+                                std::string const &help,
+                                std::vector<double> const &bounds);
+
+  /** @brief Renders the metrics of several sets in the Prometheus text
+   * format (version 0.0.4). Metrics with the same name in several sets are
+   * rendered together, under one HELP and TYPE line.
+   * @param[in] sets The sets to render.
+   * @return The text.
+   */
+  static std::string Render(std::vector<MetricsSet const *> const &sets);
+
+private:
+  /// @brief A metric of the set, only one of the pointers is set.
+  struct Metric {
+    std::string name;
+    std::string help;
+    MetricCounter *counter;
+    MetricGauge *gauge;
+    MetricHistogram *histogram;
+  };
+
+  /// @brief Appends the samples of a metric of this set.
+  void RenderSamples(Metric const &metric, std::string &text) const;
+
+  /// @brief The port label, escaped and ready to be written.
+  std::string portLabel;
+  std::vector<Metric> metrics;
+  std::deque<MetricCounter> counters;
+  std::deque<MetricGauge> gauges;
+  std::deque<MetricHistogram> histograms;
+};
+
+/** @brief A minimal HTTP server which answers every GET request with the
+ * metrics of the sets added to it, so that they can be scraped by
+ * Prometheus. Listens on the loopback interface only.
+ * There is one server per TCP port, shared by all plugins and drivers
+ * exporting their metrics on that port. The sets are protected by a mutex of
+ * the server, the port driver locks are never taken by a scrape. A
+ * connection is served at a time, which is enough for a scraper.
+ */
+class MetricsServer {
+public:
+  /** @brief Returns the server listening on a TCP port, starting it if
+   * needed.
+   * @param[in] port The TCP port. With 0 a new server is started on a port
+   * chosen by the operating system, see GetPort().
+   * @return The server, or nullptr if the port can not be listened on.
+   */
+  static std::shared_ptr<MetricsServer> Get(int port);
+
+  /// @brief Stops the server.
+  ~MetricsServer();
+
+  MetricsServer(MetricsServer const &) = delete;
+  MetricsServer &operator=(MetricsServer const &) = delete;
+
+  /// @brief Adds a set to the metrics served.
+  void Add(MetricsSet const *set);
+
+  /// @brief Removes a set, which must be done before it is destroyed.
+  void Remove(MetricsSet const *set);
+
+  /// @brief Returns the metrics of the sets in the Prometheus text format.
+  std::string Render() const;
+
+  /// @brief Returns the TCP port the server listens on.
+  int GetPort() const { return port; }
+
+private:
+  MetricsServer() = default;
+
+  /// @brief Binds and listens on the port, returns false on failure.
+  bool Listen(int tcpPort);
+
+  /// @brief Accepts and serves connections until the server is stopped.
+  void ThreadFunction();
+
+  /// @brief Reads a request from a connection and writes the response.
+  void Serve(int connection);
+
+  int port{0};
+  int listenSocket{-1};
+  std::atomic_bool runThread{false};
+  std::thread serverThread;
+
+  /// @brief Protects MetricsServer::sets.
+  mutable std::mutex setsMutex;
+  std::vector<MetricsSet const *> sets;
+
+  /// @brief The servers by TCP port, see SharedInstance().
+  struct Registry;
+};
+} // namespace KafkaInterface
@@ -6,22 +6,477 @@
  */
 
 #include "NDArraySerializer.h"
+#include "ArraySummary.h"
+#include "BitPacking.h"
+#include "Crc32c.h"
+#include "FloatConversion.h"
+#include "WorkerPool.h"
+#include <algorithm>
 #include <cassert>
 #include <ciso646>
+#include <cmath>
+#include <cstdio>
+#include <limits>
 #include <memory>
+#include <string>
 #include <vector>
 
+namespace {
+/// @brief Elements checked at once, without branches, when looking for
+/// sparse elements.
+const size_t sparseBlockSize = 32;
+
+/** @brief Finds the elements with an absolute value above a threshold.
+ * Blocks of elements are first checked without branching (which the compiler
+ * can vectorize) so that blocks without such elements are skipped quickly.
+ * @param[in] data The array data.
+ * @param[in] elements Number of elements in the array.
+ * @param[in] threshold Elements with an absolute value <= this are skipped.
+ * @param[in] maxIndices Give up if this many elements are found.
+ * @param[out] indices Indices of the elements found.
+ * @return True if less than maxIndices elements were found.
+ */
+template <typename T>
+bool FindSparseIndices(const void *data, size_t elements, double threshold,
+                       size_t maxIndices, std::vector<std::uint32_t> &indices) {
+  auto values = static_cast<const T *>(data);
+  indices.clear();
+  size_t blockStart = 0;
+  while (blockStart < elements) {
+    size_t blockEnd = std::min(blockStart + sparseBlockSize, elements);
+    bool anyAbove = false;
+    for (size_t i = blockStart; i < blockEnd; i++) {
+      // Written so that NaN counts as above the threshold
+      anyAbove |= not(std::fabs(static_cast<double>(values[i])) <= threshold);
+    }
+    if (anyAbove) {
+      for (size_t i = blockStart; i < blockEnd; i++) {
+        if (not(std::fabs(static_cast<double>(values[i])) <= threshold)) {
+          if (indices.size() >= maxIndices) {
+            return false;
+          }
+          indices.push_back(static_cast<std::uint32_t>(i));
+        }
+      }
+    }
+    blockStart = blockEnd;
+  }
+  return true;
+}
+
+/// @brief Copies the elements at the given indices to the destination.
+template <typename T>
+void GatherSparseValues(const void *data,
+                        std::vector<std::uint32_t> const &indices,
+                        std::uint8_t *destination) {
+  auto values = static_cast<const T *>(data);
+  for (auto index : indices) {
+    std::memcpy(destination, &values[index], sizeof(T));
+    destination += sizeof(T);
+  }
+}
+
+/** @brief Computes the CRC32C checksum of the dense array a receiver
+ * reconstructs from sparse values, i.e. with all other elements set to 0.
+ * @param[in] values The sparse values, one per index.
+ * @param[in] elementBytes Size of an element in bytes.
+ * @param[in] indices The increasing indices of the sparse values.
+ * @param[in] elements Number of elements of the dense array.
+ */
+std::uint32_t SparseCrc32c(const std::uint8_t *values, size_t elementBytes,
+                           std::vector<std::uint32_t> const &indices,
+                           size_t elements) {
+  static const std::uint8_t zeros[4096] = {};
+  std::uint32_t crc = 0;
+  auto addZeros = [&crc](size_t bytes) {
+    while (bytes > 0) {
+      size_t chunk = std::min(bytes, sizeof(zeros));
+      crc = KafkaInterface::Crc32c(zeros, chunk, crc);
+      bytes -= chunk;
+    }
+  };
+  size_t next = 0;
+  for (auto index : indices) {
+    addZeros((index - next) * elementBytes);
+    crc = KafkaInterface::Crc32c(values, elementBytes, crc);
+    values += elementBytes;
+    next = index + 1;
+  }
+  addZeros((elements - next) * elementBytes);
+  return crc;
+}
+
+/// @brief Calls FindSparseIndices() with the type of the array.
+bool FindSparseIndices(NDDataType_t dataType, const void *data,
+                       size_t elements, double threshold, size_t maxIndices,
+                       std::vector<std::uint32_t> &indices) {
+  switch (dataType) {
+  case NDInt8:
+    return FindSparseIndices<epicsInt8>(data, elements, threshold, maxIndices,
+                                        indices);
+  case NDUInt8:
+    return FindSparseIndices<epicsUInt8>(data, elements, threshold, maxIndices,
+                                         indices);
+  case NDInt16:
+    return FindSparseIndices<epicsInt16>(data, elements, threshold, maxIndices,
+                                         indices);
+  case NDUInt16:
+    return FindSparseIndices<epicsUInt16>(data, elements, threshold, maxIndices,
+                                          indices);
+  case NDInt32:
+    return FindSparseIndices<epicsInt32>(data, elements, threshold, maxIndices,
+                                         indices);
+  case NDUInt32:
+    return FindSparseIndices<epicsUInt32>(data, elements, threshold, maxIndices,
+                                          indices);
+  case NDFloat32:
+    return FindSparseIndices<epicsFloat32>(data, elements, threshold,
+                                           maxIndices, indices);
+  case NDFloat64:
+    return FindSparseIndices<epicsFloat64>(data, elements, threshold,
+                                           maxIndices, indices);
+  default:
+    return false;
+  }
+}
+
+/// @brief Calls GatherSparseValues() with a type of the element size.
+void GatherSparseValues(const void *data, size_t elementBytes,
+                        std::vector<std::uint32_t> const &indices,
+                        std::uint8_t *destination) {
+  switch (elementBytes) {
+  case 1:
+    GatherSparseValues<std::uint8_t>(data, indices, destination);
+    break;
+  case 2:
+    GatherSparseValues<std::uint16_t>(data, indices, destination);
+    break;
+  case 4:
+    GatherSparseValues<std::uint32_t>(data, indices, destination);
+    break;
+  case 8:
+    GatherSparseValues<std::uint64_t>(data, indices, destination);
+    break;
+  default:
+    assert(false);
+  }
+}
+
+/** @brief Converts float32 data to a reduced precision transport type.
+ * @param[in] type The transport type, not TransportType::NATIVE.
+ * @param[in] input The float32 data.
+ * @param[out] output The converted data, 2 bytes per element.
+ * @param[in] elements Number of elements to convert.
+ */
+void NarrowFloats(NDArraySerializer::TransportType type, const void *input,
+                  void *output, size_t elements) {
+  auto values = static_cast<const float *>(input);
+  if (NDArraySerializer::TransportType::FLOAT16 == type) {
+    KafkaInterface::FloatToHalf(values, output, elements);
+  } else {
+    KafkaInterface::FloatToBFloat16(values, output, elements);
+  }
+}
+
+/// @brief Appends an unsigned LEB128 encoded integer.
+void AppendVarint(std::vector<std::uint8_t> &output, size_t value) {
+  while (value >= 0x80) {
+    output.push_back(static_cast<std::uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  output.push_back(static_cast<std::uint8_t>(value));
+}
+
+/// @brief Number of equal bytes required to end a run of literal bytes.
+const size_t minZeroRun = 8;
+
+/** @brief Computes the XOR of two buffers and run-length encodes the zero
+ * bytes of the result.
+ * The output is a sequence of (zero bytes, literal bytes) pairs, both counts
+ * being unsigned LEB128 integers, where the literal byte count is followed by
+ * that many bytes of the XOR result.
+ * @param[in] data The new data.
+ * @param[in] reference The data to compare against, same size as data.
+ * @param[in] size Size of the data in bytes.
+ * @param[in] maxOutput Give up if the output gets this large.
+ * @param[out] output The encoded data.
+ * @return True if the output is smaller than maxOutput.
+ */
+bool EncodeXorDelta(const std::uint8_t *data, const std::uint8_t *reference,
+                    size_t size, size_t maxOutput,
+                    std::vector<std::uint8_t> &output) {
+  output.clear();
+  size_t i = 0;
+  while (i < size) {
+    // Skip equal bytes, 8 at a time where possible
+    size_t zeroStart = i;
+    std::uint64_t dataWord, referenceWord;
+    while (i + sizeof(dataWord) <= size) {
+      std::memcpy(&dataWord, data + i, sizeof(dataWord));
+      std::memcpy(&referenceWord, reference + i, sizeof(referenceWord));
+      if (dataWord != referenceWord) {
+        break;
+      }
+      i += sizeof(dataWord);
+    }
+    while (i < size and data[i] == reference[i]) {
+      i++;
+    }
+    // Literal bytes end at minZeroRun equal bytes or at the end of the data
+    size_t literalStart = i;
+    size_t equalBytes = 0;
+    while (i < size and equalBytes < minZeroRun) {
+      equalBytes = (data[i] == reference[i]) ? equalBytes + 1 : 0;
+      i++;
+    }
+    if (equalBytes == minZeroRun) {
+      i -= equalBytes;
+    }
+    size_t literalBytes = i - literalStart;
+    AppendVarint(output, literalStart - zeroStart);
+    AppendVarint(output, literalBytes);
+    if (output.size() + literalBytes >= maxOutput) {
+      return false;
+    }
+    for (size_t j = literalStart; j < i; j++) {
+      output.push_back(data[j] ^ reference[j]);
+    }
+  }
+  return true;
+}
+} // namespace
+
+const int NDArraySerializer::maxTileThreads;
+
 NDArraySerializer::NDArraySerializer(const flatbuffers::uoffset_t bufferSize)
-    : builder(bufferSize) {}
+    : builder(bufferSize), batchBuilder(bufferSize),
+      tileWorkers(new KafkaInterface::WorkerPool) {}
+
+NDArraySerializer::~NDArraySerializer() = default;
 
 void NDArraySerializer::SerializeData(NDArray &pArray,
                                       unsigned char *&bufferPtr,
-                                      size_t &bufferSize) {
+                                      size_t &bufferSize,
+                                      std::uint64_t sequenceNumber,
+                                      std::uint64_t droppedArrays) {
+  // Required to not have a memory leak
+  builder.Clear();
+
+  auto kf_pkg = CreateNDArrayTable(builder, pArray, sequenceNumber,
+                                   droppedArrays);
+
+  // Write data to buffer
+  builder.Finish(kf_pkg, FB_Tables::NDArrayIdentifier());
+
+  bufferPtr = builder.GetBufferPointer();
+  bufferSize = builder.GetSize();
+}
+
+void NDArraySerializer::SetEncoding(Encoding encoding) {
+  usedEncoding = encoding;
+  keyframeRequested = true;
+}
+
+NDArraySerializer::Encoding NDArraySerializer::GetEncoding() const {
+  return usedEncoding;
+}
+
+bool NDArraySerializer::SetSparseThreshold(double threshold) {
+  if (not(threshold >= 0.0)) {
+    return false;
+  }
+  sparseThreshold = threshold;
+  return true;
+}
+
+double NDArraySerializer::GetSparseThreshold() const {
+  return sparseThreshold;
+}
+
+bool NDArraySerializer::SetKeyframeInterval(int interval) {
+  if (interval < 1) {
+    return false;
+  }
+  keyframeInterval = interval;
+  return true;
+}
+
+int NDArraySerializer::GetKeyframeInterval() const { return keyframeInterval; }
+
+bool NDArraySerializer::SetPackedBits(int bits) {
+  if (bits < 0 or bits > KafkaInterface::maxPackedBits) {
+    return false;
+  }
+  packedBits = bits;
+  return true;
+}
+
+int NDArraySerializer::GetPackedBits() const { return packedBits; }
+
+void NDArraySerializer::RequestKeyframe() {
+  keyframeRequested = true;
+  for (auto &tileSerializer : tileSerializers) {
+    tileSerializer->RequestKeyframe();
+  }
+}
+
+void NDArraySerializer::SetStatistics(bool enable) {
+  computeStatistics = enable;
+}
+
+bool NDArraySerializer::GetStatistics() const { return computeStatistics; }
+
+bool NDArraySerializer::SetStatisticsThreshold(double threshold) {
+  if (std::isnan(threshold)) {
+    return false;
+  }
+  statisticsThreshold = threshold;
+  return true;
+}
+
+double NDArraySerializer::GetStatisticsThreshold() const {
+  return statisticsThreshold;
+}
+
+void NDArraySerializer::SetChecksum(bool enable) { computeChecksum = enable; }
+
+bool NDArraySerializer::GetChecksum() const { return computeChecksum; }
+
+void NDArraySerializer::SetTransportType(TransportType type) {
+  transportType = type;
+  keyframeRequested = true;
+}
+
+NDArraySerializer::TransportType NDArraySerializer::GetTransportType() const {
+  return transportType;
+}
+
+bool NDArraySerializer::SetTileSize(int bytes) {
+  if (bytes < 0) {
+    return false;
+  }
+  tileSize = bytes;
+  return true;
+}
+
+int NDArraySerializer::GetTileSize() const { return tileSize; }
+
+bool NDArraySerializer::SetTileThreads(int threads) {
+  if (threads < 1 or threads > maxTileThreads) {
+    return false;
+  }
+  tileThreads = threads;
+  tileWorkers->Shrink(threads - 1);
+  return true;
+}
+
+int NDArraySerializer::GetTileThreads() const { return tileThreads; }
+
+size_t NDArraySerializer::SerializeTiles(NDArray &pArray,
+                                         std::uint64_t sequenceNumber,
+                                         std::uint64_t droppedArrays) {
+  if (tileSize <= 0 or pArray.ndims < 1) {
+    return 0;
+  }
   NDArrayInfo ndInfo{};
   pArray.getInfo(&ndInfo);
+  size_t lastDim = pArray.dims[pArray.ndims - 1].size;
+  if (0 == lastDim or ndInfo.totalBytes <= static_cast<size_t>(tileSize)) {
+    return 0;
+  }
+  size_t rowBytes = ndInfo.totalBytes / lastDim;
+  size_t tileRows = std::max<size_t>(1, tileSize / rowBytes);
+  size_t tiles = (lastDim + tileRows - 1) / tileRows;
+  if (tiles < 2 or tiles > std::numeric_limits<std::uint32_t>::max()) {
+    return 0;
+  }
+  while (tileSerializers.size() < tiles) {
+    tileSerializers.emplace_back(new NDArraySerializer());
+  }
+  for (size_t i = 0; i < tiles; i++) {
+    tileSerializers[i]->CopySettings(*this);
+  }
+  size_t threads = std::min(static_cast<size_t>(tileThreads), tiles);
+  // Tile i is serialized by thread i % threads
+  auto serializeTiles = [&](size_t firstTile) {
+    for (size_t i = firstTile; i < tiles; i += threads) {
+      TileRange tile{static_cast<std::uint32_t>(i),
+                     static_cast<std::uint32_t>(tiles), i * tileRows,
+                     std::min(tileRows, lastDim - i * tileRows)};
+      auto &tileBuilder = tileSerializers[i]->builder;
+      tileBuilder.Clear();
+      auto table = tileSerializers[i]->CreateNDArrayTable(
+          tileBuilder, pArray, sequenceNumber, droppedArrays, &tile);
+      tileBuilder.Finish(table, FB_Tables::NDArrayIdentifier());
+    }
+  };
+  tileWorkers->Run(threads, serializeTiles);
+  return tiles;
+}
 
-  // Required to not have a memory leak
-  builder.Clear();
+void NDArraySerializer::GetTile(size_t index, unsigned char *&bufferPtr,
+                                size_t &bufferSize) {
+  auto &tileBuilder = tileSerializers.at(index)->builder;
+  bufferPtr = tileBuilder.GetBufferPointer();
+  bufferSize = tileBuilder.GetSize();
+}
+
+void NDArraySerializer::CopySettings(NDArraySerializer const &other) {
+  if (usedEncoding != other.usedEncoding or
+      transportType != other.transportType) {
+    keyframeRequested = true;
+  }
+  usedEncoding = other.usedEncoding;
+  sparseThreshold = other.sparseThreshold;
+  keyframeInterval = other.keyframeInterval;
+  packedBits = other.packedBits;
+  computeStatistics = other.computeStatistics;
+  statisticsThreshold = other.statisticsThreshold;
+  computeChecksum = other.computeChecksum;
+  transportType = other.transportType;
+}
+
+void NDArraySerializer::AddToBatch(NDArray &pArray,
+                                   std::uint64_t sequenceNumber,
+                                   std::uint64_t droppedArrays) {
+  if (batchArrays.empty()) {
+    // The previous batch has been sent (or this is the first one)
+    batchBuilder.Clear();
+  }
+  NDArrayInfo ndInfo{};
+  pArray.getInfo(&ndInfo);
+  batchArrays.push_back(CreateNDArrayTable(batchBuilder, pArray,
+                                           sequenceNumber, droppedArrays));
+  batchBytes += ndInfo.totalBytes;
+}
+
+size_t NDArraySerializer::GetBatchArrays() const { return batchArrays.size(); }
+
+size_t NDArraySerializer::GetBatchBytes() const { return batchBytes; }
+
+void NDArraySerializer::FinishBatch(unsigned char *&bufferPtr,
+                                    size_t &bufferSize) {
+  if (batchArrays.empty()) {
+    bufferPtr = nullptr;
+    bufferSize = 0;
+    return;
+  }
+  auto arrays = batchBuilder.CreateVector(batchArrays);
+  auto batch = FB_Tables::CreateNDArrayBatch(batchBuilder, arrays);
+  batchBuilder.Finish(batch, FB_Tables::NDArrayBatchIdentifier());
+  batchArrays.clear();
+  batchBytes = 0;
+
+  bufferPtr = batchBuilder.GetBufferPointer();
+  bufferSize = batchBuilder.GetSize();
+}
+
+flatbuffers::Offset<FB_Tables::NDArray> NDArraySerializer::CreateNDArrayTable(
+    flatbuffers::FlatBufferBuilder &fbb, NDArray &pArray,
+    std::uint64_t sequenceNumber, std::uint64_t droppedArrays,
+    const TileRange *tile) {
+  NDArrayInfo ndInfo{};
+  pArray.getInfo(&ndInfo);
 
   auto epics_ts = FB_Tables::epicsTimeStamp(pArray.epicsTS.secPastEpoch,
                                             pArray.epicsTS.nsec);
@@ -29,25 +484,164 @@ void NDArraySerializer::SerializeData(NDArray &pArray,
   for (size_t y = 0; y < pArray.ndims; y++) {
     tempDims.push_back(pArray.dims[y].size);
   }
-  auto dims = builder.CreateVector(tempDims);
-  auto dType = GetFB_DType(pArray.dataType);
+  flatbuffers::Offset<flatbuffers::Vector<std::uint64_t>> frameDims = 0;
+  // The elements to serialize, all of them unless this is a tile
+  const void *arrayData = pArray.pData;
+  size_t nElements = ndInfo.nElements;
+  if (nullptr != tile) {
+    frameDims = fbb.CreateVector(tempDims);
+    size_t rowElements = ndInfo.nElements / tempDims.back();
+    arrayData = static_cast<const std::uint8_t *>(pArray.pData) +
+                tile->offset * rowElements * ndInfo.bytesPerElement;
+    nElements = tile->size * rowElements;
+    tempDims.back() = tile->size;
+  }
+  size_t totalBytes = nElements * ndInfo.bytesPerElement;
+  auto dims = fbb.CreateVector(tempDims);
+  auto dType = GetTransportDType(pArray.dataType);
+
+  // float32 data sent as float16 or bfloat16 has to be converted
+  bool reduced = dType != GetFB_DType(pArray.dataType);
+  size_t elementBytes =
+      reduced ? sizeof(std::uint16_t) : ndInfo.bytesPerElement;
+  size_t dataBytes = nElements * elementBytes;
+  // The dense data as sent, only converted when needed
+  auto data = static_cast<const std::uint8_t *>(arrayData);
+  bool converted = not reduced;
 
   std::uint8_t *tempPtr;
-  auto payload =
-      builder.CreateUninitializedVector(ndInfo.totalBytes, 1, &tempPtr);
-  std::memcpy(tempPtr, pArray.pData, ndInfo.totalBytes);
+  flatbuffers::Offset<flatbuffers::Vector<std::uint8_t>> payload;
+  flatbuffers::Offset<flatbuffers::Vector<std::uint32_t>> indices = 0;
+  auto encoding = FB_Tables::Encoding_dense;
+  std::uint64_t usedKeyframeId{0};
+  KafkaInterface::ArraySummary summary;
+  bool summarize = computeStatistics or computeChecksum;
+  bool summarized = false;
+  // Bits per element if the data is bit packed, 0 otherwise
+  int usedBits = 0;
+  if (Encoding::PACKED == usedEncoding and NDUInt16 == pArray.dataType) {
+    int requiredBits = KafkaInterface::RequiredBits(
+        static_cast<const std::uint16_t *>(arrayData), nElements);
+    usedBits = (0 == packedBits) ? requiredBits : packedBits;
+    // Arrays with values that do not fit are sent dense
+    if (requiredBits > usedBits or usedBits > KafkaInterface::maxPackedBits) {
+      usedBits = 0;
+    }
+  }
+  // Only use the sparse encoding if it is smaller than the dense one
+  size_t maxIndices = dataBytes / (sizeof(std::uint32_t) + elementBytes);
+  if (Encoding::AUTO_SPARSE == usedEncoding and
+      nElements <= std::numeric_limits<std::uint32_t>::max() and
+      FindSparseIndices(pArray.dataType, arrayData, nElements, sparseThreshold,
+                        maxIndices, sparseIndices)) {
+    indices = fbb.CreateVector(sparseIndices);
+    payload = fbb.CreateUninitializedVector(
+        sparseIndices.size() * elementBytes, 1, &tempPtr);
+    if (reduced) {
+      // Only the sparse elements are converted
+      transportBuffer.resize(sparseIndices.size() * ndInfo.bytesPerElement);
+      GatherSparseValues(arrayData, ndInfo.bytesPerElement, sparseIndices,
+                         transportBuffer.data());
+      NarrowFloats(transportType, transportBuffer.data(), tempPtr,
+                   sparseIndices.size());
+    } else {
+      GatherSparseValues(arrayData, elementBytes, sparseIndices, tempPtr);
+    }
+    encoding = FB_Tables::Encoding_sparse;
+  } else if (Encoding::DELTA == usedEncoding) {
+    if (not converted) {
+      transportBuffer.resize(dataBytes);
+      NarrowFloats(transportType, arrayData, transportBuffer.data(),
+                   nElements);
+      data = transportBuffer.data();
+      converted = true;
+    }
+    bool sameShape = keyframeData.size() == dataBytes and
+                     keyframeDataType == dType and keyframeDims == tempDims;
+    if (not keyframeRequested and sameShape and
+        deltasSinceKeyframe + 1 < keyframeInterval and
+        EncodeXorDelta(data, keyframeData.data(), dataBytes, dataBytes,
+                       deltaBuffer)) {
+      payload = fbb.CreateVector(deltaBuffer);
+      encoding = FB_Tables::Encoding_delta;
+      ++deltasSinceKeyframe;
+    } else {
+      payload = fbb.CreateVector(data, dataBytes);
+      keyframeData.assign(data, data + dataBytes);
+      keyframeDims = tempDims;
+      keyframeDataType = dType;
+      ++keyframeId;
+      deltasSinceKeyframe = 0;
+      keyframeRequested = false;
+      encoding = FB_Tables::Encoding_keyframe;
+    }
+    usedKeyframeId = keyframeId;
+  } else if (usedBits > 0) {
+    payload = fbb.CreateUninitializedVector(
+        KafkaInterface::PackedSize(nElements, usedBits), 1, &tempPtr);
+    KafkaInterface::PackBits(static_cast<const std::uint16_t *>(arrayData),
+                             tempPtr, nElements, usedBits);
+    encoding = FB_Tables::Encoding_packed;
+  } else {
+    payload = fbb.CreateUninitializedVector(dataBytes, 1, &tempPtr);
+    if (reduced) {
+      NarrowFloats(transportType, arrayData, tempPtr, nElements);
+      data = tempPtr;
+      converted = true;
+    } else if (summarize) {
+      // Compute the statistics and checksum while copying the data
+      summarized = KafkaInterface::CopyAndSummarize(
+          pArray.dataType, arrayData, tempPtr, nElements, statisticsThreshold,
+          computeStatistics, computeChecksum, summary);
+    }
+    if (not reduced and not summarized) {
+      std::memcpy(tempPtr, arrayData, totalBytes);
+    }
+  }
+  if (summarize and not summarized) {
+    // Reduced precision data: statistics of the float32 data but checksum of
+    // the data as sent. Sparse data: checksum of the thresholded data as
+    // reconstructed by the receiver.
+    bool sparse = FB_Tables::Encoding_sparse == encoding;
+    summarized = KafkaInterface::CopyAndSummarize(
+        pArray.dataType, arrayData, nullptr, nElements, statisticsThreshold,
+        computeStatistics, computeChecksum and not reduced and not sparse,
+        summary);
+    if (summarized and computeChecksum and sparse) {
+      summary.crc32c =
+          SparseCrc32c(tempPtr, elementBytes, sparseIndices, nElements);
+    } else if (summarized and computeChecksum and reduced) {
+      if (not converted) {
+        transportBuffer.resize(dataBytes);
+        NarrowFloats(transportType, arrayData, transportBuffer.data(),
+                     nElements);
+        data = transportBuffer.data();
+      }
+      summary.crc32c = KafkaInterface::Crc32c(data, dataBytes);
+    }
+  }
+  FB_Tables::DataStatistics statistics(summary.min, summary.max, summary.sum,
+                                       summary.aboveThreshold);
+  auto checksumType = FB_Tables::ChecksumType_none;
+  if (summarized and computeChecksum) {
+    checksumType = FB_Tables::ChecksumType_crc32c;
+  }
 
   // Get all attributes of this data package
   std::vector<flatbuffers::Offset<FB_Tables::NDAttribute>> attrVec;
 
-  // When passing NULL, get first element
-  NDAttribute *attr_ptr = pArray.pAttributeList->next(nullptr);
+  // When passing NULL, get first element. The attributes are only sent with
+  // the first tile of a frame.
+  NDAttribute *attr_ptr = nullptr;
+  if (nullptr == tile or 0 == tile->index) {
+    attr_ptr = pArray.pAttributeList->next(nullptr);
+  }
 
   // Itterate over attributes, next(ptr) returns NULL when there are no more
   while (attr_ptr != nullptr) {
-    auto temp_attr_str = builder.CreateString(attr_ptr->getName());
-    auto temp_attr_desc = builder.CreateString(attr_ptr->getDescription());
-    auto temp_attr_src = builder.CreateString(attr_ptr->getSource());
+    auto temp_attr_str = fbb.CreateString(attr_ptr->getName());
+    auto temp_attr_desc = fbb.CreateString(attr_ptr->getDescription());
+    auto temp_attr_src = fbb.CreateString(attr_ptr->getSource());
     size_t bytes;
     NDAttrDataType_t c_type;
     attr_ptr->getValueInfo(&c_type, &bytes);
@@ -57,10 +651,10 @@ void NDArraySerializer::SerializeData(NDArray &pArray,
     int attrValueRes = attr_ptr->getValue(
         c_type, reinterpret_cast<void *>(attrValueBuffer.get()), bytes);
     if (ND_SUCCESS == attrValueRes) {
-      auto attrValuePayload = builder.CreateVector(
+      auto attrValuePayload = fbb.CreateVector(
           reinterpret_cast<unsigned char *>(attrValueBuffer.get()), bytes);
 
-      auto attr = FB_Tables::CreateNDAttribute(builder, temp_attr_str,
+      auto attr = FB_Tables::CreateNDAttribute(fbb, temp_attr_str,
                                                temp_attr_desc, temp_attr_src,
                                                attrDType, attrValuePayload);
       attrVec.push_back(attr);
@@ -70,16 +664,77 @@ void NDArraySerializer::SerializeData(NDArray &pArray,
 
     attr_ptr = pArray.pAttributeList->next(attr_ptr);
   }
-  auto attributes = builder.CreateVector(attrVec);
-  auto kf_pkg =
-      FB_Tables::CreateNDArray(builder, pArray.uniqueId, pArray.timeStamp,
-                               &epics_ts, dims, dType, payload, attributes);
+  auto attributes = fbb.CreateVector(attrVec);
+  return FB_Tables::CreateNDArray(fbb, pArray.uniqueId, pArray.timeStamp,
+                                  &epics_ts, dims, dType, payload, attributes,
+                                  sequenceNumber, droppedArrays, encoding,
+                                  indices, usedKeyframeId,
+                                  (summarized and computeStatistics)
+                                      ? &statistics
+                                      : nullptr,
+                                  checksumType, summary.crc32c,
+                                  static_cast<std::uint8_t>(usedBits),
+                                  nullptr == tile ? 0 : tile->index,
+                                  nullptr == tile ? 0 : tile->count,
+                                  nullptr == tile ? 0 : tile->offset,
+                                  frameDims);
+}
 
-  // Write data to buffer
-  builder.Finish(kf_pkg, FB_Tables::NDArrayIdentifier());
+/** @brief Converts the value of an NDAttribute to a text string.
+ * @param[in] attr The attribute to convert.
+ * @param[out] valueString The value of the attribute as text.
+ * @return True on success, false otherwise.
+ */
+static bool AttributeToString(NDAttribute *attr, std::string &valueString) {
+  NDAttrDataType_t attrType;
+  size_t bytes;
+  attr->getValueInfo(&attrType, &bytes);
+  if (NDAttrString == attrType) {
+    std::unique_ptr<char[]> buffer(new char[bytes + 1]);
+    if (ND_SUCCESS != attr->getValue(attrType, buffer.get(), bytes)) {
+      return false;
+    }
+    buffer[bytes] = '\0';
+    valueString = buffer.get();
+    return true;
+  }
+  double value;
+  if (ND_SUCCESS != attr->getValue(NDAttrFloat64, &value)) {
+    return false;
+  }
+  char buffer[32];
+  if (NDAttrFloat32 == attrType) {
+    std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+  } else {
+    std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+  }
+  valueString = buffer;
+  return true;
+}
 
-  bufferPtr = builder.GetBufferPointer();
-  bufferSize = builder.GetSize();
+void NDArraySerializer::SerializeHeaders(
+    NDArray &pArray, std::vector<std::string> const &attributeNames,
+    KafkaInterface::MessageHeaders &headers) {
+  headers.clear();
+  headers.emplace_back("uniqueId", std::to_string(pArray.uniqueId));
+  std::string dimsString;
+  for (int y = 0; y < pArray.ndims; y++) {
+    if (y > 0) {
+      dimsString += "x";
+    }
+    dimsString += std::to_string(pArray.dims[y].size);
+  }
+  headers.emplace_back("dims", dimsString);
+  headers.emplace_back(
+      "dataType",
+      FB_Tables::EnumNameDType(GetTransportDType(pArray.dataType)));
+  std::string valueString;
+  for (auto const &name : attributeNames) {
+    NDAttribute *attr = pArray.pAttributeList->find(name.c_str());
+    if (nullptr != attr and AttributeToString(attr, valueString)) {
+      headers.emplace_back(name, valueString);
+    }
+  }
 }
 
 FB_Tables::DType NDArraySerializer::GetFB_DType(NDDataType_t arrType) {
@@ -106,6 +761,21 @@ FB_Tables::DType NDArraySerializer::GetFB_DType(NDDataType_t arrType) {
   return FB_Tables::DType::DType_int8;
 }
 
+FB_Tables::DType
+NDArraySerializer::GetTransportDType(NDDataType_t arrType) const {
+  if (NDFloat32 == arrType) {
+    switch (transportType) {
+    case TransportType::FLOAT16:
+      return FB_Tables::DType::DType_float16;
+    case TransportType::BFLOAT16:
+      return FB_Tables::DType::DType_bfloat16;
+    default:
+      break;
+    }
+  }
+  return GetFB_DType(arrType);
+}
+
 NDDataType_t NDArraySerializer::GetND_DType(FB_Tables::DType arrType) {
   switch (arrType) {
   case FB_Tables::DType::DType_int8:
@@ -124,6 +794,10 @@ NDDataType_t NDArraySerializer::GetND_DType(FB_Tables::DType arrType) {
     return NDFloat32;
   case FB_Tables::DType::DType_float64:
     return NDFloat64;
+  case FB_Tables::DType::DType_float16:
+  case FB_Tables::DType::DType_bfloat16:
+    // The raw 16 bit values
+    return NDUInt16;
   default:
     assert(false);
   }
@@ -5,8 +5,20 @@
  */
 #pragma once
 
+#include "NDArrayBatch_schema_generated.h"
 #include "NDArray_schema_generated.h"
+#include "Transport.h"
 #include <NDArray.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace KafkaInterface {
+// Not included as the unit tests include the header of the same name of the
+// ADKafka driver alongside this one
+class WorkerPool;
+} // namespace KafkaInterface
 
 /** @brief Class which is used to serialize NDArray data using flatbuffers.
  * The C++ flatbuffers implementatione has an internal buffer for storing the
@@ -17,6 +29,21 @@
  */
 class NDArraySerializer {
 public:
+  /// @brief How the array data (NDArray::pData) is encoded.
+  enum class Encoding {
+    DENSE = 0,
+    AUTO_SPARSE = 1,
+    DELTA = 2,
+    PACKED = 3,
+  };
+
+  /// @brief The data type used to transport float32 arrays.
+  enum class TransportType {
+    NATIVE = 0,
+    FLOAT16 = 1,
+    BFLOAT16 = 2,
+  };
+
   /** @brief Initialize the flatbuffer builder with a given buffer size.
    * The default buffer size given here is 1MB though. If the buffer is to small
    * to store the
@@ -30,6 +57,9 @@ public:
    */
   explicit NDArraySerializer(const flatbuffers::uoffset_t bufferSize = 1048576);
 
+  /// @brief Stops the tile worker threads.
+  ~NDArraySerializer();
+
   /** @brief Serializes data held in the input NDArray.
    * Note that the returned pointer is only valid until next time
    * NDArraySerializer::SerializeData() is called!
@@ -38,9 +68,236 @@ public:
    * pointer is only
    * valid until the member function is called again.
    * @param[out] bufferSize Size of serialized data in bytes.
+   * @param[in] sequenceNumber Producer sequence number of this array. Should
+   * increase by one for every array handed to the producer, including the ones
+   * that are later dropped. A value of 0 means "not set".
+   * @param[in] droppedArrays The number of arrays dropped by the producer
+   * before this one was serialized.
    */
   void SerializeData(NDArray &pArray, unsigned char *&bufferPtr,
-                     size_t &bufferSize);
+                     size_t &bufferSize, std::uint64_t sequenceNumber = 0,
+                     std::uint64_t droppedArrays = 0);
+
+  /** @brief Mirrors some of the meta data of an NDArray into text key/value
+   * pairs suitable for Kafka message headers.
+   * This makes it possible for consumers to filter messages without parsing
+   * the flatbuffer. The following headers are always created:
+   * * "uniqueId": The unique id of the array.
+   * * "dims": The size of each dimension separated by "x", e.g. "1024x768".
+   * * "dataType": The flatbuffer name of the data type, e.g. "uint16".
+   *
+   * Each of the named attributes which is present in the array is added using
+   * the name of the attribute as key.
+   * @param[in] pArray The array to extract meta data from.
+   * @param[in] attributeNames Names of the attributes to add as headers.
+   * @param[out] headers The extracted headers. Any previous content is
+   * removed.
+   */
+  void SerializeHeaders(NDArray &pArray,
+                        std::vector<std::string> const &attributeNames,
+                        KafkaInterface::MessageHeaders &headers);
+
+  /** @brief Sets how the array data is encoded.
+   * * Encoding::DENSE: All elements are sent (default).
+   * * Encoding::AUTO_SPARSE: Only the elements with an absolute value larger
+   * than the sparse threshold are sent, as (index, value) pairs. This is
+   * decided per array and only done if the result is smaller than the dense
+   * data. Elements not sent are set to 0 when deserialized.
+   * * Encoding::DELTA: Every N:th array (see
+   * NDArraySerializer::SetKeyframeInterval()) is sent as a keyframe with
+   * dense data. The arrays in between are sent as the XOR of their data and
+   * the data of the last keyframe, compressed by run-length encoding the zero
+   * bytes. A keyframe is also sent if the size, dimensions or data type of the
+   * array changes or if the compressed data would not be smaller than the
+   * dense data.
+   * * Encoding::PACKED: The elements of NDUInt16 arrays are packed into a bit
+   * stream using only as many bits per element as required (see
+   * NDArraySerializer::SetPackedBits()), e.g. 12 instead of 16 bits for data
+   * from a 12 bit detector. Arrays of other data types, or with values that
+   * do not fit, are sent dense.
+   * @param[in] encoding The encoding to use.
+   */
+  void SetEncoding(Encoding encoding);
+
+  /// @brief Returns the encoding used for the array data.
+  Encoding GetEncoding() const;
+
+  /** @brief Sets the threshold used by Encoding::AUTO_SPARSE.
+   * Elements with an absolute value smaller than or equal to the threshold
+   * are not sent. The default (0) keeps the encoding lossless.
+   * @param[in] threshold The new threshold, must be >= 0.
+   * @return True on success, false otherwise.
+   */
+  bool SetSparseThreshold(double threshold);
+
+  /// @brief Returns the threshold used by Encoding::AUTO_SPARSE.
+  double GetSparseThreshold() const;
+
+  /** @brief Sets how often a keyframe is sent when using Encoding::DELTA.
+   * @param[in] interval Send a keyframe every interval arrays, must be > 0.
+   * A value of 1 means that all arrays are sent as keyframes.
+   * @return True on success, false otherwise.
+   */
+  bool SetKeyframeInterval(int interval);
+
+  /// @brief Returns the keyframe interval used by Encoding::DELTA.
+  int GetKeyframeInterval() const;
+
+  /** @brief Sets the number of bits per element used by Encoding::PACKED.
+   * @param[in] bits A value from 1 to 15, or 0 to use the number of bits
+   * required by the largest element of each array.
+   * @return True on success, false otherwise.
+   */
+  bool SetPackedBits(int bits);
+
+  /// @brief Returns the number of bits per element used by Encoding::PACKED.
+  int GetPackedBits() const;
+
+  /** @brief Makes the next array serialized using Encoding::DELTA a keyframe.
+   * Should be called if an array could not be sent as the following delta
+   * encoded arrays might refer to it.
+   */
+  void RequestKeyframe();
+
+  /** @brief Enables computing statistics of the array data.
+   * The minimum, maximum and sum of the elements as well as the number of
+   * elements larger than the statistics threshold are added to the serialized
+   * array. They are computed while copying the data into the flatbuffer (or
+   * in a separate pass for the sparse and delta encodings).
+   * @param[in] enable True to compute the statistics.
+   */
+  void SetStatistics(bool enable);
+
+  /// @brief Returns true if statistics of the array data are computed.
+  bool GetStatistics() const;
+
+  /** @brief Sets the threshold used when counting elements for the
+   * statistics.
+   * @param[in] threshold Elements larger than this are counted. Must not be
+   * NaN.
+   * @return True on success, false otherwise.
+   */
+  bool SetStatisticsThreshold(double threshold);
+
+  /// @brief Returns the threshold used when counting elements.
+  double GetStatisticsThreshold() const;
+
+  /** @brief Enables computing a CRC32C checksum of the array data.
+   * The checksum is computed on the data of the NDArray, i.e. before any
+   * delta encoding, and is added to the serialized array. With the sparse
+   * encoding, it is computed on the data as reconstructed by the receiver,
+   * i.e. with the elements not sent set to 0.
+   * @param[in] enable True to compute the checksum.
+   */
+  void SetChecksum(bool enable);
+
+  /// @brief Returns true if a checksum of the array data is computed.
+  bool GetChecksum() const;
+
+  /** @brief Sets the data type used to transport float32 arrays.
+   * * TransportType::NATIVE: The data is sent as float32 (default).
+   * * TransportType::FLOAT16: The data is rounded to IEEE 754 half precision
+   * (float16), which halves the size of the data. Values larger than 65504
+   * become infinity and the relative precision is about 1e-3.
+   * * TransportType::BFLOAT16: The data is rounded to bfloat16 (the upper 16
+   * bits of a float32), which halves the size of the data. The range is the
+   * same as for float32 but the relative precision is about 8e-3.
+   *
+   * Arrays of other data types are always sent using their own data type. The
+   * statistics are computed on the float32 data while the checksum is
+   * computed on the reduced precision data.
+   * @param[in] type The data type to use.
+   */
+  void SetTransportType(TransportType type);
+
+  /// @brief Returns the data type used to transport float32 arrays.
+  TransportType GetTransportType() const;
+
+  /** @brief Sets the size of the tiles that large arrays are split into.
+   * An array larger than this is split along its last (slowest changing)
+   * dimension into tiles of at most this size, or single rows along that
+   * dimension if they are larger. Each tile is serialized as an NDArray of
+   * its own, see NDArraySerializer::SerializeTiles().
+   * @param[in] bytes Maximum size of the array data of a tile in bytes, 0
+   * disables tiling (default).
+   * @return True on success, false otherwise.
+   */
+  bool SetTileSize(int bytes);
+
+  /// @brief Returns the size of the tiles, 0 if tiling is disabled.
+  int GetTileSize() const;
+
+  /** @brief Sets the number of threads used to serialize the tiles of an
+   * array. The threads are kept between arrays, the ones no longer needed
+   * are stopped.
+   * @param[in] threads The number of threads, 1 to maxTileThreads.
+   * @return True on success, false otherwise.
+   */
+  bool SetTileThreads(int threads);
+
+  /// @brief Returns the number of threads used to serialize tiles.
+  int GetTileThreads() const;
+
+  /// @brief Largest number of threads accepted by SetTileThreads().
+  static const int maxTileThreads = 64;
+
+  /** @brief Serializes an array as tiles, in parallel.
+   * Each tile holds the data of a range of indices along the last dimension
+   * of the array together with its position in the array, the dimensions of
+   * the whole array and the meta data of the array. The attributes are only
+   * added to the first tile. The encoding, transport type, statistics and
+   * checksum settings apply to each tile separately, e.g. every tile has its
+   * own delta encoding keyframe.
+   * @param[in] pArray The data to be serialized.
+   * @param[in] sequenceNumber Producer sequence number of this array, used
+   * for all tiles. See NDArraySerializer::SerializeData().
+   * @param[in] droppedArrays The number of arrays dropped by the producer
+   * before this one was serialized.
+   * @return The number of tiles, or 0 if tiling is disabled or the array is
+   * not larger than one tile. In the latter case the array should be
+   * serialized using NDArraySerializer::SerializeData() instead.
+   */
+  size_t SerializeTiles(NDArray &pArray, std::uint64_t sequenceNumber = 0,
+                        std::uint64_t droppedArrays = 0);
+
+  /** @brief Gets one of the tiles serialized by
+   * NDArraySerializer::SerializeTiles().
+   * Note that the returned pointer is only valid until next time
+   * NDArraySerializer::SerializeTiles() is called!
+   * @param[in] index Index of the tile, less than the number of tiles.
+   * @param[out] bufferPtr The pointer to the serialized tile.
+   * @param[out] bufferSize Size of serialized tile in bytes.
+   */
+  void GetTile(size_t index, unsigned char *&bufferPtr, size_t &bufferSize);
+
+  /** @brief Adds an NDArray to the current batch of arrays.
+   * The array is serialized into a buffer separate from the one used by
+   * NDArraySerializer::SerializeData(). Once enough arrays have been added,
+   * call NDArraySerializer::FinishBatch() to get the serialized batch.
+   * @param[in] pArray The data to be added to the batch.
+   * @param[in] sequenceNumber Producer sequence number of this array. See
+   * NDArraySerializer::SerializeData().
+   * @param[in] droppedArrays The number of arrays dropped by the producer
+   * before this one was added.
+   */
+  void AddToBatch(NDArray &pArray, std::uint64_t sequenceNumber = 0,
+                  std::uint64_t droppedArrays = 0);
+
+  /// @brief Number of arrays in the current (unfinished) batch.
+  size_t GetBatchArrays() const;
+
+  /// @brief Size of the array data in the current batch in bytes.
+  size_t GetBatchBytes() const;
+
+  /** @brief Serializes the current batch of arrays as a NDArrayBatch
+   * flatbuffer and starts a new batch.
+   * Note that the returned pointer is only valid until next time
+   * NDArraySerializer::AddToBatch() is called!
+   * @param[out] bufferPtr The pointer to the serialized data, nullptr if there
+   * are no arrays in the batch.
+   * @param[out] bufferSize Size of serialized data in bytes.
+   */
+  void FinishBatch(unsigned char *&bufferPtr, size_t &bufferSize);
 
 protected:
   /** @brief Used to convert from areaDetector data type to flatbuffer data
@@ -53,6 +310,13 @@ protected:
    */
   static FB_Tables::DType GetFB_DType(NDDataType_t arrType);
 
+  /** @brief Returns the flatbuffer data type used to send arrays of the given
+   * areaDetector data type, see NDArraySerializer::SetTransportType().
+   * @param[in] arrType areaDetector data type.
+   * @return flatbuffer data type.
+   */
+  FB_Tables::DType GetTransportDType(NDDataType_t arrType) const;
+
   /** @brief Used to convert from flatbuffer data type to areaDetector data
    * type.
    * Could be a function only available in the implementation file but is used
@@ -84,7 +348,114 @@ protected:
    */
   static NDAttrDataType_t GetND_AttrDType(FB_Tables::DType attrType);
 
+  /// @brief The part of an array serialized as one tile.
+  struct TileRange {
+    /// @brief Index of the tile.
+    std::uint32_t index;
+    /// @brief Number of tiles of the array.
+    std::uint32_t count;
+    /// @brief First index along the last dimension of the array.
+    size_t offset;
+    /// @brief Number of indices along the last dimension.
+    size_t size;
+  };
+
+  /** @brief Serializes an NDArray into a flatbuffer table.
+   * @param[in] fbb The builder to use.
+   * @param[in] pArray The data to be serialized.
+   * @param[in] sequenceNumber Producer sequence number of the array.
+   * @param[in] droppedArrays Number of arrays dropped before this one.
+   * @param[in] tile The part of the array to serialize, nullptr for all of
+   * it.
+   * @return Offset of the table in the builder.
+   */
+  flatbuffers::Offset<FB_Tables::NDArray>
+  CreateNDArrayTable(flatbuffers::FlatBufferBuilder &fbb, NDArray &pArray,
+                     std::uint64_t sequenceNumber, std::uint64_t droppedArrays,
+                     const TileRange *tile = nullptr);
+
 private:
+  /** @brief Copies the encoding, transport type, statistics and checksum
+   * settings of another serializer. A keyframe is requested if the encoding
+   * or transport type changes.
+   * @param[in] other The serializer to copy the settings from.
+   */
+  void CopySettings(NDArraySerializer const &other);
+
   /// @brief The flatbuffer builder which serializes the data.
   flatbuffers::FlatBufferBuilder builder;
+
+  /// @brief The flatbuffer builder which serializes batches of arrays.
+  flatbuffers::FlatBufferBuilder batchBuilder;
+
+  /// @brief The arrays in the current batch.
+  std::vector<flatbuffers::Offset<FB_Tables::NDArray>> batchArrays;
+
+  /// @brief Size of the array data in the current batch in bytes.
+  size_t batchBytes{0};
+
+  /// @brief The encoding used for the array data.
+  Encoding usedEncoding{Encoding::DENSE};
+
+  /// @brief See NDArraySerializer::SetSparseThreshold().
+  double sparseThreshold{0.0};
+
+  /// @brief Re-used storage for the indices of the sparse elements.
+  std::vector<std::uint32_t> sparseIndices;
+
+  /// @brief See NDArraySerializer::SetKeyframeInterval().
+  int keyframeInterval{10};
+
+  /// @brief Number of delta encoded arrays since the last keyframe.
+  int deltasSinceKeyframe{0};
+
+  /// @brief If true, the next delta mode array is sent as a keyframe.
+  bool keyframeRequested{true};
+
+  /// @brief Id of the last keyframe, 0 if no keyframe has been sent.
+  std::uint64_t keyframeId{0};
+
+  /// @brief Data of the last keyframe.
+  std::vector<std::uint8_t> keyframeData;
+
+  /// @brief Dimensions of the last keyframe.
+  std::vector<std::uint64_t> keyframeDims;
+
+  /// @brief Data type of the last keyframe, as sent.
+  FB_Tables::DType keyframeDataType{FB_Tables::DType_int8};
+
+  /// @brief Re-used storage for the compressed delta of an array.
+  std::vector<std::uint8_t> deltaBuffer;
+
+  /// @brief See NDArraySerializer::SetStatistics().
+  bool computeStatistics{false};
+
+  /// @brief See NDArraySerializer::SetStatisticsThreshold().
+  double statisticsThreshold{0.0};
+
+  /// @brief See NDArraySerializer::SetChecksum().
+  bool computeChecksum{false};
+
+  /// @brief See NDArraySerializer::SetPackedBits().
+  int packedBits{0};
+
+  /// @brief See NDArraySerializer::SetTransportType().
+  TransportType transportType{TransportType::NATIVE};
+
+  /// @brief Re-used storage for data converted to the transport data type.
+  std::vector<std::uint8_t> transportBuffer;
+
+  /// @brief See NDArraySerializer::SetTileSize().
+  int tileSize{0};
+
+  /// @brief See NDArraySerializer::SetTileThreads().
+  int tileThreads{4};
+
+  /// @brief One serializer per tile index, each holding the serialized tile
+  /// and the delta encoding state of that part of the array.
+  std::vector<std::unique_ptr<NDArraySerializer>> tileSerializers;
+
+  /// @brief Serialize the tiles together with the thread calling
+  /// NDArraySerializer::SerializeTiles().
+  std::unique_ptr<KafkaInterface::WorkerPool> tileWorkers;
 };
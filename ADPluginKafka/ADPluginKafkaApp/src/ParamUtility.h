@@ -150,3 +150,29 @@ asynStatus setParam(asynNDArrType *driverPtr, const PV_param &param,
   }
   return retStatus;
 }
+
+/** @brief Overloaded function used to set PV floating point values.
+ * Works like the other overloads of setParam(). Note that if the type of the
+ * PV is not asynParamFloat64 this function will call std::abort().
+ * @param[in] driverPtr Pointer to the instance of the class which calls this
+ * function. Must be pointer to type which inherits from asynPortDriver.
+ * @param[in] param Has the relevant PV information for updating the value in
+ * the PV database.
+ * @param[in] value The new value of the PV.
+ * @return The result of setting the parameter in the form of
+ * asynPortDriver::asynStatus.
+ */
+template <typename asynNDArrType>
+asynStatus setParam(asynNDArrType *driverPtr, const PV_param &param,
+                    const double value) {
+  if (nullptr == driverPtr or 0 == *param.index) {
+    return asynStatus::asynError;
+  }
+  asynStatus retStatus;
+  if (asynParamFloat64 == param.type) {
+    retStatus = driverPtr->setDoubleParam(*param.index, value);
+  } else {
+    std::abort();
+  }
+  return retStatus;
+}
@@ -0,0 +1,91 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  RateLimiter.cpp
+ *  @brief Implementation of the class which limits the rate at which arrays
+ * are sent by the plugin.
+ */
+
+#include "RateLimiter.h"
+#include <algorithm>
+#include <ciso646>
+
+namespace KafkaInterface {
+
+void RateLimiter::TokenBucket::Refill(Clock::time_point now) {
+  if (0.0 == rate) {
+    return;
+  }
+  std::chrono::duration<double> elapsed = now - refillTime;
+  refillTime = now;
+  if (elapsed.count() > 0.0) {
+    tokens = std::min(tokens + rate * elapsed.count(), rate);
+  }
+}
+
+bool RateLimiter::TokenBucket::CanTake(double amount) const {
+  if (0.0 == rate) {
+    return true;
+  }
+  // Amounts larger than the bucket would never fit, they need a full bucket
+  return tokens >= std::min(amount, rate);
+}
+
+bool RateLimiter::Allow(size_t bytes, Clock::time_point now) {
+  // The first of every decimation arrays is kept
+  bool keep = 0 == decimationCount;
+  decimationCount = (decimationCount + 1) % decimation;
+  if (not keep) {
+    ++skippedArrays;
+    return false;
+  }
+  arrayBucket.Refill(now);
+  dataBucket.Refill(now);
+  double amount = static_cast<double>(bytes);
+  if (not arrayBucket.CanTake(1.0) or not dataBucket.CanTake(amount)) {
+    ++skippedArrays;
+    return false;
+  }
+  if (0.0 != arrayBucket.rate) {
+    arrayBucket.tokens -= 1.0;
+  }
+  if (0.0 != dataBucket.rate) {
+    dataBucket.tokens -= amount;
+  }
+  return true;
+}
+
+bool RateLimiter::SetMaxArrayRate(double rate) {
+  if (rate < 0.0) {
+    return false;
+  }
+  arrayBucket = TokenBucket();
+  arrayBucket.rate = rate;
+  return true;
+}
+
+double RateLimiter::GetMaxArrayRate() const { return arrayBucket.rate; }
+
+bool RateLimiter::SetMaxDataRate(double rate) {
+  if (rate < 0.0) {
+    return false;
+  }
+  dataBucket = TokenBucket();
+  dataBucket.rate = rate;
+  return true;
+}
+
+double RateLimiter::GetMaxDataRate() const { return dataBucket.rate; }
+
+bool RateLimiter::SetDecimation(int factor) {
+  if (factor < 1) {
+    return false;
+  }
+  decimation = factor;
+  decimationCount = 0;
+  return true;
+}
+
+int RateLimiter::GetDecimation() const { return decimation; }
+
+std::uint64_t RateLimiter::GetSkippedArrays() const { return skippedArrays; }
+} // namespace KafkaInterface
@@ -0,0 +1,105 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  RateLimiter.h
+ *  @brief Header file of the class which limits the rate at which arrays are
+ * sent by the plugin.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace KafkaInterface {
+
+/** @brief Decides which arrays are sent, given a decimation factor and
+ * maximum array and data rates.
+ * The rates are enforced by token buckets which are refilled continuously
+ * and hold at most one second worth of tokens, i.e. short bursts up to the
+ * maximum rate are allowed. An array larger than a second worth of data is
+ * let through when the bucket is full, after which the bucket is in debt
+ * until the data has been paid for.
+ */
+class RateLimiter {
+public:
+  /// @brief The clock used by the token buckets.
+  using Clock = std::chrono::steady_clock;
+
+  RateLimiter() = default;
+
+  /** @brief Decides if an array is to be sent.
+   * Arrays removed by the decimation do not use any tokens.
+   * @param[in] bytes Size of the array data.
+   * @param[in] now The current time.
+   * @return True if the array is to be sent, in which case its tokens are
+   * taken from the buckets, false if it is to be skipped.
+   */
+  bool Allow(size_t bytes, Clock::time_point now = Clock::now());
+
+  /** @brief Sets the maximum number of arrays sent per second.
+   * @param[in] rate Arrays per second, 0 for no limit.
+   * @return False if the rate is negative, true otherwise.
+   */
+  bool SetMaxArrayRate(double rate);
+
+  /// @brief Returns the maximum number of arrays sent per second.
+  double GetMaxArrayRate() const;
+
+  /** @brief Sets the maximum amount of array data sent per second.
+   * @param[in] rate Bytes per second, 0 for no limit.
+   * @return False if the rate is negative, true otherwise.
+   */
+  bool SetMaxDataRate(double rate);
+
+  /// @brief Returns the maximum amount of array data sent per second.
+  double GetMaxDataRate() const;
+
+  /** @brief Sets the decimation factor, only every Nth array is sent.
+   * @param[in] factor The decimation factor, 1 sends every array.
+   * @return False if the factor is smaller than 1, true otherwise.
+   */
+  bool SetDecimation(int factor);
+
+  /// @brief Returns the decimation factor.
+  int GetDecimation() const;
+
+  /// @brief Returns the number of arrays skipped so far.
+  std::uint64_t GetSkippedArrays() const;
+
+private:
+  /// @brief Tokens refilled at a constant rate, at most one second worth.
+  struct TokenBucket {
+    /// @brief Tokens per second, 0 for no limit.
+    double rate{0.0};
+
+    /// @brief Available tokens, negative if in debt.
+    double tokens{0.0};
+
+    /// @brief When the tokens were last refilled.
+    Clock::time_point refillTime;
+
+    /// @brief Refills the bucket up to the given time.
+    void Refill(Clock::time_point now);
+
+    /// @brief Returns true if the amount can be taken from the bucket.
+    bool CanTake(double amount) const;
+  };
+
+  /// @brief Limits the number of arrays.
+  TokenBucket arrayBucket;
+
+  /// @brief Limits the number of bytes.
+  TokenBucket dataBucket;
+
+  /// @brief See RateLimiter::SetDecimation().
+  int decimation{1};
+
+  /// @brief Number of arrays seen since the last one kept by the
+  /// decimation.
+  int decimationCount{0};
+
+  /// @brief See RateLimiter::GetSkippedArrays().
+  std::uint64_t skippedArrays{0};
+};
+} // namespace KafkaInterface
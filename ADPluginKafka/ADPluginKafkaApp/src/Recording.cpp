@@ -0,0 +1,427 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Recording.cpp
+ *  @brief Implementation of the recording of serialized NDArrays to memory
+ * mapped segment files and of their replay.
+ */
+
+#include "Recording.h"
+#include <algorithm>
+#include <chrono>
+#include <ciso646>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace KafkaInterface {
+
+namespace {
+const char indexMagic[8] = {'A', 'D', 'K', 'R', 'E', 'C', 'I', 'X'};
+const char segmentMagic[8] = {'A', 'D', 'K', 'R', 'E', 'C', 'S', 'G'};
+const std::uint64_t recordingVersion = 1;
+
+/// @brief Stored at the start of the index and segment files.
+struct FileHeader {
+  char magic[8];
+  std::uint64_t version;
+};
+
+/// @brief Offset of the first payload or index entry in a file.
+const std::uint64_t dataStart = sizeof(FileHeader);
+
+#ifndef _WIN32
+/** @brief Allocates the disk blocks of a file, so that a full disk is
+ * reported here rather than by a SIGBUS when writing to a mapping of it.
+ */
+bool AllocateFile(int fd, std::uint64_t size) {
+#ifdef __APPLE__
+  fstore_t store{F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(size), 0};
+  return -1 != fcntl(fd, F_PREALLOCATE, &store);
+#else
+  return 0 == posix_fallocate(fd, 0, static_cast<off_t>(size));
+#endif
+}
+#endif
+
+std::uint64_t AlignedSize(std::uint64_t size) {
+  return (size + 7) & ~std::uint64_t(7);
+}
+
+std::string IndexPath(std::string const &path) { return path + ".index"; }
+
+std::string SegmentPath(std::string const &path, std::uint32_t segment) {
+  char number[16];
+  std::snprintf(number, sizeof(number), ".%06u", segment);
+  return path + number;
+}
+
+bool HeaderIsValid(const unsigned char *data, std::uint64_t size,
+                   const char *magic) {
+  FileHeader header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  return 0 == std::memcmp(header.magic, magic, sizeof(header.magic)) and
+         recordingVersion == header.version;
+}
+
+/// @brief A message pointing into a mapped segment.
+class RecordingMessage : public TransportMessage {
+public:
+  RecordingMessage(std::shared_ptr<void> owner, const unsigned char *data,
+                   size_t size)
+      : owner(std::move(owner)), data(data), dataSize(size) {}
+
+  void *GetDataPtr() override { return const_cast<unsigned char *>(data); }
+
+  size_t size() override { return dataSize; }
+
+private:
+  std::shared_ptr<void> owner;
+  const unsigned char *data;
+  size_t dataSize;
+};
+} // namespace
+
+RecordingWriter::~RecordingWriter() { Close(); }
+
+#ifdef _WIN32
+bool RecordingWriter::Open(std::string const &, std::uint64_t) {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  errorString = "Recordings not supported on this platform.";
+  return false;
+}
+
+void RecordingWriter::Close() {}
+
+bool RecordingWriter::StartSegment(std::uint64_t) { return false; }
+
+void RecordingWriter::FinishSegment() {}
+
+bool RecordingWriter::Append(const unsigned char *, size_t, std::int64_t,
+                             std::int64_t) {
+  return false;
+}
+
+bool RecordingReader::Map(std::string const &, Mapping &) {
+  errorString = "Recordings not supported on this platform.";
+  return false;
+}
+#else
+bool RecordingWriter::Open(std::string const &path, std::uint64_t sizeBytes) {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  FinishSegment();
+  if (-1 != indexFd) {
+    close(indexFd);
+    indexFd = -1;
+  }
+  basePath = path;
+  segmentSize = std::max(sizeBytes, dataStart);
+  nextSegment = 0;
+  records = 0;
+  indexFd =
+      open(IndexPath(path).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+           0644);
+  if (-1 == indexFd) {
+    errorString = "Unable to create recording index.";
+    return false;
+  }
+  FileHeader header;
+  std::memcpy(header.magic, indexMagic, sizeof(header.magic));
+  header.version = recordingVersion;
+  if (sizeof(header) != write(indexFd, &header, sizeof(header))) {
+    close(indexFd);
+    indexFd = -1;
+    errorString = "Unable to write recording index.";
+    return false;
+  }
+  return true;
+}
+
+void RecordingWriter::Close() {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  FinishSegment();
+  if (-1 != indexFd) {
+    close(indexFd);
+    indexFd = -1;
+  }
+}
+
+bool RecordingWriter::StartSegment(std::uint64_t minSize) {
+  std::uint64_t size = std::max(segmentSize, minSize);
+  int fd = open(SegmentPath(basePath, nextSegment).c_str(),
+                O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (-1 == fd) {
+    errorString = "Unable to create recording segment.";
+    return false;
+  }
+  if (-1 == ftruncate(fd, size)) {
+    close(fd);
+    errorString = "Unable to set recording segment size.";
+    return false;
+  }
+  if (not AllocateFile(fd, size)) {
+    close(fd);
+    unlink(SegmentPath(basePath, nextSegment).c_str());
+    errorString = "Unable to allocate recording segment space.";
+    return false;
+  }
+  void *mapping =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == mapping) {
+    close(fd);
+    errorString = "Unable to memory map recording segment.";
+    return false;
+  }
+  segmentFd = fd;
+  segmentData = reinterpret_cast<unsigned char *>(mapping);
+  segmentMapped = size;
+  FileHeader header;
+  std::memcpy(header.magic, segmentMagic, sizeof(header.magic));
+  header.version = recordingVersion;
+  std::memcpy(segmentData, &header, sizeof(header));
+  segmentUsed = dataStart;
+  ++nextSegment;
+  return true;
+}
+
+void RecordingWriter::FinishSegment() {
+  if (nullptr != segmentData) {
+    munmap(segmentData, segmentMapped);
+    segmentData = nullptr;
+    segmentMapped = 0;
+  }
+  if (-1 != segmentFd) {
+    // Remove the unused space at the end of the segment
+    if (-1 == ftruncate(segmentFd, segmentUsed)) {
+      errorString = "Unable to truncate recording segment.";
+    }
+    close(segmentFd);
+    segmentFd = -1;
+  }
+}
+
+bool RecordingWriter::Append(const unsigned char *buffer, size_t size,
+                             std::int64_t timestamp, std::int64_t frameId) {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  if (-1 == indexFd) {
+    return false;
+  }
+  std::uint64_t alignedSize = AlignedSize(size);
+  if (nullptr == segmentData or segmentUsed + alignedSize > segmentMapped) {
+    FinishSegment();
+    if (not StartSegment(dataStart + alignedSize)) {
+      // Stop recording, the error is kept for RecordingWriter::GetError()
+      close(indexFd);
+      indexFd = -1;
+      return false;
+    }
+  }
+  std::memcpy(segmentData + segmentUsed, buffer, size);
+  RecordingIndexEntry entry{frameId, timestamp, nextSegment - 1, 0,
+                            segmentUsed, size};
+  if (sizeof(entry) != write(indexFd, &entry, sizeof(entry))) {
+    // A partially written entry would garble the rest of the index
+    FinishSegment();
+    close(indexFd);
+    indexFd = -1;
+    errorString = "Unable to write recording index.";
+    return false;
+  }
+  segmentUsed += alignedSize;
+  ++records;
+  return true;
+}
+
+bool RecordingReader::Map(std::string const &path, Mapping &mapping) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (-1 == fd) {
+    errorString = "Unable to open " + path + ".";
+    return false;
+  }
+  struct stat fileStat;
+  if (0 != fstat(fd, &fileStat) or 0 == fileStat.st_size) {
+    close(fd);
+    errorString = "Unable to read " + path + ".";
+    return false;
+  }
+  std::uint64_t size = fileStat.st_size;
+  void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (MAP_FAILED == data) {
+    errorString = "Unable to memory map " + path + ".";
+    return false;
+  }
+  mapping.owner =
+      std::shared_ptr<void>(data, [size](void *ptr) { munmap(ptr, size); });
+  mapping.data = reinterpret_cast<const unsigned char *>(data);
+  mapping.size = size;
+  return true;
+}
+#endif
+
+bool RecordingWriter::IsOpen() {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  return -1 != indexFd;
+}
+
+std::uint64_t RecordingWriter::GetRecords() {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  return records;
+}
+
+std::string RecordingWriter::GetError() {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  return errorString;
+}
+
+bool RecordingReader::Open(std::string const &path) {
+  index = Mapping();
+  segments.clear();
+  entries = nullptr;
+  recordCount = 0;
+  if (not Map(IndexPath(path), index)) {
+    return false;
+  }
+  if (not HeaderIsValid(index.data, index.size, indexMagic)) {
+    index = Mapping();
+    errorString = "Not a recording index.";
+    return false;
+  }
+  entries = reinterpret_cast<const RecordingIndexEntry *>(index.data +
+                                                          dataStart);
+  size_t indexEntries = (index.size - dataStart) / sizeof(RecordingIndexEntry);
+  for (; recordCount < indexEntries; recordCount++) {
+    auto const &entry = entries[recordCount];
+    while (segments.size() <= entry.segment) {
+      Mapping segment;
+      if (not Map(SegmentPath(path, segments.size()), segment) or
+          not HeaderIsValid(segment.data, segment.size, segmentMagic)) {
+        // Use the messages recorded up to the missing segment
+        return true;
+      }
+      segments.push_back(segment);
+    }
+    auto const &segment = segments[entry.segment];
+    if (entry.offset < dataStart or entry.offset > segment.size or
+        entry.size > segment.size - entry.offset) {
+      return true;
+    }
+  }
+  return true;
+}
+
+bool RecordingReader::IsOpen() const { return nullptr != entries; }
+
+size_t RecordingReader::GetRecords() const { return recordCount; }
+
+RecordingIndexEntry const &RecordingReader::GetEntry(size_t record) const {
+  return entries[record];
+}
+
+std::unique_ptr<TransportMessage>
+RecordingReader::GetMessage(size_t record) const {
+  if (record >= recordCount) {
+    return nullptr;
+  }
+  auto const &entry = entries[record];
+  auto const &segment = segments[entry.segment];
+  return std::unique_ptr<TransportMessage>(new RecordingMessage(
+      segment.owner, segment.data + entry.offset, entry.size));
+}
+
+size_t RecordingReader::FindFrame(std::int64_t frameId) const {
+  // The frame ids start over when the detector is restarted, so the entries
+  // are not necessarily sorted
+  for (size_t i = 0; i < recordCount; i++) {
+    if (entries[i].frameId >= frameId) {
+      return i;
+    }
+  }
+  return recordCount;
+}
+
+size_t RecordingReader::FindTime(std::int64_t timestamp) const {
+  for (size_t i = 0; i < recordCount; i++) {
+    if (entries[i].timestamp >= timestamp) {
+      return i;
+    }
+  }
+  return recordCount;
+}
+
+std::string RecordingReader::GetError() const { return errorString; }
+
+RecordingConsumer::RecordingConsumer(std::string const &path) {
+  reader.Open(path);
+}
+
+std::unique_ptr<TransportMessage>
+RecordingConsumer::ReceiveMessage(int timeout) {
+  size_t records = reader.GetRecords();
+  if (consuming and records > 0) {
+    size_t record = nextRecord.load();
+    while (true) {
+      size_t current = record;
+      if (current >= records) {
+        if (not loop) {
+          break;
+        }
+        current = 0;
+      }
+      // A seek from another thread may have moved the position
+      if (nextRecord.compare_exchange_weak(record, current + 1)) {
+        return reader.GetMessage(current);
+      }
+    }
+  }
+  // Nothing to replay, wait as if no message arrived in time
+  std::this_thread::sleep_for(std::chrono::milliseconds(std::max(timeout, 0)));
+  return nullptr;
+}
+
+void RecordingConsumer::StartConsumption() { consuming = true; }
+
+void RecordingConsumer::StopConsumption() { consuming = false; }
+
+bool RecordingConsumer::IsOpen() const { return reader.IsOpen(); }
+
+std::string RecordingConsumer::GetError() const { return reader.GetError(); }
+
+size_t RecordingConsumer::GetRecords() const { return reader.GetRecords(); }
+
+size_t RecordingConsumer::GetPosition() const { return nextRecord.load(); }
+
+bool RecordingConsumer::SeekFrame(std::int64_t frameId) {
+  size_t record = reader.FindFrame(frameId);
+  if (record >= reader.GetRecords()) {
+    return false;
+  }
+  nextRecord = record;
+  return true;
+}
+
+bool RecordingConsumer::SeekTime(double seconds) {
+  if (0 == reader.GetRecords()) {
+    return false;
+  }
+  std::int64_t offset = std::llround(seconds * 1000);
+  size_t record = reader.FindTime(reader.GetEntry(0).timestamp + offset);
+  if (record >= reader.GetRecords()) {
+    return false;
+  }
+  nextRecord = record;
+  return true;
+}
+
+void RecordingConsumer::SetLoop(bool enabled) { loop = enabled; }
+} // namespace KafkaInterface
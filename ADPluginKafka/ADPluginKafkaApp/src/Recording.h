@@ -0,0 +1,247 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Recording.h
+ *  @brief Header file of the recording of serialized NDArrays to memory
+ * mapped segment files and of their replay.
+ */
+
+#pragma once
+
+#include "Transport.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace KafkaInterface {
+
+/** @brief An entry of the index of a recording, one per recorded message.
+ * A recording at `path` is made up of the index file `path.index` and the
+ * segment files `path.000000`, `path.000001`, etc. The segments hold the
+ * message payloads back to back, each aligned to 8 bytes. The index holds
+ * one entry per message, in the order the messages were recorded.
+ */
+struct RecordingIndexEntry {
+  /// @brief NDArray::uniqueId of the (first) array in the message.
+  std::int64_t frameId;
+
+  /// @brief Message timestamp in milliseconds since the Unix epoch.
+  std::int64_t timestamp;
+
+  /// @brief Number of the segment holding the payload.
+  std::uint32_t segment;
+  std::uint32_t unused;
+
+  /// @brief Offset of the payload in the segment file.
+  std::uint64_t offset;
+
+  /// @brief Size of the payload in bytes.
+  std::uint64_t size;
+};
+
+/** @brief Appends messages to a recording, see RecordingIndexEntry.
+ * A new segment is started once the current one is full, the unused end of
+ * a full segment is truncated. A message larger than the segment size gets a
+ * segment of its own. The payload is written before its index entry, so
+ * that a recording cut short by a crash can still be replayed.
+ * @note All member functions are thread safe.
+ */
+class RecordingWriter {
+public:
+  RecordingWriter() = default;
+
+  /// @brief Closes the recording.
+  ~RecordingWriter();
+
+  RecordingWriter(RecordingWriter const &) = delete;
+  RecordingWriter &operator=(RecordingWriter const &) = delete;
+
+  /** @brief Starts a new recording, replacing any existing recording at the
+   * same path. The current recording, if any, is first closed.
+   * @param[in] path Path of the recording, see RecordingIndexEntry.
+   * @param[in] segmentSize Size of the segment files in bytes.
+   * @return True on success, false otherwise. See RecordingWriter::GetError().
+   */
+  bool Open(std::string const &path, std::uint64_t segmentSize);
+
+  /// @brief Closes the recording.
+  void Close();
+
+  /// @brief Returns true if a recording is open.
+  bool IsOpen();
+
+  /** @brief Appends a message to the recording.
+   * @param[in] buffer Pointer to the message payload.
+   * @param[in] size Size of the payload in bytes.
+   * @param[in] timestamp Message timestamp in milliseconds since the Unix
+   * epoch.
+   * @param[in] frameId The id of the (first) NDArray in the message.
+   * @return True on success, false if no recording is open or the message
+   * could not be written. In the latter case, the recording is closed.
+   */
+  bool Append(const unsigned char *buffer, size_t size, std::int64_t timestamp,
+              std::int64_t frameId);
+
+  /// @brief Number of messages in the current recording.
+  std::uint64_t GetRecords();
+
+  /// @brief Describes the last error encountered.
+  std::string GetError();
+
+private:
+  /// @brief Starts the next segment, of at least the given size.
+  bool StartSegment(std::uint64_t minSize);
+
+  /// @brief Truncates, unmaps and closes the current segment.
+  void FinishSegment();
+
+  std::mutex writeMutex;
+  std::string basePath;
+  std::uint64_t segmentSize{0};
+
+  /// @brief File descriptor of the index file, -1 if not open.
+  int indexFd{-1};
+
+  /// @brief File descriptor of the current segment, -1 if none.
+  int segmentFd{-1};
+
+  /// @brief Start of the memory mapped current segment.
+  unsigned char *segmentData{nullptr};
+
+  /// @brief Size of the current segment file.
+  std::uint64_t segmentMapped{0};
+
+  /// @brief Number of bytes used in the current segment.
+  std::uint64_t segmentUsed{0};
+
+  /// @brief Number of the next segment to start.
+  std::uint32_t nextSegment{0};
+
+  std::uint64_t records{0};
+  std::string errorString;
+};
+
+/** @brief Reads a recording written by RecordingWriter.
+ * The index and all segments are memory mapped read-only when the recording
+ * is opened. Messages are returned without copying their payload, the
+ * mapping is kept for as long as one of them exists. Index entries of which
+ * the payload is missing (e.g. after a crash) are ignored, as are the entries
+ * following them.
+ * @note The member functions are thread safe once the recording is opened.
+ */
+class RecordingReader {
+public:
+  /** @brief Opens a recording.
+   * @param[in] path Path of the recording, see RecordingIndexEntry.
+   * @return True on success, false otherwise. See RecordingReader::GetError().
+   */
+  bool Open(std::string const &path);
+
+  /// @brief Returns true if a recording is open.
+  bool IsOpen() const;
+
+  /// @brief Number of messages in the recording.
+  size_t GetRecords() const;
+
+  /// @brief Returns the index entry of a message, which must exist.
+  RecordingIndexEntry const &GetEntry(size_t record) const;
+
+  /** @brief Returns a message of the recording.
+   * @param[in] record Number of the message, counted from 0.
+   * @return The message, pointing into the mapped segment, or nullptr if
+   * there is no such message.
+   */
+  std::unique_ptr<TransportMessage> GetMessage(size_t record) const;
+
+  /** @brief Returns the number of the first message with a frame id at least
+   * as large as the given one, RecordingReader::GetRecords() if there is no
+   * such message.
+   */
+  size_t FindFrame(std::int64_t frameId) const;
+
+  /** @brief Returns the number of the first message with a timestamp at
+   * least as late as the given one, RecordingReader::GetRecords() if there is
+   * no such message.
+   */
+  size_t FindTime(std::int64_t timestamp) const;
+
+  /// @brief Describes the last error encountered.
+  std::string GetError() const;
+
+private:
+  /// @brief A memory mapped file, unmapped once the owner is released.
+  struct Mapping {
+    std::shared_ptr<void> owner;
+    const unsigned char *data{nullptr};
+    std::uint64_t size{0};
+  };
+
+  /// @brief Maps a file read-only, returns false on failure.
+  bool Map(std::string const &path, Mapping &mapping);
+
+  Mapping index;
+  std::vector<Mapping> segments;
+  const RecordingIndexEntry *entries{nullptr};
+  size_t recordCount{0};
+  std::string errorString;
+};
+
+/** @brief Replays a recording, used by the driver.
+ * The messages are returned as fast as they are asked for, which makes the
+ * replay a deterministic source for performance tests. Seeking is possible
+ * at any time, also from another thread than the one receiving the
+ * messages.
+ */
+class RecordingConsumer : public TransportConsumer {
+public:
+  /** @brief Opens the recording, replaying it from its start.
+   * @param[in] path Path of the recording, see RecordingIndexEntry.
+   */
+  explicit RecordingConsumer(std::string const &path);
+
+  /** @brief Returns the next message of the recording. At the end of the
+   * recording, it waits for the timeout and returns nullptr unless looping
+   * is enabled.
+   */
+  std::unique_ptr<TransportMessage> ReceiveMessage(int timeout) override;
+
+  void StartConsumption() override;
+
+  void StopConsumption() override;
+
+  /// @brief Returns true if the recording could be opened.
+  bool IsOpen() const;
+
+  /// @brief Describes why the recording could not be opened.
+  std::string GetError() const;
+
+  /// @brief Number of messages in the recording.
+  size_t GetRecords() const;
+
+  /// @brief Number of the next message to replay.
+  size_t GetPosition() const;
+
+  /** @brief Continues the replay from the first message with a frame id at
+   * least as large as the given one.
+   * @return False if there is no such message, the position is unchanged.
+   */
+  bool SeekFrame(std::int64_t frameId);
+
+  /** @brief Continues the replay from the first message recorded at least
+   * the given number of seconds after the first message of the recording.
+   * @return False if there is no such message, the position is unchanged.
+   */
+  bool SeekTime(double seconds);
+
+  /// @brief If enabled, the replay starts over at the end of the recording.
+  void SetLoop(bool enabled);
+
+private:
+  RecordingReader reader;
+  std::atomic<size_t> nextRecord{0};
+  std::atomic_bool loop{false};
+  std::atomic_bool consuming{false};
+};
+} // namespace KafkaInterface
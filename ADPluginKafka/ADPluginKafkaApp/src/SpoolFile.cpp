@@ -0,0 +1,294 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  SpoolFile.cpp
+ *  @brief Implementation of a memory mapped spool file for Kafka messages.
+ */
+
+#include "SpoolFile.h"
+#include <ciso646>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace KafkaInterface {
+
+namespace {
+const char spoolMagic[8] = {'A', 'D', 'K', 'S', 'P', 'O', 'O', 'L'};
+const std::uint64_t spoolVersion = 2;
+
+#ifndef _WIN32
+/** @brief Allocates the disk blocks of a file, so that a full disk is
+ * reported here rather than by a SIGBUS when writing to a mapping of it.
+ */
+bool AllocateFile(int fd, std::uint64_t size) {
+#ifdef __APPLE__
+  fstore_t store{F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(size), 0};
+  return -1 != fcntl(fd, F_PREALLOCATE, &store);
+#else
+  return 0 == posix_fallocate(fd, 0, static_cast<off_t>(size));
+#endif
+}
+#endif
+} // namespace
+
+SpoolFile::~SpoolFile() { Close(); }
+
+std::uint64_t SpoolFile::RecordSize(std::uint64_t headerBytes,
+                                    std::uint64_t payloadSize) {
+  std::uint64_t size = sizeof(RecordHeader) + headerBytes + payloadSize;
+  // Keep the record headers 8 byte aligned
+  return (size + 7) & ~std::uint64_t(7);
+}
+
+SpoolFile::FileHeader *SpoolFile::Header() const {
+  return reinterpret_cast<FileHeader *>(mappedFile);
+}
+
+bool SpoolFile::Wrapped() const {
+  return 0 != Header()->messages and
+         Header()->writeOffset <= Header()->readOffset;
+}
+
+std::uint64_t SpoolFile::RecordOffset(std::uint64_t offset) const {
+  if (offset + sizeof(RecordHeader) > fileSize) {
+    return dataStart;
+  }
+  RecordHeader recordHeader;
+  std::memcpy(&recordHeader, mappedFile + offset, sizeof(recordHeader));
+  if (wrapMarker == recordHeader.payloadSize) {
+    return dataStart;
+  }
+  return offset;
+}
+
+#ifdef _WIN32
+bool SpoolFile::Open(std::string const &path, std::uint64_t sizeBytes) {
+  errorString = "Spool files not supported on this platform.";
+  return false;
+}
+
+void SpoolFile::Close() {}
+#else
+bool SpoolFile::Open(std::string const &path, std::uint64_t sizeBytes) {
+  Close();
+  if (sizeBytes <= dataStart + sizeof(RecordHeader)) {
+    errorString = "Spool file size too small.";
+    return false;
+  }
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (-1 == fd) {
+    errorString = "Unable to open spool file.";
+    return false;
+  }
+  struct stat fileStat;
+  if (-1 == fstat(fd, &fileStat)) {
+    close(fd);
+    errorString = "Unable to get spool file size.";
+    return false;
+  }
+  std::uint64_t oldSize = fileStat.st_size;
+
+  // Check if the file contains messages which can be kept. Version 1 files
+  // never wrap around and are thus valid version 2 files.
+  bool keepMessages = false;
+  if (oldSize >= sizeof(FileHeader)) {
+    FileHeader oldHeader;
+    if (sizeof(FileHeader) == pread(fd, &oldHeader, sizeof(FileHeader), 0) and
+        0 == std::memcmp(oldHeader.magic, spoolMagic, sizeof(spoolMagic)) and
+        (1 == oldHeader.version or spoolVersion == oldHeader.version) and
+        oldHeader.readOffset >= dataStart and
+        oldHeader.writeOffset >= dataStart) {
+      bool wrapped = 0 != oldHeader.messages and
+                     oldHeader.writeOffset <= oldHeader.readOffset;
+      if (wrapped) {
+        // The messages at the end of the file must stay where they are
+        keepMessages = oldSize == sizeBytes and oldHeader.readOffset <= oldSize;
+      } else {
+        keepMessages = oldHeader.writeOffset <= sizeBytes and
+                       oldHeader.writeOffset <= oldSize and
+                       oldHeader.readOffset <= oldHeader.writeOffset;
+      }
+    }
+  }
+
+  if (-1 == ftruncate(fd, sizeBytes)) {
+    close(fd);
+    errorString = "Unable to set spool file size.";
+    return false;
+  }
+  if (not AllocateFile(fd, sizeBytes)) {
+    close(fd);
+    errorString = "Unable to allocate spool file space.";
+    return false;
+  }
+  void *mapping =
+      mmap(nullptr, sizeBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == mapping) {
+    close(fd);
+    errorString = "Unable to memory map spool file.";
+    return false;
+  }
+  fileDescriptor = fd;
+  mappedFile = reinterpret_cast<unsigned char *>(mapping);
+  fileSize = sizeBytes;
+  if (not keepMessages) {
+    FileHeader *header = Header();
+    std::memcpy(header->magic, spoolMagic, sizeof(spoolMagic));
+    header->version = spoolVersion;
+    header->readOffset = dataStart;
+    header->writeOffset = dataStart;
+    header->messages = 0;
+  }
+  Header()->version = spoolVersion;
+  return true;
+}
+
+void SpoolFile::Close() {
+  if (nullptr != mappedFile) {
+    munmap(mappedFile, fileSize);
+    mappedFile = nullptr;
+    fileSize = 0;
+  }
+  if (-1 != fileDescriptor) {
+    close(fileDescriptor);
+    fileDescriptor = -1;
+  }
+}
+#endif
+
+bool SpoolFile::IsOpen() const { return nullptr != mappedFile; }
+
+bool SpoolFile::Append(const unsigned char *buffer, size_t size,
+                       std::int64_t timestamp, MessageHeaders const &headers) {
+  if (not IsOpen()) {
+    return false;
+  }
+  std::uint64_t headerBytes = 0;
+  for (auto const &header : headers) {
+    headerBytes += 2 * sizeof(std::uint32_t) + header.first.size() +
+                   header.second.size();
+  }
+  FileHeader *fileHeader = Header();
+  if (0 == fileHeader->messages) {
+    // Start over from the beginning of the file to keep the writes sequential
+    fileHeader->readOffset = dataStart;
+    fileHeader->writeOffset = dataStart;
+  }
+  std::uint64_t recordSize = RecordSize(headerBytes, size);
+  std::uint64_t writeOffset = fileHeader->writeOffset;
+  if (Wrapped()) {
+    if (writeOffset + recordSize > fileHeader->readOffset) {
+      return false;
+    }
+  } else if (writeOffset + recordSize > fileSize) {
+    // Continue at the start of the file if there is room before the first
+    // message
+    if (dataStart + recordSize > fileHeader->readOffset) {
+      return false;
+    }
+    if (writeOffset + sizeof(RecordHeader) <= fileSize) {
+      RecordHeader marker{wrapMarker, 0, 0, 0};
+      std::memcpy(mappedFile + writeOffset, &marker, sizeof(marker));
+    }
+    writeOffset = dataStart;
+  }
+  unsigned char *writePtr = mappedFile + writeOffset;
+  RecordHeader recordHeader{size, timestamp,
+                            static_cast<std::uint32_t>(headers.size()),
+                            static_cast<std::uint32_t>(headerBytes)};
+  std::memcpy(writePtr, &recordHeader, sizeof(recordHeader));
+  writePtr += sizeof(recordHeader);
+  for (auto const &header : headers) {
+    for (auto const *str : {&header.first, &header.second}) {
+      auto strSize = static_cast<std::uint32_t>(str->size());
+      std::memcpy(writePtr, &strSize, sizeof(strSize));
+      writePtr += sizeof(strSize);
+      std::memcpy(writePtr, str->data(), strSize);
+      writePtr += strSize;
+    }
+  }
+  std::memcpy(writePtr, buffer, size);
+  // Only update the write position once the record is complete
+  fileHeader->writeOffset = writeOffset + recordSize;
+  ++fileHeader->messages;
+  return true;
+}
+
+bool SpoolFile::Front(const unsigned char *&buffer, size_t &size,
+                      std::int64_t &timestamp, MessageHeaders &headers) const {
+  if (Empty()) {
+    return false;
+  }
+  const unsigned char *readPtr =
+      mappedFile + RecordOffset(Header()->readOffset);
+  RecordHeader recordHeader;
+  std::memcpy(&recordHeader, readPtr, sizeof(recordHeader));
+  readPtr += sizeof(recordHeader);
+  headers.clear();
+  for (std::uint32_t i = 0; i < recordHeader.headerCount; i++) {
+    std::string strings[2];
+    for (auto &str : strings) {
+      std::uint32_t strSize;
+      std::memcpy(&strSize, readPtr, sizeof(strSize));
+      readPtr += sizeof(strSize);
+      str.assign(reinterpret_cast<const char *>(readPtr), strSize);
+      readPtr += strSize;
+    }
+    headers.emplace_back(strings[0], strings[1]);
+  }
+  buffer = readPtr;
+  size = recordHeader.payloadSize;
+  timestamp = recordHeader.timestamp;
+  return true;
+}
+
+void SpoolFile::PopFront() {
+  if (Empty()) {
+    return;
+  }
+  FileHeader *fileHeader = Header();
+  std::uint64_t readOffset = RecordOffset(fileHeader->readOffset);
+  RecordHeader recordHeader;
+  std::memcpy(&recordHeader, mappedFile + readOffset, sizeof(recordHeader));
+  fileHeader->readOffset =
+      readOffset +
+      RecordSize(recordHeader.headerBytes, recordHeader.payloadSize);
+  --fileHeader->messages;
+  if (0 == fileHeader->messages) {
+    // All messages sent, start over from the beginning of the file
+    fileHeader->readOffset = dataStart;
+    fileHeader->writeOffset = dataStart;
+  } else {
+    fileHeader->readOffset = RecordOffset(fileHeader->readOffset);
+  }
+}
+
+bool SpoolFile::Empty() const {
+  return not IsOpen() or 0 == Header()->messages;
+}
+
+std::uint64_t SpoolFile::GetMessages() const {
+  if (not IsOpen()) {
+    return 0;
+  }
+  return Header()->messages;
+}
+
+int SpoolFile::GetFillLevel() const {
+  if (not IsOpen()) {
+    return 0;
+  }
+  std::uint64_t used = Header()->writeOffset - Header()->readOffset;
+  if (Wrapped()) {
+    used = fileSize - Header()->readOffset + Header()->writeOffset - dataStart;
+  }
+  return static_cast<int>(used * 100 / (fileSize - dataStart));
+}
+
+std::string SpoolFile::GetError() const { return errorString; }
+} // namespace KafkaInterface
@@ -0,0 +1,156 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  SpoolFile.h
+ *  @brief Header file of a memory mapped spool file used to store serialized
+ * NDArrays while the Kafka brokers can not be reached.
+ */
+
+#pragma once
+
+#include "Transport.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace KafkaInterface {
+
+/** @brief A bounded and memory mapped ring buffer of Kafka messages.
+ * Messages are appended at the write position and removed from the read
+ * position in the same order. A message which does not fit between the write
+ * position and the end of the file is written at the start of the file
+ * instead, if the messages not yet removed leave enough room there. The read
+ * and write positions are stored in the file itself so that messages not yet
+ * sent when the IOC is stopped are sent after a restart.
+ * @note The data is written to the mapped memory only and it is up to the
+ * operating system to write it to disk. Thus, the data will survive a crash of
+ * the IOC but not necessarily a power failure.
+ * @note This class is not thread safe.
+ */
+class SpoolFile {
+public:
+  SpoolFile() = default;
+
+  /// @brief Unmaps and closes the spool file.
+  ~SpoolFile();
+
+  SpoolFile(SpoolFile const &) = delete;
+  SpoolFile &operator=(SpoolFile const &) = delete;
+
+  /** @brief Opens (and creates if needed) a spool file of a given size.
+   * Any currently open file is first closed. If the file exists and contains
+   * messages which fit in the new size, these are kept. Otherwise they are
+   * discarded.
+   * @param[in] path Path to the spool file.
+   * @param[in] sizeBytes The size of the file, i.e. the maximum amount of data
+   * that can be stored in it.
+   * @return True on success, false otherwise. See SpoolFile::GetError().
+   */
+  bool Open(std::string const &path, std::uint64_t sizeBytes);
+
+  /// @brief Unmaps and closes the spool file. Stored messages are kept.
+  void Close();
+
+  /// @brief Returns true if a spool file is open.
+  bool IsOpen() const;
+
+  /** @brief Appends a message at the write position of the spool file.
+   * @param[in] buffer Pointer to the message payload.
+   * @param[in] size Size of the payload in bytes.
+   * @param[in] timestamp Kafka timestamp of the message.
+   * @param[in] headers Kafka headers of the message.
+   * @return True on success, false if no file is open or if there is not
+   * enough space left in the file.
+   */
+  bool Append(const unsigned char *buffer, size_t size, std::int64_t timestamp,
+              MessageHeaders const &headers);
+
+  /** @brief Returns the first message in the spool file.
+   * @param[out] buffer Pointer to the payload. Only valid until the next call
+   * to a non-const member function.
+   * @param[out] size Size of the payload in bytes.
+   * @param[out] timestamp Kafka timestamp of the message.
+   * @param[out] headers Kafka headers of the message.
+   * @return True if there was a message to return, false otherwise.
+   */
+  bool Front(const unsigned char *&buffer, size_t &size,
+             std::int64_t &timestamp, MessageHeaders &headers) const;
+
+  /// @brief Removes the first message from the spool file.
+  void PopFront();
+
+  /// @brief Returns true if there are no messages in the spool file.
+  bool Empty() const;
+
+  /// @brief Number of messages in the spool file.
+  std::uint64_t GetMessages() const;
+
+  /** @brief How much of the file is used, in percent. The space at the end
+   * of the file skipped by a message written at the start is counted as used
+   * until the message before it has been removed.
+   */
+  int GetFillLevel() const;
+
+  /// @brief Describes the last error encountered.
+  std::string GetError() const;
+
+protected:
+  /// @brief Stored at the start of the file.
+  struct FileHeader {
+    char magic[8];
+    std::uint64_t version;
+    std::uint64_t readOffset;
+    std::uint64_t writeOffset;
+    std::uint64_t messages;
+  };
+
+  /** @brief Stored in front of every message. A record header with
+   * RecordHeader::payloadSize set to SpoolFile::wrapMarker marks the end of
+   * the messages before the write position went back to the start of the
+   * file.
+   */
+  struct RecordHeader {
+    std::uint64_t payloadSize;
+    std::int64_t timestamp;
+    std::uint32_t headerCount;
+    std::uint32_t headerBytes;
+  };
+
+  /// @brief Offset of the first message in the file.
+  static const std::uint64_t dataStart{64};
+
+  /// @brief Payload size of the record header marking a wrap around.
+  static const std::uint64_t wrapMarker{~std::uint64_t(0)};
+
+  /** @brief Returns true if the records between the read and the write
+   * position go past the end of the file and continue at the start.
+   */
+  bool Wrapped() const;
+
+  /** @brief Returns the offset a record at a given offset is really stored
+   * at, i.e. the start of the file if there is a wrap marker or no room for a
+   * record header at the offset.
+   */
+  std::uint64_t RecordOffset(std::uint64_t offset) const;
+
+  /// @brief Size of a record including padding for alignment.
+  static std::uint64_t RecordSize(std::uint64_t headerBytes,
+                                  std::uint64_t payloadSize);
+
+  /// @brief Returns the header at the start of the mapped file.
+  FileHeader *Header() const;
+
+  /// @brief File descriptor of the spool file, -1 if not open.
+  int fileDescriptor{-1};
+
+  /// @brief Start of the memory mapped file.
+  unsigned char *mappedFile{nullptr};
+
+  /// @brief Size of the memory mapped file in bytes.
+  std::uint64_t fileSize{0};
+
+  /// @brief Description of the last error.
+  std::string errorString;
+};
+} // namespace KafkaInterface
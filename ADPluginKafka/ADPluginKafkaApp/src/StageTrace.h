@@ -0,0 +1,179 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  StageTrace.h
+ *  @brief Header file of the low overhead timing of the stages of processing
+ * an array.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <ciso646>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if (defined(__x86_64__) or defined(__i386__)) and                            \
+    (defined(__GNUC__) or defined(__clang__))
+#define STAGE_TRACE_TSC
+#include <x86intrin.h>
+#endif
+
+namespace KafkaInterface {
+
+/** @brief Reads the time stamp counter of the CPU, or the steady clock (in ns)
+ * on CPUs without one. Only the difference between two readings is
+ * meaningful, see TicksPerSecond().
+ */
+inline std::uint64_t ReadTicks() {
+#ifdef STAGE_TRACE_TSC
+  return __rdtsc();
+#else
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+#endif
+}
+
+/** @brief Returns the number of ticks of ReadTicks() per second.
+ * Measured against the steady clock by the first call, which takes about 20
+ * ms. Assumes an invariant time stamp counter, which is the case for all
+ * x86 CPUs of the last decade.
+ */
+double TicksPerSecond();
+
+/// @brief The maximum number of stages of a StageTrace.
+const size_t maxTraceStages = 8;
+
+/** @brief The times of the stages of processing one array.
+ * Lives on the stack of the thread processing the array, so that several
+ * threads can time arrays at the same time.
+ */
+class StageTimes {
+public:
+  /// @brief Starts the timing of an array.
+  StageTimes() : start(ReadTicks()), last(start) {}
+
+  /** @brief Ends the current stage, i.e. adds the time since the previous
+   * call (or the start) to the given stage.
+   */
+  void Mark(size_t stage) {
+    std::uint64_t now = ReadTicks();
+    ticks[stage] += now - last;
+    last = now;
+  }
+
+  /// @brief When the timing started.
+  std::uint64_t start;
+
+  /// @brief When the last stage ended.
+  std::uint64_t last;
+
+  /// @brief Time spent in each stage.
+  std::uint64_t ticks[maxTraceStages]{};
+};
+
+/** @brief Keeps the stage times of the last arrays in a ring buffer and
+ * exponential moving averages of the stage times.
+ * The arrays are added by Record(), which must not be called by several
+ * threads at the same time (i.e. it is called with the port driver lock
+ * held). The ring buffer can be read at any time, by any thread, without
+ * locking: records overwritten while they are read are left out.
+ * Traces are registered by name, so that they can be found by the iocsh
+ * command StageTraceDump.
+ */
+class StageTrace {
+public:
+  /** @brief Creates and registers a trace.
+   * @param[in] name Name of the trace, normally the port name.
+   * @param[in] stageNames The names of the stages, at most maxTraceStages.
+   * Extra stages are ignored.
+   * @param[in] capacity Size of the ring buffer, rounded up to a power of
+   * two. The last capacity - 1 arrays can be read from it.
+   */
+  StageTrace(std::string const &name,
+             std::vector<std::string> const &stageNames,
+             size_t capacity = 1024);
+
+  /// @brief Removes the trace from the register.
+  ~StageTrace();
+
+  StageTrace(StageTrace const &) = delete;
+  StageTrace &operator=(StageTrace const &) = delete;
+
+  /** @brief Adds the stage times of an array.
+   * @param[in] times The stage times, the total time is taken to be from
+   * the start of the timing to now.
+   * @param[in] frameId Unique id of the array.
+   */
+  void Record(StageTimes const &times, std::int64_t frameId);
+
+  /** @brief Returns the moving average of a stage, in microseconds.
+   * @param[in] stage The stage, or the number of stages for the total time.
+   */
+  double GetAverageUs(size_t stage) const;
+
+  /// @brief Returns the number of stages.
+  size_t GetStages() const;
+
+  /// @brief Returns the number of arrays recorded so far.
+  std::uint64_t GetRecorded() const;
+
+  /** @brief Returns true once a second, to limit how often the moving
+   * averages are published.
+   */
+  bool PublishDue();
+
+  /** @brief Writes the stage times of the last arrays as a table.
+   * @param[in] file Where to write.
+   * @param[in] records The maximum number of arrays to write.
+   */
+  void Dump(std::FILE *file, size_t records) const;
+
+  /** @brief Writes the stage times of the trace with the given name.
+   * @param[in] file Where to write.
+   * @param[in] name Name of the trace.
+   * @param[in] records The maximum number of arrays to write.
+   * @return False if there is no trace with that name.
+   */
+  static bool Dump(std::FILE *file, std::string const &name, size_t records);
+
+  /// @brief Returns the names of the registered traces.
+  static std::vector<std::string> GetNames();
+
+private:
+  /// @brief The times of one array in the ring buffer.
+  struct Entry {
+    std::atomic<std::int64_t> frameId{0};
+    std::atomic<std::uint64_t> start{0};
+    std::atomic<std::uint64_t> total{0};
+    std::atomic<std::uint64_t> ticks[maxTraceStages];
+  };
+
+  /// @brief Converts ticks to microseconds.
+  double ToMicroseconds(double ticks) const;
+
+  std::string name;
+  std::vector<std::string> stages;
+  std::unique_ptr<Entry[]> ring;
+  size_t mask;
+
+  /// @brief Number of arrays recorded, the next entry written is head & mask.
+  std::atomic<std::uint64_t> head{0};
+
+  /// @brief Moving averages, in ticks, of the stages followed by the total.
+  std::atomic<double> averages[maxTraceStages + 1];
+
+  double ticksPerSecond;
+  std::uint64_t nextPublish{0};
+
+  /// @brief The registered traces, see SharedInstance().
+  struct Registry;
+  static Registry &GetRegistry();
+};
+} // namespace KafkaInterface
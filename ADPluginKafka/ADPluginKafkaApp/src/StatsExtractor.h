@@ -0,0 +1,79 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  StatsExtractor.h
+ *  @brief Header file of the function which extracts the values published as
+ * PV:s from the JSON statistics of librdkafka.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace KafkaInterface {
+
+/** @brief Values extracted from the librdkafka statistics. Brokers added
+ * internally by librdkafka only count towards KafkaStatistics::brokers and
+ * KafkaStatistics::brokerUp.
+ */
+struct KafkaStatistics {
+  /// @brief Number of brokers known to librdkafka.
+  int brokers{0};
+
+  /// @brief True if at least one of the brokers is in the "UP" state.
+  bool brokerUp{false};
+
+  /// @brief Number of messages in the producer queue.
+  std::int64_t messagesInQueue{0};
+
+  /// @brief Time of the statistics in microseconds (monotonic clock).
+  std::int64_t timestamp{0};
+
+  /// @brief Total number of messages transmitted to the brokers.
+  std::int64_t txMessages{0};
+
+  /// @brief Total number of message bytes transmitted to the brokers.
+  std::int64_t txBytes{0};
+
+  /// @brief Size of the messages in the producer queue in bytes.
+  std::int64_t queuedBytes{0};
+
+  /// @brief Requests waiting to be sent, summed over all brokers.
+  std::int64_t outbufCount{0};
+
+  /// @brief Largest average round trip time of the brokers in microseconds.
+  double rttAvg{0.0};
+
+  /// @brief Largest 99th percentile round trip time of the brokers in
+  /// microseconds.
+  double rttP99{0.0};
+
+  /// @brief Largest average internal producer queue latency in microseconds.
+  double intLatencyAvg{0.0};
+
+  /// @brief Largest average broker throttling time in ms.
+  double throttleAvg{0.0};
+
+  /// @brief Average size of the message batches in bytes, weighted by the
+  /// number of batches of each topic.
+  double batchSizeAvg{0.0};
+
+  /// @brief Average number of messages per batch, weighted by the number of
+  /// batches of each topic.
+  double batchCountAvg{0.0};
+};
+
+/** @brief Extracts the published values from a librdkafka statistics
+ * document.
+ * The document is scanned once without building a tree and without
+ * allocating memory, all other values are skipped. The document does not
+ * have to be null terminated.
+ * @param[in] json The JSON document.
+ * @param[in] size Length of the document in bytes.
+ * @param[out] stats The extracted values, fields not found in the document
+ * are left at their defaults.
+ * @return False if the document is not valid JSON or nested too deeply,
+ * true otherwise.
+ */
+bool ExtractStatistics(const char *json, size_t size, KafkaStatistics &stats);
+} // namespace KafkaInterface
@@ -0,0 +1,90 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  Transport.h
+ *  @brief Interfaces implemented by the back-ends which carry the serialized
+ * NDArrays from the plugin to the driver.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace KafkaInterface {
+
+/// @brief Key/value pairs which are sent as Kafka message headers.
+using MessageHeaders = std::vector<std::pair<std::string, std::string>>;
+
+/// @brief The back-ends that can carry the serialized NDArrays.
+enum class TransportBackend {
+  /// @brief Kafka brokers, see KafkaProducer and KafkaConsumer.
+  KAFKA = 0,
+  /// @brief A queue in the same process, see LocalProducer and LocalConsumer.
+  LOCAL = 1,
+  /// @brief A memory mapped file, see SegmentProducer and SegmentConsumer.
+  SEGMENT_FILE = 2,
+  /// @brief A recording, replayed by the driver only. See RecordingConsumer.
+  RECORDING = 3,
+};
+
+/// @brief A message received by a TransportConsumer.
+class TransportMessage {
+public:
+  virtual ~TransportMessage() = default;
+
+  /** @brief Returns the pointer to the message payload, owned by the
+   * message.
+   */
+  virtual void *GetDataPtr() = 0;
+
+  /// @brief The size of the message payload in bytes.
+  virtual size_t size() = 0;
+};
+
+/// @brief Sends messages, used by the plugin.
+class TransportProducer {
+public:
+  virtual ~TransportProducer() = default;
+
+  /** @brief Sends a message.
+   * The data is copied and the buffer can thus be re-used as soon as this
+   * member function returns.
+   * @param[in] buffer Pointer to the message payload.
+   * @param[in] size Size of the payload in bytes.
+   * @param[in] timestamp Message timestamp in milliseconds since the Unix
+   * epoch, 0 if not known.
+   * @param[in] headers Message headers. Only sent by back-ends that support
+   * them.
+   * @param[in] arrays The number of arrays lost if the message is dropped
+   * after it has been accepted, see KafkaProducer::TakeEvictedArrays().
+   * @return True if the message was accepted, false if it was dropped.
+   */
+  virtual bool SendMessage(const unsigned char *buffer, size_t size,
+                           std::int64_t timestamp,
+                           MessageHeaders const &headers,
+                           std::uint64_t arrays = 1) = 0;
+};
+
+/// @brief Receives messages, used by the driver.
+class TransportConsumer {
+public:
+  virtual ~TransportConsumer() = default;
+
+  /** @brief Waits for the next message.
+   * @param[in] timeout Maximum time to wait in milliseconds.
+   * @return The message or nullptr if no message was received, which is
+   * always the case while the consumption is stopped.
+   */
+  virtual std::unique_ptr<TransportMessage> ReceiveMessage(int timeout) = 0;
+
+  /// @brief Starts (or resumes) the consumption of messages.
+  virtual void StartConsumption() = 0;
+
+  /// @brief Stops the consumption of messages.
+  virtual void StopConsumption() = 0;
+};
+} // namespace KafkaInterface
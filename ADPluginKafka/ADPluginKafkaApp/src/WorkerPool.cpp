@@ -0,0 +1,84 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  WorkerPool.cpp
+ *  @brief Implementation of the threads which process the tiles of an array
+ * in parallel.
+ */
+
+#include "WorkerPool.h"
+#include <ciso646>
+
+namespace KafkaInterface {
+
+WorkerPool::~WorkerPool() { Shrink(0); }
+
+void WorkerPool::Run(size_t tasks, std::function<void(size_t)> const &task) {
+  if (0 == tasks) {
+    return;
+  } else if (1 == tasks) {
+    task(0);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (workers.size() < tasks - 1) {
+      workers.emplace_back(&WorkerPool::ThreadFunction, this, workers.size(),
+                           runCount);
+    }
+    currentTask = &task;
+    currentTasks = tasks;
+    busyWorkers = tasks - 1;
+    ++runCount;
+  }
+  startCondition.notify_all();
+  task(0);
+  std::unique_lock<std::mutex> lock(mutex);
+  doneCondition.wait(lock, [this]() { return 0 == busyWorkers; });
+  currentTask = nullptr;
+}
+
+void WorkerPool::Shrink(size_t workers) {
+  if (this->workers.size() <= workers) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    workerLimit = workers;
+  }
+  startCondition.notify_all();
+  for (size_t i = workers; i < this->workers.size(); i++) {
+    this->workers[i].join();
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  this->workers.resize(workers);
+  workerLimit = SIZE_MAX;
+}
+
+size_t WorkerPool::GetWorkers() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return workers.size();
+}
+
+void WorkerPool::ThreadFunction(size_t index, std::uint64_t seenRun) {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    startCondition.wait(lock, [this, index, seenRun]() {
+      return index >= workerLimit or runCount != seenRun;
+    });
+    if (index >= workerLimit) {
+      return;
+    }
+    seenRun = runCount;
+    if (index + 1 >= currentTasks) {
+      continue;
+    }
+    auto task = currentTask;
+    lock.unlock();
+    (*task)(index + 1);
+    lock.lock();
+    if (0 == --busyWorkers) {
+      doneCondition.notify_one();
+    }
+  }
+}
+} // namespace KafkaInterface
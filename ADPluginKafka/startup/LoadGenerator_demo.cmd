@@ -0,0 +1,24 @@
+require adcore,2.6+
+require adkafka
+
+epicsEnvSet("PREFIX", "$(PREFIX=DMSC)")
+epicsEnvSet("LOADGEN_PORT", "$(PREFIX)LOADGEN")
+epicsEnvSet("K_PORT", "$(PREFIX)K")
+epicsEnvSet("XSIZE", "$(XSIZE=1024)")
+epicsEnvSet("YSIZE", "$(YSIZE=1024)")
+epicsEnvSet("QSIZE", "20")
+
+LoadGeneratorConfigure("$(LOADGEN_PORT)", $(XSIZE), $(YSIZE), 0, 0, 0, 0)
+dbLoadRecords("LoadGenerator.template", "P=$(PREFIX):, R=LOADGEN:, PORT=$(LOADGEN_PORT), ADDR=0, TIMEOUT=1")
+
+KafkaPluginConfigure("$(K_PORT)", $(QSIZE), 1, "$(LOADGEN_PORT)", 0, -1, "10.4.0.216:9092", "test_topic")
+dbLoadRecords("ADPluginKafka.template", "P=$(PREFIX),R=:KFK:,PORT=$(K_PORT),ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(LOADGEN_PORT)")
+
+iocInit
+
+dbpf $(PREFIX):KFK:EnableCallbacks Enable
+dbpf $(PREFIX):LOADGEN:LoadGenSparsity 0.9
+dbpf $(PREFIX):LOADGEN:AcquirePeriod 0.001
+dbpf $(PREFIX):LOADGEN:Acquire 1
+
+#Remember; file MUST end with a new line
@@ -0,0 +1,92 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  BinningTest.cpp
+ *  @brief Unit tests of the binning of array data.
+ */
+
+#include "Binning.h"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+using KafkaInterface::BinData;
+using KafkaInterface::BinningMode;
+
+TEST(Binning, MeanTest) {
+  // 5 x 4 elements, the last column does not fill a block
+  std::vector<std::uint16_t> values(20);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = static_cast<std::uint16_t>(i);
+  }
+  std::vector<float> binned(4);
+  ASSERT_TRUE(BinData(NDUInt16, values.data(), binned.data(), 5, 4, 1, 2,
+                      BinningMode::MEAN));
+  EXPECT_FLOAT_EQ(binned[0], (0 + 1 + 5 + 6) / 4.0f);
+  EXPECT_FLOAT_EQ(binned[1], (2 + 3 + 7 + 8) / 4.0f);
+  EXPECT_FLOAT_EQ(binned[2], (10 + 11 + 15 + 16) / 4.0f);
+  EXPECT_FLOAT_EQ(binned[3], (12 + 13 + 17 + 18) / 4.0f);
+}
+
+TEST(Binning, SumPlanesTest) {
+  // Two planes of 4 x 2 elements, binned by 2
+  std::vector<std::int8_t> values(16, -1);
+  values[8] = 3;
+  std::vector<float> binned(4);
+  ASSERT_TRUE(BinData(NDInt8, values.data(), binned.data(), 4, 2, 2, 2,
+                      BinningMode::SUM));
+  EXPECT_FLOAT_EQ(binned[0], -4.0f);
+  EXPECT_FLOAT_EQ(binned[1], -4.0f);
+  EXPECT_FLOAT_EQ(binned[2], 0.0f);
+  EXPECT_FLOAT_EQ(binned[3], -4.0f);
+}
+
+TEST(Binning, OneDimensionalTest) {
+  // The factor is limited to the size of each dimension
+  std::vector<double> values = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0};
+  std::vector<float> binned(2);
+  ASSERT_TRUE(BinData(NDFloat64, values.data(), binned.data(), 7, 1, 1, 3,
+                      BinningMode::MEAN));
+  EXPECT_FLOAT_EQ(binned[0], 2.0f);
+  EXPECT_FLOAT_EQ(binned[1], 5.0f);
+  EXPECT_EQ(KafkaInterface::BinningFactor(1, 3), 1u);
+}
+
+TEST(Binning, DecimateTest) {
+  std::vector<std::int32_t> values(36);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = static_cast<std::int32_t>(i);
+  }
+  std::vector<std::int32_t> binned(4);
+  ASSERT_TRUE(BinData(NDInt32, values.data(), binned.data(), 6, 6, 1, 3,
+                      BinningMode::DECIMATE));
+  EXPECT_EQ(binned, std::vector<std::int32_t>({0, 3, 18, 21}));
+  EXPECT_EQ(KafkaInterface::BinnedDataType(NDInt32, BinningMode::DECIMATE),
+            NDInt32);
+  EXPECT_EQ(KafkaInterface::BinnedDataType(NDInt32, BinningMode::SUM),
+            NDFloat32);
+}
+
+TEST(Binning, ColorsTest) {
+  // RGB1 data of 4 x 2 pixels, the colours are binned separately
+  std::vector<std::uint8_t> values(24);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = static_cast<std::uint8_t>(i % 3 * 10 + i / 3);
+  }
+  std::vector<float> binned(6);
+  ASSERT_TRUE(BinData(NDUInt8, values.data(), binned.data(), 4, 2, 1, 2,
+                      BinningMode::SUM, 3));
+  EXPECT_EQ(binned, std::vector<float>({10, 50, 90, 18, 58, 98}));
+  std::vector<std::uint8_t> decimated(6);
+  ASSERT_TRUE(BinData(NDUInt8, values.data(), decimated.data(), 4, 2, 1, 2,
+                      BinningMode::DECIMATE, 3));
+  EXPECT_EQ(decimated, std::vector<std::uint8_t>({0, 10, 20, 2, 12, 22}));
+}
+
+TEST(Binning, InvalidTest) {
+  std::vector<float> values(4);
+  std::vector<float> binned(4);
+  EXPECT_FALSE(BinData(NDFloat32, values.data(), binned.data(), 2, 2, 1, 0,
+                       BinningMode::MEAN));
+  EXPECT_FALSE(BinData(NDFloat32, values.data(), binned.data(), 2, 2, 1, 1,
+                       BinningMode::MEAN, 0));
+}
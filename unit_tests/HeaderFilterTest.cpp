@@ -0,0 +1,80 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  HeaderFilterTest.cpp
+ *  @brief Unit tests of the Kafka message header filter.
+ */
+
+#include "HeaderFilter.h"
+#include <ciso646>
+#include <gtest/gtest.h>
+
+using KafkaInterface::HeaderFilter;
+using KafkaInterface::MessageHeaders;
+
+/// @brief A testing fixture used for setting up unit tests.
+class HeaderFilterEnv : public ::testing::Test {
+public:
+  virtual void SetUp() {
+    headers = {
+        {"uniqueId", "1000"}, {"dims", "1024x768"}, {"dataType", "uint16"}};
+  };
+
+  HeaderFilter filter;
+  MessageHeaders headers;
+};
+
+TEST_F(HeaderFilterEnv, EmptyExpressionTest) {
+  ASSERT_TRUE(filter.IsEmpty());
+  ASSERT_TRUE(filter.Match(headers));
+  ASSERT_TRUE(filter.SetExpression(" , "));
+  ASSERT_TRUE(filter.IsEmpty());
+  ASSERT_TRUE(filter.Match(MessageHeaders()));
+}
+
+TEST_F(HeaderFilterEnv, StringCompareTest) {
+  ASSERT_TRUE(filter.SetExpression("dataType == uint16"));
+  EXPECT_TRUE(filter.Match(headers));
+  ASSERT_TRUE(filter.SetExpression("dataType!=uint16"));
+  EXPECT_FALSE(filter.Match(headers));
+  ASSERT_TRUE(filter.SetExpression("dims == 1024x768"));
+  EXPECT_TRUE(filter.Match(headers));
+}
+
+TEST_F(HeaderFilterEnv, NumberCompareTest) {
+  std::vector<std::pair<std::string, bool>> expressions = {
+      {"uniqueId == 1000", true}, {"uniqueId == 1e3", true},
+      {"uniqueId != 1000", false}, {"uniqueId < 1000", false},
+      {"uniqueId <= 1000", true}, {"uniqueId > 999", true},
+      {"uniqueId >= 1001", false}, {"uniqueId < 10000", true},
+  };
+  for (auto &expr : expressions) {
+    ASSERT_TRUE(filter.SetExpression(expr.first)) << expr.first;
+    EXPECT_EQ(filter.Match(headers), expr.second) << expr.first;
+  }
+}
+
+TEST_F(HeaderFilterEnv, AllTermsMustMatchTest) {
+  ASSERT_TRUE(filter.SetExpression("dataType == uint16, uniqueId >= 1000"));
+  EXPECT_TRUE(filter.Match(headers));
+  ASSERT_TRUE(filter.SetExpression("dataType == uint16, uniqueId > 1000"));
+  EXPECT_FALSE(filter.Match(headers));
+}
+
+TEST_F(HeaderFilterEnv, MissingHeaderTest) {
+  ASSERT_TRUE(filter.SetExpression("someAttr == 1"));
+  EXPECT_FALSE(filter.Match(headers));
+  ASSERT_TRUE(filter.SetExpression("someAttr != 1"));
+  EXPECT_FALSE(filter.Match(headers));
+}
+
+TEST_F(HeaderFilterEnv, InvalidExpressionTest) {
+  std::string usedExpression = "uniqueId > 5";
+  ASSERT_TRUE(filter.SetExpression(usedExpression));
+  std::vector<std::string> invalidExpressions = {
+      "uniqueId", "uniqueId = 5", "uniqueId => 5", "== 5", "uniqueId ==",
+      "uniqueId > 5, dims"};
+  for (auto &expr : invalidExpressions) {
+    EXPECT_FALSE(filter.SetExpression(expr)) << expr;
+    EXPECT_EQ(filter.GetExpression(), usedExpression);
+  }
+}
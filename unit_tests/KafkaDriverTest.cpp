@@ -36,6 +36,9 @@ public:
   using KafkaDriver::PV;
   using KafkaDriver::startEventId_;
   using KafkaDriver::stopEventId_;
+  using KafkaDriver::UpdateSequenceCounters;
+  using KafkaDriver::lostArrays;
+  using KafkaDriver::filteredArrays;
   using asynPortDriver::pasynUserSelf;
   using ADDriver::ADStatusMessage;
   MOCK_METHOD2(setStringParam, asynStatus(int, const char *));
@@ -176,3 +179,43 @@ TEST_F(KafkaDriverEnv, SetStatsTimeTest) {
 
   pasynManager->freeAsynUser(tempUser);
 }
+
+TEST_F(KafkaDriverEnv, SequenceCountersTest) {
+  NiceMock<KafkaDriverStandIn> drvr;
+  drvr.UpdateSequenceCounters(1, 0, 0);
+  drvr.UpdateSequenceCounters(2, 0, 0);
+  ASSERT_EQ(drvr.lostArrays, 0u);
+
+  // Two arrays missing, both dropped by the producer
+  drvr.UpdateSequenceCounters(5, 2, 0);
+  ASSERT_EQ(drvr.lostArrays, 0u);
+
+  // Three arrays missing, one dropped by the producer
+  drvr.UpdateSequenceCounters(9, 3, 0);
+  ASSERT_EQ(drvr.lostArrays, 2u);
+
+  // Producer restarted, counting starts over
+  drvr.UpdateSequenceCounters(1, 0, 0);
+  drvr.UpdateSequenceCounters(2, 0, 0);
+  ASSERT_EQ(drvr.lostArrays, 2u);
+
+  // Messages without sequence numbers are ignored
+  drvr.UpdateSequenceCounters(0, 0, 0);
+  drvr.UpdateSequenceCounters(3, 0, 0);
+  ASSERT_EQ(drvr.lostArrays, 2u);
+}
+
+TEST_F(KafkaDriverEnv, FilteredSequenceCountersTest) {
+  NiceMock<KafkaDriverStandIn> drvr;
+  drvr.UpdateSequenceCounters(1, 0, 0);
+
+  // Two arrays missing, their messages were discarded by the filter
+  drvr.UpdateSequenceCounters(4, 0, 2);
+  ASSERT_EQ(drvr.lostArrays, 0u);
+  ASSERT_EQ(drvr.filteredArrays, 2u);
+
+  // One array missing, no message discarded since the last array
+  drvr.UpdateSequenceCounters(6, 0, 2);
+  ASSERT_EQ(drvr.lostArrays, 1u);
+  ASSERT_EQ(drvr.filteredArrays, 2u);
+}
@@ -35,6 +35,9 @@ public:
   using KafkaPlugin::producer;
   using KafkaPlugin::paramsList;
   using KafkaPlugin::PV;
+  using KafkaPlugin::GetKafkaTimestamp;
+  using KafkaPlugin::timestampSource;
+  using KafkaPlugin::TimestampSource;
   using asynPortDriver::pasynUserSelf;
   MOCK_METHOD2(setStringParam, asynStatus(int, const char *));
   MOCK_METHOD2(setIntegerParam, asynStatus(int, int));
@@ -169,3 +172,24 @@ TEST_F(KafkaPluginEnv, KafkaQueueFullTest) {
       .Times(AtLeast(1));
   std::this_thread::sleep_for(sleepTime);
 }
+
+TEST_F(KafkaPluginEnv, KafkaTimestampTest) {
+  KafkaPluginStandIn plugin;
+  NDArrayGenerator arrGen;
+  NDArray *arr = arrGen.GenerateNDArray(5, 10, 3, NDDataType_t::NDUInt8);
+  arr->epicsTS.secPastEpoch = 100;
+  arr->epicsTS.nsec = 999999999;
+  arr->timeStamp = 200.5;
+  ASSERT_EQ(plugin.GetKafkaTimestamp(*arr),
+            (100 + POSIX_TIME_AT_EPICS_EPOCH) * 1000ll + 999);
+  plugin.timestampSource = KafkaPluginStandIn::TimestampSource::TIME_STAMP;
+  ASSERT_EQ(plugin.GetKafkaTimestamp(*arr),
+            (200 + POSIX_TIME_AT_EPICS_EPOCH) * 1000ll + 500);
+  plugin.timestampSource = KafkaPluginStandIn::TimestampSource::PRODUCER;
+  ASSERT_EQ(plugin.GetKafkaTimestamp(*arr), 0);
+  plugin.timestampSource = KafkaPluginStandIn::TimestampSource::EPICS_TS;
+  arr->epicsTS.secPastEpoch = 0;
+  arr->epicsTS.nsec = 0;
+  ASSERT_EQ(plugin.GetKafkaTimestamp(*arr), 0);
+  arr->release();
+}
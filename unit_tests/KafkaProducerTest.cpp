@@ -7,8 +7,18 @@
 #include "KafkaProducer.h"
 #include <NDPluginDriver.h>
 #include <ciso646>
+#include <cstdio>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <librdkafka/rdkafka.h>
+#include <thread>
+#include <vector>
+
+// The mock cluster was added in librdkafka 1.4.0
+#if RD_KAFKA_VERSION >= 0x010400ff
+#include <librdkafka/rdkafka_mock.h>
+#define HAVE_MOCK_CLUSTER
+#endif
 
 namespace KafkaInterface {
 
@@ -20,11 +30,17 @@ public:
       : KafkaProducer(addr, topic){};
   using KafkaProducer::errorState;
   using KafkaProducer::ConStat;
+  using KafkaProducer::brokersDown;
   using KafkaProducer::kafka_stats_interval;
   using KafkaProducer::PV;
   using KafkaProducer::conf;
   using KafkaProducer::tconf;
   using KafkaProducer::paramsList;
+  using KafkaProducer::ParseStatusString;
+  using KafkaProducer::pendingBytes;
+  using KafkaProducer::pendingMessages;
+  using KafkaProducer::spool;
+  using KafkaProducer::undeliveredMessages;
   void SetConStatParent(KafkaProducerStandIn::ConStat stat, std::string const &msg) {
     KafkaProducer::SetConStat(stat, msg);
   };
@@ -50,6 +66,7 @@ public:
                        priority, stackSize){};
   MOCK_METHOD2(setStringParam, asynStatus(int, const char *));
   MOCK_METHOD2(setIntegerParam, asynStatus(int, int));
+  MOCK_METHOD2(setDoubleParam, asynStatus(int, double));
   MOCK_METHOD3(createParam, asynStatus(const char *, asynParamType, int *));
   MOCK_METHOD1(processCallbacks, void(NDArray*));
 };
@@ -183,6 +200,95 @@ TEST_F(KafkaProducerEnv, ParamCallSuccess) {
 //  Mock::VerifyAndClear(plugin);
 }
 
+TEST_F(KafkaProducerEnv, StatisticsTest) {
+  KafkaProducerStandIn prod;
+  std::vector<PV_param> params = prod.GetParams();
+  int ctr = 1;
+  for (auto p : params) {
+    *p.index = ctr;
+    ctr++;
+  }
+  ON_CALL(prod, SetConStat(_, _))
+      .WillByDefault(Invoke(&prod, &KafkaProducerStandIn::SetConStatParent));
+  prod.RegisterParamCallbackClass(plugin.get());
+  auto index = [&params](KafkaProducerStandIn::PV pv) {
+    return *params[pv].index;
+  };
+  EXPECT_CALL(*plugin, setIntegerParam(_, _)).Times(AtLeast(0));
+  EXPECT_CALL(*plugin, setStringParam(_, _)).Times(AtLeast(0));
+  EXPECT_CALL(*plugin, setDoubleParam(_, _)).Times(AtLeast(0));
+  EXPECT_CALL(*plugin,
+              setIntegerParam(Eq(index(KafkaProducerStandIn::PV::outbuf_count)),
+                              Eq(5)))
+      .Times(2);
+  EXPECT_CALL(*plugin, setIntegerParam(
+                           Eq(index(KafkaProducerStandIn::PV::queued_bytes)),
+                           Eq(4096)))
+      .Times(2);
+  EXPECT_CALL(*plugin,
+              setDoubleParam(Eq(index(KafkaProducerStandIn::PV::rtt_p99)),
+                             DoubleEq(9.0)))
+      .Times(2);
+  EXPECT_CALL(*plugin,
+              setDoubleParam(Eq(index(KafkaProducerStandIn::PV::batch_size)),
+                             DoubleEq(2500.0)))
+      .Times(2);
+  // The rates are only known from the second statistics
+  EXPECT_CALL(*plugin,
+              setDoubleParam(Eq(index(KafkaProducerStandIn::PV::tx_msg_rate)),
+                             DoubleEq(200.0)))
+      .Times(1);
+  EXPECT_CALL(*plugin,
+              setDoubleParam(Eq(index(KafkaProducerStandIn::PV::tx_data_rate)),
+                             DoubleEq(2.0)))
+      .Times(1);
+  std::string stats = R"({"ts": TS, "msg_cnt": 2, "msg_size": 4096,
+    "txmsgs": TXMSGS, "txmsg_bytes": TXBYTES,
+    "brokers": {
+      ":0/internal": {"source": "internal", "state": "INIT",
+                      "outbuf_cnt": 100, "rtt": {"avg": 1e9, "p99": 1e9}},
+      "b1:9092/1": {"source": "configured", "state": "UP", "outbuf_cnt": 2,
+                    "rtt": {"avg": 1000, "p99": 9000},
+                    "int_latency": {"avg": 300}, "throttle": {"avg": 0}},
+      "b2:9092/2": {"source": "learned", "state": "DOWN", "outbuf_cnt": 3,
+                    "rtt": {"avg": 2000, "p99": 4000},
+                    "int_latency": {"avg": 100}, "throttle": {"avg": 5}}},
+    "topics": {
+      "t1": {"batchsize": {"avg": 2000, "cnt": 3},
+             "batchcnt": {"avg": 2, "cnt": 3}},
+      "t2": {"batchsize": {"avg": 4000, "cnt": 1},
+             "batchcnt": {"avg": 6, "cnt": 1}}}})";
+  auto replace = [](std::string text, std::string const &from,
+                    std::string const &to) {
+    text.replace(text.find(from), from.size(), to);
+    return text;
+  };
+  prod.ParseStatusString(replace(
+      replace(replace(stats, "TS", "1000000"), "TXMSGS", "100"), "TXBYTES",
+      "1000000"));
+  prod.ParseStatusString(replace(
+      replace(replace(stats, "TS", "1500000"), "TXMSGS", "200"), "TXBYTES",
+      "2000000"));
+}
+
+TEST_F(KafkaProducerEnv, BrokersDownTest) {
+  NiceMock<KafkaProducerStandIn> prod;
+  prod.RegisterParamCallbackClass(plugin.get());
+  EXPECT_CALL(*plugin, setIntegerParam(_, _)).Times(AtLeast(0));
+  EXPECT_CALL(*plugin, setStringParam(_, _)).Times(AtLeast(0));
+  EXPECT_CALL(*plugin, setDoubleParam(_, _)).Times(AtLeast(0));
+  ASSERT_FALSE(prod.brokersDown);
+  prod.ParseStatusString(R"({"ts": 1000000, "brokers": {
+    "b1:9092/1": {"source": "configured", "state": "DOWN"}}})");
+  ASSERT_TRUE(prod.brokersDown);
+  // Errors which do not tell anything about the brokers keep the state
+  prod.ParseStatusString("Not JSON");
+  ASSERT_TRUE(prod.brokersDown);
+  prod.ParseStatusString(R"({"ts": 2000000, "brokers": {
+    "b1:9092/1": {"source": "configured", "state": "UP"}}})");
+  ASSERT_FALSE(prod.brokersDown);
+}
+
 TEST_F(KafkaProducerEnv, MaxMessagesInQueue) {
   KafkaProducerStandIn prod("some_addr", "some_topic");
   ON_CALL(prod, MakeConnection())
@@ -325,6 +431,144 @@ TEST_F(KafkaProducerEnv, SetAddressIsSetTest) {
   ASSERT_EQ(usedAddr, prod.GetBrokerAddr());
 }
 
+TEST_F(KafkaProducerEnv, SetQueueFullPolicyTest) {
+  KafkaProducer prod("addr", "tpic");
+  ASSERT_EQ(KafkaProducer::QueueFullPolicy::DROP_NEWEST,
+            prod.GetQueueFullPolicy());
+  prod.SetQueueFullPolicy(KafkaProducer::QueueFullPolicy::BLOCK);
+  ASSERT_EQ(KafkaProducer::QueueFullPolicy::BLOCK, prod.GetQueueFullPolicy());
+}
+
+TEST_F(KafkaProducerEnv, SetBlockTimeoutTest) {
+  KafkaProducer prod("addr", "tpic");
+  int usedTimeout = 250;
+  ASSERT_TRUE(prod.SetBlockTimeoutMS(usedTimeout));
+  ASSERT_EQ(usedTimeout, prod.GetBlockTimeoutMS());
+  ASSERT_FALSE(prod.SetBlockTimeoutMS(0));
+  ASSERT_EQ(usedTimeout, prod.GetBlockTimeoutMS());
+}
+
+TEST_F(KafkaProducerEnv, DropOldestMessageTest) {
+  NiceMock<KafkaProducerStandIn> prod("some_addr", "some_topic");
+  ON_CALL(prod, MakeConnection())
+      .WillByDefault(
+          Invoke(&prod, &KafkaProducerStandIn::MakeConnectionParent));
+  int maxQueueSize = 3;
+  prod.SetMessageQueueLength(maxQueueSize);
+  prod.SetQueueFullPolicy(KafkaProducer::QueueFullPolicy::DROP_OLDEST);
+  // The broker can not be reached: the first messages fill the producer
+  // queue, the next ones the queue in front of it
+  std::string msg("Some message");
+  int sendMsgs = 3 * maxQueueSize + 2;
+  int arraysPerMsg = 2;
+  for (int i = 0; i < sendMsgs; i++) {
+    ASSERT_TRUE(prod.SendKafkaPacket(
+        reinterpret_cast<const unsigned char *>(msg.c_str()), msg.size(), i,
+        {}, arraysPerMsg));
+  }
+  ASSERT_EQ(size_t(maxQueueSize), prod.pendingMessages.size());
+  EXPECT_EQ(sendMsgs - 2 * maxQueueSize, int(prod.undeliveredMessages));
+  // The dropped messages were accepted, so the caller must count them
+  EXPECT_EQ(std::uint64_t((sendMsgs - 2 * maxQueueSize) * arraysPerMsg),
+            prod.TakeEvictedArrays());
+  EXPECT_EQ(0u, prod.TakeEvictedArrays());
+  // Only the oldest messages are dropped, the newest ones are kept in order
+  for (int i = 0; i < maxQueueSize; i++) {
+    EXPECT_EQ(sendMsgs - maxQueueSize + i,
+              prod.pendingMessages.at(i).timestamp);
+  }
+}
+
+TEST_F(KafkaProducerEnv, DropOldestMessageBytesTest) {
+  NiceMock<KafkaProducerStandIn> prod("some_addr", "some_topic");
+  ON_CALL(prod, MakeConnection())
+      .WillByDefault(
+          Invoke(&prod, &KafkaProducerStandIn::MakeConnectionParent));
+  prod.SetMessageQueueLength(100);
+  prod.SetMessageBufferSizeKbytes(1);
+  prod.SetQueueFullPolicy(KafkaProducer::QueueFullPolicy::DROP_OLDEST);
+  // Only one message fits in the queue in front of the producer queue
+  std::vector<unsigned char> msg(600, 'x');
+  for (int i = 0; i < 10; i++) {
+    ASSERT_TRUE(prod.SendKafkaPacket(msg.data(), msg.size(), i));
+  }
+  ASSERT_EQ(1u, prod.pendingMessages.size());
+  EXPECT_EQ(9, prod.pendingMessages.front().timestamp);
+  EXPECT_EQ(msg.size(), prod.pendingBytes);
+}
+
+TEST_F(KafkaProducerEnv, BlockTimeoutTest) {
+  NiceMock<KafkaProducerStandIn> prod("some_addr", "some_topic");
+  ON_CALL(prod, MakeConnection())
+      .WillByDefault(
+          Invoke(&prod, &KafkaProducerStandIn::MakeConnectionParent));
+  int maxQueueSize = 2;
+  int blockTimeout = 500;
+  prod.SetMessageQueueLength(maxQueueSize);
+  prod.SetQueueFullPolicy(KafkaProducer::QueueFullPolicy::BLOCK);
+  prod.SetBlockTimeoutMS(blockTimeout);
+  std::string msg("Some message");
+  for (int i = 0; i < maxQueueSize; i++) {
+    ASSERT_TRUE(prod.SendKafkaPacket(
+        reinterpret_cast<const unsigned char *>(msg.c_str()), msg.size()));
+  }
+  // The producer must not be locked while blocking
+  std::chrono::steady_clock::duration setterTime{};
+  std::thread setterThread([&prod, &setterTime]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto start = std::chrono::steady_clock::now();
+    prod.SetSpoolReplayRate(10);
+    setterTime = std::chrono::steady_clock::now() - start;
+  });
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(prod.SendKafkaPacket(
+      reinterpret_cast<const unsigned char *>(msg.c_str()), msg.size()));
+  auto sendTime = std::chrono::steady_clock::now() - start;
+  setterThread.join();
+  EXPECT_GE(sendTime, std::chrono::milliseconds(blockTimeout));
+  EXPECT_LT(setterTime, std::chrono::milliseconds(blockTimeout / 2));
+  EXPECT_EQ(10, prod.GetSpoolReplayRate());
+}
+
+#ifdef HAVE_MOCK_CLUSTER
+TEST_F(KafkaProducerEnv, BlockUntilBrokerIsUpTest) {
+  char errstr[512];
+  rd_kafka_t *mockHandle = rd_kafka_new(RD_KAFKA_PRODUCER, rd_kafka_conf_new(),
+                                        errstr, sizeof(errstr));
+  ASSERT_NE(mockHandle, nullptr);
+  rd_kafka_mock_cluster_t *cluster = rd_kafka_mock_cluster_new(mockHandle, 1);
+  ASSERT_NE(cluster, nullptr);
+  rd_kafka_mock_topic_create(cluster, "some_topic", 1, 1);
+  rd_kafka_mock_broker_set_down(cluster, 1);
+  {
+    NiceMock<KafkaProducerStandIn> prod(
+        rd_kafka_mock_cluster_bootstraps(cluster), "some_topic");
+    ON_CALL(prod, MakeConnection())
+        .WillByDefault(
+            Invoke(&prod, &KafkaProducerStandIn::MakeConnectionParent));
+    int maxQueueSize = 2;
+    prod.SetMessageQueueLength(maxQueueSize);
+    prod.SetQueueFullPolicy(KafkaProducer::QueueFullPolicy::BLOCK);
+    prod.SetBlockTimeoutMS(10000);
+    prod.StartThread();
+    std::string msg("Some message");
+    for (int i = 0; i < maxQueueSize; i++) {
+      ASSERT_TRUE(prod.SendKafkaPacket(
+          reinterpret_cast<const unsigned char *>(msg.c_str()), msg.size()));
+    }
+    std::thread brokerThread([cluster]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+      rd_kafka_mock_broker_set_up(cluster, 1);
+    });
+    EXPECT_TRUE(prod.SendKafkaPacket(
+        reinterpret_cast<const unsigned char *>(msg.c_str()), msg.size()));
+    brokerThread.join();
+  }
+  rd_kafka_mock_cluster_destroy(cluster);
+  rd_kafka_destroy(mockHandle);
+}
+#endif
+
 TEST_F(KafkaProducerEnv, IsAddrConfSetTest) {
   std::string testAddr = "some_weird_addr";
   std::string testTopic = "some_weird_topic";
@@ -334,4 +578,59 @@ TEST_F(KafkaProducerEnv, IsAddrConfSetTest) {
   prod.conf->get("metadata.broker.list", tempStr);
   ASSERT_EQ(testAddr, tempStr);
 }
+
+TEST_F(KafkaProducerEnv, SpoolWhileDisconnectedTest) {
+  NiceMock<KafkaProducerStandIn> prod("some_addr", "some_topic");
+  std::vector<PV_param> params = prod.GetParams();
+  int ctr = 1;
+  for (auto const &p : params) {
+    *p.index.get() = ctr;
+    ctr++;
+  }
+  auto const spoolMsgsIndex{
+      *params[KafkaProducerStandIn::PV::spool_msgs].index.get()};
+  int sendMsgs = 3;
+  EXPECT_CALL(*plugin, setIntegerParam(_, _)).Times(AtLeast(0));
+  EXPECT_CALL(*plugin, setIntegerParam(Eq(spoolMsgsIndex), Eq(sendMsgs)))
+      .Times(AtLeast(1));
+  prod.RegisterParamCallbackClass(plugin.get());
+  std::string spoolPath = std::string(TEST_DATA_PATH) + "producer_spool.data";
+  ASSERT_TRUE(prod.SetSpoolFile(spoolPath, 100000));
+  prod.brokersDown = true;
+  std::string msg("Some message");
+  for (int i = 0; i < sendMsgs; i++) {
+    ASSERT_TRUE(prod.SendKafkaPacket(
+        reinterpret_cast<const unsigned char *>(msg.c_str()), msg.size()));
+  }
+  ASSERT_TRUE(prod.SetSpoolFile("", 0));
+  std::remove(spoolPath.c_str());
+  Mock::VerifyAndClear(plugin.get());
+}
+
+TEST_F(KafkaProducerEnv, NoSpoolWhileConnectedTest) {
+  NiceMock<KafkaProducerStandIn> prod("some_addr", "some_topic");
+  ON_CALL(prod, MakeConnection())
+      .WillByDefault(
+          Invoke(&prod, &KafkaProducerStandIn::MakeConnectionParent));
+  ASSERT_EQ(0, prod.GetSpoolReplayRate());
+  std::string spoolPath = std::string(TEST_DATA_PATH) + "producer_spool.data";
+  ASSERT_TRUE(prod.SetSpoolFile(spoolPath, 100000));
+  std::string msg("Some message");
+  // Nothing is known about the brokers yet
+  ASSERT_TRUE(prod.SendKafkaPacket(
+      reinterpret_cast<const unsigned char *>(msg.c_str()), msg.size()));
+  ASSERT_EQ(0u, prod.spool.GetMessages());
+  prod.brokersDown = true;
+  ASSERT_TRUE(prod.SendKafkaPacket(
+      reinterpret_cast<const unsigned char *>(msg.c_str()), msg.size()));
+  ASSERT_EQ(1u, prod.spool.GetMessages());
+  // New messages are not spooled once the brokers are up, even if the spool
+  // is not empty
+  prod.brokersDown = false;
+  ASSERT_TRUE(prod.SendKafkaPacket(
+      reinterpret_cast<const unsigned char *>(msg.c_str()), msg.size()));
+  ASSERT_EQ(1u, prod.spool.GetMessages());
+  ASSERT_TRUE(prod.SetSpoolFile("", 0));
+  std::remove(spoolPath.c_str());
+}
 }
@@ -0,0 +1,129 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  LoadGeneratorTest.cpp
+ *  @brief Unit tests of the synthetic NDArray load generator driver.
+ */
+
+#include "LoadGenerator.h"
+#include "PortName.h"
+#include <chrono>
+#include <ciso646>
+#include <gtest/gtest.h>
+#include <set>
+#include <thread>
+#include <vector>
+
+/// @brief Simple stand-in class used for unit tests.
+class LoadGeneratorStandIn : public LoadGenerator {
+public:
+  LoadGeneratorStandIn()
+      : LoadGenerator(PortName().c_str(), 64, 32, 0, 0, 0, 0){};
+  using LoadGenerator::FillPattern;
+  using LoadGenerator::GetFreeBuffer;
+  using LoadGenerator::PrepareBuffers;
+  using LoadGenerator::buffers;
+  using LoadGenerator::paramsList;
+  using LoadGenerator::PV;
+  using asynPortDriver::pasynUserSelf;
+  using ADDriver::ADAcquire;
+  using ADDriver::ADImageMode;
+  using ADDriver::ADNumImages;
+  using ADDriver::ADNumImagesCounter;
+};
+
+/// @brief A testing fixture used for setting up unit tests.
+class LoadGeneratorEnv : public ::testing::Test {
+public:
+  static const size_t elements = 100000;
+};
+
+TEST_F(LoadGeneratorEnv, InitParamsIndexTest) {
+  LoadGeneratorStandIn generator;
+  ASSERT_EQ(generator.paramsList.size(),
+            static_cast<size_t>(LoadGeneratorStandIn::PV::count));
+  for (auto &p : generator.paramsList) {
+    ASSERT_NE(*p.index, 0);
+  }
+}
+
+TEST_F(LoadGeneratorEnv, RampPatternTest) {
+  std::vector<epicsUInt16> data(elements);
+  LoadGeneratorStandIn::FillPattern(NDUInt16, data.data(), data.size(),
+                                    LoadGenerator::Pattern::RAMP, 0.0);
+  for (size_t i = 0; i < data.size(); i++) {
+    ASSERT_EQ(data[i], 1 + i % 250);
+  }
+}
+
+TEST_F(LoadGeneratorEnv, NoisePatternTest) {
+  std::vector<epicsFloat32> data(elements);
+  std::vector<epicsFloat32> otherData(elements);
+  LoadGeneratorStandIn::FillPattern(NDFloat32, data.data(), data.size(),
+                                    LoadGenerator::Pattern::NOISE, 0.0);
+  LoadGeneratorStandIn::FillPattern(NDFloat32, otherData.data(),
+                                    otherData.size(),
+                                    LoadGenerator::Pattern::NOISE, 0.0);
+  EXPECT_EQ(data, otherData);
+  std::set<epicsFloat32> values(data.begin(), data.end());
+  EXPECT_EQ(values.size(), 250u);
+  EXPECT_EQ(*values.begin(), 1.0f);
+  EXPECT_EQ(*values.rbegin(), 250.0f);
+}
+
+TEST_F(LoadGeneratorEnv, SparsityTest) {
+  std::vector<epicsInt8> data(elements);
+  for (double sparsity : {0.0, 0.5, 0.9, 1.0}) {
+    LoadGeneratorStandIn::FillPattern(NDInt8, data.data(), data.size(),
+                                      LoadGenerator::Pattern::RAMP, sparsity);
+    size_t zeros = 0;
+    for (auto value : data) {
+      if (0 == value) {
+        zeros++;
+      }
+    }
+    EXPECT_NEAR(static_cast<double>(zeros) / elements, sparsity, 0.01);
+  }
+}
+
+TEST_F(LoadGeneratorEnv, FreeBufferTest) {
+  LoadGeneratorStandIn generator;
+  generator.lock();
+  ASSERT_TRUE(generator.PrepareBuffers());
+  ASSERT_EQ(generator.buffers.size(), 8u);
+  std::vector<NDArray *> used;
+  for (int i = 0; i < 8; i++) {
+    NDArray *pArray = generator.GetFreeBuffer();
+    ASSERT_NE(pArray, nullptr);
+    EXPECT_EQ(pArray, generator.buffers[i]);
+    // Used by a plugin
+    pArray->reserve();
+    used.push_back(pArray);
+  }
+  EXPECT_EQ(generator.GetFreeBuffer(), nullptr);
+  used[3]->release();
+  EXPECT_EQ(generator.GetFreeBuffer(), used[3]);
+  generator.unlock();
+  for (int i = 0; i < 8; i++) {
+    if (i != 3) {
+      used[i]->release();
+    }
+  }
+}
+
+TEST_F(LoadGeneratorEnv, MultipleImagesTest) {
+  LoadGeneratorStandIn generator;
+  auto pasynUser = generator.pasynUserSelf;
+  generator.setIntegerParam(generator.ADImageMode, ADImageMultiple);
+  generator.setIntegerParam(generator.ADNumImages, 5);
+  pasynUser->reason = generator.ADAcquire;
+  ASSERT_EQ(generator.writeInt32(pasynUser, 1), asynSuccess);
+  int acquire = 1;
+  for (int i = 0; i < 200 and acquire != 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    generator.getIntegerParam(generator.ADAcquire, &acquire);
+  }
+  EXPECT_EQ(acquire, 0);
+  int numImages;
+  generator.getIntegerParam(generator.ADNumImagesCounter, &numImages);
+  EXPECT_EQ(numImages, 5);
+}
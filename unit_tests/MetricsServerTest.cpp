@@ -0,0 +1,134 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  MetricsServerTest.cpp
+ *  @brief Unit tests of the metrics and of the server exporting them.
+ */
+
+#include "MetricsServer.h"
+#include <arpa/inet.h>
+#include <ciso646>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace KafkaInterface;
+
+/// @brief Sends a request to a server on the loopback interface.
+std::string Scrape(int port, std::string const &request) {
+  int connection = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(static_cast<std::uint16_t>(port));
+  std::string response;
+  if (0 == connect(connection, reinterpret_cast<sockaddr *>(&address),
+                   sizeof(address))) {
+    send(connection, request.data(), request.size(), 0);
+    char buffer[1024];
+    ssize_t received;
+    while ((received = recv(connection, buffer, sizeof(buffer), 0)) > 0) {
+      response.append(buffer, received);
+    }
+  }
+  close(connection);
+  return response;
+}
+
+TEST(MetricsServerTest, CounterAndGaugeTest) {
+  MetricsSet set("KFK1");
+  auto &counter = set.AddCounter("test_arrays_total", "Arrays.");
+  auto &gauge = set.AddGauge("test_queue", "Queue length.");
+  counter.Add();
+  counter.Add(41);
+  gauge.Set(2.5);
+  EXPECT_EQ(counter.Get(), 42u);
+  EXPECT_EQ(gauge.Get(), 2.5);
+  std::string expected = "# HELP test_arrays_total Arrays.\n"
+                         "# TYPE test_arrays_total counter\n"
+                         "test_arrays_total{port=\"KFK1\"} 42\n"
+                         "# HELP test_queue Queue length.\n"
+                         "# TYPE test_queue gauge\n"
+                         "test_queue{port=\"KFK1\"} 2.5\n";
+  EXPECT_EQ(MetricsSet::Render({&set}), expected);
+}
+
+TEST(MetricsServerTest, HistogramTest) {
+  MetricsSet set("KFK1");
+  auto &histogram = set.AddHistogram("test_seconds", "Time.", {0.5, 1.0});
+  histogram.Observe(0.25);
+  histogram.Observe(0.5);
+  histogram.Observe(0.75);
+  histogram.Observe(4.0);
+  EXPECT_EQ(histogram.GetBucket(0), 2u);
+  EXPECT_EQ(histogram.GetBucket(1), 1u);
+  EXPECT_EQ(histogram.GetBucket(2), 1u);
+  EXPECT_EQ(histogram.GetCount(), 4u);
+  EXPECT_EQ(histogram.GetSum(), 5.5);
+  std::string expected = "# HELP test_seconds Time.\n"
+                         "# TYPE test_seconds histogram\n"
+                         "test_seconds_bucket{port=\"KFK1\",le=\"0.5\"} 2\n"
+                         "test_seconds_bucket{port=\"KFK1\",le=\"1\"} 3\n"
+                         "test_seconds_bucket{port=\"KFK1\",le=\"+Inf\"} 4\n"
+                         "test_seconds_sum{port=\"KFK1\"} 5.5\n"
+                         "test_seconds_count{port=\"KFK1\"} 4\n";
+  EXPECT_EQ(MetricsSet::Render({&set}), expected);
+}
+
+TEST(MetricsServerTest, ExponentialBucketsTest) {
+  auto bounds = ExponentialBuckets(1e-3, 10, 4);
+  ASSERT_EQ(bounds.size(), 4u);
+  EXPECT_DOUBLE_EQ(bounds[0], 1e-3);
+  EXPECT_DOUBLE_EQ(bounds[3], 1.0);
+}
+
+TEST(MetricsServerTest, SeveralSetsTest) {
+  MetricsSet first("KFK1");
+  MetricsSet second("KFK\"2\"");
+  first.AddCounter("test_arrays_total", "Arrays.").Add(1);
+  second.AddCounter("test_arrays_total", "Arrays.").Add(2);
+  std::string expected = "# HELP test_arrays_total Arrays.\n"
+                         "# TYPE test_arrays_total counter\n"
+                         "test_arrays_total{port=\"KFK1\"} 1\n"
+                         "test_arrays_total{port=\"KFK\\\"2\\\"\"} 2\n";
+  EXPECT_EQ(MetricsSet::Render({&first, &second}), expected);
+}
+
+TEST(MetricsServerTest, ScrapeTest) {
+  auto server = MetricsServer::Get(0);
+  ASSERT_NE(server, nullptr);
+  ASSERT_NE(server->GetPort(), 0);
+  MetricsSet set("KFK1");
+  set.AddCounter("test_arrays_total", "Arrays.").Add(3);
+  server->Add(&set);
+  std::string response =
+      Scrape(server->GetPort(), "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n");
+  EXPECT_EQ(0u, response.find("HTTP/1.0 200 OK\r\n"));
+  EXPECT_NE(std::string::npos,
+            response.find("Content-Type: text/plain; version=0.0.4"));
+  EXPECT_NE(std::string::npos,
+            response.find("\r\n\r\n" + server->Render()));
+  EXPECT_NE(std::string::npos,
+            response.find("test_arrays_total{port=\"KFK1\"} 3\n"));
+
+  response = Scrape(server->GetPort(), "POST / HTTP/1.1\r\n\r\n");
+  EXPECT_EQ(0u, response.find("HTTP/1.0 405"));
+
+  server->Remove(&set);
+  EXPECT_EQ(server->Render(), "");
+}
+
+TEST(MetricsServerTest, SharedServerTest) {
+  auto server = MetricsServer::Get(0);
+  ASSERT_NE(server, nullptr);
+  int port = server->GetPort();
+  // Servers on a port chosen by the operating system are not shared
+  EXPECT_NE(MetricsServer::Get(0), server);
+  server.reset();
+  auto first = MetricsServer::Get(port);
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(MetricsServer::Get(port), first);
+}
@@ -4,14 +4,17 @@
  *  @brief Unit tests of the serialization and de-serialization of NDArray data.
  */
 
+#include "Crc32c.h"
 #include "GenerateNDArray.h"
 #include "NDArrayDeSerializer.h"
 #include "NDArraySerializer.h"
 #include "NDArray_schema_generated.h"
 #include <ciso646>
+#include <cmath>
 #include <fstream>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <limits>
 #include <map>
 #include <random>
 #include <set>
@@ -97,6 +100,480 @@ TEST_F(Serializer, SerializeTest) {
   delete sendArr;
 }
 
+TEST_F(Serializer, SequenceNumberTest) {
+  NDArraySerializer ser;
+  NDArray *sendArr = arrGen->GenerateNDArray(0, 10, 2, NDUInt16);
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  auto recvArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_EQ(recvArr->sequenceNumber(), 0u);
+  ASSERT_EQ(recvArr->droppedArrays(), 0u);
+
+  std::uint64_t usedSequenceNumber = 1234567890123;
+  std::uint64_t usedDroppedArrays = 42;
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize, usedSequenceNumber,
+                    usedDroppedArrays);
+  recvArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_EQ(recvArr->sequenceNumber(), usedSequenceNumber);
+  ASSERT_EQ(recvArr->droppedArrays(), usedDroppedArrays);
+  sendArr->release();
+}
+
+TEST_F(Serializer, BatchTest) {
+  NDArraySerializer ser;
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  ser.FinishBatch(bufferPtr, bufferSize);
+  ASSERT_EQ(bufferPtr, nullptr);
+  ASSERT_EQ(bufferSize, 0u);
+
+  std::vector<NDArray *> sendArrs;
+  size_t totalBytes = 0;
+  for (int i = 0; i < 3; i++) {
+    sendArrs.push_back(arrGen->GenerateNDArray(2, 10, 1, NDUInt16));
+    NDArrayInfo_t arrInfo;
+    sendArrs.back()->getInfo(&arrInfo);
+    totalBytes += arrInfo.totalBytes;
+    ser.AddToBatch(*sendArrs.back(), i + 1, 0);
+  }
+  ASSERT_EQ(ser.GetBatchArrays(), 3u);
+  ASSERT_EQ(ser.GetBatchBytes(), totalBytes);
+  ser.FinishBatch(bufferPtr, bufferSize);
+  ASSERT_EQ(ser.GetBatchArrays(), 0u);
+  ASSERT_EQ(ser.GetBatchBytes(), 0u);
+
+  flatbuffers::Verifier verifier(bufferPtr, bufferSize);
+  ASSERT_TRUE(FB_Tables::VerifyNDArrayBatchBuffer(verifier));
+  ASSERT_FALSE(FB_Tables::NDArrayBufferHasIdentifier(bufferPtr));
+  auto arrays = FB_Tables::GetNDArrayBatch(bufferPtr)->arrays();
+  ASSERT_EQ(arrays->size(), sendArrs.size());
+  for (size_t i = 0; i < sendArrs.size(); i++) {
+    auto recvArr = arrays->Get(i);
+    EXPECT_EQ(recvArr->sequenceNumber(), i + 1);
+    NDArray *deSerArr = nullptr;
+    DeSerializeData(recvPool, recvArr, deSerArr);
+    CompareSizeAndDims(sendArrs[i], deSerArr);
+    CompareData(sendArrs[i], deSerArr);
+    CompareAttributes(sendArrs[i], deSerArr);
+    deSerArr->release();
+    sendArrs[i]->release();
+  }
+}
+
+TEST_F(Serializer, SparseEncodingTest) {
+  NDArraySerializer ser;
+  ASSERT_FALSE(ser.SetSparseThreshold(-1.0));
+  ser.SetEncoding(NDArraySerializer::Encoding::AUTO_SPARSE);
+  NDArray *sendArr = arrGen->GenerateNDArray(0, 100, 1, NDInt16);
+  auto sendData = reinterpret_cast<epicsInt16 *>(sendArr->pData);
+  for (size_t i = 0; i < 100; i++) {
+    sendData[i] = 0;
+  }
+  sendData[3] = -5;
+  sendData[42] = 1;
+  sendData[99] = 7;
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  auto fbArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_EQ(fbArr->encoding(), FB_Tables::Encoding_sparse);
+  ASSERT_EQ(fbArr->sparseIndices()->size(), 3u);
+  ASSERT_EQ(fbArr->pData()->size(), 3u * sizeof(epicsInt16));
+
+  NDArray *recvArr = nullptr;
+  DeSerializeData(recvPool, bufferPtr, recvArr);
+  CompareSizeAndDims(sendArr, recvArr);
+  CompareData(sendArr, recvArr);
+  recvArr->release();
+
+  // Elements at or below the threshold are left out
+  ASSERT_TRUE(ser.SetSparseThreshold(5.0));
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  fbArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_EQ(fbArr->sparseIndices()->size(), 1u);
+  ASSERT_EQ(fbArr->sparseIndices()->Get(0), 99u);
+
+  // Dense data is sent if the sparse encoding would be larger
+  for (size_t i = 0; i < 100; i++) {
+    sendData[i] = 100;
+  }
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  fbArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_EQ(fbArr->encoding(), FB_Tables::Encoding_dense);
+  ASSERT_EQ(fbArr->pData()->size(), 100u * sizeof(epicsInt16));
+  sendArr->release();
+}
+
+TEST_F(Serializer, DeltaEncodingTest) {
+  NDArraySerializer ser;
+  ASSERT_FALSE(ser.SetKeyframeInterval(0));
+  ASSERT_TRUE(ser.SetKeyframeInterval(3));
+  ser.SetEncoding(NDArraySerializer::Encoding::DELTA);
+  NDArray *sendArr = arrGen->GenerateNDArray(0, 1000, 1, NDUInt32);
+  auto sendData = reinterpret_cast<epicsUInt32 *>(sendArr->pData);
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  KeyframeReference keyframe;
+  KeyframeReference lateKeyframe;
+  NDArray *recvArr = nullptr;
+  FB_Tables::Encoding expected[] = {
+      FB_Tables::Encoding_keyframe, FB_Tables::Encoding_delta,
+      FB_Tables::Encoding_delta, FB_Tables::Encoding_keyframe};
+  for (size_t frame = 0; frame < 4; frame++) {
+    sendData[frame * 10] += 1;
+    ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+    auto fbArr = FB_Tables::GetNDArray(bufferPtr);
+    ASSERT_EQ(fbArr->encoding(), expected[frame]);
+    if (FB_Tables::Encoding_delta == fbArr->encoding()) {
+      ASSERT_LT(fbArr->pData()->size(), 1000u * sizeof(epicsUInt32));
+      // A consumer starting in between two keyframes can not decode deltas
+      ASSERT_FALSE(DeSerializeData(recvPool, fbArr, recvArr, &lateKeyframe));
+      ASSERT_EQ(recvArr, nullptr);
+    }
+    ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr, &keyframe));
+    CompareSizeAndDims(sendArr, recvArr);
+    CompareData(sendArr, recvArr);
+    recvArr->release();
+  }
+
+  // A change of shape forces a keyframe
+  NDArray *otherArr = arrGen->GenerateNDArray(0, 500, 1, NDUInt32);
+  ser.SerializeData(*otherArr, bufferPtr, bufferSize);
+  ASSERT_EQ(FB_Tables::GetNDArray(bufferPtr)->encoding(),
+            FB_Tables::Encoding_keyframe);
+  otherArr->release();
+
+  // As does a request, e.g. after a failure to send a message
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  ASSERT_EQ(FB_Tables::GetNDArray(bufferPtr)->encoding(),
+            FB_Tables::Encoding_delta);
+  ser.RequestKeyframe();
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  ASSERT_EQ(FB_Tables::GetNDArray(bufferPtr)->encoding(),
+            FB_Tables::Encoding_keyframe);
+  sendArr->release();
+}
+
+TEST_F(Serializer, PackedEncodingTest) {
+  NDArraySerializer ser;
+  ASSERT_FALSE(ser.SetPackedBits(-1));
+  ASSERT_FALSE(ser.SetPackedBits(16));
+  ser.SetEncoding(NDArraySerializer::Encoding::PACKED);
+  ser.SetChecksum(true);
+  NDArray *sendArr = arrGen->GenerateNDArray(0, 1001, 1, NDUInt16);
+  auto sendData = reinterpret_cast<epicsUInt16 *>(sendArr->pData);
+  std::mt19937 generator(1);
+  for (size_t i = 0; i < 1001; i++) {
+    sendData[i] = static_cast<epicsUInt16>(generator() & 0x0FFF);
+  }
+  sendData[1000] = 0x0FFF;
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  NDArray *recvArr = nullptr;
+
+  // Number of bits detected from the data
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  auto fbArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_EQ(fbArr->encoding(), FB_Tables::Encoding_packed);
+  ASSERT_EQ(fbArr->packedBits(), 12);
+  ASSERT_EQ(fbArr->pData()->size(), (1001u * 12 + 7) / 8);
+  ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr));
+  CompareSizeAndDims(sendArr, recvArr);
+  CompareData(sendArr, recvArr);
+  EXPECT_TRUE(VerifyChecksum(fbArr, recvArr));
+  recvArr->release();
+
+  // More bits than required
+  ASSERT_TRUE(ser.SetPackedBits(13));
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  fbArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_EQ(fbArr->encoding(), FB_Tables::Encoding_packed);
+  ASSERT_EQ(fbArr->packedBits(), 13);
+  ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr));
+  CompareData(sendArr, recvArr);
+  recvArr->release();
+
+  // Arrays with values that do not fit are sent dense
+  ASSERT_TRUE(ser.SetPackedBits(10));
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  fbArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_EQ(fbArr->encoding(), FB_Tables::Encoding_dense);
+  ASSERT_EQ(fbArr->packedBits(), 0);
+  ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr));
+  CompareData(sendArr, recvArr);
+  recvArr->release();
+
+  // Truncated data is rejected
+  for (size_t i = 0; i < 1001; i++) {
+    sendData[i] &= 0x03FF;
+  }
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  fbArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_EQ(fbArr->encoding(), FB_Tables::Encoding_packed);
+  auto payloadSize = reinterpret_cast<flatbuffers::uoffset_t *>(
+      const_cast<std::uint8_t *>(fbArr->pData()->Data()) -
+      sizeof(flatbuffers::uoffset_t));
+  *payloadSize -= 1;
+  ASSERT_FALSE(DeSerializeData(recvPool, fbArr, recvArr));
+  ASSERT_EQ(recvArr, nullptr);
+  sendArr->release();
+
+  // Only arrays of type NDUInt16 are packed
+  NDArray *intArr = arrGen->GenerateNDArray(0, 100, 1, NDUInt32);
+  ser.SerializeData(*intArr, bufferPtr, bufferSize);
+  EXPECT_EQ(FB_Tables::GetNDArray(bufferPtr)->encoding(),
+            FB_Tables::Encoding_dense);
+  intArr->release();
+}
+
+TEST_F(Serializer, StatisticsAndChecksumTest) {
+  const char checkString[] = "123456789";
+  ASSERT_EQ(KafkaInterface::Crc32c(checkString, 9), 0xE3069283u);
+  ASSERT_EQ(KafkaInterface::Crc32c(checkString + 4, 5,
+                                   KafkaInterface::Crc32c(checkString, 4)),
+            0xE3069283u);
+
+  NDArraySerializer ser;
+  // 5000 elements makes the data span several blocks of the summary kernel
+  NDArray *sendArr = arrGen->GenerateNDArray(0, 5000, 1, NDFloat32);
+  auto sendData = reinterpret_cast<epicsFloat32 *>(sendArr->pData);
+  for (size_t i = 0; i < 5000; i++) {
+    sendData[i] = static_cast<epicsFloat32>(i % 100) - 10.0f;
+  }
+  sendData[1234] = std::numeric_limits<epicsFloat32>::quiet_NaN();
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  auto fbArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_EQ(fbArr->statistics(), nullptr);
+  ASSERT_EQ(fbArr->checksumType(), FB_Tables::ChecksumType_none);
+
+  ser.SetStatistics(true);
+  ser.SetChecksum(true);
+  ASSERT_FALSE(ser.SetStatisticsThreshold(
+      std::numeric_limits<double>::quiet_NaN()));
+  ASSERT_TRUE(ser.SetStatisticsThreshold(79.5));
+  for (auto encoding : {NDArraySerializer::Encoding::DENSE,
+                        NDArraySerializer::Encoding::AUTO_SPARSE}) {
+    ser.SetEncoding(encoding);
+    ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+    fbArr = FB_Tables::GetNDArray(bufferPtr);
+    ASSERT_NE(fbArr->statistics(), nullptr);
+    EXPECT_EQ(fbArr->statistics()->min(), -10.0);
+    EXPECT_EQ(fbArr->statistics()->max(), 89.0);
+    EXPECT_TRUE(std::isnan(fbArr->statistics()->sum()));
+    // Elements 80 to 89 of each of the 50 periods
+    EXPECT_EQ(fbArr->statistics()->aboveThreshold(), 500u);
+    ASSERT_EQ(fbArr->checksumType(), FB_Tables::ChecksumType_crc32c);
+    EXPECT_EQ(fbArr->checksum(),
+              KafkaInterface::Crc32c(sendArr->pData, 5000 * sizeof(float)));
+  }
+  sendArr->release();
+}
+
+TEST_F(Serializer, VerifyChecksumTest) {
+  NDArraySerializer ser;
+  NDArray *sendArr = arrGen->GenerateNDArray(0, 1000, 2, NDUInt16);
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  NDArray *recvArr = nullptr;
+
+  // Arrays without a checksum are accepted
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  auto fbArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr));
+  EXPECT_TRUE(VerifyChecksum(fbArr, recvArr));
+  recvArr->release();
+
+  ser.SetChecksum(true);
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  fbArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr));
+  EXPECT_TRUE(VerifyChecksum(fbArr, recvArr));
+  recvArr->release();
+
+  // Flip a bit in the serialized data
+  auto payload = const_cast<std::uint8_t *>(fbArr->pData()->data());
+  payload[123] ^= 0x10;
+  ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr));
+  EXPECT_FALSE(VerifyChecksum(fbArr, recvArr));
+  recvArr->release();
+  sendArr->release();
+}
+
+TEST_F(Serializer, SparseChecksumTest) {
+  NDArraySerializer ser;
+  ser.SetEncoding(NDArraySerializer::Encoding::AUTO_SPARSE);
+  ser.SetChecksum(true);
+  NDArray *sendArr = arrGen->GenerateNDArray(0, 5000, 1, NDInt32);
+  auto sendData = reinterpret_cast<epicsInt32 *>(sendArr->pData);
+  for (size_t i = 0; i < 5000; i++) {
+    sendData[i] = (0 == i % 97) ? static_cast<epicsInt32>(i) : 3;
+  }
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  NDArray *recvArr = nullptr;
+  // The elements at or below the threshold are received as 0, the checksum
+  // is of the data as received
+  ASSERT_TRUE(ser.SetSparseThreshold(5.0));
+  ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+  auto fbArr = FB_Tables::GetNDArray(bufferPtr);
+  ASSERT_EQ(fbArr->encoding(), FB_Tables::Encoding_sparse);
+  ASSERT_EQ(fbArr->checksumType(), FB_Tables::ChecksumType_crc32c);
+  ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr));
+  EXPECT_TRUE(VerifyChecksum(fbArr, recvArr));
+  auto recvData = reinterpret_cast<epicsInt32 *>(recvArr->pData);
+  EXPECT_EQ(recvData[1], 0);
+  EXPECT_EQ(recvData[97], 97);
+  recvArr->release();
+
+  // A corrupted value is detected
+  auto payload = const_cast<std::uint8_t *>(fbArr->pData()->data());
+  payload[5] ^= 0x01;
+  ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr));
+  EXPECT_FALSE(VerifyChecksum(fbArr, recvArr));
+  recvArr->release();
+  sendArr->release();
+}
+
+TEST_F(Serializer, TransportTypeTest) {
+  NDArraySerializer ser;
+  NDArray *sendArr = arrGen->GenerateNDArray(0, 1000, 1, NDFloat32);
+  auto sendData = reinterpret_cast<epicsFloat32 *>(sendArr->pData);
+  for (size_t i = 0; i < 1000; i++) {
+    sendData[i] = (static_cast<float>(i) - 500.0f) * 0.37f;
+  }
+  sendData[0] = 1.0f;
+  sendData[1] = 65504.0f;
+  sendData[2] = 1e6f;
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize;
+  NDArray *recvArr = nullptr;
+
+  struct TypeInfo {
+    NDArraySerializer::TransportType type;
+    FB_Tables::DType dType;
+    float precision;
+    std::uint16_t one;
+  };
+  TypeInfo types[] = {
+      {NDArraySerializer::TransportType::FLOAT16, FB_Tables::DType_float16,
+       std::ldexp(1.0f, -11), 0x3C00},
+      {NDArraySerializer::TransportType::BFLOAT16, FB_Tables::DType_bfloat16,
+       std::ldexp(1.0f, -8), 0x3F80}};
+  ser.SetChecksum(true);
+  for (auto const &info : types) {
+    ser.SetTransportType(info.type);
+    ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+    auto fbArr = FB_Tables::GetNDArray(bufferPtr);
+    ASSERT_EQ(fbArr->dataType(), info.dType);
+    ASSERT_EQ(fbArr->pData()->size(), 1000u * sizeof(std::uint16_t));
+
+    // Widened to float32 by default
+    ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr));
+    ASSERT_EQ(recvArr->dataType, NDFloat32);
+    CompareSizeAndDims(sendArr, recvArr);
+    EXPECT_TRUE(VerifyChecksum(fbArr, recvArr));
+    auto recvData = reinterpret_cast<epicsFloat32 *>(recvArr->pData);
+    EXPECT_EQ(recvData[0], 1.0f);
+    if (FB_Tables::DType_float16 == info.dType) {
+      // Largest value and out of range
+      EXPECT_EQ(recvData[1], 65504.0f);
+      EXPECT_TRUE(std::isinf(recvData[2]));
+    }
+    for (size_t i = 3; i < 1000; i++) {
+      EXPECT_NEAR(recvData[i], sendData[i],
+                  std::fabs(sendData[i]) * info.precision);
+    }
+    recvArr->release();
+
+    // The raw values
+    ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr, nullptr, false));
+    ASSERT_EQ(recvArr->dataType, NDUInt16);
+    EXPECT_EQ(reinterpret_cast<epicsUInt16 *>(recvArr->pData)[0], info.one);
+    EXPECT_TRUE(VerifyChecksum(fbArr, recvArr));
+    recvArr->release();
+
+    // Sparse encoding of the reduced data
+    ser.SetEncoding(NDArraySerializer::Encoding::AUTO_SPARSE);
+    ASSERT_TRUE(ser.SetSparseThreshold(150.0));
+    ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+    fbArr = FB_Tables::GetNDArray(bufferPtr);
+    ASSERT_EQ(fbArr->encoding(), FB_Tables::Encoding_sparse);
+    ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr));
+    EXPECT_TRUE(VerifyChecksum(fbArr, recvArr));
+    recvData = reinterpret_cast<epicsFloat32 *>(recvArr->pData);
+    for (size_t i = 3; i < 1000; i++) {
+      if (std::fabs(sendData[i]) > 150.0f) {
+        EXPECT_NEAR(recvData[i], sendData[i],
+                    std::fabs(sendData[i]) * info.precision);
+      } else {
+        EXPECT_EQ(recvData[i], 0.0f);
+      }
+    }
+    recvArr->release();
+
+    // Delta encoding of the reduced data
+    ser.SetEncoding(NDArraySerializer::Encoding::DELTA);
+    KeyframeReference keyframe;
+    for (int frame = 0; frame < 2; frame++) {
+      sendData[500] += 1.0f;
+      ser.SerializeData(*sendArr, bufferPtr, bufferSize);
+      fbArr = FB_Tables::GetNDArray(bufferPtr);
+      ASSERT_EQ(fbArr->encoding(), 0 == frame ? FB_Tables::Encoding_keyframe
+                                              : FB_Tables::Encoding_delta);
+      ASSERT_TRUE(DeSerializeData(recvPool, fbArr, recvArr, &keyframe));
+      EXPECT_TRUE(VerifyChecksum(fbArr, recvArr));
+      recvData = reinterpret_cast<epicsFloat32 *>(recvArr->pData);
+      EXPECT_EQ(recvData[500], sendData[500]);
+      recvArr->release();
+    }
+    ser.SetEncoding(NDArraySerializer::Encoding::DENSE);
+  }
+  sendArr->release();
+
+  // Only float32 arrays are affected
+  NDArray *intArr = arrGen->GenerateNDArray(0, 100, 1, NDUInt32);
+  ser.SerializeData(*intArr, bufferPtr, bufferSize);
+  EXPECT_EQ(FB_Tables::GetNDArray(bufferPtr)->dataType(),
+            FB_Tables::DType_uint32);
+  intArr->release();
+}
+
+TEST_F(Serializer, HeadersTest) {
+  NDArraySerializer ser;
+  NDArray *sendArr = arrGen->GenerateNDArray(0, 10, 2, NDUInt16);
+  epicsInt32 intValue = 42;
+  sendArr->pAttributeList->add("IntAttr", "", NDAttrInt32, &intValue);
+  epicsFloat64 floatValue = 0.5;
+  sendArr->pAttributeList->add("FloatAttr", "", NDAttrFloat64, &floatValue);
+  char stringValue[] = "some string";
+  sendArr->pAttributeList->add("StringAttr", "", NDAttrString, stringValue);
+
+  KafkaInterface::MessageHeaders headers;
+  ser.SerializeHeaders(*sendArr, {}, headers);
+  ASSERT_EQ(headers.size(), 3u);
+  EXPECT_EQ(headers[0].first, "uniqueId");
+  EXPECT_EQ(headers[0].second, std::to_string(sendArr->uniqueId));
+  EXPECT_EQ(headers[1].first, "dims");
+  EXPECT_EQ(headers[1].second, "10x12");
+  EXPECT_EQ(headers[2].first, "dataType");
+  EXPECT_EQ(headers[2].second, "uint16");
+
+  ser.SerializeHeaders(
+      *sendArr, {"IntAttr", "MissingAttr", "FloatAttr", "StringAttr"}, headers);
+  ASSERT_EQ(headers.size(), 6u);
+  EXPECT_EQ(headers[3].first, "IntAttr");
+  EXPECT_EQ(headers[3].second, "42");
+  EXPECT_EQ(headers[4].first, "FloatAttr");
+  EXPECT_EQ(headers[4].second, "0.5");
+  EXPECT_EQ(headers[5].first, "StringAttr");
+  EXPECT_EQ(headers[5].second, "some string");
+  sendArr->release();
+}
+
 /// @brief A testing fixture used for setting up unit tests.
 class DeSerializer : public ::testing::Test {
 public:
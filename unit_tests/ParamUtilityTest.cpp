@@ -29,6 +29,7 @@ public:
                        priority, stackSize){};
   MOCK_METHOD2(setStringParam, asynStatus(int, const char *));
   MOCK_METHOD2(setIntegerParam, asynStatus(int, int));
+  MOCK_METHOD2(setDoubleParam, asynStatus(int, double));
   MOCK_METHOD3(createParam, asynStatus(const char *, asynParamType, int *));
   MOCK_METHOD1(processCallbacks, void(NDArray*));
 };
@@ -98,6 +99,15 @@ TEST_F(ParamUtility, SetIntegerParamTest) {
   ASSERT_EQ(asynStatus::asynSuccess, setParam(plugin, test, testValue));
 }
 
+TEST_F(ParamUtility, SetDoubleParamTest) {
+  std::string descStr = "DESC_1";
+  double testValue = 4.2;
+  int testIndex = 11;
+  PV_param test(descStr.c_str(), asynParamFloat64, testIndex);
+  EXPECT_CALL(*plugin, setDoubleParam(testIndex, testValue)).Times(Exactly(1));
+  ASSERT_EQ(asynStatus::asynSuccess, setParam(plugin, test, testValue));
+}
+
 TEST_F(ParamUtility, SetStringParamTest) {
   std::string descStr = "DESC_1";
   std::string testValue = "some test string,.-";
@@ -0,0 +1,80 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  RateLimiterTest.cpp
+ *  @brief Unit tests of the rate limiting of the plugin.
+ */
+
+#include "RateLimiter.h"
+#include <gtest/gtest.h>
+
+using KafkaInterface::RateLimiter;
+
+class RateLimiterEnv : public ::testing::Test {
+public:
+  /// @brief Returns the time the given number of milliseconds after start.
+  RateLimiter::Clock::time_point At(int ms) {
+    return start + std::chrono::milliseconds(ms);
+  }
+
+  RateLimiter limiter;
+  RateLimiter::Clock::time_point start{RateLimiter::Clock::now()};
+};
+
+TEST_F(RateLimiterEnv, NoLimitTest) {
+  for (int i = 0; i < 100; i++) {
+    EXPECT_TRUE(limiter.Allow(1000000, At(0)));
+  }
+  EXPECT_EQ(limiter.GetSkippedArrays(), 0u);
+}
+
+TEST_F(RateLimiterEnv, SettersTest) {
+  EXPECT_FALSE(limiter.SetMaxArrayRate(-1.0));
+  EXPECT_FALSE(limiter.SetMaxDataRate(-1.0));
+  EXPECT_FALSE(limiter.SetDecimation(0));
+  EXPECT_TRUE(limiter.SetMaxArrayRate(10.0));
+  EXPECT_TRUE(limiter.SetMaxDataRate(1e6));
+  EXPECT_TRUE(limiter.SetDecimation(2));
+  EXPECT_EQ(limiter.GetMaxArrayRate(), 10.0);
+  EXPECT_EQ(limiter.GetMaxDataRate(), 1e6);
+  EXPECT_EQ(limiter.GetDecimation(), 2);
+}
+
+TEST_F(RateLimiterEnv, DecimationTest) {
+  ASSERT_TRUE(limiter.SetDecimation(3));
+  int sent = 0;
+  for (int i = 0; i < 9; i++) {
+    bool allowed = limiter.Allow(1, At(i));
+    EXPECT_EQ(allowed, 0 == i % 3);
+    sent += allowed ? 1 : 0;
+  }
+  EXPECT_EQ(sent, 3);
+  EXPECT_EQ(limiter.GetSkippedArrays(), 6u);
+}
+
+TEST_F(RateLimiterEnv, ArrayRateTest) {
+  ASSERT_TRUE(limiter.SetMaxArrayRate(10.0));
+  // A burst of up to one second worth of arrays
+  int sent = 0;
+  for (int i = 0; i < 20; i++) {
+    sent += limiter.Allow(1, At(0)) ? 1 : 0;
+  }
+  EXPECT_EQ(sent, 10);
+  // Then 10 arrays per second
+  EXPECT_FALSE(limiter.Allow(1, At(50)));
+  EXPECT_TRUE(limiter.Allow(1, At(100)));
+  EXPECT_FALSE(limiter.Allow(1, At(150)));
+  EXPECT_EQ(limiter.GetSkippedArrays(), 12u);
+}
+
+TEST_F(RateLimiterEnv, DataRateTest) {
+  ASSERT_TRUE(limiter.SetMaxDataRate(1000.0));
+  EXPECT_TRUE(limiter.Allow(600, At(0)));
+  EXPECT_FALSE(limiter.Allow(600, At(0)));
+  EXPECT_TRUE(limiter.Allow(600, At(200)));
+  // Arrays larger than the bucket are sent once it is full
+  EXPECT_FALSE(limiter.Allow(5000, At(1000)));
+  EXPECT_TRUE(limiter.Allow(5000, At(1200)));
+  // Until the debt has been paid
+  EXPECT_FALSE(limiter.Allow(1, At(5000)));
+  EXPECT_TRUE(limiter.Allow(1, At(5300)));
+}
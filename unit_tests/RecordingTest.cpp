@@ -0,0 +1,200 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  RecordingTest.cpp
+ *  @brief Unit tests of the recording and replay of serialized NDArrays.
+ */
+
+#include "Recording.h"
+#include <ciso646>
+#include <cstdio>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using namespace KafkaInterface;
+
+/// @brief A testing fixture used for setting up unit tests.
+class RecordingEnv : public ::testing::Test {
+public:
+  virtual void SetUp() {
+    recordingPath = std::string(TEST_DATA_PATH) + "recording_test";
+    RemoveRecording();
+  };
+
+  virtual void TearDown() { RemoveRecording(); };
+
+  void RemoveRecording() {
+    std::remove((recordingPath + ".index").c_str());
+    for (int i = 0; i < 10; i++) {
+      char number[16];
+      std::snprintf(number, sizeof(number), ".%06d", i);
+      std::remove((recordingPath + number).c_str());
+    }
+  }
+
+  /// @brief Records 10 messages of 100 + 10 * i bytes, with frame ids 10 *
+  /// i and timestamps 1000 + 100 * i.
+  void Record(std::uint64_t segmentSize) {
+    RecordingWriter writer;
+    ASSERT_TRUE(writer.Open(recordingPath, segmentSize));
+    for (int i = 0; i < 10; i++) {
+      auto payload = Payload(i);
+      ASSERT_TRUE(writer.Append(payload.data(), payload.size(),
+                                1000 + 100 * i, 10 * i));
+    }
+    ASSERT_EQ(writer.GetRecords(), 10u);
+  }
+
+  static std::vector<unsigned char> Payload(int message) {
+    std::vector<unsigned char> payload(100 + 10 * message);
+    for (size_t i = 0; i < payload.size(); i++) {
+      payload[i] = static_cast<unsigned char>(message + i);
+    }
+    return payload;
+  }
+
+  static bool IsMessage(std::unique_ptr<TransportMessage> const &message,
+                        int expected) {
+    auto payload = Payload(expected);
+    return nullptr != message and message->size() == payload.size() and
+           0 == std::memcmp(message->GetDataPtr(), payload.data(),
+                            payload.size());
+  }
+
+  std::string recordingPath;
+};
+
+TEST_F(RecordingEnv, NotOpenTest) {
+  RecordingWriter writer;
+  ASSERT_FALSE(writer.IsOpen());
+  auto payload = Payload(0);
+  EXPECT_FALSE(writer.Append(payload.data(), payload.size(), 0, 0));
+  RecordingReader reader;
+  EXPECT_FALSE(reader.Open(recordingPath));
+  EXPECT_FALSE(reader.IsOpen());
+  EXPECT_EQ(reader.GetMessage(0), nullptr);
+}
+
+TEST_F(RecordingEnv, ReadBackTest) {
+  Record(100000);
+  RecordingReader reader;
+  ASSERT_TRUE(reader.Open(recordingPath));
+  ASSERT_EQ(reader.GetRecords(), 10u);
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(IsMessage(reader.GetMessage(i), i));
+    EXPECT_EQ(reader.GetEntry(i).frameId, 10 * i);
+    EXPECT_EQ(reader.GetEntry(i).timestamp, 1000 + 100 * i);
+  }
+  EXPECT_EQ(reader.GetMessage(10), nullptr);
+}
+
+TEST_F(RecordingEnv, SeveralSegmentsTest) {
+  // Room for two or three messages per segment
+  Record(400);
+  RecordingReader reader;
+  ASSERT_TRUE(reader.Open(recordingPath));
+  ASSERT_EQ(reader.GetRecords(), 10u);
+  EXPECT_GT(reader.GetEntry(9).segment, 2u);
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(IsMessage(reader.GetMessage(i), i));
+  }
+}
+
+TEST_F(RecordingEnv, MessageLargerThanSegmentTest) {
+  Record(50);
+  RecordingReader reader;
+  ASSERT_TRUE(reader.Open(recordingPath));
+  ASSERT_EQ(reader.GetRecords(), 10u);
+  EXPECT_EQ(reader.GetEntry(9).segment, 9u);
+  EXPECT_TRUE(IsMessage(reader.GetMessage(9), 9));
+}
+
+TEST_F(RecordingEnv, ZeroCopyTest) {
+  Record(100000);
+  std::unique_ptr<TransportMessage> message;
+  {
+    RecordingReader reader;
+    ASSERT_TRUE(reader.Open(recordingPath));
+    auto first = reader.GetMessage(0);
+    auto second = reader.GetMessage(1);
+    // The messages point into the same mapping
+    EXPECT_EQ(reinterpret_cast<unsigned char *>(second->GetDataPtr()) -
+                  reinterpret_cast<unsigned char *>(first->GetDataPtr()),
+              104);
+    message = reader.GetMessage(3);
+  }
+  // The mapping is kept for as long as the message exists
+  EXPECT_TRUE(IsMessage(message, 3));
+}
+
+TEST_F(RecordingEnv, MissingSegmentTest) {
+  Record(400);
+  std::remove((recordingPath + ".000002").c_str());
+  RecordingReader reader;
+  ASSERT_TRUE(reader.Open(recordingPath));
+  ASSERT_GT(reader.GetRecords(), 0u);
+  ASSERT_LT(reader.GetRecords(), 10u);
+  EXPECT_EQ(reader.GetEntry(reader.GetRecords() - 1).segment, 1u);
+}
+
+TEST_F(RecordingEnv, FindTest) {
+  Record(100000);
+  RecordingReader reader;
+  ASSERT_TRUE(reader.Open(recordingPath));
+  EXPECT_EQ(reader.FindFrame(0), 0u);
+  EXPECT_EQ(reader.FindFrame(30), 3u);
+  EXPECT_EQ(reader.FindFrame(31), 4u);
+  EXPECT_EQ(reader.FindFrame(1000), 10u);
+  EXPECT_EQ(reader.FindTime(0), 0u);
+  EXPECT_EQ(reader.FindTime(1250), 3u);
+  EXPECT_EQ(reader.FindTime(5000), 10u);
+}
+
+TEST_F(RecordingEnv, ReplayTest) {
+  Record(400);
+  RecordingConsumer consumer(recordingPath);
+  ASSERT_TRUE(consumer.IsOpen());
+  EXPECT_EQ(consumer.ReceiveMessage(0), nullptr);
+  consumer.StartConsumption();
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(IsMessage(consumer.ReceiveMessage(0), i));
+  }
+  EXPECT_EQ(consumer.GetPosition(), 10u);
+  EXPECT_EQ(consumer.ReceiveMessage(0), nullptr);
+}
+
+TEST_F(RecordingEnv, LoopTest) {
+  Record(100000);
+  RecordingConsumer consumer(recordingPath);
+  consumer.StartConsumption();
+  consumer.SetLoop(true);
+  for (int i = 0; i < 25; i++) {
+    EXPECT_TRUE(IsMessage(consumer.ReceiveMessage(0), i % 10));
+  }
+}
+
+TEST_F(RecordingEnv, SeekTest) {
+  Record(100000);
+  RecordingConsumer consumer(recordingPath);
+  consumer.StartConsumption();
+  ASSERT_TRUE(consumer.SeekFrame(55));
+  EXPECT_TRUE(IsMessage(consumer.ReceiveMessage(0), 6));
+  ASSERT_TRUE(consumer.SeekTime(0.2));
+  EXPECT_TRUE(IsMessage(consumer.ReceiveMessage(0), 2));
+  EXPECT_FALSE(consumer.SeekFrame(1000));
+  EXPECT_FALSE(consumer.SeekTime(10.0));
+  EXPECT_TRUE(IsMessage(consumer.ReceiveMessage(0), 3));
+}
+
+TEST_F(RecordingEnv, NewRecordingTest) {
+  Record(400);
+  RecordingWriter writer;
+  ASSERT_TRUE(writer.Open(recordingPath, 100000));
+  auto payload = Payload(7);
+  ASSERT_TRUE(writer.Append(payload.data(), payload.size(), 0, 0));
+  RecordingReader reader;
+  ASSERT_TRUE(reader.Open(recordingPath));
+  ASSERT_EQ(reader.GetRecords(), 1u);
+  EXPECT_TRUE(IsMessage(reader.GetMessage(0), 7));
+}
@@ -0,0 +1,175 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  SerializerBenchmark.cpp
+ *  @brief Benchmarks of NDArraySerializer::SerializeData() and
+ * DeSerializeData() for different data types, frame sizes, dimensions and
+ * numbers of attributes.
+ *
+ * The benchmark names are made up of the operation followed by the index of
+ * the data type, the frame size in bytes, the number of dimensions and the
+ * number of attributes, e.g. "BM_SerializeData/type:3/bytes:1048576/dims:2/
+ * attributes:10". The name of the data type is given as label. The time per
+ * iteration is the time per frame in ns, "bytes_per_second" is the
+ * throughput in array data and "message_bytes" the size of the serialized
+ * frame. Use
+ * `--benchmark_format=json` or `--benchmark_out=<file>` for JSON output.
+ */
+
+#include "GenerateNDArray.h"
+#include "NDArrayDeSerializer.h"
+#include "NDArraySerializer.h"
+#include <benchmark/benchmark.h>
+#include <ciso646>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+struct DataType {
+  NDDataType_t type;
+  const char *name;
+  size_t size;
+};
+
+const std::vector<DataType> dataTypes = {
+    {NDInt8, "int8", 1},       {NDUInt8, "uint8", 1},
+    {NDInt16, "int16", 2},     {NDUInt16, "uint16", 2},
+    {NDInt32, "int32", 4},     {NDUInt32, "uint32", 4},
+    {NDFloat32, "float32", 4}, {NDFloat64, "float64", 8}};
+
+const int defaultType = 3; // uint16
+const std::int64_t defaultBytes = 1 << 20;
+const int defaultDims = 2;
+
+/** @brief Returns the size of the first dimension for which an array
+ * generated by NDArrayGenerator::GenerateNDArray() has at most the given
+ * number of elements. The other dimensions are 2, 4, etc. larger.
+ */
+size_t FirstDimension(size_t elements, int dims) {
+  auto arrayElements = [dims](size_t first) {
+    size_t result = first;
+    for (int k = 1; k < dims; k++) {
+      result *= first + k * 2;
+    }
+    return result;
+  };
+  size_t first = static_cast<size_t>(
+      std::ceil(std::pow(static_cast<double>(elements), 1.0 / dims)));
+  while (first > 1 and arrayElements(first) > elements) {
+    first--;
+  }
+  return first;
+}
+
+/** @brief Adds attributes named "attr_0", "attr_1", etc. to an array, cycling
+ * through integer, floating point and string values.
+ * The attributes of NDArrayGenerator::GenerateNDArray() have random unique
+ * names, of which there are too few with the shortest name length for the
+ * larger numbers of attributes of the sweep.
+ */
+void AddAttributes(NDArray *pArray, size_t attributes) {
+  for (size_t i = 0; i < attributes; i++) {
+    std::string name = "attr_" + std::to_string(i);
+    if (0 == i % 3) {
+      epicsInt32 value = static_cast<epicsInt32>(i);
+      pArray->pAttributeList->add(name.c_str(), "Benchmark attribute",
+                                  NDAttrInt32, &value);
+    } else if (1 == i % 3) {
+      epicsFloat64 value = 0.5 * i;
+      pArray->pAttributeList->add(name.c_str(), "Benchmark attribute",
+                                  NDAttrFloat64, &value);
+    } else {
+      std::string value = "value_" + std::to_string(i);
+      pArray->pAttributeList->add(name.c_str(), "Benchmark attribute",
+                                  NDAttrString,
+                                  const_cast<char *>(value.c_str()));
+    }
+  }
+}
+
+/** @brief Generates the array described by the benchmark arguments: data type
+ * index, frame size in bytes, number of dimensions and number of attributes.
+ * @note The caller must release the array.
+ */
+NDArray *GenerateArray(benchmark::State &state, NDArrayGenerator &generator) {
+  DataType const &dataType = dataTypes.at(state.range(0));
+  size_t elements = state.range(1) / dataType.size;
+  int dims = static_cast<int>(state.range(2));
+  NDArray *pArray = generator.GenerateNDArray(
+      0, FirstDimension(elements, dims), dims, dataType.type);
+  AddAttributes(pArray, state.range(3));
+  return pArray;
+}
+
+/// @brief Adds the counters common to all the benchmarks.
+void SetCounters(benchmark::State &state, NDArray *pArray,
+                 size_t messageBytes) {
+  NDArrayInfo_t info;
+  pArray->getInfo(&info);
+  state.SetBytesProcessed(state.iterations() * info.totalBytes);
+  state.counters["frame_bytes"] = info.totalBytes;
+  state.counters["message_bytes"] = messageBytes;
+  state.counters["attributes"] = pArray->pAttributeList->count();
+  state.SetLabel(dataTypes.at(state.range(0)).name);
+}
+
+void BM_SerializeData(benchmark::State &state) {
+  NDArrayGenerator generator;
+  NDArray *pArray = GenerateArray(state, generator);
+  NDArraySerializer serializer;
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize = 0;
+  std::uint64_t sequenceNumber = 1;
+  for (auto _ : state) {
+    serializer.SerializeData(*pArray, bufferPtr, bufferSize, sequenceNumber++);
+    benchmark::DoNotOptimize(bufferPtr);
+  }
+  SetCounters(state, pArray, bufferSize);
+  pArray->release();
+}
+
+void BM_DeSerializeData(benchmark::State &state) {
+  NDArrayGenerator generator;
+  NDArray *pArray = GenerateArray(state, generator);
+  NDArraySerializer serializer;
+  unsigned char *bufferPtr = nullptr;
+  size_t bufferSize = 0;
+  serializer.SerializeData(*pArray, bufferPtr, bufferSize);
+  NDArrayPool pool(nullptr, 0);
+  for (auto _ : state) {
+    NDArray *pRecvArray = nullptr;
+    DeSerializeData(&pool, bufferPtr, pRecvArray);
+    benchmark::DoNotOptimize(pRecvArray);
+    pRecvArray->release();
+  }
+  SetCounters(state, pArray, bufferSize);
+  pArray->release();
+}
+
+/** @brief Sweeps the data types and frame sizes (1 kB to 64 MB), then the
+ * dimensions and the number of attributes of a 1 MB uint16 frame.
+ * The sweeps share the 1 MB uint16 frame with 2 dimensions and no attributes.
+ */
+void Sweep(benchmark::internal::Benchmark *bench) {
+  bench->ArgNames({"type", "bytes", "dims", "attributes"});
+  for (size_t type = 0; type < dataTypes.size(); type++) {
+    for (std::int64_t bytes = 1 << 10; bytes <= 1 << 26; bytes *= 4) {
+      bench->Args({static_cast<std::int64_t>(type), bytes, defaultDims, 0});
+    }
+  }
+  for (int dims : {1, 3}) {
+    bench->Args({defaultType, defaultBytes, dims, 0});
+  }
+  for (int attributes : {1, 10, 50, 200}) {
+    bench->Args({defaultType, defaultBytes, defaultDims, attributes});
+  }
+  bench->Unit(benchmark::kNanosecond);
+  bench->UseRealTime();
+}
+} // namespace
+
+BENCHMARK(BM_SerializeData)->Apply(Sweep);
+BENCHMARK(BM_DeSerializeData)->Apply(Sweep);
+
+BENCHMARK_MAIN();
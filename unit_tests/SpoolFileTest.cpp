@@ -0,0 +1,181 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  SpoolFileTest.cpp
+ *  @brief Unit tests of the memory mapped spool file.
+ */
+
+#include "SpoolFile.h"
+#include <ciso646>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using KafkaInterface::MessageHeaders;
+using KafkaInterface::SpoolFile;
+
+/// @brief A testing fixture used for setting up unit tests.
+class SpoolFileEnv : public ::testing::Test {
+public:
+  virtual void SetUp() {
+    spoolPath = std::string(TEST_DATA_PATH) + "spool_test.data";
+    std::remove(spoolPath.c_str());
+    for (int i = 0; i < 1000; i++) {
+      payload.push_back(static_cast<unsigned char>(i));
+    }
+  };
+
+  virtual void TearDown() { std::remove(spoolPath.c_str()); };
+
+  std::string spoolPath;
+  std::vector<unsigned char> payload;
+  const unsigned char *recvPtr{nullptr};
+  size_t recvSize{0};
+  std::int64_t recvTimestamp{0};
+  MessageHeaders recvHeaders;
+};
+
+TEST_F(SpoolFileEnv, NotOpenTest) {
+  SpoolFile spool;
+  ASSERT_FALSE(spool.IsOpen());
+  ASSERT_TRUE(spool.Empty());
+  ASSERT_FALSE(spool.Append(payload.data(), payload.size(), 0, {}));
+  ASSERT_FALSE(spool.Front(recvPtr, recvSize, recvTimestamp, recvHeaders));
+}
+
+TEST_F(SpoolFileEnv, TooSmallTest) {
+  SpoolFile spool;
+  ASSERT_FALSE(spool.Open(spoolPath, 10));
+  ASSERT_FALSE(spool.IsOpen());
+}
+
+TEST_F(SpoolFileEnv, NoSpaceTest) {
+  // Far larger than the disk, opening must fail rather than a later write
+  SpoolFile spool;
+  ASSERT_FALSE(spool.Open(spoolPath, std::uint64_t(1) << 50));
+  ASSERT_FALSE(spool.IsOpen());
+}
+
+TEST_F(SpoolFileEnv, AppendAndPopTest) {
+  SpoolFile spool;
+  ASSERT_TRUE(spool.Open(spoolPath, 10000));
+  ASSERT_TRUE(spool.Empty());
+  MessageHeaders usedHeaders = {{"uniqueId", "42"}, {"dims", "10x20"}};
+  ASSERT_TRUE(spool.Append(payload.data(), payload.size(), 123, usedHeaders));
+  ASSERT_TRUE(spool.Append(payload.data(), 10, 456, {}));
+  ASSERT_EQ(spool.GetMessages(), 2u);
+  ASSERT_GT(spool.GetFillLevel(), 0);
+
+  ASSERT_TRUE(spool.Front(recvPtr, recvSize, recvTimestamp, recvHeaders));
+  ASSERT_EQ(recvSize, payload.size());
+  ASSERT_EQ(recvTimestamp, 123);
+  ASSERT_EQ(recvHeaders, usedHeaders);
+  ASSERT_EQ(std::vector<unsigned char>(recvPtr, recvPtr + recvSize), payload);
+  spool.PopFront();
+
+  ASSERT_TRUE(spool.Front(recvPtr, recvSize, recvTimestamp, recvHeaders));
+  ASSERT_EQ(recvSize, 10u);
+  ASSERT_EQ(recvTimestamp, 456);
+  ASSERT_TRUE(recvHeaders.empty());
+  spool.PopFront();
+
+  ASSERT_TRUE(spool.Empty());
+  ASSERT_EQ(spool.GetMessages(), 0u);
+  ASSERT_EQ(spool.GetFillLevel(), 0);
+}
+
+TEST_F(SpoolFileEnv, FullTest) {
+  SpoolFile spool;
+  ASSERT_TRUE(spool.Open(spoolPath, 4000));
+  int appended = 0;
+  while (spool.Append(payload.data(), payload.size(), 0, {})) {
+    ++appended;
+  }
+  ASSERT_EQ(appended, 3);
+  ASSERT_GT(spool.GetFillLevel(), 70);
+  // The space of a removed message is re-used at once
+  spool.PopFront();
+  ASSERT_TRUE(spool.Append(payload.data(), payload.size(), 0, {}));
+  ASSERT_FALSE(spool.Append(payload.data(), payload.size(), 0, {}));
+  ASSERT_EQ(spool.GetMessages(), 3u);
+}
+
+TEST_F(SpoolFileEnv, WrapAroundTest) {
+  SpoolFile spool;
+  ASSERT_TRUE(spool.Open(spoolPath, 4000));
+  std::int64_t nextAppended = 0;
+  std::int64_t nextRemoved = 0;
+  // Keep the spool nearly full for several turns around the file
+  for (int i = 0; i < 20; i++) {
+    while (spool.Append(payload.data(), payload.size(), nextAppended,
+                        {{"turn", std::to_string(i)}})) {
+      ++nextAppended;
+    }
+    ASSERT_TRUE(spool.Front(recvPtr, recvSize, recvTimestamp, recvHeaders));
+    ASSERT_EQ(recvTimestamp, nextRemoved);
+    ASSERT_EQ(std::vector<unsigned char>(recvPtr, recvPtr + recvSize),
+              payload);
+    spool.PopFront();
+    ++nextRemoved;
+  }
+  ASSERT_GT(nextAppended, 20);
+  while (spool.Front(recvPtr, recvSize, recvTimestamp, recvHeaders)) {
+    ASSERT_EQ(recvTimestamp, nextRemoved);
+    spool.PopFront();
+    ++nextRemoved;
+  }
+  ASSERT_EQ(nextRemoved, nextAppended);
+  ASSERT_TRUE(spool.Empty());
+  ASSERT_EQ(spool.GetFillLevel(), 0);
+}
+
+TEST_F(SpoolFileEnv, ReopenWrappedTest) {
+  {
+    SpoolFile spool;
+    ASSERT_TRUE(spool.Open(spoolPath, 4000));
+    for (int i = 0; i < 3; i++) {
+      ASSERT_TRUE(spool.Append(payload.data(), payload.size(), i, {}));
+    }
+    spool.PopFront();
+    ASSERT_TRUE(spool.Append(payload.data(), payload.size(), 3, {}));
+  }
+  {
+    SpoolFile spool;
+    ASSERT_TRUE(spool.Open(spoolPath, 4000));
+    ASSERT_EQ(spool.GetMessages(), 3u);
+    ASSERT_TRUE(spool.Front(recvPtr, recvSize, recvTimestamp, recvHeaders));
+    ASSERT_EQ(recvTimestamp, 1);
+  }
+  // A wrapped spool can not be resized without moving the messages
+  SpoolFile spool;
+  ASSERT_TRUE(spool.Open(spoolPath, 8000));
+  ASSERT_TRUE(spool.Empty());
+}
+
+TEST_F(SpoolFileEnv, ReopenKeepsMessagesTest) {
+  {
+    SpoolFile spool;
+    ASSERT_TRUE(spool.Open(spoolPath, 100000));
+    ASSERT_TRUE(spool.Append(payload.data(), payload.size(), 1, {}));
+    ASSERT_TRUE(spool.Append(payload.data(), payload.size(), 2, {}));
+    spool.PopFront();
+  }
+  SpoolFile spool;
+  ASSERT_TRUE(spool.Open(spoolPath, 200000));
+  ASSERT_EQ(spool.GetMessages(), 1u);
+  ASSERT_TRUE(spool.Front(recvPtr, recvSize, recvTimestamp, recvHeaders));
+  ASSERT_EQ(recvTimestamp, 2);
+  ASSERT_EQ(std::vector<unsigned char>(recvPtr, recvPtr + recvSize), payload);
+}
+
+TEST_F(SpoolFileEnv, ReopenTooSmallDiscardsMessagesTest) {
+  {
+    SpoolFile spool;
+    ASSERT_TRUE(spool.Open(spoolPath, 100000));
+    ASSERT_TRUE(spool.Append(payload.data(), payload.size(), 1, {}));
+    ASSERT_TRUE(spool.Append(payload.data(), payload.size(), 2, {}));
+  }
+  SpoolFile spool;
+  ASSERT_TRUE(spool.Open(spoolPath, 1500));
+  ASSERT_TRUE(spool.Empty());
+}
@@ -0,0 +1,121 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  StageTraceTest.cpp
+ *  @brief Unit tests of the timing of the stages of processing an array.
+ */
+
+#include "StageTrace.h"
+#include <algorithm>
+#include <ciso646>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+
+using namespace KafkaInterface;
+
+/// @brief Returns what StageTrace::Dump() writes.
+std::string DumpToString(StageTrace const &trace, size_t records) {
+  std::FILE *file = std::tmpfile();
+  trace.Dump(file, records);
+  std::string result(std::ftell(file), '\0');
+  std::rewind(file);
+  std::fread(&result[0], 1, result.size(), file);
+  std::fclose(file);
+  return result;
+}
+
+/// @brief Counts the lines of a string.
+size_t Lines(std::string const &text) {
+  size_t lines = 0;
+  for (auto character : text) {
+    if ('\n' == character) {
+      lines++;
+    }
+  }
+  return lines;
+}
+
+TEST(StageTraceTest, TicksPerSecondTest) {
+  // Any clock faster than 1 MHz and slower than 100 GHz will do
+  EXPECT_GT(TicksPerSecond(), 1e6);
+  EXPECT_LT(TicksPerSecond(), 1e11);
+}
+
+TEST(StageTraceTest, StageTimesTest) {
+  StageTimes times;
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  times.Mark(1);
+  times.Mark(0);
+  EXPECT_EQ(times.ticks[2], 0u);
+  EXPECT_GT(times.ticks[1], times.ticks[0]);
+  EXPECT_EQ(times.ticks[0] + times.ticks[1], times.last - times.start);
+}
+
+TEST(StageTraceTest, AverageTest) {
+  StageTrace trace("average_trace", {"first", "second"});
+  EXPECT_EQ(trace.GetStages(), 2u);
+  double ticksPerUs = TicksPerSecond() / 1e6;
+  for (int i = 0; i < 1000; i++) {
+    StageTimes times;
+    times.ticks[0] = static_cast<std::uint64_t>(10 * ticksPerUs);
+    times.ticks[1] = static_cast<std::uint64_t>(30 * ticksPerUs);
+    trace.Record(times, i);
+  }
+  EXPECT_EQ(trace.GetRecorded(), 1000u);
+  EXPECT_NEAR(trace.GetAverageUs(0), 10.0, 0.1);
+  EXPECT_NEAR(trace.GetAverageUs(1), 30.0, 0.1);
+  EXPECT_EQ(trace.GetAverageUs(3), 0.0);
+}
+
+TEST(StageTraceTest, DumpTest) {
+  StageTrace trace("dump_trace", {"first", "second"}, 10);
+  // A header, the column names and the averages
+  EXPECT_EQ(Lines(DumpToString(trace, 100)), 3u);
+  for (int i = 0; i < 5; i++) {
+    trace.Record(StageTimes(), 100 + i);
+  }
+  auto dump = DumpToString(trace, 100);
+  EXPECT_EQ(Lines(dump), 3u + 5u);
+  EXPECT_NE(dump.find("second"), std::string::npos);
+  EXPECT_NE(dump.find("104"), std::string::npos);
+  EXPECT_EQ(Lines(DumpToString(trace, 2)), 3u + 2u);
+  // The capacity is rounded up to 16
+  for (int i = 0; i < 50; i++) {
+    trace.Record(StageTimes(), i);
+  }
+  EXPECT_EQ(Lines(DumpToString(trace, 100)), 3u + 15u);
+}
+
+TEST(StageTraceTest, RegisterTest) {
+  {
+    StageTrace trace("registered_trace", {"first"});
+    auto names = StageTrace::GetNames();
+    EXPECT_NE(std::find(names.begin(), names.end(), "registered_trace"),
+              names.end());
+    std::FILE *file = std::tmpfile();
+    EXPECT_TRUE(StageTrace::Dump(file, "registered_trace", 10));
+    std::fclose(file);
+  }
+  std::FILE *file = std::tmpfile();
+  EXPECT_FALSE(StageTrace::Dump(file, "registered_trace", 10));
+  std::fclose(file);
+}
+
+TEST(StageTraceTest, ConcurrentDumpTest) {
+  StageTrace trace("concurrent_trace", {"first"}, 64);
+  std::atomic_bool done{false};
+  std::thread writer([&trace, &done]() {
+    for (int i = 0; i < 100000; i++) {
+      StageTimes times;
+      times.Mark(0);
+      trace.Record(times, i);
+    }
+    done = true;
+  });
+  while (not done) {
+    auto dump = DumpToString(trace, 64);
+    EXPECT_LE(Lines(dump), 3u + 63u);
+  }
+  writer.join();
+}
@@ -0,0 +1,132 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  StatsBenchmark.cpp
+ *  @brief Compares the time used to extract the published values from the
+ * recorded librdkafka statistics by ExtractStatistics() and by building a
+ * Json::Value tree with Json::Reader, as was done previously.
+ */
+
+#include "StatsExtractor.h"
+#include "json.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+using KafkaInterface::ExtractStatistics;
+using KafkaInterface::KafkaStatistics;
+
+namespace {
+/// @brief Extracts the values the way KafkaProducer used to.
+bool ExtractWithReader(std::string const &json, Json::Reader &reader,
+                       KafkaStatistics &stats) {
+  Json::Value root;
+  if (not reader.parse(json, root)) {
+    return false;
+  }
+  Json::Value brokers = root["brokers"];
+  stats.brokers = static_cast<int>(brokers.size());
+  stats.brokerUp = std::any_of(
+      brokers.begin(), brokers.end(), [](Json::Value const &CBrkr) {
+        return "UP" == CBrkr["state"].asString();
+      });
+  stats.messagesInQueue = root["msg_cnt"].asInt64();
+  stats.timestamp = root["ts"].asInt64();
+  stats.txMessages = root["txmsgs"].asInt64();
+  stats.txBytes = root["txmsg_bytes"].asInt64();
+  stats.queuedBytes = root["msg_size"].asInt64();
+  for (auto const &broker : brokers) {
+    if ("internal" == broker["source"].asString()) {
+      continue;
+    }
+    stats.outbufCount += broker["outbuf_cnt"].asInt64();
+    stats.rttAvg = std::max(stats.rttAvg, broker["rtt"]["avg"].asDouble());
+    stats.rttP99 = std::max(stats.rttP99, broker["rtt"]["p99"].asDouble());
+    stats.intLatencyAvg =
+        std::max(stats.intLatencyAvg, broker["int_latency"]["avg"].asDouble());
+    stats.throttleAvg =
+        std::max(stats.throttleAvg, broker["throttle"]["avg"].asDouble());
+  }
+  double batches = 0.0;
+  for (auto const &topicStats : root["topics"]) {
+    double count = topicStats["batchsize"]["cnt"].asDouble();
+    stats.batchSizeAvg += topicStats["batchsize"]["avg"].asDouble() * count;
+    stats.batchCountAvg += topicStats["batchcnt"]["avg"].asDouble() * count;
+    batches += count;
+  }
+  if (batches > 0.0) {
+    stats.batchSizeAvg /= batches;
+    stats.batchCountAvg /= batches;
+  }
+  return true;
+}
+
+/// @brief Returns true if the two methods extracted the same values.
+bool SameValues(KafkaStatistics const &a, KafkaStatistics const &b) {
+  return a.brokers == b.brokers and a.brokerUp == b.brokerUp and
+         a.messagesInQueue == b.messagesInQueue and
+         a.timestamp == b.timestamp and a.txMessages == b.txMessages and
+         a.txBytes == b.txBytes and a.queuedBytes == b.queuedBytes and
+         a.outbufCount == b.outbufCount and a.rttAvg == b.rttAvg and
+         a.rttP99 == b.rttP99 and a.intLatencyAvg == b.intLatencyAvg and
+         a.throttleAvg == b.throttleAvg and
+         a.batchSizeAvg == b.batchSizeAvg and
+         a.batchCountAvg == b.batchCountAvg;
+}
+
+/// @brief Returns the average time in microseconds of the given function.
+template <typename F> double TimeUs(int iterations, F function) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    function();
+  }
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+} // namespace
+
+/** @brief Runs the benchmark on the recorded statistics documents.
+ * The number of iterations per document can be given as the first argument.
+ */
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? std::atoi(argv[1]) : 10000;
+  if (iterations < 1) {
+    std::fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+  const char *fileNames[] = {"producer_stats.json", "consumer_stats.json"};
+  std::printf("%-22s %8s %14s %14s %8s\n", "Document", "Bytes",
+              "Json::Reader", "Extractor", "Speedup");
+  int result = 0;
+  for (auto fileName : fileNames) {
+    std::ifstream inFile(std::string(TEST_DATA_PATH) + fileName);
+    std::string json((std::istreambuf_iterator<char>(inFile)),
+                     std::istreambuf_iterator<char>());
+    Json::Reader reader;
+    KafkaStatistics readerStats, extractorStats;
+    if (json.empty() or
+        not ExtractWithReader(json, reader, readerStats) or
+        not ExtractStatistics(json.data(), json.size(), extractorStats) or
+        not SameValues(readerStats, extractorStats)) {
+      std::fprintf(stderr, "%s: Values differ or could not be parsed.\n",
+                   fileName);
+      result = 1;
+      continue;
+    }
+    double readerUs = TimeUs(iterations, [&]() {
+      KafkaStatistics stats;
+      ExtractWithReader(json, reader, stats);
+    });
+    double extractorUs = TimeUs(iterations, [&]() {
+      KafkaStatistics stats;
+      ExtractStatistics(json.data(), json.size(), stats);
+    });
+    std::printf("%-22s %8zu %11.2f us %11.2f us %7.1fx\n", fileName,
+                json.size(), readerUs, extractorUs, readerUs / extractorUs);
+  }
+  return result;
+}
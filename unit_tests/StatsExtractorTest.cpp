@@ -0,0 +1,119 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  StatsExtractorTest.cpp
+ *  @brief Unit tests of the extraction of values from the librdkafka
+ * statistics.
+ */
+
+#include "StatsExtractor.h"
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <string>
+
+using KafkaInterface::ExtractStatistics;
+using KafkaInterface::KafkaStatistics;
+
+namespace {
+/// @brief Reads one of the recorded statistics documents.
+std::string ReadStatistics(std::string const &fileName) {
+  std::ifstream inFile(std::string(TEST_DATA_PATH) + fileName);
+  return std::string(std::istreambuf_iterator<char>(inFile),
+                     std::istreambuf_iterator<char>());
+}
+
+bool Extract(std::string const &json, KafkaStatistics &stats) {
+  return ExtractStatistics(json.data(), json.size(), stats);
+}
+} // namespace
+
+TEST(StatsExtractor, ProducerStatisticsTest) {
+  std::string json = ReadStatistics("producer_stats.json");
+  ASSERT_FALSE(json.empty());
+  KafkaStatistics stats;
+  ASSERT_TRUE(Extract(json, stats));
+  EXPECT_EQ(stats.brokers, 3);
+  EXPECT_TRUE(stats.brokerUp);
+  EXPECT_EQ(stats.messagesInQueue, 2);
+  EXPECT_EQ(stats.timestamp, 5016483227792);
+  EXPECT_EQ(stats.txMessages, 22504);
+  EXPECT_EQ(stats.txBytes, 18641722336);
+  EXPECT_EQ(stats.queuedBytes, 2097152);
+  EXPECT_EQ(stats.outbufCount, 2);
+  EXPECT_DOUBLE_EQ(stats.rttAvg, 1872.0);
+  EXPECT_DOUBLE_EQ(stats.rttP99, 4118.0);
+  EXPECT_DOUBLE_EQ(stats.intLatencyAvg, 640.0);
+  EXPECT_DOUBLE_EQ(stats.throttleAvg, 0.0);
+  EXPECT_DOUBLE_EQ(stats.batchSizeAvg,
+                   (828224.0 * 2251 + 65536.0 * 250) / 2501);
+  EXPECT_DOUBLE_EQ(stats.batchCountAvg, (10.0 * 2251 + 1.0 * 250) / 2501);
+}
+
+TEST(StatsExtractor, ConsumerStatisticsTest) {
+  std::string json = ReadStatistics("consumer_stats.json");
+  ASSERT_FALSE(json.empty());
+  KafkaStatistics stats;
+  ASSERT_TRUE(Extract(json, stats));
+  EXPECT_EQ(stats.brokers, 3);
+  EXPECT_TRUE(stats.brokerUp);
+  EXPECT_EQ(stats.messagesInQueue, 0);
+  EXPECT_DOUBLE_EQ(stats.rttAvg, 52110.0);
+  EXPECT_DOUBLE_EQ(stats.batchSizeAvg, 0.0);
+}
+
+TEST(StatsExtractor, BrokersDownTest) {
+  KafkaStatistics stats;
+  ASSERT_TRUE(Extract(R"({"brokers": {"a:9092/1": {"state": "DOWN"},
+      "b:9092/2": {"name": "UP", "state": "CONNECT"}}, "msg_cnt": -1})",
+                      stats));
+  EXPECT_EQ(stats.brokers, 2);
+  EXPECT_FALSE(stats.brokerUp);
+  EXPECT_EQ(stats.messagesInQueue, -1);
+}
+
+TEST(StatsExtractor, OnlyPublishedPathsTest) {
+  // Same keys at other levels, escaped strings and all kinds of values
+  KafkaStatistics stats;
+  ASSERT_TRUE(Extract(R"({"name": "a \"ts\" \\", "cgrp": {"ts": 5},
+      "list": [1, -2.5e3, true, false, null, {"msg_cnt": 7}, [], {}],
+      "brokers": {"b:9092/1": {"toppars": {"rtt": {"avg": 100}},
+                               "rtt": {"avg": 1.5E2}}},
+      "ts": 42})",
+                      stats));
+  EXPECT_EQ(stats.timestamp, 42);
+  EXPECT_EQ(stats.messagesInQueue, 0);
+  EXPECT_DOUBLE_EQ(stats.rttAvg, 150.0);
+  EXPECT_EQ(stats.brokers, 1);
+  EXPECT_FALSE(stats.brokerUp);
+}
+
+TEST(StatsExtractor, InvalidTest) {
+  const char *documents[] = {"",
+                             "{",
+                             R"({"ts": })",
+                             R"({"ts": 1,})",
+                             R"({"ts" 1})",
+                             R"({"ts": 1} x)",
+                             R"({"brokers": {"a": {"state": "UP})",
+                             R"([1 2])",
+                             R"({"ts": -})",
+                             R"({"ts": 1.})",
+                             R"({"ts": tru})"};
+  for (auto document : documents) {
+    KafkaStatistics stats;
+    EXPECT_FALSE(Extract(document, stats)) << document;
+  }
+  // Too deeply nested
+  KafkaStatistics stats;
+  EXPECT_FALSE(Extract(std::string(100, '[') + std::string(100, ']'), stats));
+  EXPECT_TRUE(Extract(std::string(10, '[') + std::string(10, ']'), stats));
+}
+
+TEST(StatsExtractor, NotNullTerminatedTest) {
+  // The digits after the end of the document are not part of the number
+  std::string json = R"({"ts": 12}345)";
+  KafkaStatistics stats;
+  ASSERT_TRUE(ExtractStatistics(json.data(), 10, stats));
+  EXPECT_EQ(stats.timestamp, 12);
+  EXPECT_FALSE(ExtractStatistics(json.data(), 9, stats));
+}
@@ -0,0 +1,333 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ThroughputHarness.cpp
+ *  @brief Measures the throughput and latency of the whole path from
+ * KafkaPlugin::processCallbacks() to the NDArray callbacks of KafkaDriver,
+ * without any hardware or external Kafka broker.
+ *
+ * Synthetic uint16 frames are passed to a KafkaPlugin at a fixed rate. The
+ * plugin sends them to a KafkaDriver through the mock Kafka cluster built
+ * into librdkafka (or through an external broker or the "Local" back-end),
+ * and the driver passes them on to a sink plugin which records the time
+ * every frame took from the plugin to the sink. The frames sent while the
+ * consumer is connecting are not counted.
+ *
+ * Options (all optional):
+ * * `--rate <frames/s>` Rate at which frames are sent, 0 for as fast as
+ * possible. Defaults to 100.
+ * * `--seconds <s>` Time spent sending frames. Defaults to 10.
+ * * `--width <pixels>`, `--height <pixels>` Frame size. Defaults to 1024 x
+ * 1024.
+ * * `--backend <kafka|local>` Back-end of the plugin and the driver.
+ * Defaults to kafka.
+ * * `--broker <address>` Use an external broker instead of the mock cluster.
+ * * `--json` Print the results as JSON instead of text.
+ *
+ * The exit code is 1 if no frames were received.
+ */
+
+#include "ThroughputHarness.h"
+#include <NDPluginDriver.h>
+#include <algorithm>
+#include <chrono>
+#include <ciso646>
+#include <cstdio>
+#include <cstdlib>
+#include <librdkafka/rdkafka.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The mock cluster was added in librdkafka 1.4.0
+#if RD_KAFKA_VERSION >= 0x010400ff
+#include <librdkafka/rdkafka_mock.h>
+#define HAVE_MOCK_CLUSTER
+#endif
+
+void WriteInt32(asynPortDriver &port, int reason, epicsInt32 value) {
+  auto pasynUser = pasynManager->createAsynUser(nullptr, nullptr);
+  pasynUser->reason = reason;
+  port.lock();
+  port.writeInt32(pasynUser, value);
+  port.unlock();
+  pasynManager->freeAsynUser(pasynUser);
+}
+
+namespace {
+const char *harnessTopic = "throughput_harness";
+const char *driverPort = "HARNESS_DRIVER";
+
+/// @brief Seconds on the steady clock, sent with every frame as its timestamp.
+double SteadySeconds() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/** @brief Receives the arrays from the driver in blocking mode and records
+ * their latency, i.e. the time since their timestamp.
+ */
+class SinkPlugin : public NDPluginDriver {
+public:
+  SinkPlugin()
+      : NDPluginDriver("HARNESS_SINK", 10, 1, driverPort, 0, 1, 2, 0,
+                       asynGenericPointerMask, asynGenericPointerMask, 0, 1,
+                       0, 0, 1) {}
+
+  /// @brief Connects the plugin to the NDArray callbacks of the driver.
+  void EnableCallbacks() {
+    WriteInt32(*this, NDPluginDriverEnableCallbacks, 1);
+  }
+
+  void processCallbacks(NDArray *pArray) override {
+    NDPluginDriver::beginProcessCallbacks(pArray);
+    double now = SteadySeconds();
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (pArray->uniqueId < firstId) {
+      return;
+    }
+    latencies.push_back(now - pArray->timeStamp);
+    lastReceived = now;
+  }
+
+  /// @brief Only counts arrays with at least the given unique id from now on.
+  void Reset(int firstUniqueId) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    firstId = firstUniqueId;
+    latencies.clear();
+  }
+
+  size_t GetReceived() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return latencies.size();
+  }
+
+  std::mutex statsMutex;
+  int firstId{0};
+  std::vector<double> latencies;
+  double lastReceived{0.0};
+};
+
+struct Options {
+  double rate{100.0};
+  double seconds{10.0};
+  size_t width{1024};
+  size_t height{1024};
+  bool localBackend{false};
+  std::string broker;
+  bool json{false};
+};
+
+bool ParseOptions(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; i++) {
+    std::string option = argv[i];
+    if ("--json" == option) {
+      options.json = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string value = argv[++i];
+    if ("--rate" == option) {
+      options.rate = std::atof(value.c_str());
+    } else if ("--seconds" == option) {
+      options.seconds = std::atof(value.c_str());
+    } else if ("--width" == option) {
+      options.width = std::strtoul(value.c_str(), nullptr, 10);
+    } else if ("--height" == option) {
+      options.height = std::strtoul(value.c_str(), nullptr, 10);
+    } else if ("--backend" == option and
+               ("kafka" == value or "local" == value)) {
+      options.localBackend = "local" == value;
+    } else if ("--broker" == option) {
+      options.broker = value;
+    } else {
+      return false;
+    }
+  }
+  return options.rate >= 0.0 and options.seconds > 0.0 and
+         options.width > 0 and options.height > 0;
+}
+
+/// @brief Returns the given percentile of sorted values.
+double Percentile(std::vector<double> const &sorted, double percentile) {
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  size_t index = static_cast<size_t>(percentile / 100.0 * (sorted.size() - 1));
+  return sorted[index];
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (not ParseOptions(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "Usage: %s [--rate frames/s] [--seconds s] [--width pixels] "
+                 "[--height pixels] [--backend kafka|local] "
+                 "[--broker address] [--json]\n",
+                 argv[0]);
+    return 1;
+  }
+
+  std::string brokerAddress = options.broker;
+#ifdef HAVE_MOCK_CLUSTER
+  rd_kafka_t *mockHandle = nullptr;
+  if (brokerAddress.empty() and not options.localBackend) {
+    char errstr[512];
+    mockHandle = rd_kafka_new(RD_KAFKA_PRODUCER, rd_kafka_conf_new(), errstr,
+                              sizeof(errstr));
+    rd_kafka_mock_cluster_t *cluster =
+        nullptr == mockHandle ? nullptr
+                              : rd_kafka_mock_cluster_new(mockHandle, 1);
+    if (nullptr == cluster) {
+      std::fprintf(stderr, "Unable to create mock Kafka cluster.\n");
+      return 1;
+    }
+    rd_kafka_mock_topic_create(cluster, harnessTopic, 1, 1);
+    brokerAddress = rd_kafka_mock_cluster_bootstraps(cluster);
+  }
+#endif
+  if (brokerAddress.empty() and not options.localBackend) {
+    std::fprintf(stderr, "The mock Kafka cluster requires librdkafka 1.4.0 or "
+                         "later, use --broker or --backend local.\n");
+    return 1;
+  }
+  if (brokerAddress.empty()) {
+    brokerAddress = "localhost:9092";
+  }
+
+  auto source = CreateHarnessSource("HARNESS_PLUGIN", brokerAddress,
+                                    harnessTopic, options.localBackend);
+  auto receiver = CreateHarnessReceiver(driverPort, brokerAddress,
+                                        harnessTopic, options.localBackend);
+  auto sink = new SinkPlugin();
+  sink->start();
+  sink->EnableCallbacks();
+  receiver->Start();
+
+  // The same array is sent over and over with a new id and timestamp
+  NDArrayPool pool(nullptr, 0);
+  size_t dims[] = {options.width, options.height};
+  NDArray *pArray = pool.alloc(2, dims, NDUInt16, 0, nullptr);
+  if (nullptr == pArray) {
+    std::fprintf(stderr, "Unable to allocate the frame.\n");
+    return 1;
+  }
+  auto pixels = reinterpret_cast<epicsUInt16 *>(pArray->pData);
+  for (size_t i = 0; i < options.width * options.height; i++) {
+    pixels[i] = static_cast<epicsUInt16>(i);
+  }
+  NDArrayInfo_t arrayInfo;
+  pArray->getInfo(&arrayInfo);
+
+  int uniqueId = 0;
+  auto sendFrame = [&]() {
+    pArray->uniqueId = ++uniqueId;
+    pArray->timeStamp = SteadySeconds();
+    source->Send(pArray);
+  };
+  std::chrono::duration<double> period(
+      options.rate > 0.0 ? 1.0 / options.rate : 0.0);
+
+  // Send frames until the consumer is connected and receiving them
+  auto warmupEnd = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  while (0 == sink->GetReceived()) {
+    if (std::chrono::steady_clock::now() > warmupEnd) {
+      std::fprintf(stderr, "No frames received within 30 s.\n");
+      return 1;
+    }
+    sendFrame();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+  sink->Reset(uniqueId + 1);
+  std::uint64_t droppedBefore = source->GetDroppedArrays();
+  std::uint64_t lostBefore = receiver->GetLostArrays();
+
+  auto start = std::chrono::steady_clock::now();
+  double startSeconds = SteadySeconds();
+  auto end = start + std::chrono::duration_cast<
+                         std::chrono::steady_clock::duration>(
+                         std::chrono::duration<double>(options.seconds));
+  size_t sent = 0;
+  for (auto now = start; now < end; now = std::chrono::steady_clock::now()) {
+    sendFrame();
+    ++sent;
+    if (options.rate > 0.0) {
+      std::this_thread::sleep_until(
+          start + std::chrono::duration_cast<
+                      std::chrono::steady_clock::duration>(period * sent));
+    }
+  }
+  double sendSeconds = SteadySeconds() - startSeconds;
+
+  // Wait for the frames in flight, until nothing has arrived for 2 s
+  size_t received = sink->GetReceived();
+  while (received < sent) {
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+    size_t newReceived = sink->GetReceived();
+    if (newReceived == received) {
+      break;
+    }
+    received = newReceived;
+  }
+  receiver->Stop();
+  std::uint64_t dropped = source->GetDroppedArrays() - droppedBefore;
+  std::uint64_t lost = receiver->GetLostArrays() - lostBefore;
+
+  std::vector<double> latencies;
+  double receiveSeconds;
+  {
+    std::lock_guard<std::mutex> lock(sink->statsMutex);
+    latencies = sink->latencies;
+    receiveSeconds = sink->lastReceived - startSeconds;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  received = latencies.size();
+  double framesPerSecond = received > 0 ? received / receiveSeconds : 0.0;
+  double megabytesPerSecond = framesPerSecond * arrayInfo.totalBytes / 1e6;
+  double ms = 1e3;
+
+  if (options.json) {
+    std::printf(
+        "{\n  \"backend\": \"%s\",\n  \"frame_bytes\": %zu,\n"
+        "  \"target_rate\": %.1f,\n  \"send_seconds\": %.3f,\n"
+        "  \"sent\": %zu,\n  \"received\": %zu,\n"
+        "  \"producer_dropped\": %llu,\n  \"lost\": %llu,\n"
+        "  \"frames_per_second\": %.1f,\n  \"mb_per_second\": %.1f,\n"
+        "  \"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+        "\"p999\": %.3f, \"max\": %.3f}\n}\n",
+        options.localBackend ? "local" : "kafka", arrayInfo.totalBytes,
+        options.rate, sendSeconds, sent, received,
+        static_cast<unsigned long long>(dropped),
+        static_cast<unsigned long long>(lost), framesPerSecond,
+        megabytesPerSecond, Percentile(latencies, 50) * ms,
+        Percentile(latencies, 90) * ms, Percentile(latencies, 99) * ms,
+        Percentile(latencies, 99.9) * ms, Percentile(latencies, 100) * ms);
+  } else {
+    std::printf("Back-end:          %s (%s)\n",
+                options.localBackend ? "local" : "kafka",
+                brokerAddress.c_str());
+    std::printf("Frame size:        %zu bytes\n", arrayInfo.totalBytes);
+    std::printf("Frames sent:       %zu in %.2f s\n", sent, sendSeconds);
+    std::printf("Frames received:   %zu\n", received);
+    std::printf("Producer dropped:  %llu\n",
+                static_cast<unsigned long long>(dropped));
+    std::printf("Lost in transport: %llu\n",
+                static_cast<unsigned long long>(lost));
+    std::printf("Throughput:        %.1f frames/s, %.1f MB/s\n",
+                framesPerSecond, megabytesPerSecond);
+    std::printf("Latency (ms):      p50 %.3f, p90 %.3f, p99 %.3f, "
+                "p99.9 %.3f, max %.3f\n",
+                Percentile(latencies, 50) * ms, Percentile(latencies, 90) * ms,
+                Percentile(latencies, 99) * ms,
+                Percentile(latencies, 99.9) * ms,
+                Percentile(latencies, 100) * ms);
+  }
+  pArray->release();
+  return received > 0 ? 0 : 1;
+}
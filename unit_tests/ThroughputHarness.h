@@ -0,0 +1,63 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ThroughputHarness.h
+ *  @brief The two ends of the throughput harness, see ThroughputHarness.cpp.
+ * The plugin and the driver are kept in separate files as their sources
+ * share header file names.
+ */
+
+#pragma once
+
+#include <asynNDArrayDriver.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/// @brief Writes an integer parameter the way the asyn port thread does.
+void WriteInt32(asynPortDriver &port, int reason, epicsInt32 value);
+
+/// @brief Passes arrays to a KafkaPlugin.
+class HarnessSource {
+public:
+  virtual ~HarnessSource() = default;
+
+  /// @brief Serializes and sends an array, as in blocking callback mode.
+  virtual void Send(NDArray *pArray) = 0;
+
+  /// @brief Number of arrays dropped by the producer so far.
+  virtual std::uint64_t GetDroppedArrays() = 0;
+};
+
+/// @brief A KafkaDriver passing the arrays received on to its plugins.
+class HarnessReceiver {
+public:
+  virtual ~HarnessReceiver() = default;
+
+  /// @brief Starts a continuous acquisition.
+  virtual void Start() = 0;
+
+  /// @brief Stops the acquisition.
+  virtual void Stop() = 0;
+
+  /// @brief Number of arrays lost in transport so far.
+  virtual std::uint64_t GetLostArrays() = 0;
+};
+
+/** @brief Creates a KafkaPlugin which is not connected to any NDArray port.
+ * @param[in] portName Port name of the plugin.
+ * @param[in] brokerAddress Address of the Kafka broker.
+ * @param[in] topic Topic the arrays are sent to.
+ * @param[in] localBackend Use the "Local" back-end instead of Kafka.
+ */
+std::unique_ptr<HarnessSource>
+CreateHarnessSource(std::string const &portName,
+                    std::string const &brokerAddress, std::string const &topic,
+                    bool localBackend);
+
+/** @brief Creates a KafkaDriver, see CreateHarnessSource() for the
+ * parameters.
+ */
+std::unique_ptr<HarnessReceiver>
+CreateHarnessReceiver(std::string const &portName,
+                      std::string const &brokerAddress,
+                      std::string const &topic, bool localBackend);
@@ -0,0 +1,52 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ThroughputReceiver.cpp
+ *  @brief The KafkaDriver end of the throughput harness.
+ */
+
+#include "KafkaDriver.h"
+#include "ThroughputHarness.h"
+
+namespace {
+class DriverReceiver : public HarnessReceiver, public KafkaDriver {
+public:
+  DriverReceiver(std::string const &portName, std::string const &brokerAddress,
+                 std::string const &topic)
+      : KafkaDriver(portName.c_str(), 0, 0, 0, 0, brokerAddress.c_str(),
+                    topic.c_str()) {
+    lock();
+    setIntegerParam(ADImageMode, ADImageContinuous);
+    setIntegerParam(NDArrayCallbacks, 1);
+    // Time out of the wait for a message, i.e. how often a stop is noticed
+    setDoubleParam(ADAcquirePeriod, 0.1);
+    unlock();
+  }
+
+  void UseLocalBackend() {
+    WriteInt32(*this, *paramsList[PV::backend_type].index,
+               static_cast<int>(KafkaInterface::TransportBackend::LOCAL));
+  }
+
+  void Start() override { WriteInt32(*this, ADAcquire, 1); }
+
+  void Stop() override { WriteInt32(*this, ADAcquire, 0); }
+
+  std::uint64_t GetLostArrays() override {
+    lock();
+    std::uint64_t arrays = lostArrays;
+    unlock();
+    return arrays;
+  }
+};
+} // namespace
+
+std::unique_ptr<HarnessReceiver>
+CreateHarnessReceiver(std::string const &portName,
+                      std::string const &brokerAddress,
+                      std::string const &topic, bool localBackend) {
+  auto receiver = new DriverReceiver(portName, brokerAddress, topic);
+  if (localBackend) {
+    receiver->UseLocalBackend();
+  }
+  return std::unique_ptr<HarnessReceiver>(receiver);
+}
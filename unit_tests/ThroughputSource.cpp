@@ -0,0 +1,48 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  ThroughputSource.cpp
+ *  @brief The KafkaPlugin end of the throughput harness.
+ */
+
+#include "KafkaPlugin.h"
+#include "ThroughputHarness.h"
+
+namespace {
+class PluginSource : public HarnessSource, public KafkaPlugin {
+public:
+  PluginSource(std::string const &portName, std::string const &brokerAddress,
+               std::string const &topic)
+      : KafkaPlugin(portName.c_str(), 10, 1, "", 0, 0, 0, 0,
+                    brokerAddress.c_str(), topic.c_str()) {}
+
+  void UseLocalBackend() {
+    WriteInt32(*this, *paramsList[PV::backend_type].index,
+               static_cast<int>(KafkaInterface::TransportBackend::LOCAL));
+  }
+
+  void Send(NDArray *pArray) override {
+    lock();
+    processCallbacks(pArray);
+    unlock();
+  }
+
+  std::uint64_t GetDroppedArrays() override {
+    lock();
+    std::uint64_t arrays = droppedArrays;
+    unlock();
+    return arrays;
+  }
+};
+} // namespace
+
+std::unique_ptr<HarnessSource>
+CreateHarnessSource(std::string const &portName,
+                    std::string const &brokerAddress, std::string const &topic,
+                    bool localBackend) {
+  auto source = new PluginSource(portName, brokerAddress, topic);
+  source->start();
+  if (localBackend) {
+    source->UseLocalBackend();
+  }
+  return std::unique_ptr<HarnessSource>(source);
+}
@@ -0,0 +1,231 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  TileAssemblerTest.cpp
+ *  @brief Unit tests of the serialization of arrays as tiles and of their
+ * assembly.
+ */
+
+#include "GenerateNDArray.h"
+#include "NDArraySerializer.h"
+#include "TileAssembler.h"
+#include <ciso646>
+#include <cmath>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+using KafkaInterface::TileAssembler;
+
+/// @brief A testing fixture used for setting up unit tests.
+class TileAssemblerEnv : public ::testing::Test {
+public:
+  virtual void SetUp() {
+    recvPool.reset(new NDArrayPool(nullptr, 0));
+    // 7 rows of 64 float32 elements, 256 bytes each
+    sendArr = arrGen.GenerateNDArray(2, 64, 2, NDFloat32);
+    sendArr->dims[1].size = 7;
+    NDArrayInfo_t info;
+    sendArr->getInfo(&info);
+    sendBytes = info.totalBytes;
+    ASSERT_TRUE(serializer.SetTileSize(512));
+  };
+
+  virtual void TearDown() { sendArr->release(); };
+
+  /// @brief Serializes the array as tiles and copies them.
+  void SerializeTiles() {
+    tiles.clear();
+    size_t count = serializer.SerializeTiles(*sendArr, 42, 1);
+    for (size_t i = 0; i < count; i++) {
+      unsigned char *bufferPtr;
+      size_t bufferSize;
+      serializer.GetTile(i, bufferPtr, bufferSize);
+      tiles.emplace_back(bufferPtr, bufferPtr + bufferSize);
+    }
+  }
+
+  const FB_Tables::NDArray *Tile(size_t index) {
+    return FB_Tables::GetNDArray(tiles.at(index).data());
+  }
+
+  /** @brief Adds a tile of a frame of 4 x 4 int8 elements built by hand, as
+   * the serializer only creates tiles which fit together.
+   */
+  bool AddHandMadeTile(std::uint32_t index, std::uint32_t count,
+                       std::uint64_t offset, std::uint64_t rows) {
+    auto builder = std::make_shared<flatbuffers::FlatBufferBuilder>();
+    std::vector<std::uint64_t> dims{4, rows};
+    std::vector<std::uint64_t> frameDims{4, 4};
+    std::vector<std::uint8_t> data(4 * rows, 1);
+    FB_Tables::epicsTimeStamp epicsTS(0, 0);
+    auto attributes =
+        builder->CreateVector<flatbuffers::Offset<FB_Tables::NDAttribute>>(
+            {});
+    auto tile = FB_Tables::CreateNDArray(
+        *builder, 1, 0.0, &epicsTS, builder->CreateVector(dims),
+        FB_Tables::DType_int8, builder->CreateVector(data), attributes, 1, 0,
+        FB_Tables::Encoding_dense, 0, 0, nullptr, FB_Tables::ChecksumType_none,
+        0, 0, index, count, offset, builder->CreateVector(frameDims));
+    builder->Finish(tile);
+    return assembler.AddTile(
+        FB_Tables::GetNDArray(builder->GetBufferPointer()), builder);
+  }
+
+  /// @brief Adds all tiles in the given order, returns the last result.
+  bool AddTiles(std::vector<size_t> const &order) {
+    bool complete = false;
+    for (auto index : order) {
+      complete = assembler.AddTile(Tile(index), nullptr);
+    }
+    return complete;
+  }
+
+  NDArrayGenerator arrGen;
+  std::unique_ptr<NDArrayPool> recvPool;
+  NDArray *sendArr;
+  size_t sendBytes;
+  NDArraySerializer serializer;
+  TileAssembler assembler;
+  std::vector<std::vector<std::uint8_t>> tiles;
+};
+
+TEST_F(TileAssemblerEnv, SerializeTilesTest) {
+  ASSERT_FALSE(serializer.SetTileSize(-1));
+  ASSERT_FALSE(serializer.SetTileThreads(0));
+  ASSERT_TRUE(serializer.SetTileThreads(3));
+  SerializeTiles();
+  // Two rows per tile
+  ASSERT_EQ(tiles.size(), 4u);
+  size_t offset = 0;
+  for (size_t i = 0; i < tiles.size(); i++) {
+    auto tile = Tile(i);
+    EXPECT_EQ(tile->tileIndex(), i);
+    EXPECT_EQ(tile->tileCount(), 4u);
+    EXPECT_EQ(tile->tileOffset(), offset);
+    EXPECT_EQ(tile->sequenceNumber(), 42u);
+    EXPECT_EQ(tile->id(), sendArr->uniqueId);
+    ASSERT_EQ(tile->frameDims()->size(), 2u);
+    EXPECT_EQ(tile->frameDims()->Get(1), 7u);
+    EXPECT_EQ(tile->dims()->Get(0), 64u);
+    EXPECT_EQ(tile->pAttributeList()->size(), 0 == i ? 2u : 0u);
+    offset += tile->dims()->Get(1);
+  }
+  EXPECT_EQ(offset, 7u);
+
+  // Arrays not larger than a tile are not split
+  ASSERT_TRUE(serializer.SetTileSize(static_cast<int>(sendBytes)));
+  EXPECT_EQ(serializer.SerializeTiles(*sendArr), 0u);
+  ASSERT_TRUE(serializer.SetTileSize(0));
+  EXPECT_EQ(serializer.SerializeTiles(*sendArr), 0u);
+}
+
+TEST_F(TileAssemblerEnv, AssembleTest) {
+  serializer.SetChecksum(true);
+  ASSERT_FALSE(assembler.SetThreads(0));
+  ASSERT_TRUE(assembler.SetThreads(2));
+  SerializeTiles();
+  // Tiles may arrive in any order
+  EXPECT_FALSE(AddTiles({2, 0, 3}));
+  // Duplicates are ignored
+  EXPECT_FALSE(AddTiles({0}));
+  EXPECT_TRUE(AddTiles({1}));
+  NDArray *recvArr = nullptr;
+  ASSERT_EQ(assembler.AssembleFrame(recvPool.get(), recvArr, true, true),
+            TileAssembler::FrameStatus::OK);
+  ASSERT_NE(recvArr, nullptr);
+  ASSERT_EQ(recvArr->ndims, 2);
+  EXPECT_EQ(recvArr->dims[0].size, 64u);
+  EXPECT_EQ(recvArr->dims[1].size, 7u);
+  EXPECT_EQ(recvArr->dataType, NDFloat32);
+  EXPECT_EQ(recvArr->uniqueId, sendArr->uniqueId);
+  EXPECT_EQ(recvArr->pAttributeList->count(), 2);
+  EXPECT_EQ(std::memcmp(recvArr->pData, sendArr->pData, sendBytes), 0);
+  recvArr->release();
+  EXPECT_EQ(assembler.GetIncompleteFrames(), 0u);
+}
+
+TEST_F(TileAssemblerEnv, DeltaTilesTest) {
+  // Four rows per tile
+  ASSERT_TRUE(serializer.SetTileSize(1024));
+  serializer.SetEncoding(NDArraySerializer::Encoding::DELTA);
+  serializer.SetTransportType(NDArraySerializer::TransportType::BFLOAT16);
+  auto values = static_cast<float *>(sendArr->pData);
+  NDArray *recvArr = nullptr;
+  for (int frame = 0; frame < 3; frame++) {
+    values[frame * 100] += 1.0f;
+    sendArr->uniqueId += 1;
+    SerializeTiles();
+    ASSERT_EQ(tiles.size(), 2u);
+    auto encoding = 0 == frame ? FB_Tables::Encoding_keyframe
+                               : FB_Tables::Encoding_delta;
+    EXPECT_EQ(Tile(0)->encoding(), encoding);
+    EXPECT_EQ(Tile(1)->encoding(), encoding);
+    ASSERT_TRUE(AddTiles({0, 1}));
+    ASSERT_EQ(assembler.AssembleFrame(recvPool.get(), recvArr, true, false),
+              TileAssembler::FrameStatus::OK);
+    auto recvValues = static_cast<float *>(recvArr->pData);
+    EXPECT_NEAR(recvValues[frame * 100], values[frame * 100],
+                std::fabs(values[frame * 100]) / 128);
+    recvArr->release();
+  }
+
+  // Delta encoded tiles can not be decoded without their keyframes
+  assembler.Reset();
+  sendArr->uniqueId += 1;
+  SerializeTiles();
+  ASSERT_TRUE(AddTiles({0, 1}));
+  EXPECT_EQ(assembler.AssembleFrame(recvPool.get(), recvArr, true, false),
+            TileAssembler::FrameStatus::SKIPPED);
+  EXPECT_EQ(recvArr, nullptr);
+}
+
+TEST_F(TileAssemblerEnv, TileOffsetsTest) {
+  NDArray *recvArr = nullptr;
+  // Tiles which cover every row once
+  EXPECT_FALSE(AddHandMadeTile(0, 2, 2, 2));
+  ASSERT_TRUE(AddHandMadeTile(1, 2, 0, 2));
+  ASSERT_EQ(assembler.AssembleFrame(recvPool.get(), recvArr, true, false),
+            TileAssembler::FrameStatus::OK);
+  recvArr->release();
+
+  // Overlapping tiles, although their rows add up to those of the frame
+  EXPECT_FALSE(AddHandMadeTile(0, 2, 0, 2));
+  ASSERT_TRUE(AddHandMadeTile(1, 2, 0, 2));
+  EXPECT_EQ(assembler.AssembleFrame(recvPool.get(), recvArr, true, false),
+            TileAssembler::FrameStatus::SKIPPED);
+  EXPECT_EQ(recvArr, nullptr);
+
+  // A gap and an overlap
+  EXPECT_FALSE(AddHandMadeTile(0, 3, 0, 1));
+  EXPECT_FALSE(AddHandMadeTile(1, 3, 2, 2));
+  ASSERT_TRUE(AddHandMadeTile(2, 3, 3, 1));
+  EXPECT_EQ(assembler.AssembleFrame(recvPool.get(), recvArr, true, false),
+            TileAssembler::FrameStatus::SKIPPED);
+  EXPECT_EQ(recvArr, nullptr);
+}
+
+TEST_F(TileAssemblerEnv, IncompleteFramesTest) {
+  for (int frame = 0; frame < 6; frame++) {
+    sendArr->uniqueId += 1;
+    SerializeTiles();
+    EXPECT_FALSE(AddTiles({0, 1, 2}));
+  }
+  EXPECT_EQ(assembler.GetIncompleteFrames(), 2u);
+  // The last frame is still being collected
+  EXPECT_TRUE(AddTiles({3}));
+  EXPECT_EQ(assembler.GetIncompleteFrames(), 2u);
+}
+
+TEST_F(TileAssemblerEnv, ChecksumTest) {
+  serializer.SetChecksum(true);
+  SerializeTiles();
+  // Corrupt one element of the last tile
+  auto data = const_cast<std::uint8_t *>(Tile(3)->pData()->Data());
+  data[0] ^= 1;
+  ASSERT_TRUE(AddTiles({0, 1, 2, 3}));
+  NDArray *recvArr = nullptr;
+  EXPECT_EQ(assembler.AssembleFrame(recvPool.get(), recvArr, true, true),
+            TileAssembler::FrameStatus::CHECKSUM_FAILED);
+  EXPECT_EQ(recvArr, nullptr);
+}
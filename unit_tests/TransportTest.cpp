@@ -0,0 +1,323 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  TransportTest.cpp
+ *  @brief Unit tests of the in-process and segment file transports.
+ */
+
+#include "LocalTransport.h"
+#include "SegmentTransport.h"
+#include "SharedRegistry.h"
+#include <chrono>
+#include <ciso646>
+#include <cstdio>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace KafkaInterface;
+
+namespace {
+std::vector<unsigned char> MakePayload(size_t size, unsigned char first) {
+  std::vector<unsigned char> payload(size);
+  for (size_t i = 0; i < size; i++) {
+    payload[i] = static_cast<unsigned char>(first + i);
+  }
+  return payload;
+}
+
+/// @brief Stands in for the instance of another library.
+struct SharedCounter {
+  int value{0};
+};
+SharedCounter otherLibraryCounter;
+SharedCounter *OtherLibraryCounter() { return &otherLibraryCounter; }
+
+bool PayloadEquals(TransportMessage &message,
+                   std::vector<unsigned char> const &payload) {
+  return message.size() == payload.size() and
+         0 == std::memcmp(message.GetDataPtr(), payload.data(),
+                          payload.size());
+}
+} // namespace
+
+TEST(SharedRegistry, FirstRegisteredInstanceTest) {
+  // Registered by another library first
+  registryFunctionAdd("transport_test_counter",
+                      reinterpret_cast<REGISTRYFUNCTION>(&OtherLibraryCounter));
+  EXPECT_EQ(&SharedInstance<SharedCounter>("transport_test_counter"),
+            &otherLibraryCounter);
+  // Not registered yet, the instance of this library is used
+  auto &counter = SharedInstance<SharedCounter>("transport_test_counter_2");
+  EXPECT_NE(&counter, &otherLibraryCounter);
+  EXPECT_EQ(&SharedInstance<SharedCounter>("transport_test_counter_2"),
+            &counter);
+}
+
+TEST(LocalTransport, RoundTripTest) {
+  LocalProducer producer("transport_test_round_trip");
+  LocalConsumer consumer("transport_test_round_trip");
+  consumer.StartConsumption();
+  auto first = MakePayload(100, 0);
+  auto second = MakePayload(10, 7);
+  ASSERT_TRUE(producer.SendMessage(first.data(), first.size(), 123, {}));
+  ASSERT_TRUE(producer.SendMessage(second.data(), second.size(), 0, {}));
+  auto message = consumer.ReceiveMessage(0);
+  ASSERT_NE(message, nullptr);
+  EXPECT_TRUE(PayloadEquals(*message, first));
+  EXPECT_EQ(dynamic_cast<LocalMessage &>(*message).GetTimestamp(), 123);
+  message = consumer.ReceiveMessage(0);
+  ASSERT_NE(message, nullptr);
+  EXPECT_TRUE(PayloadEquals(*message, second));
+  EXPECT_EQ(consumer.ReceiveMessage(0), nullptr);
+}
+
+TEST(LocalTransport, SeparateChannelsTest) {
+  LocalProducer producer("transport_test_channel_a");
+  LocalConsumer consumer("transport_test_channel_b");
+  consumer.StartConsumption();
+  auto payload = MakePayload(10, 0);
+  ASSERT_TRUE(producer.SendMessage(payload.data(), payload.size(), 0, {}));
+  EXPECT_EQ(consumer.ReceiveMessage(0), nullptr);
+}
+
+TEST(LocalTransport, StoppedConsumptionTest) {
+  LocalProducer producer("transport_test_stopped");
+  LocalConsumer consumer("transport_test_stopped");
+  auto payload = MakePayload(10, 0);
+  ASSERT_TRUE(producer.SendMessage(payload.data(), payload.size(), 0, {}));
+  EXPECT_EQ(consumer.ReceiveMessage(0), nullptr);
+  consumer.StartConsumption();
+  auto message = consumer.ReceiveMessage(0);
+  ASSERT_NE(message, nullptr);
+  EXPECT_TRUE(PayloadEquals(*message, payload));
+}
+
+TEST(LocalTransport, FullChannelTest) {
+  LocalChannel channel(3);
+  ASSERT_EQ(channel.GetCapacity(), 4u);
+  auto payload = MakePayload(10, 0);
+  for (size_t i = 0; i < channel.GetCapacity(); i++) {
+    std::unique_ptr<LocalMessage> message(
+        new LocalMessage(payload.data(), payload.size(), i));
+    ASSERT_TRUE(channel.Push(message));
+    ASSERT_EQ(message, nullptr);
+  }
+  std::unique_ptr<LocalMessage> message(
+      new LocalMessage(payload.data(), payload.size(), 42));
+  ASSERT_FALSE(channel.Push(message));
+  ASSERT_NE(message, nullptr);
+  EXPECT_EQ(channel.Pop(0)->GetTimestamp(), 0);
+  EXPECT_TRUE(channel.Push(message));
+}
+
+TEST(LocalTransport, TimeoutTest) {
+  LocalChannel channel(4);
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(channel.Pop(20), nullptr);
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(20));
+}
+
+TEST(LocalTransport, WakeUpTest) {
+  LocalChannel channel(4);
+  std::unique_ptr<LocalMessage> received;
+  std::thread consumerThread([&channel, &received]() {
+    received = channel.Pop(10000);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto payload = MakePayload(10, 0);
+  std::unique_ptr<LocalMessage> message(
+      new LocalMessage(payload.data(), payload.size(), 1));
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(channel.Push(message));
+  consumerThread.join();
+  ASSERT_NE(received, nullptr);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+TEST(LocalTransport, ThreadedTest) {
+  LocalChannel channel(16);
+  const int producers = 4;
+  const int messagesPerProducer = 10000;
+  std::vector<std::thread> producerThreads;
+  for (int p = 0; p < producers; p++) {
+    producerThreads.emplace_back([&channel, p]() {
+      for (int i = 0; i < messagesPerProducer; i++) {
+        int value[2] = {p, i};
+        std::unique_ptr<LocalMessage> message(new LocalMessage(
+            reinterpret_cast<unsigned char *>(value), sizeof(value), 0));
+        while (not channel.Push(message)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  std::vector<int> next(producers, 0);
+  for (int received = 0; received < producers * messagesPerProducer;
+       received++) {
+    auto message = channel.Pop(10000);
+    ASSERT_NE(message, nullptr);
+    int value[2];
+    std::memcpy(value, message->GetDataPtr(), sizeof(value));
+    // The messages of each producer are received in order
+    ASSERT_EQ(value[1], next.at(value[0]));
+    ++next[value[0]];
+  }
+  for (auto &thread : producerThreads) {
+    thread.join();
+  }
+  EXPECT_EQ(channel.Pop(0), nullptr);
+}
+
+/// @brief A testing fixture used for setting up unit tests.
+class SegmentTransportEnv : public ::testing::Test {
+public:
+  virtual void SetUp() {
+    segmentPath = std::string(TEST_DATA_PATH) + "segment_test.data";
+    std::remove(segmentPath.c_str());
+  };
+
+  virtual void TearDown() { std::remove(segmentPath.c_str()); };
+
+  std::string segmentPath;
+
+  /// @brief Room for about four messages of 1000 bytes.
+  const std::uint64_t segmentSize{64 + 4200};
+};
+
+TEST_F(SegmentTransportEnv, TooSmallTest) {
+  SegmentProducer producer;
+  ASSERT_FALSE(producer.Open(segmentPath, 100));
+  auto payload = MakePayload(10, 0);
+  EXPECT_FALSE(producer.SendMessage(payload.data(), payload.size(), 0, {}));
+}
+
+TEST_F(SegmentTransportEnv, NoFileTest) {
+  SegmentConsumer consumer(segmentPath);
+  consumer.StartConsumption();
+  EXPECT_EQ(consumer.ReceiveMessage(10), nullptr);
+}
+
+TEST_F(SegmentTransportEnv, RoundTripTest) {
+  SegmentProducer producer;
+  ASSERT_TRUE(producer.Open(segmentPath, segmentSize));
+  SegmentConsumer consumer(segmentPath);
+  consumer.StartConsumption();
+  ASSERT_EQ(consumer.ReceiveMessage(0), nullptr);
+  auto first = MakePayload(1000, 0);
+  auto second = MakePayload(3, 5);
+  ASSERT_TRUE(producer.SendMessage(first.data(), first.size(), 0, {}));
+  ASSERT_TRUE(producer.SendMessage(second.data(), second.size(), 0, {}));
+  auto message = consumer.ReceiveMessage(0);
+  ASSERT_NE(message, nullptr);
+  EXPECT_TRUE(PayloadEquals(*message, first));
+  message = consumer.ReceiveMessage(0);
+  ASSERT_NE(message, nullptr);
+  EXPECT_TRUE(PayloadEquals(*message, second));
+  EXPECT_EQ(consumer.ReceiveMessage(0), nullptr);
+}
+
+TEST_F(SegmentTransportEnv, StartsAtNewestTest) {
+  SegmentProducer producer;
+  ASSERT_TRUE(producer.Open(segmentPath, segmentSize));
+  auto payload = MakePayload(100, 0);
+  ASSERT_TRUE(producer.SendMessage(payload.data(), payload.size(), 0, {}));
+  SegmentConsumer consumer(segmentPath);
+  consumer.StartConsumption();
+  EXPECT_EQ(consumer.ReceiveMessage(0), nullptr);
+}
+
+TEST_F(SegmentTransportEnv, TooLargeMessageTest) {
+  SegmentProducer producer;
+  ASSERT_TRUE(producer.Open(segmentPath, segmentSize));
+  auto payload = MakePayload(3000, 0);
+  EXPECT_FALSE(producer.SendMessage(payload.data(), payload.size(), 0, {}));
+}
+
+TEST_F(SegmentTransportEnv, WrapAroundTest) {
+  SegmentProducer producer;
+  ASSERT_TRUE(producer.Open(segmentPath, segmentSize));
+  SegmentConsumer consumer(segmentPath);
+  consumer.StartConsumption();
+  ASSERT_EQ(consumer.ReceiveMessage(0), nullptr);
+  for (int i = 0; i < 50; i++) {
+    // Sizes which do not divide the ring evenly
+    auto payload = MakePayload(700 + 13 * i, static_cast<unsigned char>(i));
+    ASSERT_TRUE(producer.SendMessage(payload.data(), payload.size(), 0, {}));
+    auto message = consumer.ReceiveMessage(0);
+    ASSERT_NE(message, nullptr);
+    ASSERT_TRUE(PayloadEquals(*message, payload));
+  }
+}
+
+TEST_F(SegmentTransportEnv, OverrunTest) {
+  SegmentProducer producer;
+  ASSERT_TRUE(producer.Open(segmentPath, segmentSize));
+  SegmentConsumer consumer(segmentPath);
+  consumer.StartConsumption();
+  ASSERT_EQ(consumer.ReceiveMessage(0), nullptr);
+  for (int i = 0; i < 10; i++) {
+    auto payload = MakePayload(1000, static_cast<unsigned char>(i));
+    ASSERT_TRUE(producer.SendMessage(payload.data(), payload.size(), 0, {}));
+  }
+  // The overwritten messages are skipped
+  EXPECT_EQ(consumer.ReceiveMessage(0), nullptr);
+  auto payload = MakePayload(1000, 77);
+  ASSERT_TRUE(producer.SendMessage(payload.data(), payload.size(), 0, {}));
+  auto message = consumer.ReceiveMessage(0);
+  ASSERT_NE(message, nullptr);
+  EXPECT_TRUE(PayloadEquals(*message, payload));
+}
+
+TEST_F(SegmentTransportEnv, ReUseSegmentTest) {
+  auto payload = MakePayload(100, 3);
+  SegmentConsumer consumer(segmentPath);
+  consumer.StartConsumption();
+  {
+    SegmentProducer producer;
+    ASSERT_TRUE(producer.Open(segmentPath, segmentSize));
+    ASSERT_EQ(consumer.ReceiveMessage(0), nullptr);
+  }
+  // A producer using the same size continues where the previous one stopped
+  SegmentProducer producer;
+  ASSERT_TRUE(producer.Open(segmentPath, segmentSize));
+  ASSERT_TRUE(producer.SendMessage(payload.data(), payload.size(), 0, {}));
+  auto message = consumer.ReceiveMessage(0);
+  ASSERT_NE(message, nullptr);
+  EXPECT_TRUE(PayloadEquals(*message, payload));
+}
+
+TEST_F(SegmentTransportEnv, ReplacedSegmentTest) {
+  SegmentProducer producer;
+  ASSERT_TRUE(producer.Open(segmentPath, segmentSize));
+  SegmentConsumer consumer(segmentPath);
+  consumer.StartConsumption();
+  ASSERT_EQ(consumer.ReceiveMessage(0), nullptr);
+  ASSERT_TRUE(producer.Open(segmentPath, 2 * segmentSize));
+  // The consumer checks for a new file about once a second
+  EXPECT_EQ(consumer.ReceiveMessage(1500), nullptr);
+  auto payload = MakePayload(100, 3);
+  ASSERT_TRUE(producer.SendMessage(payload.data(), payload.size(), 0, {}));
+  auto message = consumer.ReceiveMessage(0);
+  ASSERT_NE(message, nullptr);
+  EXPECT_TRUE(PayloadEquals(*message, payload));
+}
+
+TEST_F(SegmentTransportEnv, StoppedConsumptionTest) {
+  SegmentProducer producer;
+  ASSERT_TRUE(producer.Open(segmentPath, segmentSize));
+  SegmentConsumer consumer(segmentPath);
+  EXPECT_EQ(consumer.ReceiveMessage(0), nullptr);
+  consumer.StartConsumption();
+  ASSERT_EQ(consumer.ReceiveMessage(0), nullptr);
+  consumer.StopConsumption();
+  auto payload = MakePayload(100, 3);
+  ASSERT_TRUE(producer.SendMessage(payload.data(), payload.size(), 0, {}));
+  EXPECT_EQ(consumer.ReceiveMessage(0), nullptr);
+  consumer.StartConsumption();
+  auto message = consumer.ReceiveMessage(0);
+  ASSERT_NE(message, nullptr);
+  EXPECT_TRUE(PayloadEquals(*message, payload));
+}
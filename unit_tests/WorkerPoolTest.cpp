@@ -0,0 +1,69 @@
+/** Copyright (C) 2017 European Spallation Source */
+
+/** @file  WorkerPoolTest.cpp
+ *  @brief Unit tests of the threads processing the tiles of an array.
+ */
+
+#include "WorkerPool.h"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace KafkaInterface;
+
+TEST(WorkerPoolTest, RunAllTasksTest) {
+  WorkerPool pool;
+  std::vector<int> calls(5, 0);
+  pool.Run(calls.size(), [&calls](size_t index) { calls[index]++; });
+  EXPECT_EQ(calls, std::vector<int>(5, 1));
+  EXPECT_EQ(pool.GetWorkers(), 4u);
+}
+
+TEST(WorkerPoolTest, SingleTaskTest) {
+  WorkerPool pool;
+  std::thread::id caller;
+  pool.Run(1, [&caller](size_t) { caller = std::this_thread::get_id(); });
+  EXPECT_EQ(caller, std::this_thread::get_id());
+  EXPECT_EQ(pool.GetWorkers(), 0u);
+}
+
+TEST(WorkerPoolTest, ThreadsAreKeptTest) {
+  WorkerPool pool;
+  std::set<std::thread::id> threads;
+  std::mutex threadsMutex;
+  auto task = [&threads, &threadsMutex](size_t) {
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    threads.insert(std::this_thread::get_id());
+  };
+  for (int i = 0; i < 100; i++) {
+    pool.Run(3, task);
+  }
+  // The calling thread and the two workers
+  EXPECT_EQ(threads.size(), 3u);
+  EXPECT_EQ(pool.GetWorkers(), 2u);
+}
+
+TEST(WorkerPoolTest, FewerTasksThanWorkersTest) {
+  WorkerPool pool;
+  std::atomic<int> calls{0};
+  auto task = [&calls](size_t) { calls++; };
+  pool.Run(4, task);
+  pool.Run(2, task);
+  EXPECT_EQ(calls, 6);
+  EXPECT_EQ(pool.GetWorkers(), 3u);
+}
+
+TEST(WorkerPoolTest, ShrinkTest) {
+  WorkerPool pool;
+  std::atomic<int> calls{0};
+  auto task = [&calls](size_t) { calls++; };
+  pool.Run(4, task);
+  pool.Shrink(1);
+  EXPECT_EQ(pool.GetWorkers(), 1u);
+  pool.Run(4, task);
+  EXPECT_EQ(calls, 8);
+  EXPECT_EQ(pool.GetWorkers(), 3u);
+}